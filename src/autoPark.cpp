@@ -7,41 +7,194 @@
 #include <fstream>
 #include <iostream>
 #include <cmath>
+#include <cstring>
+#include <ctime>
 #include <iomanip>
+#include <vector>
+#include "autoPark.h"
+#include "velProfile.h"
+#include "parkPlan.h"
+#include "lotMap.h"
+#include "hybridAStar.h"
+#include "rangeFusion.h"
+#include "safety.h"
+#include "poseHistory.h"
+#include "scanBus.h"
+#include "telemetry.h"
+#include "links.h"
+#include "realTime.h"
+#include "planTable.h"
+#include "faults.h"
+#include "scanRoi.h"
+#include "scanMatch.h"
+#include "odomCalib.h"
+#include "coMotion.h"
+#include "tracker.h"
+#include "slotDB.h"
+#include "health.h"
+#include "parkAgent.h"
+#include "tuning.h"
+#include "unpark.h"
 
 using namespace std;
 
-// Constants
-#define MAX_MOVES 5        //Maximum times to move MOVE_DISTANCE and check for new spot
-#define MAX_SCANS 3 //Maximum times to scan for corners at each "initial" location
-#define MOVE_DISTANCE 300.0 //Distance to move before attempting to find corners again
-#define TURNING_RADIUS 525.0
-#define ROBOT_RADIUS 227.5
-#define ROBOT_BACK 425.0
-#define DEPTH_BOUND 100.0 //Adjust depending on expected depth
-#define WHEEL_BASE 320.0
-#define MAR_ERR 50.0
-#define VMAX 300.0
-#define LASER_ANGLE 90.0
-#define OMEGA_MAX 2.618
-#define PI 3.14159265
-#define TRUE 1
-#define FALSE 0
-
-struct reading {
-    double angle;
-    double distance;
-};
-
 // Global variables for robot and laser
 ArRobot robot;
 ArSick sick;
-reading reading_array[400];
-reading first_corner;
-reading second_corner;
-reading third_corner;
-double found_depth, found_width;
+RangeFusion fusion(&robot);
+SafetyAction safety(&sick, &fusion);
+PoseHistory pose_history(&robot);
+ScanBus scan_bus;
+TelemetryServer telemetry;
+DeviceLinks links(&robot, &sick);
+RealTime realtime;
+MotionScheduler motion(&robot);
+Tracker tracker;
+SlotDB slot_db;
+Health health;
+ParkAgent agent;
 FILE *logfp;
+lotMap lot_map;
+planTable plan_table = {NULL, NULL, 0};
+FaultInjector faults;
+scanRoi scan_roi = {ROI_MIN_ANGLE, ROI_MAX_ANGLE};
+pose2d map_goal;
+bool have_goal = false;
+odomCalib odom_calib;
+bool do_calibrate = false;
+bool do_unpark = false;
+double cycle_dwell = 0; //s parked before leaving again, 0 to stay
+bool use_coroutines = false;
+bool search_done = false;
+pose2d search_origin = {0, 0, 0}; //where the pose was last reset to 0,0, from the run start
+
+/*
+* lockRobot / lockLaser
+* - Take the robot or laser lock, timing the wait when another thread
+*   has it.
+*/
+void lockRobot() {
+    if (robot.tryLock() == 0)
+        return;
+    double start = healthClock();
+    robot.lock();
+    health.count(HEALTH_ROBOT_CONTENDED);
+    health.observe(HEALTH_ROBOT_LOCK_WAIT, healthClock() - start);
+    return;
+}
+
+void lockLaser() {
+    if (sick.tryLockDevice() == 0)
+        return;
+    double start = healthClock();
+    sick.lockDevice();
+    health.count(HEALTH_LASER_CONTENDED);
+    health.observe(HEALTH_LASER_LOCK_WAIT, healthClock() - start);
+    return;
+}
+
+
+/*
+* publishSweep
+* - Laser data callback to put each sweep on the scan bus for the logger,
+*   viewers and other tools, without them touching the laser lock. The
+*   tracker sees it here too, before the safety check runs.
+*/
+void publishSweep() {
+    const std::list<ArSensorReading *> *raw = sick.getRawReadings();
+    std::list<ArSensorReading *>::const_iterator it;
+    laserSweep sweep;
+
+    if (raw == NULL || raw->empty())
+        return;
+    long n = faults.beginSweep(FAULT_STREAM_BUS);
+    if (n < 0) {
+        health.count(HEALTH_SWEEPS_DROPPED);
+        return;
+    }
+    sweep.count = 0;
+    for (it = raw->begin(); it != raw->end() && sweep.count < SWEEP_MAX_BEAMS; it++) {
+        int range = faults.spike(FAULT_STREAM_BUS, n, sweep.count) ? FAULT_MAX_RANGE : (*it)->getRange();
+        sweep.ranges[sweep.count++] = (*it)->getIgnoreThisReading() ? 0 : (range > 65535 ? 65535 : range);
+    }
+    sweep.start_angle = raw->front()->getSensorTh();
+    sweep.increment = sweep.count > 1 ? (raw->back()->getSensorTh() - sweep.start_angle) / (sweep.count - 1) : 0;
+    sweep.time = toSeconds(raw->back()->getTimeTaken());
+    sweep.pose = toPose2d(raw->back()->getPoseTaken());
+    scan_bus.publish(sweep);
+    health.sweepSeen();
+
+    // Tracks keep across resetPose(), so the tracker gets the encoder pose
+    sweep.pose = toPose2d(raw->back()->getEncoderPoseTaken());
+    tracker.update(sweep, sick.getSensorPosX(), sick.getSensorPosY());
+    return;
+}
+
+ArGlobalFunctor publish_sweep_cb(&publishSweep);
+
+
+/*
+* readRoiSweep
+* - Copy the raw ranges of the beams in the region of interest out of
+*   the last sweep, with their ignore flags. Beam angles come from the
+*   first and last reading, so only the kept beams are touched. The
+*   laser must be locked.
+*/
+bool readRoiSweep(const scanRoi &roi, roiSweep &out) {
+    const std::list<ArSensorReading *> *raw = sick.getRawReadings();
+    std::list<ArSensorReading *>::const_iterator it;
+
+    if (raw == NULL || raw->size() < 2)
+        return false;
+    int beams = raw->size();
+    out.start_angle = raw->front()->getSensorTh();
+    out.increment = (raw->back()->getSensorTh() - out.start_angle) / (beams - 1);
+    if (!roiSpan(roi, out.start_angle, out.increment, beams, out.first, out.count))
+        return false;
+    out.start_angle += out.first * out.increment;
+
+    memset(out.valid, 0, sizeof(out.valid));
+    it = raw->begin();
+    std::advance(it, out.first);
+    for (int b = 0; b < out.count; b++, it++) {
+        int range = (*it)->getRange();
+        out.ranges[b] = range > 65535 ? 65535 : range;
+        if (!(*it)->getIgnoreThisReading())
+            out.valid[b >> 6] |= 1ULL << (b & 63);
+    }
+    return true;
+}
+
+
+/*
+* driveScale
+* - Speed scale for coroutine maneuvers, the same one followProfile() uses.
+*/
+double driveScale() {
+    return links.ready() ? safety.scale() : 0;
+}
+
+
+/*
+* driveCommand / driveStop
+* - Wheel commands for coroutine maneuvers, sent the way followProfile()
+*   sends them: calibrated, announced to the safety layer, and through
+*   the fault injector. Called from the robot thread with the robot locked.
+*/
+void driveCommand(double vel, double omega, double scale) {
+    double left, right;
+    calibWheels(odom_calib, vel, omega, left, right);
+    safety.setCommand(vel - omega * WHEEL_BASE / 2.0, vel + omega * WHEEL_BASE / 2.0);
+    faults.setVel2(robot, scale * left, scale * right);
+    return;
+}
+
+void driveStop() {
+    safety.clearCommand();
+    faults.stop(robot);
+    return;
+}
+
 
 /*
 * initialize
@@ -68,6 +221,82 @@ int initialize(int *argc, char **argv) {
     // Add our right increments and degrees as a deafult
     parser.addDefaultArgument("-laserDegrees 180 -laserIncrement half");
     
+    // Optional map and goal ("x,y,th" in mm and degrees) for the Hybrid-A* planner.
+    // The map alone puts remembered slots in its frame and lets us drive to them.
+    char *map_arg = parser.checkParameterArgument("-map");
+    char *goal_arg = parser.checkParameterArgument("-goal");
+
+    // Local listeners are off unless asked for, "-telemetryAt" and "-healthAt"
+    // (host:port or a socket path) pick where and turn them on too
+    bool telemetry_on = parser.checkArgument("-telemetry");
+    char *telemetry_arg = parser.checkParameterArgument("-telemetryAt");
+    bool health_on = parser.checkArgument("-health");
+    char *health_arg = parser.checkParameterArgument("-healthAt");
+
+    // Slots seen on earlier runs. Their poses are in the map frame, which
+    // without -map is just wherever the run started, so then they're only
+    // kept if -slotDb is given: every run must start from the same spot.
+    char *slot_arg = parser.checkParameterArgument("-slotDb");
+    bool slot_keep = slot_arg != NULL || map_arg != NULL;
+    if (slot_arg == NULL)
+        slot_arg = (char *)SLOTDB_FILE;
+
+    // Beams takeReadings() looks at, "-scanRoi min,max" in degrees (robot frame)
+    char *roi_arg = parser.checkParameterArgument("-scanRoi");
+    if (roi_arg != NULL && (sscanf(roi_arg, "%lf,%lf", &scan_roi.min_angle, &scan_roi.max_angle) != 2 ||
+                            scan_roi.min_angle >= scan_roi.max_angle)) {
+        printf("Could not use -scanRoi %s\n", roi_arg);
+        exit(1);
+    }
+
+    // Script the search and parking with coroutines on the robot thread
+    use_coroutines = parser.checkArgument("-coro");
+
+    // Optional fault injection for soak tests, see faults.h for the spec
+    char *fault_arg = parser.checkParameterArgument("-faults");
+    if (fault_arg != NULL && !faults.configure(fault_arg)) {
+        printf("Could not use -faults %s\n", fault_arg);
+        exit(1);
+    }
+
+    // Parking parameters tuned by mkTune, compiled defaults without a profile
+    char *tune_arg = parser.checkParameterArgument("-tune");
+    if (tune_arg == NULL)
+        tune_arg = (char *)TUNING_FILE;
+
+    // Measure this robot's kinematics instead of parking
+    do_calibrate = parser.checkArgument("-calibrate");
+
+    // Leave the slot we're parked in instead of parking, or "-cycle s" to
+    // park, stay s seconds and leave again
+    do_unpark = parser.checkArgument("-unpark");
+    char *cycle_arg = parser.checkParameterArgument("-cycle");
+    if (cycle_arg != NULL && (sscanf(cycle_arg, "%lf", &cycle_dwell) != 1 || cycle_dwell < 0)) {
+        printf("Could not use -cycle %s\n", cycle_arg);
+        exit(1);
+    }
+
+    // Optional real-time mode, "-rtCpus control,robot,laser" picks the cores
+    bool rt_on = parser.checkArgument("-rt");
+    char *rt_cpus = parser.checkParameterArgument("-rtCpus");
+    int control_cpu = RT_CONTROL_CPU, robot_cpu = RT_ROBOT_CPU, laser_cpu = RT_LASER_CPU;
+    if (rt_cpus != NULL && sscanf(rt_cpus, "%d,%d,%d", &control_cpu, &robot_cpu, &laser_cpu) != 3) {
+        printf("Could not use -rtCpus %s\n", rt_cpus);
+        exit(1);
+    }
+    if (map_arg != NULL && !loadLotMap(map_arg, lot_map)) {
+        printf("Could not use map %s\n", map_arg);
+        exit(1);
+    }
+    if (map_arg != NULL && goal_arg != NULL) {
+        if (sscanf(goal_arg, "%lf,%lf,%lf", &map_goal.x, &map_goal.y, &map_goal.th) != 3) {
+            printf("Could not use map %s with goal %s\n", map_arg, goal_arg);
+            exit(1);
+        }
+        map_goal.th *= PI / 180.0;
+        have_goal = true;
+    }
+
     // Parse the command line
     if (!connector.parseArgs() || !parser.checkHelpAndWarnUnparsed(1))
     {
@@ -78,33 +307,101 @@ int initialize(int *argc, char **argv) {
     // Add the laser device
     robot.addRangeDevice(&sick);
     
-    // Try to connect to the robot, if we fail exit
-    if (!connector.connectRobot(&robot))
+    // Connect to the robot and laser together, exit on failure
+    if (!links.connect(parser, connector))
     {
-        printf("Robot: Could not connect...exiting\n");
         Aria::shutdown();
         return 1;
     }
-    printf("Robot: Connected\n");
-    
-    // Set robot to stop the run if the connection is broken
-    robot.runAsync(true);
-    
-    // Setup laser
-    connector.setupLaser(&sick);
-    
-    // Set laser to stop the run if connection is broken
-    sick.runAsync();
-  
-    
-    // Do a blocking connect, exit on failure
-    if (!sick.blockingConnect())
-    {
-        printf("Laser: Could not connect...exiting\n");
-        Aria::shutdown();
-        return 1;
+
+    // Kinematics measured by -calibrate for this robot, if it has been
+    char calib_file[128];
+    calibFile(robot.getRobotName(), calib_file, sizeof(calib_file));
+    if (loadCalib(calib_file, odom_calib))
+        printf("Calibration: %s, wheel base %.1f mm, wheel scales %.4f %.4f\n", calib_file,
+               odom_calib.wheel_base, odom_calib.left_scale, odom_calib.right_scale);
+    else
+        printf("Calibration: none in %s, using nominal kinematics\n", calib_file);
+
+    // Before the plan table, which has to have been made with the same margin
+    if (loadTuning(tune_arg, tuning))
+        printf("Tuning: %s, depth bound %.1f mm, margin %.1f mm, wiggle %.1f mm, approach %.1f mm, "
+               "first corner under %.1f deg\n", tune_arg, tuning.depth_bound, tuning.mar_err, tuning.wiggle,
+               tuning.approach, tuning.first_max);
+    else
+        printf("Tuning: none in %s, using compiled parameters\n", tune_arg);
+
+    // Multi-point maneuvers from mkPlans, slots off its grid are planned live
+    if (mapPlanTable(PLAN_TABLE_FILE, plan_table))
+        printf("Plan table: %s\n", PLAN_TABLE_FILE);
+    else
+        printf("Plan table: none in %s, planning live\n", PLAN_TABLE_FILE);
+
+    // What earlier runs saw of the lot
+    if (!slot_keep)
+        printf("Slot DB: no map, slots are only remembered for this run (-slotDb for a fixed start)\n");
+    else if (slot_db.open(slot_arg))
+        printf("Slot DB: %d slots in %s\n", slot_db.size(), slot_arg);
+    else
+        printf("Slot DB: could not open %s, slots won't be remembered\n", slot_arg);
+
+    // Share every sweep, other processes can attach to SCAN_BUS_NAME
+    if (!scan_bus.create(SCAN_BUS_NAME)) {
+        printf("Scan bus: no shared memory, sweeps stay in this process\n");
+        scan_bus.create(NULL);
+    }
+    sick.addDataCB(&publish_sweep_cb);
+
+    // Stream sweeps and what we're doing with them to any local viewer
+    if (telemetry_on || telemetry_arg != NULL) {
+        if (telemetry_arg == NULL)
+            telemetry_arg = (char *)TELEM_DEFAULT;
+        if (telemetry.start(telemetry_arg, &scan_bus))
+            printf("Telemetry: serving on %s\n", telemetry_arg);
+        else
+            printf("Telemetry: could not listen on %s\n", telemetry_arg);
+    }
+
+    // Health counters for a local scraper, in Prometheus text format. They're
+    // kept (and reported at exit) either way, this only serves them.
+    if (health_on || health_arg != NULL) {
+        if (health_arg == NULL)
+            health_arg = (char *)HEALTH_DEFAULT;
+        if (health.start(health_arg))
+            printf("Health: serving on %s\n", health_arg);
+        else
+            printf("Health: could not listen on %s\n", health_arg);
+    }
+
+    // Check every sweep (and the sonar) against where we're about to drive
+    safety.setTracker(&tracker);
+    sick.addDataCB(safety.getSweepCB());
+    lockRobot();
+    robot.addSensorInterpTask("poseHistory", 50, pose_history.getTask());
+    robot.addUserTask("fusion", 50, fusion.getSonarTask());
+    robot.addAction(&safety, 100);
+    robot.unlock();
+    if (use_coroutines) {
+        lockRobot();
+        robot.addUserTask("motion", 40, motion.getTask());
+        robot.unlock();
+        sick.addDataCB(motion.getSweepCB());
+        motion.setScale(driveScale);
+        motion.setCommand(driveCommand, driveStop);
+    }
+    if (faults.enabled()) {
+        faults.attach(&robot);
+        printf("Faults: injecting %s\n", fault_arg);
+    }
+
+    // Everything is running now, pin and prioritize the threads that matter
+    if (rt_on) {
+        lockRobot();
+        robot.addUserTask("realTime", 100, realtime.getRobotTask());
+        robot.unlock();
+        sick.addDataCB(realtime.getLaserCB());
+        realtime.start(control_cpu, robot_cpu, laser_cpu);
     }
-    printf("Laser: Connected\n");
 
 	robot.enableMotors();
 
@@ -113,67 +410,175 @@ int initialize(int *argc, char **argv) {
 
 
 /*
-* takeReadings
-* - A function to search for an open space using the SICK laser.
+* deskewReading
+* - Move a buffered laser point to where it really was. ARIA places a whole
+*   sweep with the robot pose at the sweep's time stamp, but each beam was
+*   measured a little earlier, from wherever the robot was then.
 */
-void takeReadings() {
+ArPose deskewReading(const ArPoseWithTime &reading, const pose2d &enc_to_odo) {
+    double t = toSeconds(reading.getTime());
+    pose2d stamp_enc, beam_enc;
+
+    if (!pose_history.at(t, stamp_enc))
+        return reading;
+
+    // Back into the robot frame at the stamp, then out again from the beam's pose
+    pose2d stamp = poseCompose(enc_to_odo, stamp_enc);
+    pose2d point = {reading.getX(), reading.getY(), 0};
+    pose2d local = poseCompose(poseInverse(stamp), point);
+    double bearing = atan2(local.y - sick.getSensorPosY(), local.x - sick.getSensorPosX()) * 180.0 / PI;
+    if (!pose_history.at(t + beamTimeOffset(bearing), beam_enc))
+        return reading;
+
+    pose2d fixed = poseCompose(poseCompose(enc_to_odo, beam_enc), local);
+    return ArPose(fixed.x, fixed.y);
+}
+
+
+/*
+* readSweep
+* - Fill the agent's readings from the latest sweep. Readings on a moving
+*   track are left out, corners come from what stands still. Takes the
+*   laser lock and may wait on injected faults, so maneuvers use
+*   readBusSweep() instead.
+*/
+void readSweep(const pose2d &enc_to_odo, bool still) {
         int i;
         std::list<ArPoseWithTime *> *readings;
         std::list<ArPoseWithTime *>::iterator it;
 
         // Initialize vars
         i = 0;
-        printf("Scanning...");
-        ArUtil::sleep(500);
 
         //Initialize readings to 0
-        first_corner.distance = 0;
-        second_corner.distance = 0;
-        third_corner.distance = 0;
-        for(int i = 0; i<400; i++) {
-                reading_array[i].distance = 0;
-        }
+        agent.clearReadings();
+
+        // A dropped sweep leaves nothing to read
+        long sweep = faults.beginSweep(FAULT_STREAM_SCAN);
+        if (sweep < 0)
+                health.count(HEALTH_SWEEPS_DROPPED);
+
+        // Sweeps that went by since the last scan
+        static unsigned long long last_scanned = 0;
+        unsigned long long newest = scan_bus.newest();
+        if (last_scanned != 0 && newest > last_scanned + 1)
+                health.count(HEALTH_SCAN_SKIPPED, newest - last_scanned - 1);
+        last_scanned = newest;
+        health.count(HEALTH_SCANS);
 
         // Lock the laser
-        sick.lockDevice();
+        lockLaser();
 
         // Take readings from 90-180 degrees and store angle and distance results in reading array
-        readings = sick.getCurrentBuffer();
         int numReadings = 0;
-        for (it = readings->begin(); it != readings->end(); it++) {
-                if((*it)->findAngleTo(ArPose(0, 0)) > 89.9) {
-                        reading_array[i].distance = (*it)->findDistanceTo(ArPose(0, 0));
-                        reading_array[i].angle = (*it)->findAngleTo(ArPose(0, 0));
-                        numReadings++;
+        roiSweep roi;
+        if (still && sweep >= 0 && readRoiSweep(scan_roi, roi)) {
+                double sx = sick.getSensorPosX(), sy = sick.getSensorPosY();
+                pose2d at = toPose2d(sick.getRawReadings()->back()->getEncoderPoseTaken()); //tracker frame
+                for (int b = 0; b < roi.count && numReadings < 400; b++) {
+                        if (!roiValid(roi, b))
+                                continue;
+                        double range = faults.spike(FAULT_STREAM_SCAN, sweep, roi.first + b) ?
+                                FAULT_MAX_RANGE : roi.ranges[b];
+                        double a = (roi.start_angle + b * roi.increment) * PI / 180.0;
+                        double x = sx + range * cos(a), y = sy + range * sin(a);
+                        double angle = atan2(-y, -x) * 180.0 / PI; //bearing from the point back to the robot
+                        pose2d local = {x, y, 0};
+                        pose2d world = poseCompose(at, local);
+                        if (angle > 89.9 && !tracker.nearMoving(world.x, world.y)) {
+                                agent.readings[numReadings].distance = sqrt(x * x + y * y);
+                                agent.readings[numReadings].angle = angle;
+                                numReadings++;
+                        }
                 }
-                i++;
         }
-
-        //reverse array if first value is 180 instead of 90
-        if(reading_array[0].angle > 100.0) {
-                for(int j = 0; j <= numReadings; j++) {
-                        double tempAngle = reading_array[numReadings-j].angle;
-                        double tempDist = reading_array[numReadings-j].distance;
-                        reading_array[numReadings-j].angle = reading_array[j].angle;
-                        reading_array[numReadings-j].distance = reading_array[j].distance;
-                        reading_array[j].angle = tempAngle;
-                        reading_array[j].distance = tempDist;
+        else {
+                readings = sick.getCurrentBuffer();
+                for (it = readings->begin(); it != readings->end() && sweep >= 0; it++) {
+                        ArPose point = deskewReading(**it, enc_to_odo);
+                        pose2d odo = {point.getX(), point.getY(), 0};
+                        pose2d enc = poseCompose(poseInverse(enc_to_odo), odo); //tracker frame
+                        if(point.findAngleTo(ArPose(0, 0)) > 89.9 && !tracker.nearMoving(enc.x, enc.y)) {
+                                agent.readings[i].distance = faults.spike(FAULT_STREAM_SCAN, sweep, i) ?
+                                        FAULT_MAX_RANGE : point.findDistanceTo(ArPose(0, 0));
+                                agent.readings[i].angle = point.findAngleTo(ArPose(0, 0));
+                                numReadings++;
+                        }
+                        i++;
                 }
         }
 
+        //reverse array if first value is 180 instead of 90
+        agent.orderReadings(numReadings);
+
                 
         //print readings to log file
         for(int k = 0; k < numReadings; k++) {
         fprintf(logfp, "Reading %d:\tLaser Dist: %f\tAngle: %f\n",
-                 k, reading_array[k].distance, reading_array[k].angle);
+                 k, agent.readings[k].distance, agent.readings[k].angle);
         }
 
 
         // Unlock laser and return
         sick.unlockDevice();
+        fprintf(logfp, "\n");
+        return;
+}
+
+
+/*
+* readBusSweep
+* - Fill the agent's readings from a sweep off the scan bus, taken with the
+*   robot still at encoder pose at. Only copies, so a maneuver can call it
+*   from the robot thread.
+*/
+void readBusSweep(const laserSweep &sweep, const pose2d &at) {
+        int numReadings = 0;
+        double sx = sick.getSensorPosX(), sy = sick.getSensorPosY();
+
+        agent.clearReadings();
+        health.count(HEALTH_SCANS);
+        for (int b = 0; b < sweep.count && numReadings < 400; b++) {
+                if (sweep.ranges[b] == 0)
+                        continue;
+                double a = (sweep.start_angle + b * sweep.increment) * PI / 180.0;
+                double x = sx + sweep.ranges[b] * cos(a), y = sy + sweep.ranges[b] * sin(a);
+                double angle = atan2(-y, -x) * 180.0 / PI; //bearing from the point back to the robot
+                pose2d local = {x, y, 0};
+                pose2d world = poseCompose(at, local);
+                if (angle > 89.9 && !tracker.nearMoving(world.x, world.y)) {
+                        agent.readings[numReadings].distance = sqrt(x * x + y * y);
+                        agent.readings[numReadings].angle = angle;
+                        numReadings++;
+                }
+        }
+        agent.orderReadings(numReadings);
+        fprintf(logfp, "Sweep %llu: %d readings\n", sweep.number, numReadings);
+        return;
+}
+
+
+/*
+* takeReadings
+* - A function to search for an open space using the SICK laser.
+*/
+void takeReadings() {
+        printf("Scanning...");
+        ArUtil::sleep(500);
+
+        // Where the encoder frame (pose history) sits in the odometry frame
+        lockRobot();
+        pose2d enc_to_odo = poseCompose(toPose2d(robot.getPose()),
+                                        poseInverse(toPose2d(robot.getEncoderPose())));
+
+        // Stopped (we always stop to scan) the raw sweep is already polar,
+        // moving it needs the deskewed buffer
+        bool still = fabs(robot.getVel()) < SCAN_STILL_VEL && fabs(robot.getRotVel()) < SCAN_STILL_ROT;
+        robot.unlock();
+
+        readSweep(enc_to_odo, still);
         ArUtil::sleep(100);
         puts("");
-        fprintf(logfp, "\n");
         printf("done\n");
         return;
 }
@@ -184,59 +589,18 @@ void takeReadings() {
 * - A function to find the corners of a parking space
 */
 void findCorners() {
-    int i = 0;
-    reading current;
-    reading next;
-    reading nextnext;
-    //bool behind_car = 0; //TODO add logic to find corners assuming starting behind first car
+    agent.findCorners();
 
-    nextnext = reading_array[0];
-    
-    while (nextnext.distance != 0) {
-        current = reading_array[i];
-        next = reading_array[i+1];
-        nextnext = reading_array[i+2]; //check against 2 readings instead of 1
-
-        //This function occasionally fails and doesn't give the corners.
-        //When it fails the data looks fine... so I'm not sure what's going on.
-
-        //1st corner assuming starting right next to car #1 && we ccan see the botton corner of car2
-        if (((current.distance + DEPTH_BOUND) < next.distance) &&
-                ((current.distance + DEPTH_BOUND) < nextnext.distance) && first_corner.distance == 0) {
-            first_corner.distance = current.distance;
-            first_corner.angle = current.angle;
-            fprintf(logfp, "First Corner: Distance: %f\tAngle: %f\n",
-                    first_corner.distance, first_corner.angle);
-        }
-        //2nd corner assuming starting right next to car #1
-        if (current.distance > next.distance && current.distance > nextnext.distance
-                && first_corner.distance != 0 && second_corner.distance == 0) {
-            second_corner.distance = current.distance;
-            second_corner.angle = current.angle;
-            fprintf(logfp, "Second Corner: Distance: %f\tAngle: %f\n",
-                    second_corner.distance, second_corner.angle);
-        }
-        //3rd corner assuming starting right next to car #1
-        if (current.distance < next.distance && current.distance < nextnext.distance
-                && first_corner.distance != 0 && second_corner.distance != 0) {
-            third_corner.distance = current.distance;
-            third_corner.angle = current.angle;
-            fprintf(logfp, "Third Corner: Distance: %f\tAngle: %f\n\n",
-                    third_corner.distance, third_corner.angle);
-         break; //Got all the corners no need to check the other values
-        }
-        i++;
-    }
-        /*
-			Find the first corner if behind first car
-			if (current.distance > next.distance && first_corner.distance == NULL) {
-			first_corner.distance = current.distance;
-			first_corner.angle = current.angle;
-			fprintf(logfp, "First Corner: Distance: %f\tAngle: %f\n",
-			first_corner.distance, first_corner.angle);
-			}
-    	*/
-        return;
+    if (agent.first.distance != 0)
+        fprintf(logfp, "First Corner: Distance: %f\tAngle: %f\n",
+                agent.first.distance, agent.first.angle);
+    if (agent.second.distance != 0)
+        fprintf(logfp, "Second Corner: Distance: %f\tAngle: %f\n",
+                agent.second.distance, agent.second.angle);
+    if (agent.third.distance != 0)
+        fprintf(logfp, "Third Corner: Distance: %f\tAngle: %f\n\n",
+                agent.third.distance, agent.third.angle);
+    return;
 }
 
 /*
@@ -244,18 +608,181 @@ void findCorners() {
 * - Function to get Depth and Width using Cosines
 */
 void getDimensions() {
-    
-    found_depth = sqrt(pow(second_corner.distance,2.0) + pow(third_corner.distance,2.0)
-                    - 2.0 * second_corner.distance * third_corner.distance
-                    * cos((third_corner.angle - second_corner.angle) * PI / 180));
+    agent.getDimensions();
+    fprintf(logfp, "Depth: %f\n", agent.depth);
+    fprintf(logfp, "Width: %f\n", agent.width);
+    return;
+}
 
-    fprintf(logfp, "Depth: %f\n", found_depth);
 
-    found_width = sqrt(pow(first_corner.distance,2.0) + pow(third_corner.distance,2.0)
-                    - 2.0 * first_corner.distance * third_corner.distance
-                    * cos((third_corner.angle - first_corner.angle) * PI / 180));
-    fprintf(logfp, "Width: %f\n", found_width);
-    
+/*
+* mapPose
+* - Where odometry pose odom is on the map: the run starts on RobotHome
+*   (or at 0,0 without a map, which only means the same place from run
+*   to run with a fixed start) and search_origin keeps track of the pose
+*   resets since.
+*/
+pose2d mapPose(const ArPose &odom) {
+    return poseCompose(poseCompose(lot_map.home, search_origin), toPose2d(odom));
+}
+
+
+/*
+* resetPose
+* - Reset the pose to 0,0 for a new position, remembering where that was.
+*   The robot must be locked.
+*/
+void resetPose() {
+    search_origin = poseCompose(search_origin, toPose2d(robot.getPose()));
+    robot.moveTo(ArPose(0,0,0), true);
+    return;
+}
+
+
+/*
+* recordScan
+* - Tell the slot DB what the last scan, taken at odometry pose odom,
+*   found: the slot from the corners if found, otherwise nothing.
+*/
+void recordScan(const ArPose &odom, bool found) {
+    pose2d robot_map = mapPose(odom);
+
+    if (!found) {
+        slot_db.observeScan(robot_map, NULL, time(NULL));
+        return;
+    }
+    pose2d center;
+    slotObs obs;
+    agent.slotGeometry(center, obs.width, obs.depth);
+    obs.center = poseCompose(robot_map, center);
+    obs.view = robot_map;
+    slot_db.observeScan(robot_map, &obs, time(NULL));
+    fprintf(logfp, "Slot DB: slot at %f %f, width %f depth %f\n",
+            obs.center.x, obs.center.y, obs.width, obs.depth);
+    return;
+}
+
+
+/*
+* followProfile
+* - Stream a setpoint table to the wheels. The table is played on its own
+*   clock, which the safety layer slows down or stops: scaling both wheels
+*   keeps the robot on the same path, just slower. Returns false if the
+*   path stayed blocked for SAFETY_TIMEOUT.
+*/
+bool followProfile(const std::vector<setpoint> &table) {
+    ArTime last, blocked;
+    double tau = 0;
+    size_t i = 0;
+
+    last.setToNow();
+    blocked.setToNow();
+    realtime.beginTicks();
+    while (true) {
+        double scale = links.ready() ? safety.scale() : 0; //a dropped link counts as blocked
+        health.count(HEALTH_PROFILE_TICKS);
+        if (scale <= 0)
+            health.count(HEALTH_SAFETY_STOPPED);
+        else if (scale < 1)
+            health.count(HEALTH_SAFETY_SLOWED);
+        tau += scale * last.mSecSince() / 1000.0;
+        last.setToNow();
+        while (i + 1 < table.size() && table[i+1].t <= tau)
+            i++;
+        if (i + 1 >= table.size())
+            break;
+
+        if (scale > 0)
+            blocked.setToNow();
+        else if (blocked.mSecSince() > SAFETY_TIMEOUT) {
+            fprintf(logfp, "Safety: path blocked, maneuver abandoned\n");
+            health.count(HEALTH_ABANDONED);
+            cout << "Path blocked, giving up." << endl;
+            break;
+        }
+
+        double left, right;
+        calibWheels(odom_calib, table[i].vel, table[i].omega, left, right);
+        safety.setCommand(table[i].left, table[i].right);
+        telemetry.postControl(tau, scale, table[i].left, table[i].right);
+        lockRobot();
+        faults.setVel2(robot, scale * left, scale * right);
+        robot.unlock();
+        realtime.waitTick((unsigned int)(PROFILE_DT * 1000 / 2));
+    }
+
+    safety.clearCommand();
+    lockRobot();
+    faults.stop(robot);
+    robot.unlock();
+    return i + 1 >= table.size();
+}
+
+
+/*
+* driveStraight
+* - Function to drive distance mm (negative backs up) on a velocity profile.
+*/
+bool driveStraight(double distance) {
+    std::vector<pathSeg> path;
+    std::vector<setpoint> table;
+    pathSeg line = {fabs(distance), 0.0, distance < 0 ? -1 : 1};
+
+    path.push_back(line);
+    buildProfile(path, table);
+    return followProfile(table);
+}
+
+
+/*
+* drivePath
+* - Maneuver to drive a planned path one segment at a time.
+*/
+Maneuver drivePath(std::vector<pathSeg> path) {
+    for (size_t i = 0; i < path.size(); i++) {
+        fprintf(logfp, "Segment %d: length %f curvature %f dir %d\n",
+                (int)i, path[i].length, path[i].curvature, path[i].dir);
+        co_await followArc(path[i]);
+    }
+    co_await stopped();
+    co_return true;
+}
+
+
+/*
+* classifySlot
+* - Function to decide what kind of slot the corners describe, see
+*   ParkAgent::classifySlot().
+*/
+void classifySlot() {
+    agent.classifySlot();
+    fprintf(logfp, "Slot type: %s\tBay angle: %f\n",
+            agent.type == SLOT_PARALLEL ? "parallel" :
+            agent.type == SLOT_PERPENDICULAR ? "perpendicular" : "angled",
+            agent.bayAngle() * 180.0 / PI);
+    telemetry.postCorners(agent.first, agent.second, agent.third, agent.type);
+    return;
+}
+
+
+/*
+* sendPlan
+* - Function to pass a planned path (and parkRobot()'s circles, if any)
+*   on to the telemetry viewers.
+*/
+void sendPlan(const std::vector<pathSeg> &path, double circle1_x, double circle1_y,
+              double circle2_x, double circle2_y, double xtangent) {
+    telemPlan plan;
+
+    plan.circle1_x = circle1_x;
+    plan.circle1_y = circle1_y;
+    plan.circle2_x = circle2_x;
+    plan.circle2_y = circle2_y;
+    plan.xtangent = xtangent;
+    plan.num_segs = path.size() < TELEM_MAX_SEGS ? path.size() : TELEM_MAX_SEGS;
+    for (int i = 0; i < plan.num_segs; i++)
+        plan.segs[i] = path[i];
+    telemetry.postPlan(plan);
     return;
 }
 
@@ -265,70 +792,463 @@ void getDimensions() {
 * - Function to park the robot.
 */
 void parkRobot() {
-    // TODO: Combine variables once we know they are individually correct
+    std::vector<pathSeg> path;
+    parallelPlan plan;
 
-    double first_car_x = -cos(first_corner.angle * PI /180.0) * first_corner.distance;
-    fprintf(logfp, "first_car_x: %f\n", first_car_x);
+    // Drive up to the start of the first circle, then reverse along both
+    // circles. The profile ramps speed in and out of each arc instead of
+    // stepping the wheel velocities.
+    agent.planParallel(path, plan);
+    fprintf(logfp, "first_car_x: %f\n", plan.first_car_x);
+    fprintf(logfp, "wall_y %f\n", plan.wall_y);
+    fprintf(logfp, "circle1_x: %f\n", plan.circle1_x);
+    fprintf(logfp, "circle1_y %f\n", plan.circle1_y);
+    fprintf(logfp, "circle2_y %f\n", plan.circle2_y);
+    fprintf(logfp, "xtangent %f\n", plan.xtangent);
+    fprintf(logfp, "circle2_x %f\n", plan.circle2_x);
+    fprintf(logfp, "turnAngle %f\n", plan.turn_angle);
+    sendPlan(path, plan.circle1_x, plan.circle1_y, plan.circle2_x, plan.circle2_y, plan.xtangent);
 
-    double wall_y = -sin(second_corner.angle * PI /180.0) * second_corner.distance;
-    fprintf(logfp, "wall_y %f\n", wall_y);
+    std::vector<setpoint> table;
+    buildProfile(path, table);
+    fprintf(logfp, "profile_time %f\n", 1000 * table.back().t);
 
-    double circle1_x = first_car_x + ROBOT_BACK;
-    fprintf(logfp, "circle1_x: %f\n", circle1_x);
+    cout << "Moving forward " << plan.circle2_x << " mm." << endl;
+    if (use_coroutines) {
+        cout << "Driving parking path" << endl;
+        motion.run(drivePath(path));
+        return;
+    }
+    cout << "Following parking profile (" << table.size() << " setpoints, "
+         << table.back().t << " s)" << endl;
+    followProfile(table);
 
-    double circle1_y = wall_y + ROBOT_RADIUS + TURNING_RADIUS + 50;  //50 = wiggle room, mm
-    fprintf(logfp, "circle1_y %f\n", circle1_y);
+    return;
+}
 
-    double circle2_y = -TURNING_RADIUS;
-    fprintf(logfp, "circle2_y %f\n", circle2_y);
 
-    double xtangent = circle1_x + sqrt(pow(TURNING_RADIUS,2.0) - pow(((circle2_y - circle1_y)/2),2.0));
-    fprintf(logfp, "xtangent %f\n", xtangent);
+/*
+* countPlan
+* - Count a plan and how long it took since start (healthClock()).
+*/
+void countPlan(double start, bool ok) {
+    health.count(HEALTH_PLANS);
+    if (!ok)
+        health.count(HEALTH_PLAN_FAILURES);
+    health.observe(HEALTH_PLAN_TIME, healthClock() - start);
+    return;
+}
 
-    double circle2_x = (2.0 * xtangent) - circle1_x;
-    fprintf(logfp, "circle2_x %f\n", circle2_x);
 
-    double wheel_ratio = ((2.0 * TURNING_RADIUS/WHEEL_BASE) + 1.0)/((2.0 * TURNING_RADIUS/WHEEL_BASE) - 1.0);
-    fprintf(logfp, "wheel_ratio %f\n", wheel_ratio);
+/*
+* parkMultiPoint
+* - Function to park in a slot too short for parkRobot() with a
+*   forward/reverse maneuver. Returns false if none fits.
+*/
+bool parkMultiPoint() {
+    parkSlot slot;
 
-    double rightVel = -(VMAX * 2.0) / (1 + wheel_ratio);
-    fprintf(logfp, "rightVel %f\n", rightVel);
+    agent.parallelSlot(slot);
+    fprintf(logfp, "Multi-point slot: car1_x %f car2_x %f curb_y %f wall_y %f\n",
+            slot.car1_x, slot.car2_x, slot.curb_y, slot.wall_y);
 
-    double A = atan2(circle1_y - circle2_y, circle2_x - circle1_x);
-    fprintf(logfp, "turnAngle %f\n", A);
+    ArTime timer;
+    std::vector<pathSeg> path;
+    timer.setToNow();
+    double started = healthClock();
+    bool ok = planMultiPoint(slot, path, &plan_table);
+    countPlan(started, ok);
+    fprintf(logfp, "Multi-point plan: %s in %ld ms\n", ok ? "found" : "failed", (long)timer.mSecSince());
+    if (!ok) {
+        fprintf(logfp, "Multi-point: no maneuver found\n");
+        return false;
+    }
+    for (size_t i = 0; i < path.size(); i++) {
+        fprintf(logfp, "Multi-point segment %d: length %f curvature %f dir %d\n",
+                (int)i, path[i].length, path[i].curvature, path[i].dir);
+    }
+    sendPlan(path, 0, 0, 0, 0, 0);
 
-    double t_turn = 1000 * abs(((PI/2)-A)/((rightVel - wheel_ratio * rightVel)/WHEEL_BASE));
-    fprintf(logfp, "turn_time %f\n", t_turn);
+    std::vector<setpoint> table;
+    buildProfile(path, table);
+    fprintf(logfp, "profile_time %f\n", 1000 * table.back().t);
 
-    //move to starting location for parking
-    cout << "Moving forward " << circle2_x << " mm." << endl;
-    robot.lock();
-    robot.move(circle2_x-150);
+    cout << "Following " << path.size() << " segment parking maneuver ("
+         << table.back().t << " s)" << endl;
+    followProfile(table);
+    return true;
+}
+
+
+/*
+* driveToMapPose
+* - Function to drive to a map pose around the map lines with the
+*   Hybrid-A* planner. The robot is assumed to start on the map's
+*   RobotHome.
+*/
+bool driveToMapPose(const pose2d &goal) {
+    primTable prims;
+
+    if (!loadPrimitives(PRIM_FILE, prims)) {
+        printf("Could not load %s, run mkPrims first\n", PRIM_FILE);
+        fprintf(logfp, "Map: no primitive table\n");
+        return false;
+    }
+
+    lockRobot();
+    pose2d start = mapPose(robot.getPose());
     robot.unlock();
-    ArUtil::sleep(5000);
-    while(robot.isMoveDone() == false) {} //don't do anything until the move is done
+    fprintf(logfp, "Map start: %f %f %f\n", start.x, start.y, start.th);
+    fprintf(logfp, "Map goal: %f %f %f\n", goal.x, goal.y, goal.th);
 
-    //This does the general parking motion, although far from perfect
-    //the ratio seems a bit off because it needs to turn almost 90 degrees to get deep enough into the spot
-    //need to calculate sleep amount or find another way to follow circular path
+    ArTime timer;
+    std::vector<pathSeg> path;
+    timer.setToNow();
+    double started = healthClock();
+    bool ok = planHybridAStar(lot_map, prims, start, goal, path);
+    countPlan(started, ok);
+    fprintf(logfp, "Map plan: %s in %ld ms, %d segments\n", ok ? "found" : "failed",
+            (long)timer.mSecSince(), (int)path.size());
+    if (!ok) {
+        cout << "No path to goal." << endl;
+        return false;
+    }
+    sendPlan(path, 0, 0, 0, 0, 0);
 
-    cout << "1st turning velocity: (" << rightVel << "," << (wheel_ratio * rightVel) << ")" << endl;
-    robot.lock();
-    robot.setVel2((wheel_ratio * rightVel), rightVel);
+    std::vector<setpoint> table;
+    buildProfile(path, table);
+    fprintf(logfp, "profile_time %f\n", 1000 * table.back().t);
+    cout << "Following " << path.size() << " segment path to goal ("
+         << table.back().t << " s)" << endl;
+    return followProfile(table);
+}
+
+
+/*
+* driveOnMap
+* - Function to drive to map_goal.
+*/
+bool driveOnMap() {
+    return driveToMapPose(map_goal);
+}
+
+
+/*
+* parkBay
+* - Function to park in a perpendicular or angled bay. Returns false if
+*   the bay is too small or can't be reached with one arc.
+*/
+bool parkBay() {
+    baySlot bay;
+    agent.bay(bay);
+    fprintf(logfp, "Bay: entry_x %f curb_y %f angle %f width %f depth %f\n",
+            bay.entry_x, bay.curb_y, bay.angle, bay.width, bay.depth);
+
+    std::vector<pathSeg> path;
+    double started = healthClock();
+    bool ok = planBay(bay, path);
+    countPlan(started, ok);
+    if (!ok) {
+        fprintf(logfp, "Bay: no path found\n");
+        return false;
+    }
+    sendPlan(path, 0, 0, 0, 0, 0);
+
+    std::vector<setpoint> table;
+    buildProfile(path, table);
+    fprintf(logfp, "profile_time %f\n", 1000 * table.back().t);
+    cout << "Pulling into bay (" << table.back().t << " s)" << endl;
+    followProfile(table);
+    return true;
+}
+
+
+/*
+* unparkRobot
+* - Function to leave a parallel slot. Looks at the laser and sonar
+*   points around the robot, plans the exit with the fewest moves and
+*   checks it against the points, drives the first move and looks again,
+*   until only the two arcs onto the lane are left. A move the safety
+*   layer stops is planned again from wherever the robot got to.
+*   Returns whether the robot made it out.
+*/
+bool unparkRobot() {
+    static double xs[FUSE_MAX_POINTS], ys[FUSE_MAX_POINTS];
+
+    for (int move = 0; move < UNPARK_MAX_MOVES; move++) {
+        ArUtil::sleep(CALIB_SETTLE); //fresh sweeps and a round of sonar
+        lockRobot();
+        ArPose now = robot.getEncoderPose(); //the fusion store's frame
+        robot.unlock();
+        int n = fusion.points(now, xs, ys, FUSE_MAX_POINTS);
+
+        exitScene scene;
+        if (!findExitScene(xs, ys, n, scene)) {
+            fprintf(logfp, "Unpark: nothing in view\n");
+            cout << "Nothing in view, not leaving." << endl;
+            return false;
+        }
+        fprintf(logfp, "Unpark slot: car1_x %f car2_x %f curb_y %f wall_y %f start %f %f %f (%d wall points)\n",
+                scene.slot.car1_x, scene.slot.car2_x, scene.slot.curb_y, scene.slot.wall_y,
+                scene.start.x, scene.start.y, scene.start.th, scene.wall_points);
+
+        std::vector<pathSeg> path;
+        double exit_x;
+        double started = healthClock();
+        bool ok = planExit(scene.slot, scene.start, path, exit_x);
+        countPlan(started, ok);
+        if (!ok) {
+            fprintf(logfp, "Unpark: no way out\n");
+            cout << "No way out of the slot." << endl;
+            return false;
+        }
+        if (!exitPathClear(scene, path, xs, ys, n)) {
+            fprintf(logfp, "Unpark: exit blocked by something outside the slot\n");
+            cout << "Way out is blocked." << endl;
+            return false;
+        }
+        for (size_t i = 0; i < path.size(); i++) {
+            fprintf(logfp, "Unpark segment %d: length %f curvature %f dir %d\n",
+                    (int)i, path[i].length, path[i].curvature, path[i].dir);
+        }
+        sendPlan(path, 0, 0, 0, 0, 0);
+
+        // The last two are the arcs onto the lane, driven together
+        bool last = path.size() <= 2;
+        std::vector<pathSeg> step(path.begin(), last ? path.end() : path.begin() + 1);
+        std::vector<setpoint> table;
+        buildProfile(step, table);
+        fprintf(logfp, "profile_time %f\n", 1000 * table.back().t);
+        cout << (last ? "Pulling out onto the lane (" : "Unpark move (") << table.back().t << " s)" << endl;
+        if (followProfile(table) && last) {
+            fprintf(logfp, "Unpark: out after %d moves\n", move + 1);
+            return true;
+        }
+    }
+    fprintf(logfp, "Unpark: still in after %d moves\n", UNPARK_MAX_MOVES);
+    cout << "Could not get out of the slot." << endl;
+    return false;
+}
+
+
+/*
+* spinInPlace
+* - Function to turn angle radians (+ left) on the spot, ramping the
+*   wheels up and down at ACC_MAX.
+*/
+bool spinInPlace(double angle) {
+    std::vector<setpoint> table;
+    double travel = fabs(angle) * WHEEL_BASE / 2.0; //per wheel
+    double ramp = CALIB_SPIN_SPEED / ACC_MAX;
+    double cruise = travel / CALIB_SPIN_SPEED - ramp;
+    double peak = CALIB_SPIN_SPEED;
+    if (cruise < 0) { //too short to reach full speed
+        ramp = sqrt(travel / ACC_MAX);
+        peak = ACC_MAX * ramp;
+        cruise = 0;
+    }
+
+    for (double t = 0; t <= 2 * ramp + cruise + PROFILE_DT; t += PROFILE_DT) {
+        setpoint sp;
+        double wheel = t < ramp ? ACC_MAX * t :
+                       t < ramp + cruise ? peak : fmax(0.0, peak - ACC_MAX * (t - ramp - cruise));
+        sp.t = t;
+        sp.vel = 0;
+        sp.omega = (angle > 0 ? 1 : -1) * wheel * 2.0 / WHEEL_BASE;
+        sp.left = -sp.omega * WHEEL_BASE / 2.0;
+        sp.right = -sp.left;
+        table.push_back(sp);
+    }
+    return followProfile(table);
+}
+
+
+/*
+* stillScan
+* - Function to wait for the robot to settle and return the newest sweep
+*   as points in the robot frame, plus the encoder pose it was taken at.
+*/
+int stillScan(double *xs, double *ys, ArPose &encoder) {
+    laserSweep sweep;
+    int n = 0;
+
+    ArUtil::sleep(CALIB_SETTLE);
+    lockRobot();
+    encoder = robot.getEncoderPose();
     robot.unlock();
-    ArUtil::sleep(t_turn);
+    if (!scan_bus.readLatest(sweep))
+        return 0;
+    for (int i = 0; i < sweep.count; i++) {
+        if (sweep.ranges[i] == 0)
+            continue;
+        double a = (sweep.start_angle + i * sweep.increment) * PI / 180.0;
+        xs[n] = sick.getSensorPosX() + sweep.ranges[i] * cos(a);
+        ys[n] = sick.getSensorPosY() + sweep.ranges[i] * sin(a);
+        n++;
+    }
+    return n;
+}
 
-    cout << "2nd turning velocity: (" << (wheel_ratio * rightVel) << "," << rightVel << ")" << endl;
-    robot.lock();
-    robot.setVel2(rightVel, (wheel_ratio * rightVel));
+
+/*
+* calibrateOdometry
+* - Function to drive a short pattern (straight out and back, spin left
+*   and right, CALIB_REPS times), match the scans before and after each
+*   move to see how far the robot really went, and fit the wheel scales
+*   and wheel base to the encoder readings. Needs walls in view and a
+*   clear CALIB_DIST ahead.
+*/
+bool calibrateOdometry() {
+    static double xa[SWEEP_MAX_BEAMS], ya[SWEEP_MAX_BEAMS], xb[SWEEP_MAX_BEAMS], yb[SWEEP_MAX_BEAMS];
+    std::vector<calibSample> samples;
+    ArPose enc_a, enc_b;
+
+    cout << "Calibrating odometry, keep the area clear." << endl;
+    int na = stillScan(xa, ya, enc_a);
+    for (int rep = 0; rep < CALIB_REPS; rep++) {
+        for (int move = 0; move < 4; move++) {
+            bool ok = move == 0 ? driveStraight(CALIB_DIST) :
+                      move == 1 ? driveStraight(-CALIB_DIST) :
+                      move == 2 ? spinInPlace(CALIB_ANGLE) : spinInPlace(-CALIB_ANGLE);
+            int nb = stillScan(xb, yb, enc_b);
+            if (!ok) {
+                cout << "Calibration move blocked, giving up." << endl;
+                return false;
+            }
+
+            // What the encoders say, in the frame of the first scan
+            double th = enc_a.getTh() * PI / 180.0;
+            double dx = enc_b.getX() - enc_a.getX(), dy = enc_b.getY() - enc_a.getY();
+            double enc_dist = cos(th) * dx + sin(th) * dy;
+            double enc_rot = ArMath::subAngle(enc_b.getTh(), enc_a.getTh()) * PI / 180.0;
+            pose2d delta = {cos(enc_rot / 2) * enc_dist, sin(enc_rot / 2) * enc_dist, enc_rot};
+
+            double rms;
+            if (matchScans(xa, ya, na, xb, yb, nb, delta, &rms) && rms < CALIB_MAX_RMS) {
+                calibSample sample;
+                sample.enc_left = enc_dist - enc_rot * WHEEL_BASE / 2.0;
+                sample.enc_right = enc_dist + enc_rot * WHEEL_BASE / 2.0;
+                sample.scan_dist = delta.x;
+                sample.scan_rot = delta.th;
+                samples.push_back(sample);
+                fprintf(logfp, "Calibration move %d: encoders %f mm %f rad, scans %f mm %f rad, rms %f\n",
+                        move, enc_dist, enc_rot, delta.x, delta.th, rms);
+            }
+            else
+                fprintf(logfp, "Calibration move %d: scans didn't match\n", move);
+
+            memcpy(xa, xb, nb * sizeof(double));
+            memcpy(ya, yb, nb * sizeof(double));
+            na = nb;
+            enc_a = enc_b;
+        }
+    }
+
+    odomCalib calib;
+    defaultCalib(calib);
+    if (!solveCalib(samples, calib)) {
+        cout << "Calibration failed, not enough matched moves." << endl;
+        return false;
+    }
+
+    char file[128];
+    calibFile(robot.getRobotName(), file, sizeof(file));
+    fprintf(logfp, "Calibration: wheel base %f left %f right %f (%d moves)\n",
+            calib.wheel_base, calib.left_scale, calib.right_scale, calib.samples);
+    printf("Wheel base %.1f mm, wheel scales %.4f %.4f\n",
+           calib.wheel_base, calib.left_scale, calib.right_scale);
+    if (!saveCalib(file, calib)) {
+        printf("Could not write %s\n", file);
+        return false;
+    }
+    printf("Saved to %s\n", file);
+    odom_calib = calib;
+    return true;
+}
+
+
+/*
+* headForKnownSlot
+* - Function to drive to where an earlier run saw the nearest slot that's
+*   likely still free, and scan for it from there. Straight ahead along
+*   the lane is always reachable, anywhere else (behind us included)
+*   needs -map. Returns whether the slot was found.
+*/
+bool headForKnownSlot() {
+    slotRecord slot;
+
+    lockRobot();
+    pose2d here = mapPose(robot.getPose());
     robot.unlock();
-    ArUtil::sleep(t_turn);
-    
-    robot.lock();
-    robot.stop();
+    if (!slot_db.nearestFree(here, ROBOT_RADIUS * 2, SLOTDB_MIN_CONF, time(NULL), slot))
+        return false;
+    pose2d to = poseCompose(poseInverse(here), slot.view);
+    fprintf(logfp, "Slot DB: slot %u at %f %f, %.0f%% free, %f ahead %f left\n", slot.id, slot.center.x,
+            slot.center.y, 100 * slotFreeNow(slot, time(NULL)), to.x, to.y);
+
+    bool there;
+    if (to.x > 0 && fabs(to.y) < SLOTDB_LANE_TOL && fabs(atan2(sin(to.th), cos(to.th))) < SLOTDB_LANE_ANGLE) {
+        cout << "Heading for a slot seen free before, " << to.x << " mm ahead" << endl;
+        there = driveStraight(to.x);
+    }
+    else if (!lot_map.lines.empty()) {
+        cout << "Heading for a slot seen free before, on the map" << endl;
+        there = driveToMapPose(slot.view);
+    }
+    else
+        there = false;
+    if (!there)
+        return false;
+
+    takeReadings();
+    findCorners();
+    bool found = agent.found();
+    lockRobot();
+    ArPose odom = robot.getPose();
     robot.unlock();
+    recordScan(odom, found);
+    return found;
+}
 
-    return;
+
+/*
+* searchManeuver
+* - The slot search from main() as a maneuver: scan on a fresh bus sweep
+*   once stopped (instead of sleeping), up to MAX_SCANS times, then move
+*   on MOVE_DISTANCE, MAX_MOVES times. Returns whether a slot was found.
+*/
+Maneuver searchManeuver() {
+    bool found = false;
+
+    for (int move = 0; move < MAX_MOVES && !found; move++) {
+        for (int scan = 0; scan < MAX_SCANS && !found; scan++) {
+            co_await stopped();
+            laserSweep sweep = co_await nextBusSweep(&scan_bus);
+            readBusSweep(sweep, toPose2d(robot.getEncoderPose()));
+            findCorners();
+            found = agent.found();
+            recordScan(robot.getPose(), found);
+        }
+        co_await moveDistance(MOVE_DISTANCE);
+        co_await stopped();
+        resetPose();
+    }
+    search_done = true;
+    co_return found;
+}
+
+
+/*
+* logManeuver
+* - Log the pose on every sweep while the search runs, alongside it.
+*/
+Maneuver logManeuver() {
+    while (!search_done) {
+        co_await nextSweep();
+        ArPose pose = robot.getPose();
+        fprintf(logfp, "Pose: %f %f %f\n", pose.getX(), pose.getY(), pose.getTh());
+    }
+    co_return true;
 }
 
 
@@ -365,6 +1285,45 @@ int main(int argc, char **argv) {
         fprintf(logfp, "Initialization failed\n\n");
     }
   
+    // Calibrate instead of parking
+    if (do_calibrate) {
+        fprintf(logfp, "## CALIBRATION ##\n");
+        calibrateOdometry();
+        realtime.report(logfp);
+        health.report(logfp);
+        health.stop();
+        telemetry.stop();
+        Aria::shutdown();
+        fclose(logfp);
+        return 0;
+    }
+
+    // Leave the slot instead of parking
+    if (do_unpark) {
+        fprintf(logfp, "## UNPARK ##\n");
+        unparkRobot();
+        realtime.report(logfp);
+        health.report(logfp);
+        health.stop();
+        telemetry.stop();
+        Aria::shutdown();
+        fclose(logfp);
+        return 0;
+    }
+
+    // Drive to a goal on a map instead of searching for a slot
+    if (have_goal) {
+        fprintf(logfp, "## MAP GOAL ##\n");
+        driveOnMap();
+        realtime.report(logfp);
+        health.report(logfp);
+        health.stop();
+        telemetry.stop();
+        Aria::shutdown();
+        fclose(logfp);
+        return 0;
+    }
+
     // Take readings
     fprintf(logfp, "## SCAN FOR SPACE ##\n");
     takeReadings();
@@ -372,26 +1331,34 @@ int main(int argc, char **argv) {
     // Calcuate corner angles and distances
     fprintf(logfp, "## CORNERS ##\n");
     findCorners();
+    lockRobot();
+    ArPose scan_pose = robot.getPose();
+    robot.unlock();
+    recordScan(scan_pose, agent.found());
 
     int max_tries; //Didn't find corners? try a few more times.
-        int max_move = MAX_MOVES;
-        bool found_spot = false;
+        int max_move = use_coroutines ? 0 : MAX_MOVES;
+        bool found_spot = headForKnownSlot();
+        if (use_coroutines && !found_spot) {
+                motion.spawn(logManeuver());
+                found_spot = motion.run(searchManeuver());
+        }
         while(!found_spot && max_move > 0) {
                 max_tries = MAX_SCANS;
-                while((third_corner.distance == 0 || first_corner.angle > 150.0 )&& max_tries > 0) {
+                while(!agent.found() && max_tries > 0) {
                         takeReadings();
                         findCorners();
-                        if(third_corner.distance != 0 && first_corner.angle < 150.0)
+                        if(agent.found())
                                 found_spot = true;
+                        lockRobot();
+                        scan_pose = robot.getPose();
+                        robot.unlock();
+                        recordScan(scan_pose, found_spot);
                         max_tries--;
                 }
-                robot.lock();
-                robot.move(MOVE_DISTANCE);
-                robot.unlock();
-                ArUtil::sleep(2000);
-                while(robot.isMoveDone() == false) {}
-                robot.lock();
-                robot.moveTo(ArPose(0,0,0), true); //resets pose to 0,0 for new position
+                driveStraight(MOVE_DISTANCE);
+                lockRobot();
+                resetPose(); //resets pose to 0,0 for new position
                 robot.unlock();
                 ArUtil::sleep(200);
                 max_move--;
@@ -400,16 +1367,37 @@ int main(int argc, char **argv) {
 
     // Use corners to get dimension of parking spot
     getDimensions();
+    classifySlot();
         
     // When parking space is found, execute park function
-        if((found_width > (ROBOT_RADIUS *2 + 150)) && found_spot)
+        if(found_spot && agent.type != SLOT_PARALLEL)
+            found_spot = parkBay();
+        else if((agent.width > AGENT_PARALLEL_MIN) && found_spot)
             parkRobot();
-        else
+        else if(found_spot)
+            found_spot = parkMultiPoint(); //too short for one maneuver, try several
+        if(!found_spot)
                 cout << "Adequate spot not found." << endl;
                 cout << found_spot << endl;
+
+    // Stay a while and leave again
+    if (found_spot && cycle_dwell > 0 && agent.type == SLOT_PARALLEL) {
+        cout << "Parked, leaving in " << cycle_dwell << " s" << endl;
+        ArUtil::sleep((unsigned int)(cycle_dwell * 1000));
+        fprintf(logfp, "## UNPARK ##\n");
+        unparkRobot();
+    }
     
     // Shutdown the robot
     //robot.waitForRunExit();
+    realtime.report(stdout);
+    realtime.report(logfp);
+    faults.report(stdout);
+    faults.report(logfp);
+    health.report(stdout);
+    health.report(logfp);
+    health.stop();
+    telemetry.stop();
     Aria::shutdown();
     fclose(logfp);
     return 0;
@@ -0,0 +1,62 @@
+/*
+* autoPark.h
+* - Constants and types shared by the auto-park modules.
+*/
+#ifndef AUTOPARK_H
+#define AUTOPARK_H
+
+// Constants
+#define MAX_MOVES 5        //Maximum times to move MOVE_DISTANCE and check for new spot
+#define MAX_SCANS 3 //Maximum times to scan for corners at each "initial" location
+#define MOVE_DISTANCE 300.0 //Distance to move before attempting to find corners again
+#define TURNING_RADIUS 525.0
+#define ROBOT_RADIUS 227.5
+#define ROBOT_BACK 425.0
+#define DEPTH_BOUND 100.0 //Adjust depending on expected depth
+#define WHEEL_BASE 320.0
+#define MAR_ERR 50.0
+#define VMAX 300.0
+#define LASER_ANGLE 90.0
+#define OMEGA_MAX 2.618
+#define PI 3.14159265
+#define TRUE 1
+#define FALSE 0
+
+struct reading {
+    double angle;
+    double distance;
+};
+
+// Kinds of slot the corners can describe
+enum slotType {
+    SLOT_PARALLEL,      //along the wall, longer than deep
+    SLOT_PERPENDICULAR, //bay at right angles to the lane
+    SLOT_ANGLED         //bay at any other angle
+};
+
+/*
+* pose2d
+* - A robot pose, mm and radians, in the frame of the robot at scan time
+*   (x forward, y to the left).
+*/
+struct pose2d {
+    double x;
+    double y;
+    double th;
+};
+
+/*
+* pathSeg
+* - One piece of a planned path: a straight line (curvature 0) or an arc.
+*   Curvature is signed relative to the robot's heading, + turns left
+*   (counter-clockwise) when driving forward.
+*/
+struct pathSeg {
+    double length;    //mm, always positive
+    double curvature; //1/mm
+    int dir;          //+1 forward, -1 reverse
+};
+
+#endif
+
+// EOF
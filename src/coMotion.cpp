@@ -0,0 +1,226 @@
+/*
+* coMotion.cpp
+* - Motion coroutine scheduler and awaitables.
+*
+*   Everything here runs in the robot thread from one user task, which
+*   ARIA calls with the robot locked once per cycle. A maneuver runs
+*   until it co_awaits, its awaitable is then polled each cycle and the
+*   maneuver resumed when it's satisfied. Nothing here blocks, and a
+*   maneuver mustn't either (no sleeps, no laser lock, scans come off the
+*   scan bus), so a search, a logger and anything else spawned share the
+*   one thread with the robot's own tasks.
+*/
+#include "Aria.h"
+#include <cmath>
+#include "coMotion.h"
+#include "velProfile.h"
+
+thread_local MotionScheduler *MotionScheduler::ourCurrent = nullptr;
+
+/*
+* motionWait::await_suspend
+* - Register with the scheduler that is resuming this maneuver.
+*/
+void motionWait::await_suspend(std::coroutine_handle<> handle) {
+    myHandle = handle;
+    myScheduler = MotionScheduler::current();
+    start(myScheduler->robot());
+    myScheduler->addWait(this);
+    return;
+}
+
+/*
+* followArc / moveDistance
+* - Drive one path segment (moveDistance: straight, negative backs up),
+*   slowing down under ACC_MAX towards the end. Distance is measured on
+*   the encoders.
+*/
+arcWait followArc(const pathSeg &seg) {
+    return arcWait(seg);
+}
+
+arcWait moveDistance(double distance) {
+    pathSeg line = {fabs(distance), 0.0, distance < 0 ? -1 : 1};
+    return arcWait(line);
+}
+
+void arcWait::start(ArRobot *robot) {
+    myDone = 0;
+    myLast = robot->getEncoderPose();
+    poll(robot);
+    return;
+}
+
+bool arcWait::poll(ArRobot *robot) {
+    ArPose now = robot->getEncoderPose();
+    myDone += now.findDistanceTo(myLast);
+    myLast = now;
+
+    double remaining = mySeg.length - myDone;
+    if (remaining <= CO_DONE_TOL) {
+        myScheduler->stop();
+        return true;
+    }
+    double v = mySeg.dir * fmin(CO_SPEED, sqrt(2.0 * ACC_MAX * remaining));
+    myScheduler->command(v, v * mySeg.curvature);
+    return false;
+}
+
+/*
+* nextSweep
+* - Wait for a laser sweep that finished after the call.
+*/
+sweepWait nextSweep() {
+    return sweepWait();
+}
+
+void sweepWait::start(ArRobot *robot) {
+    mySeen = myScheduler->sweeps();
+    return;
+}
+
+bool sweepWait::poll(ArRobot *robot) {
+    return myScheduler->sweeps() > mySeen;
+}
+
+/*
+* nextBusSweep
+* - Wait for a sweep published on the bus after the call, and give a copy
+*   of it. Only reads the bus, never the laser, so it can't hold up the
+*   robot thread.
+*/
+busSweepWait nextBusSweep(const ScanBus *bus) {
+    return busSweepWait(bus);
+}
+
+void busSweepWait::start(ArRobot *robot) {
+    mySeen = myBus->newest();
+    return;
+}
+
+bool busSweepWait::poll(ArRobot *robot) {
+    return myBus->newest() > mySeen && myBus->readLatest(mySweep) && mySweep.number > mySeen;
+}
+
+/*
+* stopped
+* - Wait until the robot has come to rest.
+*/
+stoppedWait stopped() {
+    return stoppedWait();
+}
+
+bool stoppedWait::poll(ArRobot *robot) {
+    return fabs(robot->getVel()) < CO_STILL_VEL && fabs(robot->getRotVel()) < CO_STILL_ROT;
+}
+
+timeWait waitMs(int ms) {
+    return timeWait(ms);
+}
+
+/*
+* MotionScheduler
+* - Constructor.
+*/
+MotionScheduler::MotionScheduler(ArRobot *robot) :
+    myRobot(robot), myScale(NULL), myCommand(NULL), myStop(NULL), mySweeps(0), myNextId(0),
+    myTask(this, &MotionScheduler::tick),
+    mySweepCB(this, &MotionScheduler::sweepCB) {
+}
+
+/*
+* spawn / run
+* - Hand a maneuver to the robot thread, it starts on the next cycle.
+*   run() waits for it to finish and returns its result.
+*/
+int MotionScheduler::spawn(Maneuver maneuver) {
+    std::lock_guard<std::mutex> lock(myMutex);
+    root r = {myNextId++, std::move(maneuver)};
+    myIncoming.push_back(std::move(r));
+    return r.id;
+}
+
+bool MotionScheduler::run(Maneuver maneuver) {
+    int id = spawn(std::move(maneuver));
+    std::unique_lock<std::mutex> lock(myMutex);
+    myFinishedCV.wait(lock, [&]() { return myFinished.count(id) > 0; });
+    bool result = myFinished[id];
+    myFinished.erase(id);
+    return result;
+}
+
+/*
+* command / stop
+* - Wheel commands for the awaitables, through the hooks if set. vel and
+*   omega are unscaled, the scale is applied here or by the hook.
+*/
+void MotionScheduler::command(double vel, double omega) {
+    double s = scale();
+    if (myCommand) {
+        myCommand(vel, omega, s);
+        return;
+    }
+    vel *= s;
+    omega *= s;
+    myRobot->setVel2(vel - omega * WHEEL_BASE / 2.0, vel + omega * WHEEL_BASE / 2.0);
+    return;
+}
+
+void MotionScheduler::stop() {
+    if (myStop)
+        myStop();
+    else
+        myRobot->setVel2(0, 0);
+    return;
+}
+
+void MotionScheduler::sweepCB() {
+    mySweeps++;
+    return;
+}
+
+/*
+* tick
+* - One robot cycle: start new maneuvers, resume the ones whose wait is
+*   over, and report the ones that finished.
+*/
+void MotionScheduler::tick() {
+    std::vector<root> incoming;
+    std::vector<motionWait *> ready, waiting;
+
+    ourCurrent = this;
+    {
+        std::lock_guard<std::mutex> lock(myMutex);
+        incoming.swap(myIncoming);
+    }
+    for (size_t i = 0; i < incoming.size(); i++) {
+        myRoots.push_back(std::move(incoming[i]));
+        myRoots.back().maneuver.myHandle.resume();
+    }
+
+    // Resuming adds new waits, so split the list first
+    for (size_t i = 0; i < myWaits.size(); i++) {
+        if (myWaits[i]->poll(myRobot))
+            ready.push_back(myWaits[i]);
+        else
+            waiting.push_back(myWaits[i]);
+    }
+    myWaits.swap(waiting);
+    for (size_t i = 0; i < ready.size(); i++)
+        ready[i]->myHandle.resume();
+
+    for (size_t i = 0; i < myRoots.size();) {
+        if (!myRoots[i].maneuver.myHandle.done()) {
+            i++;
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(myMutex);
+        myFinished[myRoots[i].id] = myRoots[i].maneuver.myHandle.promise().result;
+        myRoots.erase(myRoots.begin() + i);
+        myFinishedCV.notify_all();
+    }
+    ourCurrent = nullptr;
+    return;
+}
+
+// EOF
@@ -0,0 +1,215 @@
+/*
+* coMotion.h
+* - Coroutine motion scripting: maneuvers written as straight line code
+*   that co_await motion and sweeps, run by one scheduler ticked from the
+*   robot's sync loop. Needs -std=c++20.
+*/
+#ifndef COMOTION_H
+#define COMOTION_H
+
+#include "Aria.h"
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "autoPark.h"
+#include "scanBus.h"
+
+#define CO_SPEED 200.0     //Cruise speed for followArc(), mm/s
+#define CO_DONE_TOL 5.0    //followArc() ends this close to the end, mm
+#define CO_STILL_VEL 5.0   //stopped(): slower than this, mm/s
+#define CO_STILL_ROT 1.0   //deg/s
+
+class MotionScheduler;
+
+/*
+* Maneuver
+* - Return type of a motion coroutine. It starts when the scheduler runs
+*   it or another maneuver co_awaits it, and co_await gives its co_return
+*   value once it has finished.
+*/
+class Maneuver {
+public:
+    struct promise_type {
+        bool result = false;
+        std::coroutine_handle<> parent;
+
+        Maneuver get_return_object() {
+            return Maneuver(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        struct finalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                return h.promise().parent ? h.promise().parent : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        finalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(bool value) { result = value; }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Maneuver(Maneuver &&other) noexcept : myHandle(other.myHandle) { other.myHandle = nullptr; }
+    Maneuver(const Maneuver &) = delete;
+    Maneuver &operator=(const Maneuver &) = delete;
+    Maneuver &operator=(Maneuver &&other) noexcept {
+        std::swap(myHandle, other.myHandle);
+        return *this;
+    }
+    ~Maneuver() { if (myHandle) myHandle.destroy(); }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> parent) {
+        myHandle.promise().parent = parent;
+        return myHandle;
+    }
+    bool await_resume() { return myHandle.promise().result; }
+
+protected:
+    friend class MotionScheduler;
+    explicit Maneuver(std::coroutine_handle<promise_type> handle) : myHandle(handle) {}
+    std::coroutine_handle<promise_type> myHandle;
+};
+
+/*
+* motionWait
+* - Base of the awaitables below. start() runs when the maneuver
+*   suspends on it, poll() every robot cycle until it returns true. Both
+*   run in the robot thread with the robot locked.
+*/
+class motionWait {
+public:
+    virtual ~motionWait() {}
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle);
+    void await_resume() {}
+    virtual void start(ArRobot *robot) {}
+    virtual bool poll(ArRobot *robot) = 0;
+
+    std::coroutine_handle<> myHandle;
+    MotionScheduler *myScheduler = nullptr;
+};
+
+class arcWait : public motionWait {
+public:
+    explicit arcWait(const pathSeg &seg) : mySeg(seg) {}
+    virtual void start(ArRobot *robot);
+    virtual bool poll(ArRobot *robot);
+protected:
+    pathSeg mySeg;
+    double myDone = 0;
+    ArPose myLast;
+};
+
+class sweepWait : public motionWait {
+public:
+    virtual void start(ArRobot *robot);
+    virtual bool poll(ArRobot *robot);
+protected:
+    long mySeen = 0;
+};
+
+class busSweepWait : public motionWait {
+public:
+    explicit busSweepWait(const ScanBus *bus) : myBus(bus) {}
+    virtual void start(ArRobot *robot);
+    virtual bool poll(ArRobot *robot);
+    laserSweep await_resume() { return mySweep; }
+protected:
+    const ScanBus *myBus;
+    unsigned long long mySeen = 0;
+    laserSweep mySweep;
+};
+
+class stoppedWait : public motionWait {
+public:
+    virtual bool poll(ArRobot *robot);
+};
+
+class timeWait : public motionWait {
+public:
+    explicit timeWait(int ms) : myMs(ms) {}
+    virtual void start(ArRobot *robot) { myStart.setToNow(); }
+    virtual bool poll(ArRobot *robot) { return myStart.mSecSince() >= myMs; }
+protected:
+    int myMs;
+    ArTime myStart;
+};
+
+arcWait followArc(const pathSeg &seg);
+arcWait moveDistance(double distance);
+sweepWait nextSweep();
+busSweepWait nextBusSweep(const ScanBus *bus);
+stoppedWait stopped();
+timeWait waitMs(int ms);
+
+/*
+* MotionScheduler
+* - Runs every maneuver in the robot thread, one robot cycle at a time,
+*   so behaviors interleave without threads of their own or sleeps.
+*   Maneuvers run with the robot locked and must not lock it themselves.
+*   spawn() starts a maneuver in the background, run() starts one and
+*   waits for its result. Add getTask() as a robot user task and
+*   getSweepCB() as a laser data callback. setScale() sets a speed scale
+*   source (e.g. the safety layer) for followArc(), setCommand() how its
+*   velocities reach the wheels: command(vel, omega, scale) every cycle,
+*   stop() once the arc is over. Without them it calls setVel2() itself.
+*/
+class MotionScheduler {
+public:
+    MotionScheduler(ArRobot *robot);
+    int spawn(Maneuver maneuver);
+    bool run(Maneuver maneuver);
+    void setScale(double (*scale)()) { myScale = scale; }
+    void setCommand(void (*command)(double vel, double omega, double scale), void (*stop)()) {
+        myCommand = command;
+        myStop = stop;
+    }
+    ArFunctor *getTask() { return &myTask; }
+    ArFunctor *getSweepCB() { return &mySweepCB; }
+
+    // For the awaitables
+    static MotionScheduler *current() { return ourCurrent; }
+    ArRobot *robot() { return myRobot; }
+    void addWait(motionWait *wait) { myWaits.push_back(wait); }
+    long sweeps() const { return mySweeps; }
+    double scale() const { return myScale ? myScale() : 1.0; }
+    void command(double vel, double omega);
+    void stop();
+
+protected:
+    struct root {
+        int id;
+        Maneuver maneuver;
+    };
+
+    void tick();
+    void sweepCB();
+
+    ArRobot *myRobot;
+    double (*myScale)();
+    void (*myCommand)(double vel, double omega, double scale);
+    void (*myStop)();
+    std::vector<root> myRoots;
+    std::vector<motionWait *> myWaits;
+    std::atomic<long> mySweeps;
+
+    // Between the robot thread and whoever spawns and waits
+    std::mutex myMutex;
+    std::condition_variable myFinishedCV;
+    std::vector<root> myIncoming;
+    std::map<int, bool> myFinished;
+    int myNextId;
+
+    ArFunctorC<MotionScheduler> myTask;
+    ArFunctorC<MotionScheduler> mySweepCB;
+    static thread_local MotionScheduler *ourCurrent;
+};
+
+#endif
+
+// EOF
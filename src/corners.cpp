@@ -0,0 +1,86 @@
+/*
+* corners.cpp
+* - Corner detection and slot dimensions.
+*/
+#include <cmath>
+#include "corners.h"
+#include "tuning.h"
+
+/*
+* readingAt
+* - Readings past the end of the scan count as empty, like the zeroed
+*   tail of reading_array.
+*/
+static reading readingAt(const reading *readings, int n, int i) {
+    reading none = {0, 0};
+    return i < n ? readings[i] : none;
+}
+
+/*
+* detectCorners
+* - Walk the readings (sorted from 90 to 180 degrees) for the corner of
+*   car 1, the back of the space and the corner of car 2. Corners not
+*   found have distance 0. Returns how many were found.
+*/
+int detectCorners(const reading *readings, int n, reading &first, reading &second, reading &third) {
+    int i = 0;
+    reading current;
+    reading next;
+    reading nextnext;
+    //bool behind_car = 0; //TODO add logic to find corners assuming starting behind first car
+
+    first.distance = second.distance = third.distance = 0;
+    nextnext = readingAt(readings, n, 0);
+
+    while (nextnext.distance != 0) {
+        current = readingAt(readings, n, i);
+        next = readingAt(readings, n, i+1);
+        nextnext = readingAt(readings, n, i+2); //check against 2 readings instead of 1
+
+        //This function occasionally fails and doesn't give the corners.
+        //When it fails the data looks fine... so I'm not sure what's going on.
+
+        //1st corner assuming starting right next to car #1 && we ccan see the botton corner of car2
+        if (((current.distance + tuning.depth_bound) < next.distance) &&
+                ((current.distance + tuning.depth_bound) < nextnext.distance) && first.distance == 0) {
+            first = current;
+        }
+        //2nd corner assuming starting right next to car #1
+        if (current.distance > next.distance && current.distance > nextnext.distance
+                && first.distance != 0 && second.distance == 0) {
+            second = current;
+        }
+        //3rd corner assuming starting right next to car #1
+        if (current.distance < next.distance && current.distance < nextnext.distance
+                && first.distance != 0 && second.distance != 0) {
+            third = current;
+            return 3; //Got all the corners no need to check the other values
+        }
+        i++;
+    }
+    /*
+        Find the first corner if behind first car
+        if (current.distance > next.distance && first.distance == 0) {
+            first = current;
+        }
+    */
+    return (first.distance != 0) + (second.distance != 0);
+}
+
+/*
+* slotDimensions
+* - Depth and width of the space using cosines.
+*/
+void slotDimensions(const reading &first, const reading &second, const reading &third,
+                    double &depth, double &width) {
+    depth = sqrt(pow(second.distance,2.0) + pow(third.distance,2.0)
+                 - 2.0 * second.distance * third.distance
+                 * cos((third.angle - second.angle) * PI / 180));
+
+    width = sqrt(pow(first.distance,2.0) + pow(third.distance,2.0)
+                 - 2.0 * first.distance * third.distance
+                 * cos((third.angle - first.angle) * PI / 180));
+    return;
+}
+
+// EOF
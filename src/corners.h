@@ -0,0 +1,17 @@
+/*
+* corners.h
+* - Finds the corners of a parking space in a scan and the space's size.
+*   No robot or laser calls, so the offline tools can use it too.
+*/
+#ifndef CORNERS_H
+#define CORNERS_H
+
+#include "autoPark.h"
+
+int detectCorners(const reading *readings, int n, reading &first, reading &second, reading &third);
+void slotDimensions(const reading &first, const reading &second, const reading &third,
+                    double &depth, double &width);
+
+#endif
+
+// EOF
@@ -0,0 +1,195 @@
+/*
+* faults.cpp
+* - Seeded fault schedules for sweeps and wheel commands.
+*
+*   Faults are decided by hashing the event number instead of drawing
+*   from a shared random stream, so the laser thread, the control loop
+*   and the robot thread can't shift each other's schedule. A delayed
+*   command is held until its time and never overtakes one sent before
+*   it, like a slow serial link. A stop can be delayed too.
+*/
+#include "Aria.h"
+#include <cstdlib>
+#include <cstring>
+#include "faults.h"
+
+static const char *fault_names[FAULT_KINDS] = {"dropped sweeps", "max range spikes",
+                                               "late sweeps", "delayed commands"};
+
+/*
+* FaultInjector
+* - Constructor.
+*/
+FaultInjector::FaultInjector() :
+    myEnabled(false), mySeed(1), myDrop(0), mySpike(0), myLate(0), myCmd(0),
+    myLateMs(0), myCmdMs(0), myCommands(0), myRobot(NULL), myHead(0), myTail(0),
+    myReleaseTask(this, &FaultInjector::releaseCommands) {
+    for (int i = 0; i < FAULT_STREAMS; i++)
+        mySweeps[i] = 0;
+    for (int i = 0; i < FAULT_KINDS; i++)
+        myCounts[i] = 0;
+}
+
+/*
+* configure
+* - Parse a fault spec. Returns false (and stays off) if it doesn't make
+*   sense.
+*/
+bool FaultInjector::configure(const char *spec) {
+    char buf[256];
+    strncpy(buf, spec, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    for (char *item = strtok(buf, ","); item != NULL; item = strtok(NULL, ",")) {
+        char *value = strchr(item, '=');
+        if (value == NULL)
+            return false;
+        *value++ = '\0';
+        double p = atof(value);
+        char *ms = strchr(value, ':');
+        int delay = ms ? atoi(ms + 1) : 0;
+
+        if (strcmp(item, "seed") == 0)
+            mySeed = strtoull(value, NULL, 10);
+        else if (p < 0 || p > 1 || delay < 0 || delay > FAULT_MAX_DELAY)
+            return false;
+        else if (strcmp(item, "drop") == 0)
+            myDrop = p;
+        else if (strcmp(item, "spike") == 0)
+            mySpike = p;
+        else if (strcmp(item, "late") == 0 && ms) {
+            myLate = p;
+            myLateMs = delay;
+        }
+        else if (strcmp(item, "cmd") == 0 && ms) {
+            myCmd = p;
+            myCmdMs = delay;
+        }
+        else
+            return false;
+    }
+    myEnabled = true;
+    return true;
+}
+
+/*
+* attach
+* - Add the robot task that releases delayed commands each cycle.
+*/
+void FaultInjector::attach(ArRobot *robot) {
+    if (!myEnabled)
+        return;
+    myRobot = robot;
+    robot->lock();
+    robot->addUserTask("faults", 60, &myReleaseTask);
+    robot->unlock();
+    return;
+}
+
+/*
+* chance
+* - Uniform [0,1) for event n of a kind and stream (splitmix64).
+*/
+double FaultInjector::chance(int kind, int stream, long n) const {
+    unsigned long long z = mySeed ^ ((unsigned long long)kind << 56) ^
+                           ((unsigned long long)stream << 48) ^ (unsigned long long)n;
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+* injectSweep
+* - Number the sweep, drop it or hold it back.
+*/
+long FaultInjector::injectSweep(int stream) {
+    long n = mySweeps[stream]++;
+    if (chance(FAULT_DROP, stream, n) < myDrop) {
+        myCounts[FAULT_DROP]++;
+        return -1;
+    }
+    if (chance(FAULT_LATE, stream, n) < myLate) {
+        myCounts[FAULT_LATE]++;
+        ArUtil::sleep(myLateMs);
+    }
+    return n;
+}
+
+bool FaultInjector::injectSpike(int stream, long sweep, int beam) {
+    if (chance(FAULT_SPIKE, stream, sweep * 1024 + beam) >= mySpike)
+        return false;
+    myCounts[FAULT_SPIKE]++;
+    return true;
+}
+
+/*
+* queueCommand
+* - Send a command now or hold it, behind anything already held. The
+*   caller has the robot locked.
+*/
+void FaultInjector::queueCommand(ArRobot &robot, bool stop, double left, double right) {
+    command &c = myQueue[myTail];
+    myRobot = &robot;
+    c.due.setToNow();
+    if (chance(FAULT_CMD, 0, myCommands++) < myCmd) {
+        myCounts[FAULT_CMD]++;
+        c.due.addMSec(myCmdMs);
+    }
+    if (myHead == myTail && c.due.mSecTo() <= 0) {
+        if (stop)
+            robot.stop();
+        else
+            robot.setVel2(left, right);
+        return;
+    }
+
+    // Full, the oldest goes out now
+    if ((myTail + 1) % FAULT_QUEUE == myHead) {
+        myQueue[myHead].due.setToNow();
+        releaseCommands();
+    }
+    const command &last = myQueue[(myTail + FAULT_QUEUE - 1) % FAULT_QUEUE];
+    if (myHead != myTail && last.due.isAfter(c.due))
+        c.due = last.due;
+    c.stop = stop;
+    c.left = left;
+    c.right = right;
+    myTail = (myTail + 1) % FAULT_QUEUE;
+    releaseCommands();
+    return;
+}
+
+/*
+* releaseCommands
+* - Send every held command that's due, oldest first. Runs in the robot
+*   thread, which has the robot locked, and from queueCommand().
+*/
+void FaultInjector::releaseCommands() {
+    ArRobot *robot = myRobot;
+    while (robot != NULL && myHead != myTail && myQueue[myHead].due.mSecTo() <= 0) {
+        const command &c = myQueue[myHead];
+        if (c.stop)
+            robot->stop();
+        else
+            robot->setVel2(c.left, c.right);
+        myHead = (myHead + 1) % FAULT_QUEUE;
+    }
+    return;
+}
+
+/*
+* report
+* - Print what was injected, with the seed to repeat it.
+*/
+void FaultInjector::report(FILE *fp) {
+    if (!myEnabled)
+        return;
+    fprintf(fp, "Faults (seed %llu):", mySeed);
+    for (int i = 0; i < FAULT_KINDS; i++)
+        fprintf(fp, " %ld %s%s", myCounts[i].load(), fault_names[i], i + 1 < FAULT_KINDS ? "," : "\n");
+    return;
+}
+
+// EOF
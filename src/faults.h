@@ -0,0 +1,99 @@
+/*
+* faults.h
+* - Fault injection between the laser/robot and the rest of the program,
+*   for soak tests on the simulator or the real robot.
+*/
+#ifndef FAULTS_H
+#define FAULTS_H
+
+#include "Aria.h"
+#include <atomic>
+#include <cstdio>
+
+#define FAULT_MAX_RANGE 8183  //What the SICK reports with no return, mm
+#define FAULT_MAX_DELAY 5000  //Longest late sweep or command delay, ms
+#define FAULT_QUEUE 64        //Delayed commands held at once
+
+// Kinds of fault, also the counters in report()
+enum faultKind {
+    FAULT_DROP,   //sweep never arrives
+    FAULT_SPIKE,  //one beam reads max range
+    FAULT_LATE,   //sweep arrives late
+    FAULT_CMD,    //wheel command reaches the robot late
+    FAULT_KINDS
+};
+
+// Who is reading sweeps, each gets its own schedule
+enum faultStream {
+    FAULT_STREAM_BUS,    //publishSweep(), what the scan bus and its readers see
+    FAULT_STREAM_SCAN,   //takeReadings()
+    FAULT_STREAMS
+};
+
+/*
+* FaultInjector
+* - configure() takes a spec like "drop=0.05,spike=0.01,late=0.1:300,
+*   cmd=0.2:250,seed=7": a probability per sweep, beam or command, and
+*   for late and cmd the delay in ms. Whether event n gets a fault is a
+*   hash of (seed, kind, stream, n), so a seed gives the same schedule
+*   every run whatever the threads do. When it isn't configured every
+*   hook is one branch.
+*
+*   Sweep readers call beginSweep() (which sleeps if the sweep is late)
+*   and skip the sweep if it returns -1, then ask spike() per beam.
+*   Wheel commands go through setVel2()/stop() with the robot locked;
+*   delayed ones are released in order by a robot task from attach().
+*/
+class FaultInjector {
+public:
+    FaultInjector();
+    bool configure(const char *spec);
+    bool enabled() const { return myEnabled; }
+    void attach(ArRobot *robot);
+
+    long beginSweep(int stream) { return myEnabled ? injectSweep(stream) : 0; }
+    bool spike(int stream, long sweep, int beam) {
+        return myEnabled && mySpike > 0 && injectSpike(stream, sweep, beam);
+    }
+    void setVel2(ArRobot &robot, double left, double right) {
+        if (myEnabled) queueCommand(robot, false, left, right);
+        else robot.setVel2(left, right);
+    }
+    void stop(ArRobot &robot) {
+        if (myEnabled) queueCommand(robot, true, 0, 0);
+        else robot.stop();
+    }
+
+    void report(FILE *fp);
+
+protected:
+    struct command {
+        ArTime due;
+        bool stop;
+        double left, right;
+    };
+
+    double chance(int kind, int stream, long n) const;
+    long injectSweep(int stream);
+    bool injectSpike(int stream, long sweep, int beam);
+    void queueCommand(ArRobot &robot, bool stop, double left, double right);
+    void releaseCommands();
+
+    bool myEnabled;
+    unsigned long long mySeed;
+    double myDrop, mySpike, myLate, myCmd;
+    int myLateMs, myCmdMs;
+    std::atomic<long> mySweeps[FAULT_STREAMS];
+    long myCommands;
+    std::atomic<long> myCounts[FAULT_KINDS];
+
+    // Delayed commands, guarded by the robot lock
+    ArRobot *myRobot;
+    command myQueue[FAULT_QUEUE];
+    int myHead, myTail;
+    ArFunctorC<FaultInjector> myReleaseTask;
+};
+
+#endif
+
+// EOF
@@ -0,0 +1,325 @@
+/*
+* health.cpp
+* - Health counters and their endpoint.
+*
+*   The server thread polls the listening socket every HEALTH_POLL_MS.
+*   A scrape is answered from a snapshot of relaxed loads, so values may
+*   be a few updates apart from each other but never block a writer.
+*/
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "health.h"
+
+static const char *counter_names[HEALTH_COUNTERS][2] = {
+    {"autopark_laser_sweeps_total", "Sweeps published on the scan bus"},
+    {"autopark_laser_sweeps_late_total", "Sweeps late enough that the laser skipped one"},
+    {"autopark_laser_sweeps_dropped_total", "Sweeps dropped before they were published or read"},
+    {"autopark_scans_total", "Sweeps read for corner detection"},
+    {"autopark_scan_sweeps_skipped_total", "Sweeps published between two scans and never read"},
+    {"autopark_robot_lock_contended_total", "Robot lock acquisitions that had to wait"},
+    {"autopark_laser_lock_contended_total", "Laser lock acquisitions that had to wait"},
+    {"autopark_plans_total", "Parking and map plans attempted"},
+    {"autopark_plan_failures_total", "Plans that found no path"},
+    {"autopark_profile_ticks_total", "Velocity profile control ticks"},
+    {"autopark_safety_slowed_ticks_total", "Control ticks slowed by the safety layer"},
+    {"autopark_safety_stopped_ticks_total", "Control ticks stopped by the safety layer or a dropped link"},
+    {"autopark_maneuvers_abandoned_total", "Maneuvers abandoned with the path blocked"},
+};
+
+static const char *hist_names[HEALTH_HISTOGRAMS][2] = {
+    {"autopark_robot_lock_wait_seconds", "Time spent waiting for the robot lock when it was held"},
+    {"autopark_laser_lock_wait_seconds", "Time spent waiting for the laser lock when it was held"},
+    {"autopark_plan_seconds", "Time to plan a path"},
+};
+
+/*
+* healthClock
+* - Monotonic seconds.
+*/
+double healthClock() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+* bucketBound
+* - Upper bound of histogram bucket b in seconds, 0 for the +Inf bucket.
+*/
+static double bucketBound(int b) {
+    return b < HEALTH_BUCKETS - 1 ? 1e-6 * (1 << (2 * b)) : 0;
+}
+
+/*
+* Health
+* - Constructor and destructor.
+*/
+Health::Health() : myListen(-1), myRunning(false), myInterval(0), myLastSweep(0) {
+    for (int i = 0; i < HEALTH_COUNTERS; i++)
+        myCounters[i].store(0);
+    for (int h = 0; h < HEALTH_HISTOGRAMS; h++) {
+        for (int b = 0; b < HEALTH_BUCKETS; b++)
+            myHists[h].buckets[b].store(0);
+        myHists[h].sum_ns.store(0);
+        myHists[h].max_ns.store(0);
+    }
+    myStart = healthClock();
+}
+
+Health::~Health() {
+    stop();
+}
+
+/*
+* start
+* - Listen on host:port or a Unix socket path and start the thread.
+*   Returns false if the socket can't be opened.
+*/
+bool Health::start(const char *where) {
+    stop();
+
+    if (where[0] == '/') {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, where, sizeof(addr.sun_path) - 1);
+        unlink(where);
+        myListen = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (myListen < 0 || bind(myListen, (sockaddr *)&addr, sizeof(addr)) != 0) {
+            stop();
+            return false;
+        }
+    }
+    else {
+        char host[64];
+        int port;
+        sockaddr_in addr;
+        int on = 1;
+        if (sscanf(where, "%63[^:]:%d", host, &port) != 2)
+            return false;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+            return false;
+        myListen = socket(AF_INET, SOCK_STREAM, 0);
+        if (myListen < 0)
+            return false;
+        setsockopt(myListen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(myListen, (sockaddr *)&addr, sizeof(addr)) != 0) {
+            stop();
+            return false;
+        }
+    }
+    if (listen(myListen, 4) != 0) {
+        stop();
+        return false;
+    }
+
+    myRunning.store(true);
+    myThread = std::thread(&Health::run, this);
+    return true;
+}
+
+/*
+* stop
+* - Stop the thread and close the socket. The counters are kept.
+*/
+void Health::stop() {
+    myRunning.store(false);
+    if (myThread.joinable())
+        myThread.join();
+    if (myListen >= 0)
+        close(myListen);
+    myListen = -1;
+}
+
+/*
+* observe
+* - Add a wait or run time to a histogram.
+*/
+void Health::observe(int which, double seconds) {
+    healthHistogram &h = myHists[which];
+    unsigned long long ns = seconds > 0 ? (unsigned long long)(seconds * 1e9) : 0;
+    int b = 0;
+
+    while (b < HEALTH_BUCKETS - 1 && seconds > bucketBound(b))
+        b++;
+    h.buckets[b].fetch_add(1, std::memory_order_relaxed);
+    h.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    unsigned long long worst = h.max_ns.load(std::memory_order_relaxed);
+    while (ns > worst && !h.max_ns.compare_exchange_weak(worst, ns, std::memory_order_relaxed))
+        ;
+    return;
+}
+
+/*
+* sweepSeen
+* - Count a published sweep and keep up the laser rate. A sweep that
+*   comes HEALTH_LATE_FACTOR intervals after the last means the laser
+*   (or its thread) skipped at least one. Laser thread only.
+*/
+void Health::sweepSeen() {
+    double now = healthClock();
+    double last = myLastSweep.load(std::memory_order_relaxed);
+    double interval = myInterval.load(std::memory_order_relaxed);
+
+    count(HEALTH_SWEEPS);
+    myLastSweep.store(now, std::memory_order_relaxed);
+    if (last == 0)
+        return;
+    double dt = now - last;
+    if (interval > 0 && dt > HEALTH_LATE_FACTOR * interval) {
+        count(HEALTH_SWEEPS_LATE);
+        return; //a gap isn't the laser's rate
+    }
+    myInterval.store(interval > 0 ? interval + HEALTH_RATE_GAIN * (dt - interval) : dt,
+                     std::memory_order_relaxed);
+    return;
+}
+
+/*
+* render
+* - Write every value in Prometheus text format into buf. Returns the
+*   length.
+*/
+int Health::render(char *buf, int size) {
+    int len = 0;
+    double now = healthClock();
+
+#define HEALTH_PRINT(...) \
+    do { \
+        if (len < size) \
+            len += snprintf(buf + len, size - len, __VA_ARGS__); \
+    } while (0)
+
+    for (int i = 0; i < HEALTH_COUNTERS; i++) {
+        HEALTH_PRINT("# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_names[i][0], counter_names[i][1],
+                     counter_names[i][0], counter_names[i][0], myCounters[i].load(std::memory_order_relaxed));
+    }
+
+    double interval = myInterval.load(std::memory_order_relaxed);
+    double last = myLastSweep.load(std::memory_order_relaxed);
+    HEALTH_PRINT("# HELP autopark_laser_rate_hz Average sweep rate while the laser is delivering\n"
+                 "# TYPE autopark_laser_rate_hz gauge\nautopark_laser_rate_hz %g\n",
+                 interval > 0 ? 1.0 / interval : 0.0);
+    HEALTH_PRINT("# HELP autopark_laser_sweep_age_seconds Time since the newest sweep\n"
+                 "# TYPE autopark_laser_sweep_age_seconds gauge\nautopark_laser_sweep_age_seconds %g\n",
+                 now - (last > 0 ? last : myStart));
+    HEALTH_PRINT("# HELP autopark_uptime_seconds Time since start\n"
+                 "# TYPE autopark_uptime_seconds gauge\nautopark_uptime_seconds %g\n", now - myStart);
+
+    for (int h = 0; h < HEALTH_HISTOGRAMS; h++) {
+        const char *name = hist_names[h][0];
+        unsigned long long total = 0;
+        HEALTH_PRINT("# HELP %s %s\n# TYPE %s histogram\n", name, hist_names[h][1], name);
+        for (int b = 0; b < HEALTH_BUCKETS; b++) {
+            total += myHists[h].buckets[b].load(std::memory_order_relaxed);
+            if (b < HEALTH_BUCKETS - 1)
+                HEALTH_PRINT("%s_bucket{le=\"%g\"} %llu\n", name, bucketBound(b), total);
+            else
+                HEALTH_PRINT("%s_bucket{le=\"+Inf\"} %llu\n", name, total);
+        }
+        HEALTH_PRINT("%s_sum %.9f\n%s_count %llu\n", name,
+                     myHists[h].sum_ns.load(std::memory_order_relaxed) / 1e9, name, total);
+    }
+#undef HEALTH_PRINT
+    return len < size ? len : size - 1;
+}
+
+/*
+* serve
+* - Answer one connection. Whatever the request is, the answer is the
+*   metrics; a client that sends nothing gets them after a short wait.
+*/
+void Health::serve(int fd) {
+    static char body[16384];
+    char head[160], request[1024];
+    timeval timeout = {0, HEALTH_POLL_MS * 1000};
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    ssize_t got = recv(fd, request, sizeof(request) - 1, 0);
+    bool http = got >= 4 && strncmp(request, "GET ", 4) == 0;
+
+    int len = render(body, sizeof(body));
+    if (http) {
+        int head_len = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+                                "Content-Type: text/plain; version=0.0.4\r\n"
+                                "Content-Length: %d\r\nConnection: close\r\n\r\n", len);
+        send(fd, head, head_len, MSG_NOSIGNAL);
+    }
+    for (int sent = 0; sent < len; ) {
+        ssize_t n = send(fd, body + sent, len - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    close(fd);
+    return;
+}
+
+/*
+* run
+* - Server thread.
+*/
+void Health::run() {
+    while (myRunning.load()) {
+        pollfd p = {myListen, POLLIN, 0};
+        if (poll(&p, 1, HEALTH_POLL_MS) <= 0 || !(p.revents & POLLIN))
+            continue;
+        int fd = accept(myListen, NULL, NULL);
+        if (fd >= 0)
+            serve(fd);
+    }
+    return;
+}
+
+/*
+* report
+* - Sum up the run: laser rate and gaps, skipped scans, lock waits (mean,
+*   p99 and worst), plans and safety stops.
+*/
+void Health::report(FILE *fp) {
+    unsigned long long c[HEALTH_COUNTERS];
+    double interval = myInterval.load();
+
+    for (int i = 0; i < HEALTH_COUNTERS; i++)
+        c[i] = myCounters[i].load();
+    fprintf(fp, "Health: %llu sweeps at %.1f Hz, %llu late, %llu dropped; %llu scans, %llu sweeps skipped between\n",
+            c[HEALTH_SWEEPS], interval > 0 ? 1.0 / interval : 0.0, c[HEALTH_SWEEPS_LATE],
+            c[HEALTH_SWEEPS_DROPPED], c[HEALTH_SCANS], c[HEALTH_SCAN_SKIPPED]);
+    for (int h = 0; h < HEALTH_HISTOGRAMS; h++) {
+        unsigned long long n = 0, total = 0;
+        int p99 = HEALTH_BUCKETS - 1;
+        for (int b = 0; b < HEALTH_BUCKETS; b++)
+            n += myHists[h].buckets[b].load();
+        if (n == 0)
+            continue;
+        for (int b = 0; b < HEALTH_BUCKETS; b++) {
+            total += myHists[h].buckets[b].load();
+            if (total >= n * 0.99) {
+                p99 = b;
+                break;
+            }
+        }
+        fprintf(fp, "Health: %s %llu, mean %.0f us, p99 %s %.0f us, max %.0f us\n", hist_names[h][0], n,
+                myHists[h].sum_ns.load() / 1e3 / n, p99 < HEALTH_BUCKETS - 1 ? "<" : ">",
+                (p99 < HEALTH_BUCKETS - 1 ? bucketBound(p99) : bucketBound(HEALTH_BUCKETS - 2)) * 1e6,
+                myHists[h].max_ns.load() / 1e3);
+    }
+    fprintf(fp, "Health: lock waits robot %llu laser %llu; %llu plans, %llu failed; %llu control ticks, "
+            "%llu slowed, %llu stopped, %llu maneuvers abandoned\n",
+            c[HEALTH_ROBOT_CONTENDED], c[HEALTH_LASER_CONTENDED], c[HEALTH_PLANS], c[HEALTH_PLAN_FAILURES],
+            c[HEALTH_PROFILE_TICKS], c[HEALTH_SAFETY_SLOWED], c[HEALTH_SAFETY_STOPPED], c[HEALTH_ABANDONED]);
+    return;
+}
+
+// EOF
@@ -0,0 +1,91 @@
+/*
+* health.h
+* - Runtime health counters for the scan, planning and motion paths,
+*   served as Prometheus text to a local scraper and summed up at exit.
+*/
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#define HEALTH_DEFAULT "127.0.0.1:9273" //-health, -healthAt takes host:port or a Unix socket path
+#define HEALTH_POLL_MS 100
+#define HEALTH_RATE_GAIN 0.1            //Laser interval average, weight of each new sweep
+#define HEALTH_LATE_FACTOR 1.8          //A sweep this many intervals after the last missed one
+#define HEALTH_BUCKETS 12               //Wait histograms: 1 us to 1 s in powers of 4, then +Inf
+
+// Counters
+#define HEALTH_SWEEPS 0              //sweeps published
+#define HEALTH_SWEEPS_LATE 1         //sweeps that came late enough to have skipped one
+#define HEALTH_SWEEPS_DROPPED 2      //sweeps dropped before the bus or a scan read them
+#define HEALTH_SCANS 3               //sweeps read for corners
+#define HEALTH_SCAN_SKIPPED 4        //sweeps published between two scans and never read
+#define HEALTH_ROBOT_CONTENDED 5     //robot.lock() calls that had to wait
+#define HEALTH_LASER_CONTENDED 6     //sick.lockDevice() calls that had to wait
+#define HEALTH_PLANS 7
+#define HEALTH_PLAN_FAILURES 8
+#define HEALTH_PROFILE_TICKS 9       //followProfile() control ticks
+#define HEALTH_SAFETY_SLOWED 10      //ticks the safety layer slowed down
+#define HEALTH_SAFETY_STOPPED 11     //ticks it (or a dropped link) stopped
+#define HEALTH_ABANDONED 12          //maneuvers given up blocked
+#define HEALTH_COUNTERS 13
+
+// Histograms
+#define HEALTH_ROBOT_LOCK_WAIT 0
+#define HEALTH_LASER_LOCK_WAIT 1
+#define HEALTH_PLAN_TIME 2
+#define HEALTH_HISTOGRAMS 3
+
+/*
+* healthHistogram
+* - Bucket counts, not cumulative, plus the sum and worst in ns.
+*/
+struct healthHistogram {
+    std::atomic<unsigned long long> buckets[HEALTH_BUCKETS];
+    std::atomic<unsigned long long> sum_ns;
+    std::atomic<unsigned long long> max_ns;
+};
+
+double healthClock();
+
+/*
+* Health
+* - Every update is a relaxed atomic add or store, so the control, robot
+*   and laser threads never wait on it or on each other. The server runs
+*   its own thread, answering each connection to the endpoint (an HTTP
+*   GET, or just a connect) with the current values and closing it.
+*/
+class Health {
+public:
+    Health();
+    ~Health();
+    bool start(const char *where);
+    void stop();
+
+    void count(int which, unsigned long long n = 1) { myCounters[which].fetch_add(n, std::memory_order_relaxed); }
+    void observe(int which, double seconds);
+    void sweepSeen();
+    void report(FILE *fp);
+
+protected:
+    void run();
+    void serve(int fd);
+    int render(char *buf, int size);
+
+    int myListen;
+    std::thread myThread;
+    std::atomic<bool> myRunning;
+    std::atomic<unsigned long long> myCounters[HEALTH_COUNTERS];
+    healthHistogram myHists[HEALTH_HISTOGRAMS];
+
+    // Laser rate, written by the laser thread only
+    std::atomic<double> myInterval;   //s, running average
+    std::atomic<double> myLastSweep;  //healthClock() of the newest sweep
+    double myStart;
+};
+
+#endif
+
+// EOF
@@ -0,0 +1,333 @@
+/*
+* hybridAStar.cpp
+* - Hybrid-A* over precomputed differential drive primitives.
+*
+*   Headings are kept in NUM_HEADINGS bins and every arc primitive turns a
+*   whole number of bins, so the table from mkPrims gives each successor
+*   with a lookup and an add. Positions stay continuous. The heuristic is
+*   the obstacle aware grid distance to the goal, computed once per map and
+*   goal cell. Search nodes come from a fixed pool that is reset, not freed,
+*   between plans.
+*/
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <vector>
+#include "hybridAStar.h"
+#include "parkPlan.h"
+
+using namespace std;
+
+struct searchNode {
+    float x, y;
+    float g;
+    int parent;
+    unsigned short heading;
+    unsigned short prim; //record index that reached this node
+};
+
+/*
+* mapSearchCache
+* - Everything sized by the map: the heuristic for the last goal cell and
+*   the best cost seen per (cell, heading). Stamps mark which entries
+*   belong to the current search so nothing is cleared between plans.
+*/
+struct mapSearchCache {
+    const lotMap *map;
+    int goal_cell;
+    std::vector<float> heuristic;
+    std::vector<float> best_g;
+    std::vector<unsigned int> stamp;
+    unsigned int generation;
+};
+
+typedef std::pair<float, int> openEntry;
+
+static searchNode *node_pool = NULL;
+static int pool_used = 0;
+static mapSearchCache search_cache = {NULL, -1, std::vector<float>(), std::vector<float>(),
+                                      std::vector<unsigned int>(), 0};
+
+/*
+* generatePrimitives
+* - Build the primitive table: for every heading bin, forward and reverse
+*   moves turning left, straight or right.
+*/
+void generatePrimitives(primTable &table) {
+    double bin = 2.0 * PI / NUM_HEADINGS;
+    int turns[3] = {1, 0, -1};
+
+    memcpy(table.header.magic, PRIM_MAGIC, 4);
+    table.header.version = PRIM_VERSION;
+    table.header.num_headings = NUM_HEADINGS;
+    table.header.prims_per_heading = PRIM_PER_HEADING;
+    table.header.samples = PRIM_SAMPLES;
+    table.header.turning_radius = TURNING_RADIUS;
+    table.records.clear();
+
+    for (int h = 0; h < NUM_HEADINGS; h++) {
+        for (int dir = 1; dir >= -1; dir -= 2) {
+            for (int t = 0; t < 3; t++) {
+                primRecord rec;
+                pathSeg seg;
+                seg.dir = dir;
+                seg.curvature = turns[t] / TURNING_RADIUS;
+                seg.length = turns[t] ? TURNING_RADIUS * PRIM_ARC_BINS * bin : PRIM_LINE_LEN;
+
+                memset(&rec, 0, sizeof(rec));
+                for (int s = 0; s < PRIM_SAMPLES; s++) {
+                    pose2d p = {0, 0, h * bin};
+                    advancePose(p, seg, seg.length * (s + 1) / PRIM_SAMPLES);
+                    rec.sx[s] = (short)floor(p.x * 10.0 + 0.5);
+                    rec.sy[s] = (short)floor(p.y * 10.0 + 0.5);
+                }
+                rec.dx = rec.sx[PRIM_SAMPLES - 1];
+                rec.dy = rec.sy[PRIM_SAMPLES - 1];
+                rec.end_heading = ((h + dir * turns[t] * PRIM_ARC_BINS) % NUM_HEADINGS + NUM_HEADINGS) % NUM_HEADINGS;
+                rec.dir = dir;
+                rec.turn = turns[t];
+                rec.length = seg.length;
+                table.records.push_back(rec);
+            }
+        }
+    }
+    return;
+}
+
+/*
+* writePrimitives
+* - Save a primitive table. Returns false on a write error.
+*/
+bool writePrimitives(const char *file, const primTable &table) {
+    FILE *fp = fopen(file, "wb");
+    if (fp == NULL)
+        return false;
+    bool ok = fwrite(&table.header, sizeof(primHeader), 1, fp) == 1 &&
+              fwrite(&table.records[0], sizeof(primRecord), table.records.size(), fp) == table.records.size();
+    fclose(fp);
+    return ok;
+}
+
+/*
+* loadPrimitives
+* - Load a table written by mkPrims. Tables built for another layout or
+*   turning radius, or that aren't exactly that many records long, are
+*   rejected (and table is left empty).
+*/
+bool loadPrimitives(const char *file, primTable &table) {
+    size_t n = (size_t)NUM_HEADINGS * PRIM_PER_HEADING;
+    table.records.clear();
+    FILE *fp = fopen(file, "rb");
+    if (fp == NULL)
+        return false;
+
+    bool ok = fread(&table.header, sizeof(primHeader), 1, fp) == 1 &&
+              memcmp(table.header.magic, PRIM_MAGIC, 4) == 0 &&
+              table.header.version == PRIM_VERSION &&
+              table.header.num_headings == NUM_HEADINGS &&
+              table.header.prims_per_heading == PRIM_PER_HEADING &&
+              table.header.samples == PRIM_SAMPLES &&
+              table.header.turning_radius == (float)TURNING_RADIUS;
+    if (ok) {
+        fseek(fp, 0, SEEK_END);
+        ok = ftell(fp) == (long)(sizeof(primHeader) + n * sizeof(primRecord));
+        fseek(fp, sizeof(primHeader), SEEK_SET);
+    }
+    if (ok) {
+        table.records.resize(n);
+        ok = fread(&table.records[0], sizeof(primRecord), n, fp) == n;
+        for (size_t i = 0; i < n && ok; i++)
+            ok = table.records[i].end_heading < NUM_HEADINGS;
+    }
+    if (!ok)
+        table.records.clear();
+    fclose(fp);
+    return ok;
+}
+
+/*
+* prepareCache
+* - Size the per-map arrays and compute the heuristic for the goal cell
+*   unless the last plan already did.
+*/
+static void prepareCache(const lotMap &map, int goal_cell, double radius) {
+    mapSearchCache &c = search_cache;
+    int cells = map.width * map.height;
+
+    if (c.map != &map || (int)c.best_g.size() != cells * NUM_HEADINGS) {
+        c.map = &map;
+        c.goal_cell = -1;
+        c.best_g.assign(cells * NUM_HEADINGS, 0);
+        c.stamp.assign(cells * NUM_HEADINGS, 0);
+        c.generation = 0;
+    }
+    c.generation++;
+    if (c.goal_cell == goal_cell)
+        return;
+
+    // Dijkstra from the goal over cells the robot fits in
+    c.goal_cell = goal_cell;
+    c.heuristic.assign(cells, 1e30f);
+    priority_queue<openEntry, vector<openEntry>, greater<openEntry> > open;
+    c.heuristic[goal_cell] = 0;
+    open.push(openEntry(0, goal_cell));
+    while (!open.empty()) {
+        openEntry e = open.top();
+        open.pop();
+        if (e.first > c.heuristic[e.second])
+            continue;
+        int cx = e.second % map.width, cy = e.second / map.width;
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                int nx = cx + dx, ny = cy + dy;
+                if ((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= map.width || ny >= map.height)
+                    continue;
+                int n = ny * map.width + nx;
+                if (map.clearance[n] < radius + map.cell)
+                    continue;
+                float d = e.first + map.cell * ((dx && dy) ? 1.41421356f : 1.0f);
+                if (d < c.heuristic[n]) {
+                    c.heuristic[n] = d;
+                    open.push(openEntry(d, n));
+                }
+            }
+        }
+    }
+    return;
+}
+
+/*
+* planHybridAStar
+* - Plan from start to goal (map frame) around the map lines. Returns false
+*   if the goal can't be reached within MAX_SEARCH_NODES.
+*/
+bool planHybridAStar(const lotMap &map, const primTable &prims, pose2d start, pose2d goal,
+                     std::vector<pathSeg> &path) {
+    double radius = ROBOT_RADIUS + PLAN_CLEARANCE;
+    double bin = 2.0 * PI / NUM_HEADINGS;
+    int per = prims.header.prims_per_heading;
+    int gx, gy, sx, sy;
+
+    path.clear();
+
+    // Primitives assume the heading is on a bin, turn onto the nearest one
+    // first, checked at as many points as a primitive
+    double snap = floor(start.th / bin + 0.5) * bin - start.th;
+    pathSeg align = {TURNING_RADIUS * fabs(snap), snap < 0 ? -1.0 / TURNING_RADIUS : 1.0 / TURNING_RADIUS, 1};
+    if (align.length > 1.0) {
+        for (int s = 1; s <= PRIM_SAMPLES; s++) {
+            pose2d q = start;
+            advancePose(q, align, align.length * s / PRIM_SAMPLES);
+            if (!lotPointFree(map, q.x, q.y, radius))
+                return false;
+        }
+        advancePose(start, align, align.length);
+        start.th = floor(start.th / bin + 0.5) * bin;
+    }
+
+    if (prims.records.empty() || !lotCell(map, goal.x, goal.y, gx, gy) || !lotCell(map, start.x, start.y, sx, sy))
+        return false;
+    if (!lotPointFree(map, goal.x, goal.y, radius) || !lotPointFree(map, start.x, start.y, radius))
+        return false;
+
+    prepareCache(map, gy * map.width + gx, radius);
+    mapSearchCache &c = search_cache;
+    if (c.heuristic[sy * map.width + sx] >= 1e30f)
+        return false;
+
+    if (node_pool == NULL)
+        node_pool = new searchNode[MAX_SEARCH_NODES];
+    pool_used = 0;
+
+    int goal_heading = ((int)floor(goal.th / bin + 0.5) % NUM_HEADINGS + NUM_HEADINGS) % NUM_HEADINGS;
+    priority_queue<openEntry, vector<openEntry>, greater<openEntry> > open;
+    searchNode &root = node_pool[pool_used];
+    root.x = start.x;
+    root.y = start.y;
+    root.g = 0;
+    root.parent = -1;
+    root.heading = ((int)floor(start.th / bin + 0.5) % NUM_HEADINGS + NUM_HEADINGS) % NUM_HEADINGS;
+    root.prim = 0xFFFF;
+    open.push(openEntry(c.heuristic[sy * map.width + sx], pool_used++));
+
+    int found = -1;
+    bool full = false;
+    while (!open.empty() && !full) {
+        int idx = open.top().second;
+        open.pop();
+        searchNode n = node_pool[idx];
+
+        int cx, cy;
+        lotCell(map, n.x, n.y, cx, cy);
+        int key = (cy * map.width + cx) * NUM_HEADINGS + n.heading;
+        if (n.parent >= 0 && c.stamp[key] == c.generation && n.g > c.best_g[key])
+            continue; //a cheaper way here was found after this was queued
+
+        int dh = abs((int)n.heading - goal_heading);
+        if (dh > NUM_HEADINGS / 2)
+            dh = NUM_HEADINGS - dh;
+        if (hypot(n.x - goal.x, n.y - goal.y) < GOAL_TOL_XY && dh <= GOAL_TOL_BINS) {
+            found = idx;
+            break;
+        }
+
+        int last_dir = n.prim == 0xFFFF ? 0 : prims.records[n.prim].dir;
+        for (int p = n.heading * per; p < (n.heading + 1) * per; p++) {
+            const primRecord &r = prims.records[p];
+            bool free = true;
+            for (int s = 0; s < PRIM_SAMPLES && free; s++)
+                free = lotPointFree(map, n.x + r.sx[s] / 10.0, n.y + r.sy[s] / 10.0, radius);
+            if (!free)
+                continue;
+
+            float x = n.x + r.dx / 10.0f, y = n.y + r.dy / 10.0f;
+            int nx, ny;
+            lotCell(map, x, y, nx, ny);
+            int cell = ny * map.width + nx;
+            if (c.heuristic[cell] >= 1e30f)
+                continue;
+
+            float g = n.g + r.length * (r.dir < 0 ? REVERSE_COST : 1.0);
+            if (last_dir != 0 && last_dir != r.dir)
+                g += SWITCH_COST;
+            int nkey = cell * NUM_HEADINGS + r.end_heading;
+            if (c.stamp[nkey] == c.generation && g >= c.best_g[nkey])
+                continue;
+            if (pool_used >= MAX_SEARCH_NODES) {
+                full = true; //out of nodes, give up rather than go on expanding
+                break;
+            }
+
+            c.stamp[nkey] = c.generation;
+            c.best_g[nkey] = g;
+            searchNode &child = node_pool[pool_used];
+            child.x = x;
+            child.y = y;
+            child.g = g;
+            child.parent = idx;
+            child.heading = r.end_heading;
+            child.prim = p;
+            float h = fmax(c.heuristic[cell], hypot(x - goal.x, y - goal.y));
+            open.push(openEntry(g + h, pool_used++));
+        }
+    }
+    if (found < 0)
+        return false;
+
+    // Walk back to the start, merging repeats of the same primitive
+    if (align.length > 1.0)
+        path.push_back(align);
+    size_t first = path.size();
+    for (int i = found; node_pool[i].parent >= 0; i = node_pool[i].parent) {
+        const primRecord &r = prims.records[node_pool[i].prim];
+        pathSeg seg = {r.length, r.turn / TURNING_RADIUS, r.dir};
+        if (path.size() > first && path[first].dir == seg.dir && path[first].curvature == seg.curvature)
+            path[first].length += seg.length;
+        else
+            path.insert(path.begin() + first, seg);
+    }
+    return true;
+}
+
+// EOF
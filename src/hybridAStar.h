@@ -0,0 +1,69 @@
+/*
+* hybridAStar.h
+* - Hybrid-A* planner for lots where the closed form maneuvers in
+*   parkRobot() and parkPlan don't apply.
+*/
+#ifndef HYBRIDASTAR_H
+#define HYBRIDASTAR_H
+
+#include <vector>
+#include "autoPark.h"
+#include "lotMap.h"
+
+// Primitive table layout
+#define PRIM_MAGIC "APRM"
+#define PRIM_VERSION 1
+#define NUM_HEADINGS 72       //5 degree heading bins
+#define PRIM_PER_HEADING 6    //Forward and reverse, each left, straight and right
+#define PRIM_ARC_BINS 3       //Heading bins turned by one arc primitive
+#define PRIM_LINE_LEN 150.0   //Length of a straight primitive, mm
+#define PRIM_SAMPLES 6        //Collision check points stored per primitive
+#define PRIM_FILE "prims.bin"
+
+// Search limits
+#define MAX_SEARCH_NODES 200000 //Size of the node pool
+#define REVERSE_COST 1.5        //Cost multiplier for driving backwards
+#define SWITCH_COST 300.0       //Extra cost for changing direction, mm
+#define GOAL_TOL_XY 100.0       //mm
+#define GOAL_TOL_BINS 1         //heading bins
+
+/*
+* primHeader / primRecord
+* - On-disk primitive table, written by mkPrims. Offsets are in tenths
+*   of a mm in the map frame for a start at (0,0) facing the record's
+*   heading bin, so no trig is needed while searching.
+*/
+struct primHeader {
+    char magic[4];
+    unsigned short version;
+    unsigned short num_headings;
+    unsigned short prims_per_heading;
+    unsigned short samples;
+    float turning_radius;
+};
+
+struct primRecord {
+    short dx, dy;             //end point, 0.1 mm
+    unsigned char end_heading;
+    signed char dir;          //+1 forward, -1 reverse
+    signed char turn;         //+1 left, 0 straight, -1 right (driving forward)
+    unsigned char pad;
+    float length;             //mm
+    short sx[PRIM_SAMPLES];   //sample points, 0.1 mm
+    short sy[PRIM_SAMPLES];
+};
+
+struct primTable {
+    primHeader header;
+    std::vector<primRecord> records; //prims_per_heading records per heading bin
+};
+
+void generatePrimitives(primTable &table);
+bool writePrimitives(const char *file, const primTable &table);
+bool loadPrimitives(const char *file, primTable &table);
+bool planHybridAStar(const lotMap &map, const primTable &prims, pose2d start, pose2d goal,
+                     std::vector<pathSeg> &path);
+
+#endif
+
+// EOF
@@ -0,0 +1,316 @@
+/*
+* links.cpp
+* - Robot and laser start up and reconnect.
+*
+*   The SICK handshake at 38400 baud takes seconds, most of start up.
+*   With a cached laser configuration the laser thread does it while the
+*   main thread connects to the robot. Without one (first run, or the
+*   cache didn't work) the laser is set up from the robot's parameter file
+*   as before and the cache is written once it connects.
+*/
+#include "Aria.h"
+#include <cstdio>
+#include <cstring>
+#include "links.h"
+
+/*
+* loadLaserConfig / saveLaserConfig
+* - Read and write the cache, one "key value" per line.
+*/
+bool loadLaserConfig(const char *file, laserConfig &config) {
+    char line[128];
+    int fields = 0;
+    FILE *fp = fopen(file, "r");
+
+    if (fp == NULL)
+        return false;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        int value;
+        if (sscanf(line, "port %63s", config.port) == 1)
+            fields++;
+        else if (sscanf(line, "baud %d", &config.baud) == 1)
+            fields++;
+        else if (sscanf(line, "degrees %d", &config.degrees) == 1)
+            fields++;
+        else if (sscanf(line, "half %d", &value) == 1) {
+            config.half = value;
+            fields++;
+        }
+        else if (sscanf(line, "flipped %d", &value) == 1) {
+            config.flipped = value;
+            fields++;
+        }
+        else if (sscanf(line, "power %d", &value) == 1) {
+            config.power = value;
+            fields++;
+        }
+        else if (sscanf(line, "position %lf %lf %lf", &config.x, &config.y, &config.th) == 3)
+            fields++;
+    }
+    fclose(fp);
+    return fields == 7;
+}
+
+bool saveLaserConfig(const char *file, const laserConfig &config) {
+    FILE *fp = fopen(file, "w");
+    if (fp == NULL)
+        return false;
+    fprintf(fp, "port %s\n", config.port);
+    fprintf(fp, "baud %d\n", config.baud);
+    fprintf(fp, "degrees %d\n", config.degrees);
+    fprintf(fp, "half %d\n", config.half);
+    fprintf(fp, "flipped %d\n", config.flipped);
+    fprintf(fp, "power %d\n", config.power);
+    fprintf(fp, "position %f %f %f\n", config.x, config.y, config.th);
+    fclose(fp);
+    return true;
+}
+
+/*
+* DeviceLinks
+* - Constructor.
+*/
+DeviceLinks::DeviceLinks(ArRobot *robot, ArSick *sick) :
+    myRobot(robot), mySick(sick), myPortGiven(false),
+    myRobotUp(false), myLaserUp(false), myLaserFailed(false),
+    myRobotConnectedCB(this, &DeviceLinks::robotConnected),
+    myRobotLostCB(this, &DeviceLinks::robotLost),
+    myLaserConnectedCB(this, &DeviceLinks::laserConnected),
+    myLaserFailedCB(this, &DeviceLinks::laserFailed),
+    myLaserLostCB(this, &DeviceLinks::laserLost) {
+    memset(&myArgs, 0, sizeof(myArgs));
+}
+
+/*
+* peekArgs
+* - Read the laser options without taking them from the parser, the
+*   connector still needs them when there's no cache.
+*/
+void DeviceLinks::peekArgs(ArArgumentParser &parser) {
+    char **argv = parser.getArgv();
+
+    strcpy(myArgs.port, LINK_DEFAULT_LASER_PORT);
+    myArgs.baud = 38400;
+    myArgs.degrees = 180;
+    myArgs.half = true;
+    for (size_t i = 0; i + 1 < parser.getArgc(); i++) {
+        const char *value = argv[i+1];
+        if (strcmp(argv[i], "-lp") == 0 || strcmp(argv[i], "-laserPort") == 0) {
+            strncpy(myArgs.port, value, sizeof(myArgs.port) - 1);
+            myPortGiven = true;
+        }
+        else if (strcmp(argv[i], "-laserBaud") == 0)
+            myArgs.baud = atoi(value);
+        else if (strcmp(argv[i], "-ld") == 0 || strcmp(argv[i], "-laserDegrees") == 0)
+            myArgs.degrees = atoi(value);
+        else if (strcmp(argv[i], "-li") == 0 || strcmp(argv[i], "-laserIncrement") == 0)
+            myArgs.half = strcmp(value, "half") == 0;
+    }
+    return;
+}
+
+/*
+* startLaser
+* - Configure the laser from a cached configuration and start its
+*   handshake in the laser thread.
+*/
+void DeviceLinks::startLaser(const laserConfig &config) {
+    mySick->configure(false, config.power, config.flipped,
+                      config.baud == 9600 ? ArSick::BAUD9600 :
+                      config.baud == 19200 ? ArSick::BAUD19200 : ArSick::BAUD38400,
+                      config.degrees == 100 ? ArSick::DEGREES100 : ArSick::DEGREES180,
+                      config.half ? ArSick::INCREMENT_HALF : ArSick::INCREMENT_ONE);
+    mySick->setSensorPosition(config.x, config.y, config.th);
+    myLaserCon.setPort(config.port);
+    mySick->setDeviceConnection(&myLaserCon);
+    mySick->runAsync();
+    mySick->asyncConnect();
+    return;
+}
+
+/*
+* waitForLaser
+* - Wait for the handshake to finish. Returns false if it failed or took
+*   longer than LINK_CONNECT_TIMEOUT.
+*/
+bool DeviceLinks::waitForLaser() {
+    ArTime start;
+    start.setToNow();
+    while (start.mSecSince() < LINK_CONNECT_TIMEOUT) {
+        myMutex.lock();
+        bool up = myLaserUp, failed = myLaserFailed;
+        myMutex.unlock();
+        if (up)
+            return true;
+        if (failed)
+            return false;
+        ArUtil::sleep(20);
+    }
+    return false;
+}
+
+/*
+* connect
+* - Bring up both links. Returns false if either can't be reached.
+*/
+bool DeviceLinks::connect(ArArgumentParser &parser, ArSimpleConnector &connector) {
+    laserConfig cache;
+    ArTime start;
+
+    start.setToNow();
+    peekArgs(parser);
+    myRobot->addConnectCB(&myRobotConnectedCB);
+    myRobot->addDisconnectOnErrorCB(&myRobotLostCB);
+    mySick->addConnectCB(&myLaserConnectedCB);
+    mySick->addFailedConnectCB(&myLaserFailedCB);
+    mySick->addDisconnectOnErrorCB(&myLaserLostCB);
+
+    // Laser first when we can, it's the slow one. A cache made with other
+    // laser options is set aside and rebuilt below.
+    bool cached = loadLaserConfig(LINK_CACHE, cache) &&
+                  (!myPortGiven || strcmp(cache.port, myArgs.port) == 0);
+    if (cached && (cache.baud != myArgs.baud || cache.degrees != myArgs.degrees || cache.half != myArgs.half)) {
+        printf("Laser: %s is for %d baud, %d degrees, %s increment; setting up from the robot parameters\n",
+               LINK_CACHE, cache.baud, cache.degrees, cache.half ? "half" : "one");
+        cached = false;
+    }
+    if (cached) {
+        printf("Laser: connecting from %s while the robot connects\n", LINK_CACHE);
+        startLaser(cache);
+    }
+
+    if (!connector.connectRobot(myRobot)) {
+        printf("Robot: Could not connect...exiting\n");
+        return false;
+    }
+    printf("Robot: Connected (%ld ms)\n", (long)start.mSecSince());
+
+    // Keep the robot thread running through a dropped link so it can reconnect
+    myRobot->runAsync(false);
+
+    bool laser = cached && waitForLaser();
+    bool used_cache = laser;
+    if (!laser) {
+        if (cached) {
+            printf("Laser: cached settings failed, setting up from the robot parameters\n");
+            remove(LINK_CACHE);
+            myMutex.lock();
+            myLaserFailed = false;
+            myMutex.unlock();
+            mySick->setDeviceConnection(NULL);
+            myLaserCon.close();
+        }
+        connector.setupLaser(mySick);
+        if (!cached)
+            mySick->runAsync();
+        mySick->asyncConnect();
+        laser = waitForLaser();
+    }
+    if (!laser) {
+        printf("Laser: Could not connect...exiting\n");
+        return false;
+    }
+    printf("Laser: Connected (%ld ms)\n", (long)start.mSecSince());
+
+    // Remember what worked for next time
+    if (!used_cache) {
+        laserConfig now = myArgs;
+        now.flipped = mySick->isLaserFlipped();
+        now.power = mySick->isControllingPower();
+        now.x = mySick->getSensorPosX();
+        now.y = mySick->getSensorPosY();
+        now.th = mySick->getSensorPosTh();
+        saveLaserConfig(LINK_CACHE, now);
+    }
+
+    runAsync();
+    return true;
+}
+
+/*
+* ready
+* - Whether both links are up right now.
+*/
+bool DeviceLinks::ready() {
+    myMutex.lock();
+    bool up = myRobotUp && myLaserUp;
+    myMutex.unlock();
+    return up;
+}
+
+/*
+* Connection callbacks, from the robot and laser threads.
+*/
+void DeviceLinks::robotConnected() {
+    myMutex.lock();
+    myRobotUp = true;
+    myMutex.unlock();
+    myRobot->enableMotors(); //a reconnected robot comes back with them off
+    return;
+}
+
+void DeviceLinks::robotLost() {
+    myMutex.lock();
+    myRobotUp = false;
+    myMutex.unlock();
+    ArLog::log(ArLog::Normal, "Links: robot connection lost");
+    return;
+}
+
+void DeviceLinks::laserConnected() {
+    myMutex.lock();
+    myLaserUp = true;
+    myLaserFailed = false;
+    myMutex.unlock();
+    return;
+}
+
+void DeviceLinks::laserFailed() {
+    myMutex.lock();
+    myLaserFailed = true;
+    myMutex.unlock();
+    return;
+}
+
+void DeviceLinks::laserLost() {
+    myMutex.lock();
+    myLaserUp = false;
+    myMutex.unlock();
+    ArLog::log(ArLog::Normal, "Links: laser connection lost");
+    return;
+}
+
+/*
+* runThread
+* - Reconnect whichever link is down, every LINK_RETRY_PERIOD. Both
+*   connects are asynchronous, handled by the robot and laser threads.
+*/
+void *DeviceLinks::runThread(void *arg) {
+    myLaserRetry.setToNow();
+    myRobotRetry.setToNow();
+    while (getRunningWithLock()) {
+        myMutex.lock();
+        bool robot_up = myRobotUp, laser_up = myLaserUp;
+        myMutex.unlock();
+
+        if (!laser_up && !mySick->tryingToConnect() && myLaserRetry.mSecSince() > LINK_RETRY_PERIOD) {
+            ArDeviceConnection *con = mySick->getDeviceConnection();
+            ArLog::log(ArLog::Normal, "Links: reconnecting laser");
+            if (con != NULL && con->getStatus() != ArDeviceConnection::STATUS_OPEN)
+                con->openSimple();
+            mySick->asyncConnect();
+            myLaserRetry.setToNow();
+        }
+        if (!robot_up && myRobotRetry.mSecSince() > LINK_RETRY_PERIOD) {
+            ArLog::log(ArLog::Normal, "Links: reconnecting robot");
+            myRobot->lock();
+            myRobot->asyncConnect();
+            myRobot->unlock();
+            myRobotRetry.setToNow();
+        }
+        ArUtil::sleep(100);
+    }
+    return NULL;
+}
+
+// EOF
@@ -0,0 +1,75 @@
+/*
+* links.h
+* - Brings up the robot and laser links side by side and keeps them up.
+*/
+#ifndef LINKS_H
+#define LINKS_H
+
+#include "Aria.h"
+
+#define LINK_CACHE "laser.cache"           //Laser settings from the last good connect
+#define LINK_DEFAULT_LASER_PORT "/dev/ttyS2"
+#define LINK_CONNECT_TIMEOUT 30000         //ms to wait for the laser handshake
+#define LINK_RETRY_PERIOD 2000             //ms between reconnect attempts
+
+/*
+* laserConfig
+* - What the laser was set up with, so the next start doesn't have to wait
+*   for the robot's parameter file before talking to it.
+*/
+struct laserConfig {
+    char port[64];
+    int baud;        //9600, 19200 or 38400
+    int degrees;     //180 or 100
+    bool half;       //half degree increment
+    bool flipped;
+    bool power;      //robot switches laser power
+    double x, y, th; //sensor position on the robot, mm and degrees
+};
+
+bool loadLaserConfig(const char *file, laserConfig &config);
+bool saveLaserConfig(const char *file, const laserConfig &config);
+
+/*
+* DeviceLinks
+* - connect() starts the laser handshake from the cached settings (if
+*   there are any, for the same port, baud rate, degrees and increment)
+*   before connecting to the robot, so the slow SICK start up runs while
+*   the robot connects. Afterwards a thread reconnects whichever link
+*   drops, without restarting the program.
+*/
+class DeviceLinks : public ArASyncTask {
+public:
+    DeviceLinks(ArRobot *robot, ArSick *sick);
+    bool connect(ArArgumentParser &parser, ArSimpleConnector &connector);
+    bool ready();
+    virtual void *runThread(void *arg);
+
+protected:
+    void peekArgs(ArArgumentParser &parser);
+    void startLaser(const laserConfig &config);
+    bool waitForLaser();
+    void robotConnected();
+    void robotLost();
+    void laserConnected();
+    void laserFailed();
+    void laserLost();
+
+    ArRobot *myRobot;
+    ArSick *mySick;
+    ArSerialConnection myLaserCon;
+    laserConfig myArgs;     //from the command line
+    bool myPortGiven;
+    ArMutex myMutex;
+    bool myRobotUp, myLaserUp, myLaserFailed;
+    ArTime myLaserRetry, myRobotRetry;
+    ArFunctorC<DeviceLinks> myRobotConnectedCB;
+    ArFunctorC<DeviceLinks> myRobotLostCB;
+    ArFunctorC<DeviceLinks> myLaserConnectedCB;
+    ArFunctorC<DeviceLinks> myLaserFailedCB;
+    ArFunctorC<DeviceLinks> myLaserLostCB;
+};
+
+#endif
+
+// EOF
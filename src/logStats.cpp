@@ -0,0 +1,402 @@
+/*
+* logStats.cpp
+* - Offline analyzer for archived autoPark runs. Maps every log under the
+*   given directories, parses them on all cores, re-runs corner detection
+*   on the recorded readings and prints summary statistics as CSV.
+*
+*   usage: ./logStats [-j threads] [-o runs.csv] [-truth width,depth] <dir|file>...
+*
+*   Each scan block ("Reading N" lines) is checked against the corners
+*   logged after it. Depth and width are compared with the dimensions
+*   recomputed from the last scan, or with -truth if the real slot size
+*   is known.
+*/
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "corners.h"
+
+using namespace std;
+
+#define LOG_SUFFIX ".txt"
+#define MAX_LINE 256
+#define CORNER_TOL 0.5 //mm, logged vs redetected corner distance
+
+/*
+* scanBlock
+* - One takeReadings() worth of log: what the run found, what we find now.
+*/
+struct scanBlock {
+    reading logged[3];
+    reading found[3];
+    int num_found;
+};
+
+struct runStats {
+    string file;
+    bool ok;
+    int scans;
+    int logged_found;   //scans with a third corner in the log
+    int redetected;     //scans where detectCorners finds all three
+    int mismatched;     //scans where the two disagree
+    bool have_dims, have_redo;
+    double depth, width;           //logged
+    double depth_redo, width_redo; //from the last scan's redetected corners
+    double turn_time, profile_time; //ms, summed over the run
+    int profiles;
+    char slot_type[16];
+};
+
+/*
+* parseNumber
+* - Reads the plain decimals printf's %f writes, several times faster than
+*   strtod which dominates the run time otherwise. Anything else (exponents,
+*   nan, inf) goes to strtod.
+*/
+static double parseNumber(const char *p) {
+    const char *start = p;
+    double sign = 1, value = 0, scale = 1;
+
+    while (*p == ' ')
+        p++;
+    if (*p == '-') {
+        sign = -1;
+        p++;
+    }
+    if (*p < '0' || *p > '9')
+        return strtod(start, NULL);
+    while (*p >= '0' && *p <= '9')
+        value = value * 10 + (*p++ - '0');
+    if (*p == '.') {
+        long frac = 0;
+        p++;
+        while (*p >= '0' && *p <= '9') {
+            if (scale < 1e15) { //digits past that don't change a double
+                frac = frac * 10 + (*p - '0');
+                scale *= 10;
+            }
+            p++;
+        }
+        value += frac / scale;
+    }
+    if (*p == 'e' || *p == 'E')
+        return strtod(start, NULL);
+    return sign * value;
+}
+
+/*
+* lineNumber
+* - The number after a label, or NAN if the label isn't in the line.
+*/
+static double lineNumber(const char *line, const char *label) {
+    const char *p = strstr(line, label);
+    return p == NULL ? NAN : parseNumber(p + strlen(label));
+}
+
+/*
+* finishBlock
+* - Run corner detection on a completed scan block.
+*/
+static void finishBlock(vector<reading> &readings, vector<scanBlock> &blocks) {
+    scanBlock b;
+    if (readings.empty())
+        return;
+    memset(&b, 0, sizeof(b));
+    b.num_found = detectCorners(&readings[0], readings.size(), b.found[0], b.found[1], b.found[2]);
+    blocks.push_back(b);
+    readings.clear();
+}
+
+/*
+* parseLog
+* - Parse one mapped log.
+*/
+static void parseLog(const char *data, size_t size, runStats &run) {
+    vector<reading> readings;
+    vector<scanBlock> blocks;
+    const char *p = data, *end = data + size;
+    char line[MAX_LINE];
+
+    readings.reserve(400);
+    while (p < end) {
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        if (nl == NULL)
+            nl = end;
+        size_t len = nl - p < MAX_LINE - 1 ? nl - p : MAX_LINE - 1;
+        memcpy(line, p, len);
+        line[len] = '\0';
+        p = nl + 1;
+
+        if (strncmp(line, "Reading ", 8) == 0) {
+            reading r;
+            int k = atoi(line + 8);
+            if (k == 0)
+                finishBlock(readings, blocks);
+            r.distance = lineNumber(line, "Dist: ");
+            r.angle = lineNumber(line, "Angle: ");
+            readings.push_back(r);
+            continue;
+        }
+        finishBlock(readings, blocks);
+
+        int corner = strncmp(line, "First Corner:", 13) == 0 ? 0 :
+                     strncmp(line, "Second Corner:", 14) == 0 ? 1 :
+                     strncmp(line, "Third Corner:", 13) == 0 ? 2 : -1;
+        if (corner >= 0 && !blocks.empty()) {
+            blocks.back().logged[corner].distance = lineNumber(line, "Distance: ");
+            blocks.back().logged[corner].angle = lineNumber(line, "Angle: ");
+        }
+        else if (strncmp(line, "Depth: ", 7) == 0) {
+            run.depth = parseNumber(line + 7);
+            run.have_dims = true;
+        }
+        else if (strncmp(line, "Width: ", 7) == 0) {
+            run.width = parseNumber(line + 7);
+        }
+        else if (strncmp(line, "turn_time ", 10) == 0) {
+            run.turn_time += parseNumber(line + 10);
+        }
+        else if (strncmp(line, "profile_time ", 13) == 0) {
+            run.profile_time += parseNumber(line + 13);
+            run.profiles++;
+        }
+        else if (strncmp(line, "Slot type: ", 11) == 0) {
+            sscanf(line + 11, "%15s", run.slot_type);
+        }
+    }
+    finishBlock(readings, blocks);
+
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const scanBlock &b = blocks[i];
+        bool logged = b.logged[2].distance != 0;
+        bool found = b.num_found == 3;
+        run.scans++;
+        run.logged_found += logged;
+        run.redetected += found;
+        for (int c = 0; c < 3; c++) {
+            if (fabs(b.logged[c].distance - b.found[c].distance) > CORNER_TOL) {
+                run.mismatched++;
+                break;
+            }
+        }
+    }
+    if (!blocks.empty() && blocks.back().num_found == 3) {
+        const scanBlock &b = blocks.back();
+        slotDimensions(b.found[0], b.found[1], b.found[2], run.depth_redo, run.width_redo);
+        run.have_redo = true;
+    }
+    return;
+}
+
+/*
+* analyzeFile
+* - Map a log read-only and parse it.
+*/
+static void analyzeFile(runStats &run) {
+    struct stat st;
+    int fd = open(run.file.c_str(), O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    if (st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            parseLog((const char *)data, st.st_size, run);
+            munmap(data, st.st_size);
+            run.ok = true;
+        }
+    }
+    close(fd);
+    return;
+}
+
+/*
+* findLogs
+* - Collect log files under path, largest first so no thread is left with
+*   a big one at the end.
+*/
+static void findLogs(const string &path, vector<pair<off_t, string> > &logs) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return;
+    if (S_ISREG(st.st_mode)) {
+        logs.push_back(make_pair(st.st_size, path));
+        return;
+    }
+    DIR *dir = opendir(path.c_str());
+    if (dir == NULL)
+        return;
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        string name = e->d_name;
+        if (name == "." || name == "..")
+            continue;
+        string full = path + "/" + name;
+        if (stat(full.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            findLogs(full, logs);
+        else if (S_ISREG(st.st_mode) && name.size() >= strlen(LOG_SUFFIX) &&
+                 name.compare(name.size() - strlen(LOG_SUFFIX), strlen(LOG_SUFFIX), LOG_SUFFIX) == 0)
+            logs.push_back(make_pair(st.st_size, full));
+    }
+    closedir(dir);
+    return;
+}
+
+/*
+* printStat
+* - One summary row: count, mean, standard deviation and percentiles.
+*/
+static void printStat(const char *name, vector<double> v) {
+    if (v.empty()) {
+        printf("%s,0,,,,,,,\n", name);
+        return;
+    }
+    sort(v.begin(), v.end());
+    double sum = 0, sq = 0;
+    for (size_t i = 0; i < v.size(); i++)
+        sum += v[i];
+    double mean = sum / v.size();
+    for (size_t i = 0; i < v.size(); i++)
+        sq += (v[i] - mean) * (v[i] - mean);
+    printf("%s,%d,%f,%f,%f,%f,%f,%f,%f\n", name, (int)v.size(), mean, sqrt(sq / v.size()),
+           v.front(), v[v.size() / 10], v[v.size() / 2], v[v.size() * 9 / 10], v.back());
+    return;
+}
+
+int main(int argc, char **argv) {
+    int threads = thread::hardware_concurrency();
+    const char *runs_csv = NULL;
+    double truth_width = 0, truth_depth = 0;
+    bool have_truth = false;
+    vector<pair<off_t, string> > logs;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            runs_csv = argv[++i];
+        else if (strcmp(argv[i], "-truth") == 0 && i + 1 < argc)
+            have_truth = sscanf(argv[++i], "%lf,%lf", &truth_width, &truth_depth) == 2;
+        else
+            findLogs(argv[i], logs);
+    }
+    if (logs.empty()) {
+        printf("usage: %s [-j threads] [-o runs.csv] [-truth width,depth] <dir|file>...\n", argv[0]);
+        return 1;
+    }
+    if (threads < 1)
+        threads = 1;
+
+    sort(logs.rbegin(), logs.rend());
+    vector<runStats> runs(logs.size());
+    for (size_t i = 0; i < logs.size(); i++) {
+        runs[i].file = logs[i].second;
+        runs[i].ok = runs[i].have_dims = runs[i].have_redo = false;
+        runs[i].scans = runs[i].logged_found = runs[i].redetected = runs[i].mismatched = 0;
+        runs[i].depth = runs[i].width = runs[i].depth_redo = runs[i].width_redo = 0;
+        runs[i].turn_time = runs[i].profile_time = 0;
+        runs[i].profiles = 0;
+        strcpy(runs[i].slot_type, "-");
+    }
+
+    // Workers take the next file until none are left
+    atomic<size_t> next(0);
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(thread([&]() {
+            size_t i;
+            while ((i = next++) < runs.size())
+                analyzeFile(runs[i]);
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+
+    // Per-run rows
+    if (runs_csv != NULL) {
+        FILE *fp = fopen(runs_csv, "w");
+        if (fp == NULL) {
+            printf("Could not write %s\n", runs_csv);
+            return 1;
+        }
+        fprintf(fp, "file,scans,logged_found,redetected,mismatched,slot_type,depth,width,"
+                    "depth_redo,width_redo,turn_time,profile_time\n");
+        for (size_t i = 0; i < runs.size(); i++) {
+            const runStats &r = runs[i];
+            if (!r.ok)
+                continue;
+            fprintf(fp, "%s,%d,%d,%d,%d,%s,%f,%f,%f,%f,%f,%f\n", r.file.c_str(), r.scans,
+                    r.logged_found, r.redetected, r.mismatched, r.slot_type, r.depth, r.width,
+                    r.depth_redo, r.width_redo, r.turn_time, r.profile_time);
+        }
+        fclose(fp);
+    }
+
+    // Summary
+    int ok = 0, scans = 0, logged = 0, redetected = 0, mismatched = 0, parked = 0;
+    vector<double> depth, width, depth_err, width_err, turn, profile, scans_per_run;
+    for (size_t i = 0; i < runs.size(); i++) {
+        const runStats &r = runs[i];
+        if (!r.ok)
+            continue;
+        ok++;
+        scans += r.scans;
+        logged += r.logged_found;
+        redetected += r.redetected;
+        mismatched += r.mismatched;
+        scans_per_run.push_back(r.scans);
+        if (r.have_dims) {
+            depth.push_back(r.depth);
+            width.push_back(r.width);
+            if (have_truth) {
+                depth_err.push_back(r.depth - truth_depth);
+                width_err.push_back(r.width - truth_width);
+            }
+            else if (r.have_redo) {
+                depth_err.push_back(r.depth - r.depth_redo);
+                width_err.push_back(r.width - r.width_redo);
+            }
+        }
+        if (r.turn_time > 0)
+            turn.push_back(r.turn_time);
+        if (r.profiles > 0) {
+            profile.push_back(r.profile_time);
+            parked++;
+        }
+    }
+
+    printf("runs,%d\n", ok);
+    printf("scans,%d\n", scans);
+    printf("detection_rate_logged,%f\n", scans ? (double)logged / scans : 0.0);
+    printf("detection_rate_redetected,%f\n", scans ? (double)redetected / scans : 0.0);
+    printf("corner_mismatch_rate,%f\n", scans ? (double)mismatched / scans : 0.0);
+    printf("runs_with_maneuver,%d\n", parked);
+    printf("\nmetric,count,mean,stddev,min,p10,p50,p90,max\n");
+    printStat("scans_per_run", scans_per_run);
+    printStat("depth", depth);
+    printStat("width", width);
+    printStat(have_truth ? "depth_error_truth" : "depth_error_redo", depth_err);
+    printStat(have_truth ? "width_error_truth" : "width_error_redo", width_err);
+    printStat("turn_time", turn);
+    printStat("profile_time", profile);
+    return 0;
+}
+
+// EOF
@@ -0,0 +1,137 @@
+/*
+* lotMap.cpp
+* - ARIA 2D-Map reader and clearance grid.
+*/
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "lotMap.h"
+
+using namespace std;
+
+/*
+* loadLotMap
+* - Read the LINES section (and RobotHome) of a .map file, then build the
+*   clearance grid. Returns false if the file can't be read.
+*/
+bool loadLotMap(const char *file, lotMap &map) {
+    char line[512];
+    bool in_lines = false;
+    FILE *fp = fopen(file, "r");
+
+    if (fp == NULL)
+        return false;
+
+    map.lines.clear();
+    map.home.x = map.home.y = map.home.th = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lotLine l;
+        double th;
+        if (strncmp(line, "LINES", 5) == 0) {
+            in_lines = true;
+        }
+        else if (strncmp(line, "DATA", 4) == 0) {
+            in_lines = false;
+        }
+        else if (in_lines && sscanf(line, "%lf %lf %lf %lf", &l.x1, &l.y1, &l.x2, &l.y2) == 4) {
+            map.lines.push_back(l);
+        }
+        else if (sscanf(line, "Cairn: RobotHome %lf %lf %lf", &map.home.x, &map.home.y, &th) == 3) {
+            map.home.th = th * PI / 180.0;
+        }
+    }
+    fclose(fp);
+
+    rasterizeLotMap(map, MAP_CELL);
+    return true;
+}
+
+/*
+* rasterizeLotMap
+* - Mark the cells every line passes through, then fill in the distance to
+*   the nearest marked cell with a two pass chamfer transform.
+*/
+void rasterizeLotMap(lotMap &map, double cell) {
+    double max_x = -1e9, max_y = -1e9;
+    const float far = 1e9;
+
+    map.min_x = map.min_y = 1e9;
+    for (size_t i = 0; i < map.lines.size(); i++) {
+        const lotLine &l = map.lines[i];
+        map.min_x = fmin(map.min_x, fmin(l.x1, l.x2));
+        map.min_y = fmin(map.min_y, fmin(l.y1, l.y2));
+        max_x = fmax(max_x, fmax(l.x1, l.x2));
+        max_y = fmax(max_y, fmax(l.y1, l.y2));
+    }
+    if (map.lines.empty()) {
+        map.min_x = map.min_y = max_x = max_y = 0;
+    }
+
+    // One cell of padding around the lines
+    map.cell = cell;
+    map.min_x -= cell;
+    map.min_y -= cell;
+    map.width = (int)ceil((max_x - map.min_x) / cell) + 2;
+    map.height = (int)ceil((max_y - map.min_y) / cell) + 2;
+    map.clearance.assign(map.width * map.height, far);
+
+    for (size_t i = 0; i < map.lines.size(); i++) {
+        const lotLine &l = map.lines[i];
+        double len = sqrt(pow(l.x2 - l.x1, 2.0) + pow(l.y2 - l.y1, 2.0));
+        int steps = (int)ceil(len / (cell / 2.0)) + 1;
+        for (int s = 0; s <= steps; s++) {
+            int cx, cy;
+            if (lotCell(map, l.x1 + (l.x2 - l.x1) * s / steps, l.y1 + (l.y2 - l.y1) * s / steps, cx, cy))
+                map.clearance[cy * map.width + cx] = 0;
+        }
+    }
+
+    // Chamfer distance, 1 and sqrt(2) steps
+    float d1 = cell, d2 = cell * sqrt(2.0);
+    int w = map.width, h = map.height;
+    vector<float> &c = map.clearance;
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            float &v = c[y * w + x];
+            if (x > 0) v = fmin(v, c[y * w + x - 1] + d1);
+            if (y > 0) v = fmin(v, c[(y - 1) * w + x] + d1);
+            if (x > 0 && y > 0) v = fmin(v, c[(y - 1) * w + x - 1] + d2);
+            if (x < w - 1 && y > 0) v = fmin(v, c[(y - 1) * w + x + 1] + d2);
+        }
+    }
+    for (int y = h - 1; y >= 0; y--) {
+        for (int x = w - 1; x >= 0; x--) {
+            float &v = c[y * w + x];
+            if (x < w - 1) v = fmin(v, c[y * w + x + 1] + d1);
+            if (y < h - 1) v = fmin(v, c[(y + 1) * w + x] + d1);
+            if (x < w - 1 && y < h - 1) v = fmin(v, c[(y + 1) * w + x + 1] + d2);
+            if (x > 0 && y < h - 1) v = fmin(v, c[(y + 1) * w + x - 1] + d2);
+        }
+    }
+    return;
+}
+
+/*
+* lotCell
+* - Grid cell holding a point, false if it's off the grid.
+*/
+bool lotCell(const lotMap &map, double x, double y, int &cx, int &cy) {
+    cx = (int)floor((x - map.min_x) / map.cell);
+    cy = (int)floor((y - map.min_y) / map.cell);
+    return cx >= 0 && cy >= 0 && cx < map.width && cy < map.height;
+}
+
+/*
+* lotPointFree
+* - True if a disc of radius centered on (x, y) clears every line. A cell
+*   of slack is kept for the grid resolution.
+*/
+bool lotPointFree(const lotMap &map, double x, double y, double radius) {
+    int cx, cy;
+    if (!lotCell(map, x, y, cx, cy))
+        return false;
+    return map.clearance[cy * map.width + cx] >= radius + map.cell;
+}
+
+// EOF
@@ -0,0 +1,38 @@
+/*
+* lotMap.h
+* - Loads the LINES of an ARIA .map file and rasterizes them into a grid
+*   of clearances for planning.
+*/
+#ifndef LOTMAP_H
+#define LOTMAP_H
+
+#include <vector>
+#include "autoPark.h"
+
+#define MAP_CELL 50.0 //Grid cell size, mm
+
+struct lotLine {
+    double x1, y1, x2, y2;
+};
+
+/*
+* lotMap
+* - Map lines plus a grid holding each cell's distance to the nearest line.
+*/
+struct lotMap {
+    std::vector<lotLine> lines;
+    pose2d home;        //RobotHome cairn, if the map has one
+    double min_x, min_y;
+    double cell;
+    int width, height;
+    std::vector<float> clearance; //mm, row major from (min_x, min_y)
+};
+
+bool loadLotMap(const char *file, lotMap &map);
+void rasterizeLotMap(lotMap &map, double cell);
+bool lotCell(const lotMap &map, double x, double y, int &cx, int &cy);
+bool lotPointFree(const lotMap &map, double x, double y, double radius);
+
+#endif
+
+// EOF
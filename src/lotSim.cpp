@@ -0,0 +1,420 @@
+/*
+* lotSim.cpp
+* - Multi-robot lot simulation.
+*
+*   A robot does what autoPark's main() does: scan up to MAX_SCANS times,
+*   park if a slot turns up, otherwise drive on MOVE_DISTANCE and scan
+*   again. Sweeps are cast against the map lines and the other robots
+*   (parked ones included, so a taken slot looks taken). Moving robots
+*   stand in for the safety layer by holding still while their next
+*   SIM_LOOKAHEAD of motion would close in on another robot or run into
+*   a line. Held up for SIM_BLOCKED, a robot moving along the lane scans
+*   again from where it is, and one parking gives up, as autoPark does,
+*   and is taken out of the lot. That is where two robots going for the
+*   same slot shows.
+*/
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include "lotSim.h"
+
+using namespace std;
+
+/*
+* parallelFor
+* - Run fn(i) for i in [0, n) over threads.
+*/
+template <class F>
+static void parallelFor(int n, int threads, F fn) {
+    atomic<int> next(0);
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(thread([&]() {
+            for (int i = next++; i < n; i = next++)
+                fn(i);
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+    return;
+}
+
+/*
+* mix
+* - splitmix64, for laser noise keyed on what it's for.
+*/
+static unsigned long long mix(unsigned long long z) {
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+* advance / drive
+* - Move a pose for dt at linear velocity v and turn rate w, exactly on
+*   the arc; and along a profile from time from to time to.
+*/
+static void advance(pose2d &p, double v, double w, double dt) {
+    if (fabs(w) < 1e-9) {
+        p.x += v * dt * cos(p.th);
+        p.y += v * dt * sin(p.th);
+        return;
+    }
+    double th = p.th + w * dt;
+    p.x += v / w * (sin(th) - sin(p.th));
+    p.y -= v / w * (cos(th) - cos(p.th));
+    p.th = th;
+    return;
+}
+
+static void drive(pose2d &p, const vector<setpoint> &table, double from, double to) {
+    size_t i = 0;
+    for (double t = from; t < to - 1e-9; ) {
+        while (i + 1 < table.size() && table[i+1].t <= t)
+            i++;
+        double until = i + 1 < table.size() ? fmin(to, table[i+1].t) : to;
+        advance(p, table[i].vel, table[i].omega, until - t);
+        t = until;
+    }
+    return;
+}
+
+/*
+* rayLine / rayCircle
+* - Distance along a unit ray from (ox, oy) to a line or circle, or -1.
+*/
+static double rayLine(double ox, double oy, double dx, double dy, const lotLine &l) {
+    double ex = l.x2 - l.x1, ey = l.y2 - l.y1;
+    double den = dx * ey - dy * ex;
+    if (fabs(den) < 1e-12)
+        return -1;
+    double wx = l.x1 - ox, wy = l.y1 - oy;
+    double t = (wx * ey - wy * ex) / den;
+    double u = (wx * dy - wy * dx) / den;
+    return t > 0 && u >= 0 && u <= 1 ? t : -1;
+}
+
+static double rayCircle(double ox, double oy, double dx, double dy, double cx, double cy, double r) {
+    double wx = cx - ox, wy = cy - oy;
+    double along = wx * dx + wy * dy;
+    double d2 = wx * wx + wy * wy - along * along;
+    if (along <= 0 || d2 > r * r)
+        return -1;
+    return along - sqrt(r * r - d2);
+}
+
+/*
+* LotSim
+* - Constructor. Every robot starts waiting for its arrival time.
+*/
+LotSim::LotSim(const lotMap &map, const simConfig &config) : myMap(map), myConfig(config), myTime(0), myStep(0) {
+    myRobots.resize(config.robots);
+    for (int i = 0; i < config.robots; i++) {
+        simRobot &r = myRobots[i];
+        r.id = i;
+        r.state = SIM_WAITING;
+        r.pose = map.home;
+        r.tau = r.timer = r.blocked = 0;
+        r.scans_here = 0;
+        r.maneuver = AGENT_NONE;
+        r.arrive = i * config.arrival;
+        r.enter = r.parked = r.gone = -1;
+        r.scans = r.moves = r.plans = r.abandoned = 0;
+        r.waited = 0;
+        r.contacts = 0;
+    }
+    myPoses.assign(config.robots, map.home);
+    myStates.assign(config.robots, SIM_WAITING);
+    if (myConfig.threads < 1)
+        myConfig.threads = 1;
+}
+
+bool LotSim::present(int j) const {
+    return myStates[j] != SIM_WAITING && myStates[j] != SIM_LEFT && myStates[j] != SIM_FAILED;
+}
+
+/*
+* done
+* - Every robot has gone, or time is up.
+*/
+bool LotSim::done() const {
+    if (myConfig.time_limit > 0 && myTime >= myConfig.time_limit)
+        return true;
+    for (size_t i = 0; i < myRobots.size(); i++) {
+        if (myRobots[i].state != SIM_LEFT && myRobots[i].state != SIM_FAILED)
+            return false;
+    }
+    return true;
+}
+
+/*
+* simulateSweep
+* - What robot i's laser sees from where it was at the start of the step.
+*/
+void LotSim::simulateSweep(int i, laserSweep &sweep) const {
+    const pose2d &p = myPoses[i];
+    double ox = p.x + SIM_LASER_X * cos(p.th), oy = p.y + SIM_LASER_X * sin(p.th);
+
+    sweep.number = myStep + 1;
+    sweep.time = myTime;
+    sweep.pose = p;
+    sweep.start_angle = -90;
+    sweep.increment = 0.5;
+    sweep.count = SWEEP_MAX_BEAMS;
+    for (int b = 0; b < SWEEP_MAX_BEAMS; b++) {
+        double a = p.th + (sweep.start_angle + b * sweep.increment) * PI / 180.0;
+        double dx = cos(a), dy = sin(a);
+        double best = SIM_MAX_RANGE;
+        for (size_t l = 0; l < myMap.lines.size(); l++) {
+            double t = rayLine(ox, oy, dx, dy, myMap.lines[l]);
+            if (t > 0 && t < best)
+                best = t;
+        }
+        for (size_t j = 0; j < myRobots.size(); j++) {
+            if ((int)j == i || !present(j))
+                continue;
+            double t = rayCircle(ox, oy, dx, dy, myPoses[j].x, myPoses[j].y, ROBOT_RADIUS);
+            if (t > 0 && t < best)
+                best = t;
+        }
+        if (best >= SIM_MAX_RANGE) {
+            sweep.ranges[b] = 0; //no return, the laser flags it
+            continue;
+        }
+        unsigned long long key = myConfig.seed ^ ((unsigned long long)i << 40) ^ ((unsigned long long)myStep << 10) ^ b;
+        double noise = ((mix(key) >> 11) * (1.0 / 9007199254740992.0) * 2 - 1) * SIM_NOISE;
+        sweep.ranges[b] = (unsigned short)fmax(1.0, floor(best + noise + 0.5));
+    }
+    return;
+}
+
+/*
+* heldUp
+* - Whether robot i going on to pose ahead would close in on another,
+*   or hit a line it isn't touching yet.
+*/
+bool LotSim::heldUp(int i, const pose2d &ahead) const {
+    const pose2d &p = myPoses[i];
+    double touch = ROBOT_RADIUS - myMap.cell;
+
+    if (!lotPointFree(myMap, ahead.x, ahead.y, touch) && lotPointFree(myMap, p.x, p.y, touch))
+        return true;
+    for (size_t j = 0; j < myRobots.size(); j++) {
+        if ((int)j == i || !present(j))
+            continue;
+        double now = hypot(myPoses[j].x - p.x, myPoses[j].y - p.y);
+        double then = hypot(myPoses[j].x - ahead.x, myPoses[j].y - ahead.y);
+        if (then < 2 * ROBOT_RADIUS + SIM_GAP && then < now)
+            return true;
+    }
+    return false;
+}
+
+/*
+* startProfile
+* - Start following a path from where the robot is.
+*/
+void LotSim::startProfile(simRobot &r, const vector<pathSeg> &path, int state) {
+    buildProfile(path, r.table);
+    r.tau = 0;
+    r.blocked = 0;
+    r.state = state;
+    return;
+}
+
+/*
+* scan
+* - Take a scan and decide: park, scan again, move on or give up.
+*/
+void LotSim::scan(int i) {
+    simRobot &r = myRobots[i];
+    laserSweep sweep;
+
+    simulateSweep(i, sweep);
+    r.agent.readSweep(sweep, SIM_LASER_X, 0);
+    r.agent.findCorners();
+    r.scans++;
+    r.scans_here++;
+    if (r.agent.found()) {
+        vector<pathSeg> path;
+        r.agent.getDimensions();
+        r.agent.classifySlot();
+        r.maneuver = r.agent.planPark(path, NULL);
+        r.plans++;
+        if (r.maneuver != AGENT_NONE) {
+            startProfile(r, path, SIM_PARKING);
+            return;
+        }
+    }
+    if (r.scans_here < MAX_SCANS) {
+        r.timer = SIM_SCAN_TIME;
+        return;
+    }
+
+    // Nothing here, on along the lane if there's room
+    pose2d next = r.pose;
+    advance(next, MOVE_DISTANCE, 0, 1.0);
+    if (r.moves >= myConfig.max_moves || !lotPointFree(myMap, next.x, next.y, ROBOT_RADIUS)) {
+        r.state = SIM_FAILED;
+        r.gone = myTime;
+        return;
+    }
+    vector<pathSeg> path;
+    pathSeg line = {MOVE_DISTANCE, 0.0, 1};
+    path.push_back(line);
+    r.moves++;
+    startProfile(r, path, SIM_SEARCHING);
+    return;
+}
+
+/*
+* follow
+* - One step along the profile, unless held up.
+*/
+void LotSim::follow(int i) {
+    simRobot &r = myRobots[i];
+    double end = r.table.back().t;
+    double to = fmin(r.tau + SIM_DT, end);
+    pose2d ahead = r.pose;
+
+    drive(ahead, r.table, r.tau, fmin(r.tau + SIM_LOOKAHEAD, end));
+    if (heldUp(i, ahead)) {
+        r.blocked += SIM_DT;
+        r.waited += SIM_DT;
+        if (r.blocked < SIM_BLOCKED)
+            return;
+        r.table.clear();
+        if (r.state == SIM_PARKING) {
+            r.abandoned++;
+            r.state = SIM_FAILED;
+            r.gone = myTime + SIM_DT;
+            return;
+        }
+        r.state = SIM_SCANNING;
+        r.timer = SIM_SCAN_TIME;
+        r.scans_here = 0;
+        return;
+    }
+
+    r.blocked = 0;
+    drive(r.pose, r.table, r.tau, to);
+    r.tau = to;
+    if (!lotPointFree(myMap, r.pose.x, r.pose.y, ROBOT_RADIUS - myMap.cell))
+        r.contacts++;
+    if (r.tau < end)
+        return;
+
+    r.table.clear();
+    if (r.state == SIM_PARKING) {
+        r.state = SIM_PARKED;
+        r.parked = myTime + SIM_DT;
+        r.timer = myConfig.dwell;
+    }
+    else {
+        r.state = SIM_SCANNING;
+        r.timer = SIM_SCAN_TIME;
+        r.scans_here = 0;
+    }
+    return;
+}
+
+/*
+* stepRobot
+* - Everything robot i does in a step. Reads the snapshot, writes only
+*   robot i.
+*/
+void LotSim::stepRobot(int i) {
+    simRobot &r = myRobots[i];
+
+    switch (r.state) {
+    case SIM_SCANNING:
+        r.timer -= SIM_DT;
+        if (r.timer <= 1e-9)
+            scan(i);
+        break;
+    case SIM_SEARCHING:
+    case SIM_PARKING:
+        follow(i);
+        break;
+    case SIM_PARKED:
+        r.timer -= SIM_DT;
+        if (r.timer <= 1e-9) {
+            r.state = SIM_LEFT;
+            r.gone = myTime + SIM_DT;
+        }
+        break;
+    }
+    return;
+}
+
+/*
+* step
+* - Advance the lot SIM_DT.
+*/
+void LotSim::step() {
+    // Sweeps are the work, threads only pay when several robots scan
+    int scanning = 0;
+    for (size_t i = 0; i < myRobots.size(); i++) {
+        if (myRobots[i].state == SIM_SCANNING && myRobots[i].timer <= SIM_DT + 1e-9)
+            scanning++;
+    }
+    if (scanning > 1 && myConfig.threads > 1)
+        parallelFor(myRobots.size(), myConfig.threads, [&](int i) {
+            stepRobot(i);
+        });
+    else {
+        for (size_t i = 0; i < myRobots.size(); i++)
+            stepRobot(i);
+    }
+    myTime = (myStep + 1) * SIM_DT;
+    myStep++;
+
+    for (size_t i = 0; i < myRobots.size(); i++) {
+        myPoses[i] = myRobots[i].pose;
+        myStates[i] = myRobots[i].state;
+    }
+
+    // Arrivals come in at RobotHome once it's clear, in order
+    for (size_t i = 0; i < myRobots.size(); i++) {
+        simRobot &r = myRobots[i];
+        if (r.state != SIM_WAITING)
+            continue;
+        if (r.arrive > myTime)
+            break;
+        bool clear = true;
+        for (size_t j = 0; j < myRobots.size() && clear; j++) {
+            if (present(j) && hypot(myPoses[j].x - myMap.home.x, myPoses[j].y - myMap.home.y) <
+                              2 * ROBOT_RADIUS + MOVE_DISTANCE)
+                clear = false;
+        }
+        if (!clear)
+            break;
+        r.state = SIM_SCANNING;
+        r.enter = myTime;
+        r.timer = SIM_SCAN_TIME;
+        r.pose = myMap.home;
+        myPoses[i] = r.pose;
+        myStates[i] = r.state;
+    }
+    return;
+}
+
+/*
+* checksum
+* - Hash of every robot's state and pose, to compare runs.
+*/
+unsigned long long LotSim::checksum() const {
+    unsigned long long h = 0;
+    for (size_t i = 0; i < myRobots.size(); i++) {
+        const simRobot &r = myRobots[i];
+        h = mix(h ^ r.state);
+        h = mix(h ^ (unsigned long long)llround(r.pose.x * 100));
+        h = mix(h ^ (unsigned long long)llround(r.pose.y * 100));
+        h = mix(h ^ (unsigned long long)llround(r.pose.th * 1e6));
+        h = mix(h ^ (unsigned long long)r.scans ^ ((unsigned long long)r.abandoned << 32));
+    }
+    return h;
+}
+
+// EOF
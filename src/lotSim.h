@@ -0,0 +1,112 @@
+/*
+* lotSim.h
+* - Simulates several robots parking in one lot: each runs its own
+*   ParkAgent on simulated sweeps of the map lines and the other robots,
+*   searching, parking, staying a while and leaving.
+*/
+#ifndef LOTSIM_H
+#define LOTSIM_H
+
+#include <vector>
+#include "autoPark.h"
+#include "lotMap.h"
+#include "parkAgent.h"
+#include "velProfile.h"
+
+#define SIM_DT 0.1               //Step, s
+#define SIM_MAX_RANGE 8000.0     //Laser range, mm
+#define SIM_NOISE 10.0           //Range noise, +/- mm
+#define SIM_LASER_X 160.0        //Laser ahead of the robot centre, mm
+#define SIM_SCAN_TIME 0.6        //Stopped this long for a scan, like takeReadings(), s
+#define SIM_ARRIVAL 20.0         //Default time between arrivals, s
+#define SIM_DWELL 600.0          //Default time parked before leaving, s
+#define SIM_MAX_MOVES 40         //Default moves along the lane before giving up
+#define SIM_GAP 50.0             //Robots stop short of each other by this, mm
+#define SIM_LOOKAHEAD 0.5        //s ahead a moving robot checks for the others
+#define SIM_BLOCKED 5.0          //Blocked this long, a maneuver is given up, s
+
+// Robot states
+#define SIM_WAITING 0            //not in the lot yet
+#define SIM_SCANNING 1
+#define SIM_SEARCHING 2          //moving on along the lane
+#define SIM_PARKING 3
+#define SIM_PARKED 4
+#define SIM_LEFT 5               //parked and gone
+#define SIM_FAILED 6             //gave up and gone
+
+/*
+* simConfig
+* - What to run. Robot i arrives at i * arrival s.
+*/
+struct simConfig {
+    int robots;
+    double arrival;
+    double dwell;
+    int max_moves;
+    double time_limit;           //s, 0 for until every robot has gone
+    unsigned long long seed;
+    int threads;
+};
+
+/*
+* simRobot
+* - One robot, map frame. table is the profile it's following, from
+*   wherever it was when it was planned.
+*/
+struct simRobot {
+    int id;
+    int state;
+    pose2d pose;
+    std::vector<setpoint> table;
+    double tau;                  //profile time, s
+    double timer;                //s left scanning or parked
+    double blocked;              //s the current maneuver has been held up
+    int scans_here;
+    int maneuver;                //AGENT_* of the last plan
+
+    // What happened, for the results
+    double arrive, enter, parked, gone;
+    int scans, moves, plans, abandoned;
+    double waited;               //s held up by other robots
+    long contacts;               //steps spent touching a line
+    ParkAgent agent;
+};
+
+/*
+* LotSim
+* - Steps every robot in parallel. A step has each robot act on a
+*   snapshot of where the others were at the start of it, writing only
+*   its own state, then spawns arrivals and takes the next snapshot, in
+*   robot order. Laser noise is keyed on seed, robot, step and beam, so
+*   results don't depend on the thread count.
+*/
+class LotSim {
+public:
+    LotSim(const lotMap &map, const simConfig &config);
+    void step();
+    bool done() const;
+    double time() const { return myTime; }
+    const std::vector<simRobot> &robots() const { return myRobots; }
+    unsigned long long checksum() const;
+    void simulateSweep(int i, laserSweep &sweep) const;
+
+protected:
+    void stepRobot(int i);
+    void scan(int i);
+    void startProfile(simRobot &r, const std::vector<pathSeg> &path, int state);
+    void follow(int i);
+    bool heldUp(int i, const pose2d &ahead) const;
+    bool present(int j) const;
+
+    const lotMap &myMap;
+    simConfig myConfig;
+    std::vector<simRobot> myRobots;
+    std::vector<pose2d> myPoses;     //snapshot at the start of the step
+    std::vector<int> myStates;
+    double myTime;
+    long myStep;
+};
+
+#endif
+
+// EOF
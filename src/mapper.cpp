@@ -0,0 +1,922 @@
+/*
+* mapper.cpp
+* - Offline mapper.
+*
+*   Scans far enough apart to be worth keeping are matched to the one
+*   before (ICP from scanMatch, started from odometry), chained, and then
+*   matched against every earlier scan that the chain puts close by to
+*   close loops. The pose graph is solved by Gauss-Newton with conjugate
+*   gradients over the edges, so nothing bigger than a 3x3 block is ever
+*   stored. Loop edges are down weighted past MAPPER_HUBER sigma and the
+*   ones that still disagree are dropped, and with the better poses the
+*   loop search runs again. Each stage is split over threads by scan.
+*
+*   The occupancy grid only decides which points are structure; lines
+*   come from split and merge on each scan's occupied points, merged
+*   across scans, so a wall is one line however many times it was seen.
+*/
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include "mapper.h"
+#include "scanMatch.h"
+
+using namespace std;
+
+/*
+* compose / inverse / wrap
+* - Pose algebra, as in poseHistory.cpp which needs ARIA.
+*/
+static pose2d compose(const pose2d &a, const pose2d &b) {
+    pose2d p;
+    p.x = a.x + b.x * cos(a.th) - b.y * sin(a.th);
+    p.y = a.y + b.x * sin(a.th) + b.y * cos(a.th);
+    p.th = a.th + b.th;
+    return p;
+}
+
+static pose2d inverse(const pose2d &a) {
+    pose2d p;
+    p.x = -a.x * cos(a.th) - a.y * sin(a.th);
+    p.y = a.x * sin(a.th) - a.y * cos(a.th);
+    p.th = -a.th;
+    return p;
+}
+
+static double wrap(double a) {
+    return atan2(sin(a), cos(a));
+}
+
+/*
+* parallelFor
+* - Run fn(i) for i in [0, n) over threads.
+*/
+template <class F>
+static void parallelFor(int n, int threads, F fn) {
+    atomic<int> next(0);
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(thread([&]() {
+            for (int i = next++; i < n; i = next++)
+                fn(i);
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+    return;
+}
+
+/*
+* readSickLog
+* - Append the scans of a .2d log written by ArSickLogger. The laser's
+*   place on the robot comes from "sick1pose: x y th", each scan from
+*   "robot: x y th" (odometry, degrees) followed by "sick1:" or "scan1:"
+*   and x y pairs relative to the laser (0 0 for an ignored reading).
+*   Returns false if the file can't be read.
+*/
+bool readSickLog(const char *file, std::vector<mapScan> &scans) {
+    FILE *fp = fopen(file, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    pose2d sensor = {0, 0, 0};
+    mapScan scan;
+    bool have_pose = false;
+
+    if (fp == NULL)
+        return false;
+    scan.time = 0;
+    while (getline(&line, &cap, fp) > 0) {
+        double x, y, th;
+        if (sscanf(line, "sick1pose: %lf %lf %lf", &x, &y, &th) == 3) {
+            sensor.x = x;
+            sensor.y = y;
+            sensor.th = th * PI / 180.0;
+        }
+        else if (sscanf(line, "time: %lf", &x) == 1) {
+            scan.time = x;
+        }
+        else if (sscanf(line, "robot: %lf %lf %lf", &x, &y, &th) == 3) {
+            scan.odom.x = x;
+            scan.odom.y = y;
+            scan.odom.th = th * PI / 180.0;
+            have_pose = true;
+        }
+        else if (have_pose && (strncmp(line, "sick1:", 6) == 0 || strncmp(line, "scan1:", 6) == 0)) {
+            double c = cos(sensor.th), s = sin(sensor.th);
+            char *p = line + 6, *end;
+            scan.sensor = sensor;
+            scan.xs.clear();
+            scan.ys.clear();
+            for (;;) {
+                x = strtod(p, &end);
+                if (end == p)
+                    break;
+                p = end;
+                y = strtod(p, &end);
+                if (end == p)
+                    break;
+                p = end;
+                if ((x == 0 && y == 0) || hypot(x, y) >= MAPPER_MAX_RANGE)
+                    continue;
+                scan.xs.push_back(sensor.x + c * x - s * y);
+                scan.ys.push_back(sensor.y + s * x + c * y);
+            }
+
+            // Thin out the near points, they'd dominate matching
+            scan.mx.clear();
+            scan.my.clear();
+            for (size_t i = 0; i < scan.xs.size(); i++) {
+                if (scan.mx.empty() || hypot(scan.xs[i] - scan.mx.back(), scan.ys[i] - scan.my.back()) >= MAPPER_ICP_SPACING) {
+                    scan.mx.push_back(scan.xs[i]);
+                    scan.my.push_back(scan.ys[i]);
+                }
+            }
+            scans.push_back(scan);
+            have_pose = false;
+        }
+    }
+    free(line);
+    fclose(fp);
+    return true;
+}
+
+/*
+* keyScans
+* - Drop scans taken before the robot moved far enough from the last one
+*   kept. ArSickLogger already logs by distance, this covers logs taken
+*   at a fixed rate.
+*/
+void keyScans(std::vector<mapScan> &scans) {
+    size_t kept = 0;
+    for (size_t i = 0; i < scans.size(); i++) {
+        if (kept > 0) {
+            pose2d d = compose(inverse(scans[kept - 1].odom), scans[i].odom);
+            if (hypot(d.x, d.y) < MAPPER_KEY_DIST && fabs(wrap(d.th)) < MAPPER_KEY_ANGLE)
+                continue;
+        }
+        if (kept != i)
+            scans[kept] = scans[i];
+        kept++;
+    }
+    scans.resize(kept);
+    return;
+}
+
+/*
+* matchSequential
+* - One edge from each scan to the next, scan matched where that works
+*   and odometry (with less weight) where it doesn't.
+*/
+void matchSequential(const std::vector<mapScan> &scans, std::vector<mapEdge> &edges, int threads) {
+    int n = scans.size();
+    vector<mapEdge> seq(n > 0 ? n - 1 : 0);
+
+    parallelFor(n - 1, threads, [&](int i) {
+        const mapScan &a = scans[i], &b = scans[i + 1];
+        pose2d odo = compose(inverse(a.odom), b.odom);
+        pose2d delta = odo;
+        double rms;
+        mapEdge &e = seq[i];
+        e.from = i;
+        e.to = i + 1;
+        e.loop = false;
+        if (matchScans(a.mx.data(), a.my.data(), a.mx.size(), b.mx.data(), b.my.data(), b.mx.size(), delta, &rms) &&
+            rms < MAPPER_SEQ_RMS && hypot(delta.x - odo.x, delta.y - odo.y) < MAPPER_SEQ_JUMP) {
+            e.delta = delta;
+            e.info_xy = 1.0 / (MAPPER_SIGMA_XY * MAPPER_SIGMA_XY);
+            e.info_th = 1.0 / (MAPPER_SIGMA_TH * MAPPER_SIGMA_TH);
+        }
+        else {
+            e.delta = odo;
+            e.info_xy = 1.0 / (MAPPER_ODOM_SIGMA_XY * MAPPER_ODOM_SIGMA_XY);
+            e.info_th = 1.0 / (MAPPER_ODOM_SIGMA_TH * MAPPER_ODOM_SIGMA_TH);
+        }
+    });
+    edges.insert(edges.end(), seq.begin(), seq.end());
+    return;
+}
+
+/*
+* chainPoses
+* - Starting poses: the first scan's odometry, then the sequential edges.
+*/
+void chainPoses(const std::vector<mapScan> &scans, const std::vector<mapEdge> &edges, std::vector<pose2d> &poses) {
+    poses.assign(scans.size(), scans.empty() ? pose2d() : scans[0].odom);
+    for (size_t i = 0; i < edges.size(); i++) {
+        const mapEdge &e = edges[i];
+        if (!e.loop && e.to == e.from + 1)
+            poses[e.to] = compose(poses[e.from], e.delta);
+    }
+    return;
+}
+
+/*
+* overlap
+* - Fraction of scan b's points (moved by delta) with a point of scan a
+*   close by. A corridor of look-alike bays can match tightly where the
+*   two scans do agree, this catches that the rest of them don't.
+*/
+static double overlap(const mapScan &a, const mapScan &b, const pose2d &delta) {
+    double c = cos(delta.th), s = sin(delta.th);
+    double gate = MAPPER_OVERLAP_DIST * MAPPER_OVERLAP_DIST;
+    int inside = 0;
+
+    if (b.mx.empty())
+        return 0;
+    for (size_t j = 0; j < b.mx.size(); j++) {
+        double x = delta.x + c * b.mx[j] - s * b.my[j];
+        double y = delta.y + s * b.mx[j] + c * b.my[j];
+        for (size_t i = 0; i < a.mx.size(); i++) {
+            if ((a.mx[i] - x) * (a.mx[i] - x) + (a.my[i] - y) * (a.my[i] - y) < gate) {
+                inside++;
+                break;
+            }
+        }
+    }
+    return (double)inside / b.mx.size();
+}
+
+/*
+* closeLoops
+* - Match each scan against the nearest earlier scan the current poses
+*   put within reach, skipping pairs already joined. Returns the number
+*   of loop edges added.
+*/
+int closeLoops(const std::vector<mapScan> &scans, const std::vector<pose2d> &poses,
+               std::vector<mapEdge> &edges, int threads) {
+    int n = scans.size();
+    vector<int> partner(n, -1);
+    vector<mapEdge> found(n);
+    vector<char> ok(n, 0);
+
+    // Pairs joined already
+    vector<vector<int> > joined(n);
+    for (size_t k = 0; k < edges.size(); k++) {
+        if (edges[k].loop)
+            joined[edges[k].to].push_back(edges[k].from);
+    }
+
+    for (int i = 0; i < n; i++) {
+        double best = MAPPER_LOOP_DIST;
+        for (int j = 0; j + MAPPER_LOOP_GAP < i; j++) {
+            double d = hypot(poses[i].x - poses[j].x, poses[i].y - poses[j].y);
+            if (d < best && fabs(wrap(poses[i].th - poses[j].th)) < MAPPER_LOOP_ANGLE &&
+                find(joined[i].begin(), joined[i].end(), j) == joined[i].end()) {
+                best = d;
+                partner[i] = j;
+            }
+        }
+    }
+
+    parallelFor(n, threads, [&](int i) {
+        int j = partner[i];
+        if (j < 0)
+            return;
+        const mapScan &a = scans[j], &b = scans[i];
+        pose2d delta = compose(inverse(poses[j]), poses[i]);
+        double rms;
+        if (!matchScans(a.mx.data(), a.my.data(), a.mx.size(), b.mx.data(), b.my.data(), b.mx.size(), delta, &rms) ||
+            rms >= MAPPER_LOOP_RMS || overlap(a, b, delta) < MAPPER_LOOP_OVERLAP)
+            return;
+        mapEdge &e = found[i];
+        e.from = j;
+        e.to = i;
+        e.delta = delta;
+        e.info_xy = 1.0 / (MAPPER_SIGMA_XY * MAPPER_SIGMA_XY);
+        e.info_th = 1.0 / (MAPPER_SIGMA_TH * MAPPER_SIGMA_TH);
+        e.loop = true;
+        ok[i] = 1;
+    });
+
+    int added = 0;
+    for (int i = 0; i < n; i++) {
+        if (ok[i]) {
+            edges.push_back(found[i]);
+            added++;
+        }
+    }
+    return added;
+}
+
+/*
+* edgeJacobians
+* - Error of an edge (the measured delta against the poses' delta, in the
+*   measured frame) and its derivatives by the two poses.
+*/
+static void edgeJacobians(const pose2d &pi, const pose2d &pj, const mapEdge &e,
+                          double err[3], double A[3][3], double B[3][3]) {
+    double ci = cos(pi.th), si = sin(pi.th);
+    double cz = cos(e.delta.th), sz = sin(e.delta.th);
+    double dx = pj.x - pi.x, dy = pj.y - pi.y;
+
+    // Delta of j in i's frame, then the measurement's frame
+    double hx = ci * dx + si * dy, hy = -si * dx + ci * dy;
+    double rx = hx - e.delta.x, ry = hy - e.delta.y;
+    err[0] = cz * rx + sz * ry;
+    err[1] = -sz * rx + cz * ry;
+    err[2] = wrap(pj.th - pi.th - e.delta.th);
+
+    // Rz^T Ri^T, and Rz^T dRi^T/dth (tj - ti)
+    double m00 = cz * ci - sz * si, m01 = cz * si + sz * ci;
+    double m10 = -sz * ci - cz * si, m11 = -sz * si + cz * ci;
+    double gx = -si * dx + ci * dy, gy = -ci * dx - si * dy;
+    A[0][0] = -m00; A[0][1] = -m01; A[0][2] = cz * gx + sz * gy;
+    A[1][0] = -m10; A[1][1] = -m11; A[1][2] = -sz * gx + cz * gy;
+    A[2][0] = 0;    A[2][1] = 0;    A[2][2] = -1;
+    B[0][0] = m00;  B[0][1] = m01;  B[0][2] = 0;
+    B[1][0] = m10;  B[1][1] = m11;  B[1][2] = 0;
+    B[2][0] = 0;    B[2][1] = 0;    B[2][2] = 1;
+    return;
+}
+
+/*
+* invert3
+* - Inverse of a symmetric 3x3, or identity if it's singular.
+*/
+static void invert3(const double m[9], double out[9]) {
+    double c0 = m[4] * m[8] - m[5] * m[7];
+    double c1 = m[5] * m[6] - m[3] * m[8];
+    double c2 = m[3] * m[7] - m[4] * m[6];
+    double det = m[0] * c0 + m[1] * c1 + m[2] * c2;
+    if (fabs(det) < 1e-30) {
+        for (int k = 0; k < 9; k++)
+            out[k] = k % 4 == 0 ? 1 : 0;
+        return;
+    }
+    out[0] = c0 / det;
+    out[1] = (m[2] * m[7] - m[1] * m[8]) / det;
+    out[2] = (m[1] * m[5] - m[2] * m[4]) / det;
+    out[3] = c1 / det;
+    out[4] = (m[0] * m[8] - m[2] * m[6]) / det;
+    out[5] = (m[2] * m[3] - m[0] * m[5]) / det;
+    out[6] = c2 / det;
+    out[7] = (m[1] * m[6] - m[0] * m[7]) / det;
+    out[8] = (m[0] * m[4] - m[1] * m[3]) / det;
+    return;
+}
+
+/*
+* optimizePoseGraph
+* - Gauss-Newton over all poses with the first held fixed. The normal
+*   equations are never formed: conjugate gradients multiplies by them
+*   edge by edge, preconditioned by each pose's 3x3 diagonal block. Loop
+*   edges that still disagree with the rest afterwards are removed and
+*   the graph solved again. Returns the number removed.
+*/
+int optimizePoseGraph(std::vector<pose2d> &poses, std::vector<mapEdge> &edges) {
+    int n = poses.size();
+    int removed = 0;
+    if (n < 2)
+        return 0;
+
+    struct linear {
+        double A[3][3], B[3][3];
+        double w[3];          //information times the robust weight
+    };
+    vector<linear> lin(edges.size());
+    vector<double> b(3 * n), diag(9 * n), precond(9 * n);
+    vector<double> dx(3 * n), r(3 * n), z(3 * n), p(3 * n), hp(3 * n);
+
+    // H v, edge by edge, with pose 0 held
+    auto multiply = [&](const vector<double> &v, vector<double> &out) {
+        fill(out.begin(), out.end(), 0.0);
+        for (size_t k = 0; k < edges.size(); k++) {
+            const linear &l = lin[k];
+            int i = edges[k].from, j = edges[k].to;
+            double u[3];
+            for (int a = 0; a < 3; a++) {
+                u[a] = 0;
+                for (int c = 0; c < 3; c++)
+                    u[a] += (i ? l.A[a][c] * v[3 * i + c] : 0) + (j ? l.B[a][c] * v[3 * j + c] : 0);
+                u[a] *= l.w[a];
+            }
+            for (int c = 0; c < 3; c++) {
+                for (int a = 0; a < 3; a++) {
+                    if (i)
+                        out[3 * i + c] += l.A[a][c] * u[a];
+                    if (j)
+                        out[3 * j + c] += l.B[a][c] * u[a];
+                }
+            }
+        }
+    };
+
+    for (int round = 0; round < 2; round++) {
+        for (int iter = 0; iter < MAPPER_GN_ITERATIONS; iter++) {
+            fill(b.begin(), b.end(), 0.0);
+            fill(diag.begin(), diag.end(), 0.0);
+            for (size_t k = 0; k < edges.size(); k++) {
+                const mapEdge &e = edges[k];
+                linear &l = lin[k];
+                double err[3];
+                edgeJacobians(poses[e.from], poses[e.to], e, err, l.A, l.B);
+                l.w[0] = l.w[1] = e.info_xy;
+                l.w[2] = e.info_th;
+                if (e.loop) {
+                    double chi = sqrt(err[0] * err[0] * e.info_xy + err[1] * err[1] * e.info_xy +
+                                      err[2] * err[2] * e.info_th);
+                    if (chi > MAPPER_HUBER) {
+                        for (int a = 0; a < 3; a++)
+                            l.w[a] *= MAPPER_HUBER / chi;
+                    }
+                }
+                for (int c = 0; c < 3; c++) {
+                    for (int a = 0; a < 3; a++) {
+                        b[3 * e.from + c] += l.A[a][c] * l.w[a] * err[a];
+                        b[3 * e.to + c] += l.B[a][c] * l.w[a] * err[a];
+                        for (int d = 0; d < 3; d++) {
+                            diag[9 * e.from + 3 * c + d] += l.A[a][c] * l.w[a] * l.A[a][d];
+                            diag[9 * e.to + 3 * c + d] += l.B[a][c] * l.w[a] * l.B[a][d];
+                        }
+                    }
+                }
+            }
+            for (int i = 0; i < n; i++)
+                invert3(&diag[9 * i], &precond[9 * i]);
+
+            // Preconditioned conjugate gradients on H dx = -b
+            double rz = 0, r0 = 0;
+            for (int i = 0; i < 3 * n; i++) {
+                dx[i] = 0;
+                r[i] = i < 3 ? 0 : -b[i];
+                r0 += r[i] * r[i];
+            }
+            for (int i = 0; i < n; i++) {
+                for (int c = 0; c < 3; c++) {
+                    z[3 * i + c] = 0;
+                    for (int d = 0; d < 3; d++)
+                        z[3 * i + c] += precond[9 * i + 3 * c + d] * r[3 * i + d];
+                }
+            }
+            p = z;
+            for (int i = 0; i < 3 * n; i++)
+                rz += r[i] * z[i];
+            for (int cg = 0; cg < MAPPER_CG_ITERATIONS && rz > 0; cg++) {
+                multiply(p, hp);
+                double php = 0;
+                for (int i = 0; i < 3 * n; i++)
+                    php += p[i] * hp[i];
+                if (php <= 0)
+                    break;
+                double alpha = rz / php, rr = 0;
+                for (int i = 0; i < 3 * n; i++) {
+                    dx[i] += alpha * p[i];
+                    r[i] -= alpha * hp[i];
+                    rr += r[i] * r[i];
+                }
+                if (rr < 1e-16 * r0)
+                    break;
+                double rz_new = 0;
+                for (int i = 0; i < n; i++) {
+                    for (int c = 0; c < 3; c++) {
+                        z[3 * i + c] = 0;
+                        for (int d = 0; d < 3; d++)
+                            z[3 * i + c] += precond[9 * i + 3 * c + d] * r[3 * i + d];
+                        rz_new += r[3 * i + c] * z[3 * i + c];
+                    }
+                }
+                for (int i = 0; i < 3 * n; i++)
+                    p[i] = z[i] + rz_new / rz * p[i];
+                rz = rz_new;
+            }
+
+            double step = 0;
+            for (int i = 1; i < n; i++) {
+                poses[i].x += dx[3 * i];
+                poses[i].y += dx[3 * i + 1];
+                poses[i].th = wrap(poses[i].th + dx[3 * i + 2]);
+                step = fmax(step, fmax(fabs(dx[3 * i]), fabs(dx[3 * i + 1])));
+            }
+            if (step < 0.1)
+                break;
+        }
+
+        // Drop the loop closures the solution doesn't agree with
+        size_t kept = 0;
+        for (size_t k = 0; k < edges.size(); k++) {
+            const mapEdge &e = edges[k];
+            double err[3], A[3][3], B[3][3];
+            edgeJacobians(poses[e.from], poses[e.to], e, err, A, B);
+            double chi2 = (err[0] * err[0] + err[1] * err[1]) * e.info_xy + err[2] * err[2] * e.info_th;
+            if (e.loop && chi2 > MAPPER_OUTLIER) {
+                removed++;
+                continue;
+            }
+            edges[kept++] = e;
+        }
+        if (kept == edges.size())
+            break;
+        edges.resize(kept);
+        lin.resize(kept);
+    }
+    return removed;
+}
+
+/*
+* gridIndex
+* - Cell index of a point, -1 off the grid.
+*/
+static int gridIndex(const occGrid &grid, double x, double y) {
+    int cx = (int)floor((x - grid.min_x) / grid.cell);
+    int cy = (int)floor((y - grid.min_y) / grid.cell);
+    if (cx < 0 || cy < 0 || cx >= grid.width || cy >= grid.height)
+        return -1;
+    return cy * grid.width + cx;
+}
+
+/*
+* buildOccupancy
+* - Trace every reading of every scan: the cells it passes count a miss,
+*   the cell it ends in a hit.
+*/
+void buildOccupancy(const std::vector<mapScan> &scans, const std::vector<pose2d> &poses, occGrid &grid, int threads) {
+    double max_x = -1e9, max_y = -1e9;
+
+    grid.cell = MAPPER_CELL;
+    grid.min_x = grid.min_y = 1e9;
+    for (size_t i = 0; i < scans.size(); i++) {
+        double c = cos(poses[i].th), s = sin(poses[i].th);
+        for (size_t k = 0; k < scans[i].xs.size(); k++) {
+            double x = poses[i].x + c * scans[i].xs[k] - s * scans[i].ys[k];
+            double y = poses[i].y + s * scans[i].xs[k] + c * scans[i].ys[k];
+            grid.min_x = fmin(grid.min_x, x);
+            grid.min_y = fmin(grid.min_y, y);
+            max_x = fmax(max_x, x);
+            max_y = fmax(max_y, y);
+        }
+        grid.min_x = fmin(grid.min_x, poses[i].x);
+        grid.min_y = fmin(grid.min_y, poses[i].y);
+        max_x = fmax(max_x, poses[i].x);
+        max_y = fmax(max_y, poses[i].y);
+    }
+    if (scans.empty())
+        grid.min_x = grid.min_y = max_x = max_y = 0;
+    grid.min_x -= grid.cell;
+    grid.min_y -= grid.cell;
+    grid.width = (int)ceil((max_x - grid.min_x) / grid.cell) + 2;
+    grid.height = (int)ceil((max_y - grid.min_y) / grid.cell) + 2;
+
+    size_t cells = (size_t)grid.width * grid.height;
+    unique_ptr<atomic<int>[]> hits(new atomic<int>[cells]()), misses(new atomic<int>[cells]());
+    parallelFor(scans.size(), threads, [&](int i) {
+        const mapScan &scan = scans[i];
+        pose2d laser = compose(poses[i], scan.sensor);
+        double c = cos(poses[i].th), s = sin(poses[i].th);
+        for (size_t k = 0; k < scan.xs.size(); k++) {
+            double x = poses[i].x + c * scan.xs[k] - s * scan.ys[k];
+            double y = poses[i].y + s * scan.xs[k] + c * scan.ys[k];
+            double len = hypot(x - laser.x, y - laser.y);
+            int steps = (int)(len / (grid.cell / 2));
+            int last = -1, end = gridIndex(grid, x, y);
+            for (int t = 0; t < steps; t++) {
+                int cell = gridIndex(grid, laser.x + (x - laser.x) * t / steps, laser.y + (y - laser.y) * t / steps);
+                if (cell >= 0 && cell != last && cell != end)
+                    misses[cell].fetch_add(1, memory_order_relaxed);
+                last = cell;
+            }
+            if (end >= 0)
+                hits[end].fetch_add(1, memory_order_relaxed);
+        }
+    });
+    grid.hits.resize(cells);
+    grid.misses.resize(cells);
+    for (size_t k = 0; k < cells; k++) {
+        grid.hits[k] = hits[k].load();
+        grid.misses[k] = misses[k].load();
+    }
+    return;
+}
+
+bool occupied(const occGrid &grid, double x, double y) {
+    int k = gridIndex(grid, x, y);
+    return k >= 0 && grid.hits[k] >= MAPPER_MIN_HITS && grid.hits[k] > grid.misses[k];
+}
+
+/*
+* fitSegment
+* - Total least squares line through points [a, b], cut at the
+*   projections of the end points.
+*/
+static lotLine fitSegment(const vector<double> &xs, const vector<double> &ys, int a, int b) {
+    double mx = 0, my = 0, sxx = 0, sxy = 0, syy = 0;
+    int n = b - a + 1;
+    for (int k = a; k <= b; k++) {
+        mx += xs[k];
+        my += ys[k];
+    }
+    mx /= n;
+    my /= n;
+    for (int k = a; k <= b; k++) {
+        sxx += (xs[k] - mx) * (xs[k] - mx);
+        sxy += (xs[k] - mx) * (ys[k] - my);
+        syy += (ys[k] - my) * (ys[k] - my);
+    }
+    double th = 0.5 * atan2(2 * sxy, sxx - syy);
+    double dx = cos(th), dy = sin(th);
+    double s0 = (xs[a] - mx) * dx + (ys[a] - my) * dy;
+    double s1 = (xs[b] - mx) * dx + (ys[b] - my) * dy;
+    lotLine l = {mx + s0 * dx, my + s0 * dy, mx + s1 * dx, my + s1 * dy};
+    return l;
+}
+
+/*
+* splitRun
+* - Split and merge: keep [a, b] as one line if no point strays more than
+*   MAPPER_SPLIT_DIST from the chord, otherwise split at the worst point.
+*/
+static void splitRun(const vector<double> &xs, const vector<double> &ys, int a, int b, vector<lotLine> &out) {
+    if (b - a + 1 < MAPPER_LINE_POINTS)
+        return;
+    double dx = xs[b] - xs[a], dy = ys[b] - ys[a];
+    double len = hypot(dx, dy);
+    double worst = 0;
+    int split = -1;
+    for (int k = a + 1; k < b && len > 0; k++) {
+        double d = fabs((xs[k] - xs[a]) * dy - (ys[k] - ys[a]) * dx) / len;
+        if (d > worst) {
+            worst = d;
+            split = k;
+        }
+    }
+    if (split >= 0 && worst > MAPPER_SPLIT_DIST) {
+        splitRun(xs, ys, a, split, out);
+        splitRun(xs, ys, split, b, out);
+        return;
+    }
+    lotLine l = fitSegment(xs, ys, a, b);
+    if (hypot(l.x2 - l.x1, l.y2 - l.y1) >= MAPPER_MIN_LINE / 2)
+        out.push_back(l);
+    return;
+}
+
+/*
+* mergedLine
+* - Lines being merged. The pieces' length weighted moments give the
+*   fitted line (centroid and direction), the outermost end points its
+*   extent, and support counts the scan lines that went in.
+*/
+struct mergedLine {
+    double w, sx, sy, sxx, sxy, syy;
+    double ox, oy, dx, dy;
+    double ax, ay, bx, by;
+    int support;
+};
+
+/*
+* refit
+* - Line through the moments, stretched to the outermost of the given
+*   end points.
+*/
+static void refit(mergedLine &m, const double *px, const double *py, int n) {
+    m.ox = m.sx / m.w;
+    m.oy = m.sy / m.w;
+    double cxx = m.sxx / m.w - m.ox * m.ox;
+    double cxy = m.sxy / m.w - m.ox * m.oy;
+    double cyy = m.syy / m.w - m.oy * m.oy;
+    double th = 0.5 * atan2(2 * cxy, cxx - cyy);
+    m.dx = cos(th);
+    m.dy = sin(th);
+
+    double lo = 1e18, hi = -1e18;
+    for (int k = 0; k < n; k++) {
+        double t = (px[k] - m.ox) * m.dx + (py[k] - m.oy) * m.dy;
+        if (t < lo) {
+            lo = t;
+            m.ax = px[k];
+            m.ay = py[k];
+        }
+        if (t > hi) {
+            hi = t;
+            m.bx = px[k];
+            m.by = py[k];
+        }
+    }
+    return;
+}
+
+static mergedLine pieceLine(const lotLine &l) {
+    mergedLine m;
+    double len = hypot(l.x2 - l.x1, l.y2 - l.y1);
+    double mx = (l.x1 + l.x2) / 2, my = (l.y1 + l.y2) / 2;
+    double ex = l.x2 - l.x1, ey = l.y2 - l.y1;
+    double px[2] = {l.x1, l.x2}, py[2] = {l.y1, l.y2};
+    m.w = len;
+    m.sx = len * mx;
+    m.sy = len * my;
+    m.sxx = len * (mx * mx + ex * ex / 12);
+    m.sxy = len * (mx * my + ex * ey / 12);
+    m.syy = len * (my * my + ey * ey / 12);
+    m.support = 1;
+    refit(m, px, py, 2);
+    return m;
+}
+
+static double along(const mergedLine &m, double x, double y) {
+    return (x - m.ox) * m.dx + (y - m.oy) * m.dy;
+}
+
+static double across(const mergedLine &m, double x, double y) {
+    return fabs((x - m.ox) * m.dy - (y - m.oy) * m.dx);
+}
+
+/*
+* tryMerge
+* - Fold o into m if they're the same wall: parallel, in line and
+*   overlapping or nearly so.
+*/
+static bool tryMerge(mergedLine &m, const mergedLine &o) {
+    if (fabs(m.dx * o.dy - m.dy * o.dx) > sin(MAPPER_MERGE_ANGLE))
+        return false;
+    if (across(m, o.ax, o.ay) > MAPPER_MERGE_DIST || across(m, o.bx, o.by) > MAPPER_MERGE_DIST)
+        return false;
+    double a = along(m, o.ax, o.ay), b = along(m, o.bx, o.by);
+    if (fmax(a, b) < along(m, m.ax, m.ay) - MAPPER_MERGE_GAP || fmin(a, b) > along(m, m.bx, m.by) + MAPPER_MERGE_GAP)
+        return false;
+
+    double px[4] = {m.ax, m.bx, o.ax, o.bx}, py[4] = {m.ay, m.by, o.ay, o.by};
+    m.w += o.w;
+    m.sx += o.sx;
+    m.sy += o.sy;
+    m.sxx += o.sxx;
+    m.sxy += o.sxy;
+    m.syy += o.syy;
+    m.support += o.support;
+    refit(m, px, py, 4);
+    return true;
+}
+
+/*
+* segmentDist
+* - Distance from a point to a line segment.
+*/
+static double segmentDist(const lotLine &l, double x, double y) {
+    double ex = l.x2 - l.x1, ey = l.y2 - l.y1;
+    double len2 = ex * ex + ey * ey;
+    double t = len2 > 0 ? ((x - l.x1) * ex + (y - l.y1) * ey) / len2 : 0;
+    t = fmax(0.0, fmin(1.0, t));
+    return hypot(x - l.x1 - t * ex, y - l.y1 - t * ey);
+}
+
+/*
+* extractLines
+* - Lines from each scan's occupied points, merged across scans, longest
+*   first. Short lines lying along a longer one are dropped.
+*/
+void extractLines(const std::vector<mapScan> &scans, const std::vector<pose2d> &poses, const occGrid &grid,
+                  std::vector<lotLine> &lines, int threads) {
+    vector<vector<lotLine> > per_scan(scans.size());
+
+    parallelFor(scans.size(), threads, [&](int i) {
+        const mapScan &scan = scans[i];
+        double c = cos(poses[i].th), s = sin(poses[i].th);
+        vector<double> xs, ys;
+        for (size_t k = 0; k <= scan.xs.size(); k++) {
+            bool keep = false;
+            double x = 0, y = 0;
+            if (k < scan.xs.size()) {
+                x = poses[i].x + c * scan.xs[k] - s * scan.ys[k];
+                y = poses[i].y + s * scan.xs[k] + c * scan.ys[k];
+                keep = occupied(grid, x, y);
+            }
+            bool gap = !xs.empty() && (!keep || hypot(x - xs.back(), y - ys.back()) > MAPPER_LINE_GAP);
+            if (gap) {
+                splitRun(xs, ys, 0, xs.size() - 1, per_scan[i]);
+                xs.clear();
+                ys.clear();
+            }
+            if (keep) {
+                xs.push_back(x);
+                ys.push_back(y);
+            }
+        }
+    });
+
+    vector<lotLine> all;
+    for (size_t i = 0; i < per_scan.size(); i++)
+        all.insert(all.end(), per_scan[i].begin(), per_scan[i].end());
+    sort(all.begin(), all.end(), [](const lotLine &a, const lotLine &b) {
+        return hypot(a.x2 - a.x1, a.y2 - a.y1) > hypot(b.x2 - b.x1, b.y2 - b.y1);
+    });
+
+    vector<mergedLine> merged;
+    for (size_t k = 0; k < all.size(); k++) {
+        mergedLine piece = pieceLine(all[k]);
+        size_t m;
+        for (m = 0; m < merged.size(); m++) {
+            if (tryMerge(merged[m], piece))
+                break;
+        }
+        if (m == merged.size())
+            merged.push_back(piece);
+    }
+
+    // Pieces of one wall first seen apart
+    for (bool again = true; again;) {
+        again = false;
+        for (size_t a = 0; a < merged.size() && !again; a++) {
+            for (size_t b = a + 1; b < merged.size() && !again; b++) {
+                if (tryMerge(merged[a], merged[b])) {
+                    merged.erase(merged.begin() + b);
+                    again = true;
+                }
+            }
+        }
+    }
+
+    vector<lotLine> found;
+    for (size_t m = 0; m < merged.size(); m++) {
+        const mergedLine &l = merged[m];
+        double s0 = along(l, l.ax, l.ay), s1 = along(l, l.bx, l.by);
+        if (l.support < MAPPER_MIN_SUPPORT || s1 - s0 < MAPPER_MIN_LINE)
+            continue;
+        lotLine out = {l.ox + s0 * l.dx, l.oy + s0 * l.dy, l.ox + s1 * l.dx, l.oy + s1 * l.dy};
+        found.push_back(out);
+    }
+    sort(found.begin(), found.end(), [](const lotLine &a, const lotLine &b) {
+        return hypot(a.x2 - a.x1, a.y2 - a.y1) > hypot(b.x2 - b.x1, b.y2 - b.y1);
+    });
+    lines.clear();
+    for (size_t k = 0; k < found.size(); k++) {
+        size_t j;
+        for (j = 0; j < lines.size(); j++) {
+            if (segmentDist(lines[j], found[k].x1, found[k].y1) < MAPPER_MERGE_DIST &&
+                segmentDist(lines[j], found[k].x2, found[k].y2) < MAPPER_MERGE_DIST)
+                break;
+        }
+        if (j == lines.size())
+            lines.push_back(found[k]);
+    }
+    return;
+}
+
+/*
+* writeAriaMap
+* - Write a 2D-Map with the lines, the occupied cells as points and the
+*   start of the log as RobotHome.
+*/
+bool writeAriaMap(const char *file, const std::vector<lotLine> &lines, const occGrid &grid, const pose2d &home) {
+    FILE *fp = fopen(file, "w");
+    if (fp == NULL)
+        return false;
+
+    vector<int> points;
+    double pmin_x = 0, pmin_y = 0, pmax_x = 0, pmax_y = 0;
+    for (int cy = 0; cy < grid.height; cy++) {
+        for (int cx = 0; cx < grid.width; cx++) {
+            int k = cy * grid.width + cx;
+            if (grid.hits[k] < MAPPER_MIN_HITS || grid.hits[k] <= grid.misses[k])
+                continue;
+            int x = (int)lround(grid.min_x + (cx + 0.5) * grid.cell);
+            int y = (int)lround(grid.min_y + (cy + 0.5) * grid.cell);
+            if (points.empty()) {
+                pmin_x = pmax_x = x;
+                pmin_y = pmax_y = y;
+            }
+            pmin_x = fmin(pmin_x, x);
+            pmin_y = fmin(pmin_y, y);
+            pmax_x = fmax(pmax_x, x);
+            pmax_y = fmax(pmax_y, y);
+            points.push_back(x);
+            points.push_back(y);
+        }
+    }
+    double lmin_x = 0, lmin_y = 0, lmax_x = 0, lmax_y = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+        const lotLine &l = lines[i];
+        if (i == 0) {
+            lmin_x = lmax_x = l.x1;
+            lmin_y = lmax_y = l.y1;
+        }
+        lmin_x = fmin(lmin_x, fmin(l.x1, l.x2));
+        lmin_y = fmin(lmin_y, fmin(l.y1, l.y2));
+        lmax_x = fmax(lmax_x, fmax(l.x1, l.x2));
+        lmax_y = fmax(lmax_y, fmax(l.y1, l.y2));
+    }
+
+    fprintf(fp, "2D-Map\n");
+    fprintf(fp, "MinPos: %.0f %.0f\n", pmin_x, pmin_y);
+    fprintf(fp, "MaxPos: %.0f %.0f\n", pmax_x, pmax_y);
+    fprintf(fp, "NumPoints: %d\n", (int)points.size() / 2);
+    fprintf(fp, "Resolution: %.0f\n", grid.cell);
+    fprintf(fp, "LineMinPos: %.0f %.0f\n", lmin_x, lmin_y);
+    fprintf(fp, "LineMaxPos: %.0f %.0f\n", lmax_x, lmax_y);
+    fprintf(fp, "NumLines: %d\n", (int)lines.size());
+    fprintf(fp, "LinesAreSorted: false\n");
+    fprintf(fp, "Cairn: RobotHome %.0f %.0f %f \"\" ICON \"\"\n", home.x, home.y, home.th * 180.0 / PI);
+    fprintf(fp, "LINES\n");
+    for (size_t i = 0; i < lines.size(); i++)
+        fprintf(fp, "%.0f %.0f %.0f %.0f\n", lines[i].x1, lines[i].y1, lines[i].x2, lines[i].y2);
+    fprintf(fp, "DATA\n");
+    for (size_t i = 0; i < points.size(); i += 2)
+        fprintf(fp, "%d %d\n", points[i], points[i + 1]);
+    bool ok = ferror(fp) == 0;
+    fclose(fp);
+    return ok;
+}
+
+// EOF
@@ -0,0 +1,101 @@
+/*
+* mapper.h
+* - Offline mapping from ArSickLogger logs: scan matching, loop closure,
+*   a pose graph, an occupancy grid and the LINES of an ARIA .map file.
+*/
+#ifndef MAPPER_H
+#define MAPPER_H
+
+#include <vector>
+#include "autoPark.h"
+#include "lotMap.h"
+
+// Scans
+#define MAPPER_MAX_RANGE 7900.0  //Readings this far or further are misses only, mm
+#define MAPPER_KEY_DIST 200.0    //Scans closer together than this are skipped, mm
+#define MAPPER_KEY_ANGLE 0.17    //and turned less than this, rad
+#define MAPPER_ICP_SPACING 40.0  //Points kept for matching at least this far apart, mm
+
+// Pose graph
+#define MAPPER_SEQ_RMS 40.0      //Worst match kept between consecutive scans, mm
+#define MAPPER_SEQ_JUMP 500.0    //Matches further than this from odometry are wrong, mm
+#define MAPPER_LOOP_RMS 25.0     //Worst loop closure kept, mm
+#define MAPPER_LOOP_OVERLAP 0.8  //and it must explain this much of the scan
+#define MAPPER_OVERLAP_DIST 60.0 //within this, mm
+#define MAPPER_LOOP_GAP 20       //Scans between the ends of a loop, at least
+#define MAPPER_LOOP_DIST 2000.0  //Loop candidates are this close, mm
+#define MAPPER_LOOP_ANGLE 1.0    //and facing within this, rad
+#define MAPPER_LOOP_ROUNDS 3     //Search, optimize, search again
+#define MAPPER_SIGMA_XY 20.0     //Scan match error, mm
+#define MAPPER_SIGMA_TH 0.01     //rad
+#define MAPPER_ODOM_SIGMA_XY 100.0 //Odometry error between scans, mm
+#define MAPPER_ODOM_SIGMA_TH 0.05  //rad
+#define MAPPER_HUBER 3.0         //Loop residuals past this many sigma are down weighted
+#define MAPPER_OUTLIER 25.0      //Loop edges with chi^2 past this are dropped
+#define MAPPER_GN_ITERATIONS 20
+#define MAPPER_CG_ITERATIONS 500
+
+// Grid and lines
+#define MAPPER_CELL 50.0         //Occupancy grid cell, mm
+#define MAPPER_MIN_HITS 2        //Occupied cells were hit this often, and more than missed
+#define MAPPER_LINE_GAP 200.0    //A gap this big ends a run of wall points, mm
+#define MAPPER_SPLIT_DIST 30.0   //Split a run where it strays this far from a line, mm
+#define MAPPER_LINE_POINTS 6     //Fewest points on a line from one scan
+#define MAPPER_MERGE_ANGLE 0.09  //Lines from different scans merge within this, rad
+#define MAPPER_MERGE_DIST 80.0   //and this far apart sideways, mm
+#define MAPPER_MERGE_GAP 300.0   //and this far apart end to end, mm
+#define MAPPER_MIN_SUPPORT 3     //Scans that saw a line before it goes in the map
+#define MAPPER_MIN_LINE 300.0    //Shortest line written, mm
+
+/*
+* mapScan
+* - One logged scan: odometry pose and the readings in the robot frame,
+*   in beam order, plus a thinned copy for scan matching.
+*/
+struct mapScan {
+    double time;
+    pose2d odom;
+    pose2d sensor;             //laser on the robot
+    std::vector<double> xs, ys;
+    std::vector<double> mx, my;
+};
+
+/*
+* mapEdge
+* - A pose graph constraint: the pose of scan to in the frame of scan
+*   from, with a diagonal information matrix.
+*/
+struct mapEdge {
+    int from, to;
+    pose2d delta;
+    double info_xy, info_th;
+    bool loop;
+};
+
+/*
+* occGrid
+* - Hit and miss counts per cell, row major from (min_x, min_y).
+*/
+struct occGrid {
+    double min_x, min_y;
+    double cell;
+    int width, height;
+    std::vector<int> hits, misses;
+};
+
+bool readSickLog(const char *file, std::vector<mapScan> &scans);
+void keyScans(std::vector<mapScan> &scans);
+void matchSequential(const std::vector<mapScan> &scans, std::vector<mapEdge> &edges, int threads);
+void chainPoses(const std::vector<mapScan> &scans, const std::vector<mapEdge> &edges, std::vector<pose2d> &poses);
+int closeLoops(const std::vector<mapScan> &scans, const std::vector<pose2d> &poses,
+               std::vector<mapEdge> &edges, int threads);
+int optimizePoseGraph(std::vector<pose2d> &poses, std::vector<mapEdge> &edges);
+void buildOccupancy(const std::vector<mapScan> &scans, const std::vector<pose2d> &poses, occGrid &grid, int threads);
+bool occupied(const occGrid &grid, double x, double y);
+void extractLines(const std::vector<mapScan> &scans, const std::vector<pose2d> &poses, const occGrid &grid,
+                  std::vector<lotLine> &lines, int threads);
+bool writeAriaMap(const char *file, const std::vector<lotLine> &lines, const occGrid &grid, const pose2d &home);
+
+#endif
+
+// EOF
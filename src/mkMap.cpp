@@ -0,0 +1,75 @@
+/*
+* mkMap.cpp
+* - Offline tool that builds an ARIA .map from ArSickLogger logs (e.g.
+*   the 1scans.2d examples/sickLogger writes).
+*
+*   usage: ./mkMap [-j threads] [-o file.map] log.2d [log.2d ...]
+*          (default out.map; logs of one run, in order)
+*/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "mapper.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+    const char *out = "out.map";
+    int threads = std::thread::hardware_concurrency();
+    std::vector<mapScan> scans;
+    std::vector<mapEdge> edges;
+    std::vector<pose2d> poses;
+    std::vector<lotLine> lines;
+    occGrid grid;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out = argv[++i];
+        else if (!readSickLog(argv[i], scans)) {
+            printf("Could not read %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (threads < 1)
+        threads = 1;
+    int logged = scans.size();
+    keyScans(scans);
+    if (scans.size() < 2) {
+        printf("Need at least two scans, have %d\n", (int)scans.size());
+        return 1;
+    }
+    printf("Read %d scans, %d kept (%.1f s)\n", logged, (int)scans.size(), secondsSince(start));
+
+    matchSequential(scans, edges, threads);
+    chainPoses(scans, edges, poses);
+    printf("Matched consecutive scans (%.1f s)\n", secondsSince(start));
+
+    int loops = 0, dropped = 0;
+    for (int round = 0; round < MAPPER_LOOP_ROUNDS; round++) {
+        int added = closeLoops(scans, poses, edges, threads);
+        if (added == 0)
+            break;
+        loops += added;
+        dropped += optimizePoseGraph(poses, edges);
+        printf("Loop closures: %d found, %d dropped (%.1f s)\n", loops, dropped, secondsSince(start));
+    }
+
+    buildOccupancy(scans, poses, grid, threads);
+    extractLines(scans, poses, grid, lines, threads);
+    if (!writeAriaMap(out, lines, grid, poses[0])) {
+        printf("Could not write %s\n", out);
+        return 1;
+    }
+    printf("Wrote %d lines (%dx%d grid) to %s in %.1f s\n", (int)lines.size(), grid.width, grid.height,
+           out, secondsSince(start));
+    return 0;
+}
+
+// EOF
@@ -0,0 +1,51 @@
+/*
+* mkPlans.cpp
+* - Offline tool that writes the multi-point parking plan table.
+*
+*   usage: ./mkPlans [-j threads] [-tune profile] [file]   (default plans.bin)
+*
+*   autoPark only uses a table made with the margin it runs with, so one
+*   running a tuned profile wants a table made with -tune.
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "planTable.h"
+#include "tuning.h"
+
+int main(int argc, char **argv) {
+    const char *file = PLAN_TABLE_FILE;
+    int threads = std::thread::hardware_concurrency();
+    planTableHeader header;
+    std::vector<planEntry> entries;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-tune") == 0 && i + 1 < argc) {
+            if (!loadTuning(argv[++i], tuning)) {
+                printf("Could not use profile %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else
+            file = argv[i];
+    }
+    if (threads < 1)
+        threads = 1;
+
+    generatePlanTable(header, entries, threads);
+    int found = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+        found += entries[i].found;
+    if (!writePlanTable(file, header, entries)) {
+        printf("Could not write %s\n", file);
+        return 1;
+    }
+    printf("Wrote %d slots (%d with a maneuver, %d bytes) to %s\n", (int)entries.size(), found,
+           (int)(sizeof(planTableHeader) + entries.size() * sizeof(planEntry)), file);
+    return 0;
+}
+
+// EOF
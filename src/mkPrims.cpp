@@ -0,0 +1,24 @@
+/*
+* mkPrims.cpp
+* - Offline tool that writes the Hybrid-A* motion primitive table.
+*
+*   usage: ./mkPrims [file]   (default prims.bin)
+*/
+#include <cstdio>
+#include "hybridAStar.h"
+
+int main(int argc, char **argv) {
+    const char *file = argc > 1 ? argv[1] : PRIM_FILE;
+    primTable table;
+
+    generatePrimitives(table);
+    if (!writePrimitives(file, table)) {
+        printf("Could not write %s\n", file);
+        return 1;
+    }
+    printf("Wrote %d primitives (%d bytes) to %s\n", (int)table.records.size(),
+           (int)(sizeof(primHeader) + table.records.size() * sizeof(primRecord)), file);
+    return 0;
+}
+
+// EOF
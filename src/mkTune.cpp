@@ -0,0 +1,432 @@
+/*
+* mkTune.cpp
+* - Offline tool that tunes the parking parameters (see tuning.h) and
+*   writes a profile for autoPark -tune.
+*
+*   usage: ./mkTune [-j threads] [-episodes n] [-n robots] [-gens n] [-seed n]
+*                   [-truth width,depth] [-log file]... [-o profile] [map...]
+*          (default 512 episodes of up to 4 robots on Map1.map, 40
+*          generations, written to tuning.txt)
+*
+*   Candidates come from a separable CMA-ES (diagonal covariance, the
+*   parameters barely interact and four of them don't need more) in a
+*   box scaled to each parameter's range. Every candidate is scored on
+*   the same episodes, so differences are the parameters and not the
+*   noise: lot simulations cycling through the maps with 1 to n robots,
+*   plus, with -truth, the last scan of each autoPark log replayed
+*   through the corner detector against the real slot size. The cost is
+*   seconds per robot to park, a failure counting as TUNE_FAIL_COST.
+*   The profile is only changed from the defaults if it does better.
+*
+*   mar_err isn't searched. It's the margin for execution error, and the
+*   simulator has range noise but no wheel or odometry error, so nothing
+*   here pays for a thin margin and the search would only shrink it. It
+*   keeps its measured value.
+*/
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "corners.h"
+#include "lotSim.h"
+#include "tuning.h"
+
+using namespace std;
+
+#define TUNE_DIMS 4
+#define TUNE_SIGMA 0.2           //Starting step, fraction of each range
+#define TUNE_FAIL_COST 600.0     //s, a robot that never parks
+#define TUNE_CONTACT_COST 5.0    //s per step spent touching a line
+#define TUNE_MM_COST 0.5         //s per mm a replayed slot is off by
+#define TUNE_TIME 1800.0         //s, episodes stop here
+#define TUNE_BOX_COST 1000.0     //per unit squared outside the box
+
+// Search box, everything inside it is a sane robot. wiggle below 0
+// puts circle 1 into the wall, so that edge is a hard limit; the rest
+// are well past anything that has done well (approach is signed, below
+// 0 the arcs start past circle 2 and end further up the slot).
+static const char *names[TUNE_DIMS] = {"depth_bound", "wiggle", "approach", "first_max"};
+static const double low[TUNE_DIMS] = {30.0, 0.0, -300.0, 120.0};
+static const double high[TUNE_DIMS] = {300.0, 500.0, 600.0, 175.0};
+
+/*
+* replayScan
+* - The readings of the last scan in a log, and the slot it was really.
+*/
+struct replayScan {
+    vector<reading> readings;
+    double width, depth;
+};
+
+/*
+* episodeCost
+* - What a batch of episodes came to.
+*/
+struct episodeCost {
+    double cost;
+    int robots;
+    int parked;
+};
+
+/*
+* parallelFor
+* - Run fn(i) for i in [0, n) over threads.
+*/
+template <class F>
+static void parallelFor(int n, int threads, F fn) {
+    atomic<int> next(0);
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(thread([&]() {
+            for (int i = next++; i < n; i = next++)
+                fn(i);
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+    return;
+}
+
+/*
+* uniform / gaussian
+* - splitmix64 and Box-Muller, so a seed gives the same run anywhere.
+*/
+static unsigned long long rng_state;
+
+static double uniform() {
+    unsigned long long z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return ((z >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double gaussian() {
+    return sqrt(-2.0 * log(uniform())) * cos(2.0 * PI * uniform());
+}
+
+/*
+* toTuning / fromTuning
+* - Between a profile and a point in the unit box. mar_err isn't in the
+*   box and is left as it is.
+*/
+static void toTuning(const double *x, tuneParams &t) {
+    double v[TUNE_DIMS];
+    for (int d = 0; d < TUNE_DIMS; d++)
+        v[d] = low[d] + fmin(fmax(x[d], 0.0), 1.0) * (high[d] - low[d]);
+    t.depth_bound = v[0];
+    t.wiggle = v[1];
+    t.approach = v[2];
+    t.first_max = v[3];
+    return;
+}
+
+static void fromTuning(const tuneParams &t, double *x) {
+    double v[TUNE_DIMS] = {t.depth_bound, t.wiggle, t.approach, t.first_max};
+    for (int d = 0; d < TUNE_DIMS; d++)
+        x[d] = (v[d] - low[d]) / (high[d] - low[d]);
+    return;
+}
+
+/*
+* loadReplay
+* - The last "Reading N" block of an autoPark log.
+*/
+static bool loadReplay(const char *file, replayScan &scan) {
+    FILE *fp = fopen(file, "r");
+    char line[256];
+
+    if (fp == NULL)
+        return false;
+    scan.readings.clear();
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        int k;
+        reading r;
+        if (sscanf(line, "Reading %d:\tLaser Dist: %lf\tAngle: %lf", &k, &r.distance, &r.angle) != 3)
+            continue;
+        if (k == 0)
+            scan.readings.clear();
+        if (scan.readings.size() < AGENT_READINGS)
+            scan.readings.push_back(r);
+    }
+    fclose(fp);
+    return !scan.readings.empty();
+}
+
+/*
+* simulate
+* - One lot simulation: seconds to park summed over the robots that
+*   turned up, failures and contacts charged. A robot still kept out at
+*   the entrance when time runs out counts as a failure.
+*/
+static void simulate(const lotMap &map, int robots, unsigned long long seed, episodeCost &out) {
+    simConfig config;
+    config.robots = robots;
+    config.arrival = SIM_ARRIVAL;
+    config.dwell = SIM_DWELL;
+    config.max_moves = SIM_MAX_MOVES;
+    config.time_limit = TUNE_TIME;
+    config.seed = seed;
+    config.threads = 1;
+
+    LotSim sim(map, config);
+    while (!sim.done())
+        sim.step();
+
+    out.cost = 0;
+    out.robots = 0;
+    out.parked = 0;
+    const vector<simRobot> &rs = sim.robots();
+    for (size_t i = 0; i < rs.size(); i++) {
+        const simRobot &r = rs[i];
+        if (r.state == SIM_WAITING) {
+            if (r.arrive > sim.time())
+                continue;
+            out.robots++;
+            out.cost += TUNE_FAIL_COST;
+            continue;
+        }
+        out.robots++;
+        if (r.parked >= 0) {
+            out.cost += r.parked - r.enter;
+            out.parked++;
+        }
+        else
+            out.cost += TUNE_FAIL_COST;
+        out.cost += r.contacts * TUNE_CONTACT_COST;
+    }
+    return;
+}
+
+/*
+* replay
+* - A logged scan through the corner detector: seconds charged for how
+*   far off the slot comes out, or a failure if it isn't found.
+*/
+static void replay(const replayScan &scan, episodeCost &out) {
+    ParkAgent agent;
+    for (size_t i = 0; i < scan.readings.size(); i++)
+        agent.readings[i] = scan.readings[i];
+    agent.findCorners();
+
+    out.robots = 1;
+    out.parked = agent.found();
+    out.cost = TUNE_FAIL_COST;
+    if (out.parked) {
+        agent.getDimensions();
+        double err = fabs(agent.width - scan.width) + fabs(agent.depth - scan.depth);
+        out.cost = fmin(err * TUNE_MM_COST, TUNE_FAIL_COST);
+    }
+    return;
+}
+
+/*
+* evaluate
+* - Average cost per robot of a candidate over every episode. Sets the
+*   global tuning, so only one candidate runs at a time.
+*/
+static double evaluate(const double *x, const vector<lotMap> &maps, const vector<replayScan> &replays,
+                       int episodes, int max_robots, unsigned long long seed, int threads, double *park_rate) {
+    toTuning(x, tuning);
+    int total = episodes + replays.size();
+    vector<episodeCost> costs(total);
+    parallelFor(total, threads, [&](int e) {
+        if (e < episodes)
+            simulate(maps[e % maps.size()], 1 + (e / maps.size()) % max_robots, seed + e, costs[e]);
+        else
+            replay(replays[e - episodes], costs[e]);
+    });
+
+    double cost = 0;
+    int robots = 0, parked = 0;
+    for (int e = 0; e < total; e++) {
+        cost += costs[e].cost;
+        robots += costs[e].robots;
+        parked += costs[e].parked;
+    }
+    if (park_rate != NULL)
+        *park_rate = robots > 0 ? (double)parked / robots : 0;
+
+    // Points outside the box run clamped, and pay for being out there
+    for (int d = 0; d < TUNE_DIMS; d++) {
+        double out = x[d] - fmin(fmax(x[d], 0.0), 1.0);
+        cost += TUNE_BOX_COST * out * out * (robots > 0 ? robots : 1);
+    }
+    return robots > 0 ? cost / robots : 0;
+}
+
+int main(int argc, char **argv) {
+    const char *out_file = TUNING_FILE;
+    int threads = std::thread::hardware_concurrency();
+    int episodes = 512, max_robots = 4, generations = 40;
+    unsigned long long seed = 1;
+    double truth_width = 0, truth_depth = 0;
+    vector<const char *> map_files, log_files;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-episodes") == 0 && i + 1 < argc)
+            episodes = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            max_robots = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-gens") == 0 && i + 1 < argc)
+            generations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-truth") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%lf,%lf", &truth_width, &truth_depth) != 2) {
+                printf("Could not use -truth %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-log") == 0 && i + 1 < argc)
+            log_files.push_back(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out_file = argv[++i];
+        else
+            map_files.push_back(argv[i]);
+    }
+    if (threads < 1)
+        threads = 1;
+    if (map_files.empty())
+        map_files.push_back("Map1.map");
+    if (episodes < 0 || max_robots < 1 || generations < 1) {
+        printf("Nothing to tune with %d episodes of %d robots over %d generations\n", episodes, max_robots,
+               generations);
+        return 1;
+    }
+
+    vector<lotMap> maps(map_files.size());
+    for (size_t i = 0; i < map_files.size(); i++) {
+        if (!loadLotMap(map_files[i], maps[i])) {
+            printf("Could not use map %s\n", map_files[i]);
+            return 1;
+        }
+    }
+    if (!log_files.empty() && (truth_width <= 0 || truth_depth <= 0)) {
+        printf("Replaying logs needs -truth width,depth\n");
+        return 1;
+    }
+    vector<replayScan> replays;
+    for (size_t i = 0; i < log_files.size(); i++) {
+        replayScan scan;
+        scan.width = truth_width;
+        scan.depth = truth_depth;
+        if (!loadReplay(log_files[i], scan)) {
+            printf("No scan in %s\n", log_files[i]);
+            return 1;
+        }
+        replays.push_back(scan);
+    }
+    printf("%d episodes on %d maps with 1 to %d robots, %d replayed scans, %d threads\n", episodes,
+           (int)maps.size(), max_robots, (int)replays.size(), threads);
+
+    // Strategy parameters, the usual defaults with the separable learning rates
+    const int n = TUNE_DIMS;
+    const int lambda = 4 + (int)(3 * log((double)n));
+    const int mu = lambda / 2;
+    double w[TUNE_DIMS * 4], wsum = 0, w2sum = 0;
+    for (int i = 0; i < mu; i++) {
+        w[i] = log(mu + 0.5) - log(i + 1.0);
+        wsum += w[i];
+    }
+    for (int i = 0; i < mu; i++) {
+        w[i] /= wsum;
+        w2sum += w[i] * w[i];
+    }
+    double mueff = 1.0 / w2sum;
+    double cs = (mueff + 2) / (n + mueff + 5);
+    double ds = 1 + 2 * fmax(0, sqrt((mueff - 1) / (n + 1)) - 1) + cs;
+    double cc = (4 + mueff / n) / (n + 4 + 2 * mueff / n);
+    double c1 = (n + 2) / 3.0 * 2 / ((n + 1.3) * (n + 1.3) + mueff);
+    double cmu = fmin(1 - c1, (n + 2) / 3.0 * 2 * (mueff - 2 + 1 / mueff) / ((n + 2) * (n + 2) + mueff));
+    double chi = sqrt((double)n) * (1 - 1.0 / (4 * n) + 1.0 / (21 * n * n));
+
+    tuneParams defaults;
+    defaultTuning(defaults);
+    double mean[TUNE_DIMS], cov[TUNE_DIMS], ps[TUNE_DIMS], pc[TUNE_DIMS];
+    fromTuning(defaults, mean);
+    for (int d = 0; d < n; d++) {
+        cov[d] = 1;
+        ps[d] = pc[d] = 0;
+    }
+    double sigma = TUNE_SIGMA;
+    rng_state = seed;
+
+    double rate;
+    double best[TUNE_DIMS];
+    double base_cost = evaluate(mean, maps, replays, episodes, max_robots, seed, threads, &rate);
+    double best_cost = base_cost;
+    memcpy(best, mean, sizeof(best));
+    printf("defaults: %.2f s per robot, %.0f%% parked\n", base_cost, rate * 100);
+
+    vector<vector<double> > z(lambda, vector<double>(n)), y(lambda, vector<double>(n));
+    vector<pair<double, int> > ranked(lambda);
+    for (int g = 0; g < generations; g++) {
+        for (int k = 0; k < lambda; k++) {
+            double x[TUNE_DIMS];
+            for (int d = 0; d < n; d++) {
+                z[k][d] = gaussian();
+                y[k][d] = sqrt(cov[d]) * z[k][d];
+                x[d] = mean[d] + sigma * y[k][d];
+            }
+            ranked[k] = make_pair(evaluate(x, maps, replays, episodes, max_robots, seed, threads, NULL), k);
+            if (ranked[k].first < best_cost) {
+                best_cost = ranked[k].first;
+                memcpy(best, x, sizeof(best));
+            }
+        }
+        sort(ranked.begin(), ranked.end());
+
+        // Move the mean towards the best mu and adapt the step and the spread
+        double zw[TUNE_DIMS], yw[TUNE_DIMS], ps_norm = 0;
+        for (int d = 0; d < n; d++) {
+            zw[d] = yw[d] = 0;
+            for (int i = 0; i < mu; i++) {
+                zw[d] += w[i] * z[ranked[i].second][d];
+                yw[d] += w[i] * y[ranked[i].second][d];
+            }
+            mean[d] += sigma * yw[d];
+            ps[d] = (1 - cs) * ps[d] + sqrt(cs * (2 - cs) * mueff) * zw[d];
+            ps_norm += ps[d] * ps[d];
+        }
+        ps_norm = sqrt(ps_norm);
+        bool hsig = ps_norm / sqrt(1 - pow(1 - cs, 2.0 * (g + 1))) / chi < 1.4 + 2.0 / (n + 1);
+        for (int d = 0; d < n; d++) {
+            pc[d] = (1 - cc) * pc[d] + (hsig ? sqrt(cc * (2 - cc) * mueff) * yw[d] : 0);
+            double rank_mu = 0;
+            for (int i = 0; i < mu; i++)
+                rank_mu += w[i] * y[ranked[i].second][d] * y[ranked[i].second][d];
+            cov[d] = (1 - c1 - cmu) * cov[d] + c1 * (pc[d] * pc[d] + (hsig ? 0 : cc * (2 - cc) * cov[d]))
+                     + cmu * rank_mu;
+        }
+        sigma *= exp((cs / ds) * (ps_norm / chi - 1));
+        printf("generation %d: best %.2f, generation best %.2f, step %.4f\n", g + 1, best_cost,
+               ranked[0].first, sigma);
+        fflush(stdout);
+    }
+
+    tuneParams result = defaults;
+    if (best_cost < base_cost)
+        toTuning(best, result);
+    fromTuning(result, best);
+    evaluate(best, maps, replays, episodes, max_robots, seed, threads, &rate);
+    printf("tuned: %.2f s per robot, %.0f%% parked (defaults %.2f s)\n", best_cost, rate * 100, base_cost);
+    double v[TUNE_DIMS] = {result.depth_bound, result.wiggle, result.approach, result.first_max};
+    for (int d = 0; d < n; d++)
+        printf("  %-12s %8.1f\n", names[d], v[d]);
+    printf("  %-12s %8.1f (not tuned)\n", "mar_err", result.mar_err);
+    if (!saveTuning(out_file, result, "parking parameters, written by mkTune")) {
+        printf("Could not write %s\n", out_file);
+        return 1;
+    }
+    printf("Wrote %s\n", out_file);
+    return 0;
+}
+
+// EOF
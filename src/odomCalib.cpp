@@ -0,0 +1,136 @@
+/*
+* odomCalib.cpp
+* - Solving and applying the odometry calibration.
+*
+*   With left and right encoder travel eL, eR the robot really moves
+*       dist = (kL eL + kR eR) / 2
+*       rot  = (kR eR - kL eL) / B
+*   The rotation is linear in kL/B and kR/B: spins give their sum and the
+*   heading drift of the straight moves their difference, both well above
+*   the scan matching noise. The straight moves' length then gives the
+*   mean scale, which fixes B. (The few mm a spin drifts sideways would
+*   also give the difference, but that's lost in the noise.) Repeating the
+*   pattern in both directions cancels most of the slip.
+*/
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "odomCalib.h"
+#include "params.h"
+
+void defaultCalib(odomCalib &calib) {
+    calib.wheel_base = WHEEL_BASE;
+    calib.left_scale = 1.0;
+    calib.right_scale = 1.0;
+    calib.samples = 0;
+    return;
+}
+
+/*
+* solve2
+* - Least squares for p, q in p*a + q*b = c. Returns false if the moves
+*   don't separate the two.
+*/
+static bool solve2(const std::vector<double> &a, const std::vector<double> &b,
+                   const std::vector<double> &c, double &p, double &q) {
+    double aa = 0, ab = 0, bb = 0, ac = 0, bc = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        aa += a[i] * a[i];
+        ab += a[i] * b[i];
+        bb += b[i] * b[i];
+        ac += a[i] * c[i];
+        bc += b[i] * c[i];
+    }
+    double det = aa * bb - ab * ab;
+    if (fabs(det) < 1e-9 * (aa * bb + 1e-12))
+        return false;
+    p = (ac * bb - bc * ab) / det;
+    q = (aa * bc - ab * ac) / det;
+    return true;
+}
+
+/*
+* solveCalib
+* - Fit the calibration to the moves. Returns false (calib untouched) if
+*   the moves don't include both straights and spins.
+*/
+bool solveCalib(const std::vector<calibSample> &samples, odomCalib &calib) {
+    std::vector<double> neg_left, right, rot;
+    double mm = 0, md = 0, ul, ur;
+
+    for (size_t i = 0; i < samples.size(); i++) {
+        const calibSample &s = samples[i];
+        double mean = (s.enc_left + s.enc_right) / 2.0;
+        mm += mean * mean;
+        md += mean * s.scan_dist;
+        neg_left.push_back(-s.enc_left);
+        right.push_back(s.enc_right);
+        rot.push_back(s.scan_rot);
+    }
+    if (mm < 1.0 || !solve2(neg_left, right, rot, ul, ur) || ul + ur <= 0)
+        return false;
+
+    double k = md / mm;
+    calib.wheel_base = 2.0 * k / (ul + ur);
+    calib.left_scale = ul * calib.wheel_base;
+    calib.right_scale = ur * calib.wheel_base;
+    calib.samples = samples.size();
+    return calib.left_scale > 0 && calib.right_scale > 0;
+}
+
+/*
+* loadCalib / saveCalib
+* - Read and write a calibration as a parameter file.
+*/
+bool loadCalib(const char *file, odomCalib &calib) {
+    paramFile params;
+    defaultCalib(calib);
+    if (!loadParams(file, params) || !hasParam(params, "wheel_base"))
+        return false;
+    calib.wheel_base = getParam(params, "wheel_base", WHEEL_BASE);
+    calib.left_scale = getParam(params, "left_scale", 1.0);
+    calib.right_scale = getParam(params, "right_scale", 1.0);
+    calib.samples = (int)getParam(params, "samples", 0);
+    return calib.wheel_base > 0 && calib.left_scale > 0 && calib.right_scale > 0;
+}
+
+bool saveCalib(const char *file, const odomCalib &calib) {
+    paramFile params;
+    clearParams(params);
+    setParam(params, "wheel_base", calib.wheel_base);
+    setParam(params, "left_scale", calib.left_scale);
+    setParam(params, "right_scale", calib.right_scale);
+    setParam(params, "samples", calib.samples);
+    return saveParams(file, params, "odometry calibration, written by autoPark -calibrate");
+}
+
+/*
+* calibFile
+* - File name for a robot's calibration, its name with anything odd
+*   replaced.
+*/
+void calibFile(const char *robot_name, char *file, int size) {
+    int n = 0;
+    const char *name = robot_name != NULL && robot_name[0] != '\0' ? robot_name : "robot";
+    for (; *name != '\0' && n < size - (int)strlen(CALIB_SUFFIX) - 1; name++) {
+        char c = *name;
+        file[n++] = (isalnum((unsigned char)c) || c == '-' || c == '_') ? c : '_';
+    }
+    strcpy(file + n, CALIB_SUFFIX);
+    return;
+}
+
+/*
+* calibWheels
+* - Wheel commands for a path speed and turn rate on the calibrated
+*   robot. The robot holds its encoder speeds to the command, so each
+*   wheel is asked for its true speed over its scale.
+*/
+void calibWheels(const odomCalib &calib, double vel, double omega, double &left, double &right) {
+    left = (vel - omega * calib.wheel_base / 2.0) / calib.left_scale;
+    right = (vel + omega * calib.wheel_base / 2.0) / calib.right_scale;
+    return;
+}
+
+// EOF
@@ -0,0 +1,51 @@
+/*
+* odomCalib.h
+* - Wheel scale and wheel base calibration from scan matched motion.
+*/
+#ifndef ODOMCALIB_H
+#define ODOMCALIB_H
+
+#include <vector>
+#include "autoPark.h"
+
+#define CALIB_SUFFIX ".calib"  //saved as <robot name>.calib
+#define CALIB_DIST 500.0       //mm driven by each straight move
+#define CALIB_ANGLE (PI/2)     //rad turned by each spin
+#define CALIB_REPS 2           //times the pattern is repeated
+#define CALIB_SPIN_SPEED 100.0 //wheel speed while spinning, mm/s
+#define CALIB_SETTLE 500       //ms to stand still before a scan
+#define CALIB_MAX_RMS 40.0     //mm, scan matches worse than this are dropped
+
+/*
+* odomCalib
+* - Effective kinematics. Each wheel really travels scale times what its
+*   encoder says, and the robot turns as if the wheels were wheel_base
+*   apart. That covers turning in place too, spins are in the fit.
+*/
+struct odomCalib {
+    double wheel_base;  //mm
+    double left_scale;
+    double right_scale;
+    int samples;
+};
+
+/*
+* calibSample
+* - One move: wheel travel from the encoders, motion from the scans.
+*/
+struct calibSample {
+    double enc_left, enc_right; //mm
+    double scan_dist;           //mm forward
+    double scan_rot;            //rad, + left
+};
+
+void defaultCalib(odomCalib &calib);
+bool solveCalib(const std::vector<calibSample> &samples, odomCalib &calib);
+bool loadCalib(const char *file, odomCalib &calib);
+bool saveCalib(const char *file, const odomCalib &calib);
+void calibFile(const char *robot_name, char *file, int size);
+void calibWheels(const odomCalib &calib, double vel, double omega, double &left, double &right);
+
+#endif
+
+// EOF
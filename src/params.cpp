@@ -0,0 +1,88 @@
+/*
+* params.cpp
+* - Parameter file reading and writing. Lines are "key value", anything
+*   after a '#' is a comment.
+*/
+#include <cstdio>
+#include <cstring>
+#include "params.h"
+
+void clearParams(paramFile &params) {
+    params.count = 0;
+    return;
+}
+
+/*
+* loadParams
+* - Read a parameter file. Returns false if it can't be opened.
+*/
+bool loadParams(const char *file, paramFile &params) {
+    char line[256];
+    FILE *fp = fopen(file, "r");
+
+    clearParams(params);
+    if (fp == NULL)
+        return false;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char key[PARAM_KEY_LEN];
+        double value;
+        char *hash = strchr(line, '#');
+        if (hash != NULL)
+            *hash = '\0';
+        if (sscanf(line, "%31s %lf", key, &value) == 2)
+            setParam(params, key, value);
+    }
+    fclose(fp);
+    return true;
+}
+
+/*
+* saveParams
+* - Write a parameter file, with an optional comment line at the top.
+*/
+bool saveParams(const char *file, const paramFile &params, const char *comment) {
+    FILE *fp = fopen(file, "w");
+    if (fp == NULL)
+        return false;
+    if (comment != NULL)
+        fprintf(fp, "# %s\n", comment);
+    for (int i = 0; i < params.count; i++)
+        fprintf(fp, "%s %.9g\n", params.entries[i].key, params.entries[i].value);
+    return fclose(fp) == 0;
+}
+
+bool hasParam(const paramFile &params, const char *key) {
+    for (int i = 0; i < params.count; i++)
+        if (strcmp(params.entries[i].key, key) == 0)
+            return true;
+    return false;
+}
+
+double getParam(const paramFile &params, const char *key, double def) {
+    for (int i = 0; i < params.count; i++)
+        if (strcmp(params.entries[i].key, key) == 0)
+            return params.entries[i].value;
+    return def;
+}
+
+/*
+* setParam
+* - Set or add a parameter. Keys past PARAM_MAX are dropped.
+*/
+void setParam(paramFile &params, const char *key, double value) {
+    for (int i = 0; i < params.count; i++) {
+        if (strcmp(params.entries[i].key, key) == 0) {
+            params.entries[i].value = value;
+            return;
+        }
+    }
+    if (params.count >= PARAM_MAX)
+        return;
+    strncpy(params.entries[params.count].key, key, PARAM_KEY_LEN - 1);
+    params.entries[params.count].key[PARAM_KEY_LEN - 1] = '\0';
+    params.entries[params.count].value = value;
+    params.count++;
+    return;
+}
+
+// EOF
@@ -0,0 +1,31 @@
+/*
+* params.h
+* - Small "key value" parameter files for settings that are measured or
+*   tuned per robot instead of compiled in.
+*/
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#define PARAM_MAX 64
+#define PARAM_KEY_LEN 32
+
+struct param {
+    char key[PARAM_KEY_LEN];
+    double value;
+};
+
+struct paramFile {
+    int count;
+    param entries[PARAM_MAX];
+};
+
+void clearParams(paramFile &params);
+bool loadParams(const char *file, paramFile &params);
+bool saveParams(const char *file, const paramFile &params, const char *comment);
+bool hasParam(const paramFile &params, const char *key);
+double getParam(const paramFile &params, const char *key, double def);
+void setParam(paramFile &params, const char *key, double value);
+
+#endif
+
+// EOF
@@ -0,0 +1,242 @@
+/*
+* parkAgent.cpp
+* - Per-robot parking logic.
+*/
+#include <cmath>
+#include "parkAgent.h"
+#include "corners.h"
+#include "tuning.h"
+
+/*
+* ParkAgent
+* - Constructor.
+*/
+ParkAgent::ParkAgent() : depth(0), width(0), type(SLOT_PARALLEL) {
+    for (int i = 0; i < AGENT_READINGS; i++) {
+        readings[i].angle = 0;
+        readings[i].distance = 0;
+    }
+    clearReadings();
+}
+
+/*
+* clearReadings
+* - Forget the last scan and its corners.
+*/
+void ParkAgent::clearReadings() {
+    first.distance = 0;
+    second.distance = 0;
+    third.distance = 0;
+    for (int i = 0; i < AGENT_READINGS; i++)
+        readings[i].distance = 0;
+    return;
+}
+
+/*
+* readSweep
+* - Take the readings from a sweep, with the laser at (sx, sy) on the
+*   robot. Returns how many there are.
+*/
+int ParkAgent::readSweep(const laserSweep &sweep, double sx, double sy) {
+    int n = 0;
+
+    clearReadings();
+    for (int b = 0; b < sweep.count && n < AGENT_READINGS; b++) {
+        if (sweep.ranges[b] == 0)
+            continue;
+        double a = (sweep.start_angle + b * sweep.increment) * PI / 180.0;
+        double x = sx + sweep.ranges[b] * cos(a), y = sy + sweep.ranges[b] * sin(a);
+        double angle = atan2(-y, -x) * 180.0 / PI; //bearing from the point back to the robot
+        if (angle > 89.9) {
+            readings[n].distance = sqrt(x * x + y * y);
+            readings[n].angle = angle;
+            n++;
+        }
+    }
+    orderReadings(n);
+    return n;
+}
+
+/*
+* orderReadings
+* - Reverse the first n readings if they start at 180 instead of 90.
+*/
+void ParkAgent::orderReadings(int n) {
+    if (readings[0].angle > 100.0) {
+        for (int j = 0; j <= n; j++) {
+            double tempAngle = readings[n-j].angle;
+            double tempDist = readings[n-j].distance;
+            readings[n-j].angle = readings[j].angle;
+            readings[n-j].distance = readings[j].distance;
+            readings[j].angle = tempAngle;
+            readings[j].distance = tempDist;
+        }
+    }
+    return;
+}
+
+/*
+* findCorners / found
+* - Find the corners of a slot in the readings, and whether they make one.
+*/
+void ParkAgent::findCorners() {
+    detectCorners(readings, AGENT_READINGS, first, second, third);
+    return;
+}
+
+bool ParkAgent::found() const {
+    return third.distance != 0 && first.angle < tuning.first_max;
+}
+
+/*
+* getDimensions
+* - Depth and width of the slot.
+*/
+void ParkAgent::getDimensions() {
+    slotDimensions(first, second, third, depth, width);
+    return;
+}
+
+/*
+* cornerPoints
+* - The corners as points in the robot frame.
+*/
+void ParkAgent::cornerPoints(double &x1, double &y1, double &x2, double &y2, double &x3, double &y3) const {
+    x1 = -cos(first.angle * PI /180.0) * first.distance;
+    y1 = -sin(first.angle * PI /180.0) * first.distance;
+    x2 = -cos(second.angle * PI /180.0) * second.distance;
+    y2 = -sin(second.angle * PI /180.0) * second.distance;
+    x3 = -cos(third.angle * PI /180.0) * third.distance;
+    y3 = -sin(third.angle * PI /180.0) * third.distance;
+    return;
+}
+
+/*
+* bayAngle / classifySlot
+* - Decide what kind of slot the corners describe. Parallel slots are
+*   longer along the lane than they are deep. Otherwise the side of car 2
+*   (third corner back to the second) gives the bay angle.
+*/
+double ParkAgent::bayAngle() const {
+    double x1, y1, x2, y2, x3, y3;
+    cornerPoints(x1, y1, x2, y2, x3, y3);
+    return atan2(-(y2 - y3), x2 - x3);
+}
+
+void ParkAgent::classifySlot() {
+    double x1, y1, x2, y2, x3, y3;
+    cornerPoints(x1, y1, x2, y2, x3, y3);
+
+    double curb_y = y1 > y3 ? y1 : y3;
+    double bay_angle = bayAngle();
+
+    if (x3 - x1 >= curb_y - y2)
+        type = SLOT_PARALLEL;
+    else if (fabs(bay_angle - PI/2) <= BAY_RIGHT_TOL)
+        type = SLOT_PERPENDICULAR;
+    else
+        type = SLOT_ANGLED;
+    return;
+}
+
+/*
+* slotGeometry
+* - Middle of the slot (th 0, along the lane), its width and depth.
+*/
+void ParkAgent::slotGeometry(pose2d &center, double &slot_width, double &slot_depth) const {
+    double x1, y1, x2, y2, x3, y3;
+    cornerPoints(x1, y1, x2, y2, x3, y3);
+
+    double curb_y = y1 > y3 ? y1 : y3;
+    center.x = (x1 + x3) / 2.0;
+    center.y = (curb_y + y2) / 2.0;
+    center.th = 0;
+    slot_width = x3 - x1;
+    slot_depth = curb_y - y2;
+    return;
+}
+
+/*
+* parallelSlot
+* - The slot for planMultiPoint(), using whichever car sticks out further.
+*/
+void ParkAgent::parallelSlot(parkSlot &slot) const {
+    double x1, y1, x2, y2, x3, y3;
+    cornerPoints(x1, y1, x2, y2, x3, y3);
+
+    slot.car1_x = x1;
+    slot.car2_x = x3;
+    slot.wall_y = y2;
+    slot.curb_y = y3 > y1 ? y3 : y1;
+    return;
+}
+
+/*
+* bay
+* - The bay for planBay().
+*/
+void ParkAgent::bay(baySlot &out) const {
+    double x1, y1, x2, y2, x3, y3;
+    cornerPoints(x1, y1, x2, y2, x3, y3);
+
+    out.curb_y = y1 > y3 ? y1 : y3;
+    out.entry_x = (x1 + x3) / 2.0;
+    out.angle = type == SLOT_PERPENDICULAR ? PI/2 : bayAngle();
+    out.width = (x3 - x1) * sin(out.angle);
+    out.depth = (out.curb_y - y2) / sin(out.angle);
+    return;
+}
+
+/*
+* planParallel
+* - The two circle maneuver: drive up to the start of the first circle,
+*   then reverse along both.
+*/
+void ParkAgent::planParallel(std::vector<pathSeg> &path, parallelPlan &plan) const {
+    // TODO: Combine variables once we know they are individually correct
+    plan.first_car_x = -cos(first.angle * PI /180.0) * first.distance;
+    plan.wall_y = -sin(second.angle * PI /180.0) * second.distance;
+    plan.circle1_x = plan.first_car_x + ROBOT_BACK;
+    plan.circle1_y = plan.wall_y + ROBOT_RADIUS + TURNING_RADIUS + tuning.wiggle;
+    plan.circle2_y = -TURNING_RADIUS;
+    plan.xtangent = plan.circle1_x + sqrt(pow(TURNING_RADIUS,2.0) - pow(((plan.circle2_y - plan.circle1_y)/2),2.0));
+    plan.circle2_x = (2.0 * plan.xtangent) - plan.circle1_x;
+    plan.turn_angle = atan2(plan.circle1_y - plan.circle2_y, plan.circle2_x - plan.circle1_x);
+
+    double A = plan.turn_angle;
+    pathSeg approach = {fabs(plan.circle2_x - tuning.approach), 0.0, (plan.circle2_x - tuning.approach) < 0 ? -1 : 1};
+    pathSeg arc1 = {TURNING_RADIUS * ((PI/2) - A), -1.0 / TURNING_RADIUS, -1};
+    pathSeg arc2 = {TURNING_RADIUS * ((PI/2) - A), 1.0 / TURNING_RADIUS, -1};
+    path.clear();
+    path.push_back(approach);
+    path.push_back(arc1);
+    path.push_back(arc2);
+    return;
+}
+
+/*
+* planPark
+* - Pick and plan the maneuver for the slot found, the way main() does:
+*   bays, then the two circles if the slot is wide enough, otherwise
+*   multi-point. Returns which (AGENT_NONE if there's no slot or no path).
+*/
+int ParkAgent::planPark(std::vector<pathSeg> &path, const planTable *table) const {
+    path.clear();
+    if (!found())
+        return AGENT_NONE;
+    if (type != SLOT_PARALLEL) {
+        baySlot b;
+        bay(b);
+        return planBay(b, path) ? AGENT_BAY : AGENT_NONE;
+    }
+    if (width > AGENT_PARALLEL_MIN) {
+        parallelPlan plan;
+        planParallel(path, plan);
+        return std::isfinite(plan.xtangent) ? AGENT_TWO_ARC : AGENT_NONE;
+    }
+    parkSlot slot;
+    parallelSlot(slot);
+    return planMultiPoint(slot, path, table) ? AGENT_MULTI_POINT : AGENT_NONE;
+}
+
+// EOF
@@ -0,0 +1,69 @@
+/*
+* parkAgent.h
+* - One robot's parking logic: the readings of its last scan, the corners
+*   and slot they describe, and the maneuver for that slot. No robot or
+*   laser calls, so autoPark and the lot simulator share it, one per robot.
+*/
+#ifndef PARKAGENT_H
+#define PARKAGENT_H
+
+#include <vector>
+#include "autoPark.h"
+#include "parkPlan.h"
+#include "scanBus.h"
+
+#define AGENT_READINGS 400
+#define AGENT_PARALLEL_MIN (ROBOT_RADIUS * 2 + 150) //Narrower slots need the multi-point maneuver
+
+// Maneuvers planPark() picks
+#define AGENT_NONE 0
+#define AGENT_TWO_ARC 1
+#define AGENT_MULTI_POINT 2
+#define AGENT_BAY 3
+
+/*
+* parallelPlan
+* - parkRobot()'s two circles: drive up to circle 2, reverse along both.
+*/
+struct parallelPlan {
+    double first_car_x, wall_y;
+    double circle1_x, circle1_y;
+    double circle2_x, circle2_y;
+    double xtangent;
+    double turn_angle;
+};
+
+/*
+* ParkAgent
+* - Everything is in the robot frame at the time of the scan. Readings
+*   are (bearing back to the robot, distance) pairs from 90 degrees round
+*   to 180, as detectCorners() wants them.
+*/
+class ParkAgent {
+public:
+    ParkAgent();
+    void clearReadings();
+    int readSweep(const laserSweep &sweep, double sx, double sy);
+    void orderReadings(int n);
+    void findCorners();
+    bool found() const;
+    void getDimensions();
+    void classifySlot();
+
+    void cornerPoints(double &x1, double &y1, double &x2, double &y2, double &x3, double &y3) const;
+    double bayAngle() const;
+    void slotGeometry(pose2d &center, double &width, double &depth) const;
+    void parallelSlot(parkSlot &slot) const;
+    void bay(baySlot &bay) const;
+    void planParallel(std::vector<pathSeg> &path, parallelPlan &plan) const;
+    int planPark(std::vector<pathSeg> &path, const planTable *table) const;
+
+    reading readings[AGENT_READINGS];
+    reading first, second, third;
+    double depth, width;
+    slotType type;
+};
+
+#endif
+
+// EOF
@@ -0,0 +1,450 @@
+/*
+* parkPlan.cpp
+* - Multi-point parallel parking planner, and the planner for
+*   perpendicular and angled bays.
+*
+*   The search runs backwards: starting parked in the slot, it looks for
+*   the shortest sequence of forward/reverse moves on the turning circle
+*   (or straight) that gets the robot back out to the lane it scanned
+*   from. Every move is driven until just before a collision, or half of
+*   that. The lane is reached with two opposite arcs, the same shape the
+*   single maneuver in parkRobot() uses. Reversing the escape gives the
+*   parking maneuver.
+*
+*   Slots are rounded to PLAN_QUANT (always towards less room) so a plan
+*   can be cached and reused for every slot in the same bucket.
+*/
+#include <cmath>
+#include <map>
+#include <set>
+#include <vector>
+#include "parkPlan.h"
+#include "planTable.h"
+
+using namespace std;
+
+struct box {
+    double xmin, xmax, ymin, ymax;
+};
+
+struct planNode {
+    pose2d p;
+    pathSeg seg;  //move that reached this node from its parent
+    int parent;
+    int depth;
+};
+
+struct cachedPlan {
+    bool found;
+    std::vector<pathSeg> escape; //from the parked pose out to the lane
+    double exit_x;               //lane x the escape ends at, relative to car1_x
+};
+
+// One per thread, so the lot simulator can plan for several robots at once.
+// Plans depend on the margin too, so the cache is dropped when it changes.
+static thread_local std::map<long long, cachedPlan> plan_cache;
+static thread_local double plan_cache_margin = MAR_ERR;
+
+/*
+* advancePose
+* - Move a pose s mm along a path segment (s <= seg.length).
+*/
+void advancePose(pose2d &p, const pathSeg &seg, double s) {
+    double d = seg.dir * s;
+    double k = seg.curvature;
+
+    if (fabs(k) < 1e-9) {
+        p.x += d * cos(p.th);
+        p.y += d * sin(p.th);
+        return;
+    }
+    double th = p.th + d * k;
+    p.x += (sin(th) - sin(p.th)) / k;
+    p.y -= (cos(th) - cos(p.th)) / k;
+    p.th = th;
+    return;
+}
+
+/*
+* boxDistance
+* - Distance from a point to an axis aligned box, 0 inside.
+*/
+static double boxDistance(const box &b, double x, double y) {
+    double dx = 0, dy = 0;
+    if (x < b.xmin) dx = b.xmin - x;
+    if (x > b.xmax) dx = x - b.xmax;
+    if (y < b.ymin) dy = b.ymin - y;
+    if (y > b.ymax) dy = y - b.ymax;
+    return sqrt(dx * dx + dy * dy);
+}
+
+/*
+* slotPoseFree
+* - True if the robot (a disc) at p clears both cars and the wall.
+*/
+bool slotPoseFree(const parkSlot &slot, const pose2d &p) {
+    double r = ROBOT_RADIUS + PLAN_CLEARANCE;
+    box car1 = {-1e9, slot.car1_x, -1e9, slot.curb_y};
+    box car2 = {slot.car2_x, 1e9, -1e9, slot.curb_y};
+
+    if (p.y - r < slot.wall_y)
+        return false;
+    return boxDistance(car1, p.x, p.y) >= r && boxDistance(car2, p.x, p.y) >= r;
+}
+
+/*
+* freeLength
+* - How far the robot can follow a segment from p before colliding,
+*   up to cap.
+*/
+static double freeLength(const parkSlot &slot, const pose2d &p, pathSeg seg, double cap) {
+    double s = 0;
+    while (s + PLAN_STEP <= cap) {
+        pose2d q = p;
+        advancePose(q, seg, s + PLAN_STEP);
+        if (!slotPoseFree(slot, q))
+            break;
+        s += PLAN_STEP;
+    }
+    return s;
+}
+
+/*
+* segmentsFree
+* - Collision check a list of segments starting at p, p is left at the end.
+*/
+static bool segmentsFree(const parkSlot &slot, pose2d &p, const std::vector<pathSeg> &segs) {
+    for (size_t i = 0; i < segs.size(); i++) {
+        for (double s = PLAN_STEP; s < segs[i].length; s += PLAN_STEP) {
+            pose2d q = p;
+            advancePose(q, segs[i], s);
+            if (!slotPoseFree(slot, q))
+                return false;
+        }
+        advancePose(p, segs[i], segs[i].length);
+        if (!slotPoseFree(slot, p))
+            return false;
+    }
+    return true;
+}
+
+/*
+* exitToLane
+* - Try to reach the lane (y = 0, heading 0) from p with two opposite
+*   arcs, driving in direction dir. On success the arcs are appended to
+*   segs and the lane x is returned in exit_x.
+*/
+static bool exitToLane(const parkSlot &slot, const pose2d &p, int dir,
+                       std::vector<pathSeg> &segs, double &exit_x) {
+    double R = TURNING_RADIUS;
+    double th = dir * p.th;
+    double c = (R * (cos(p.th) + 1.0) + p.y) / (2.0 * R);
+
+    if (c < -1.0 || c > 1.0)
+        return false;
+    double alpha = acos(c);
+    if (alpha < th)
+        return false;
+
+    std::vector<pathSeg> arcs;
+    pathSeg first = {R * (alpha - th), 1.0 / R, dir};
+    pathSeg second = {R * alpha, -1.0 / R, dir};
+    if (first.length > 0)
+        arcs.push_back(first);
+    if (second.length > 0)
+        arcs.push_back(second);
+
+    pose2d q = p;
+    if (!segmentsFree(slot, q, arcs))
+        return false;
+    if (fabs(q.y) > 1.0 || fabs(q.th) > 0.01)
+        return false;
+
+    segs.insert(segs.end(), arcs.begin(), arcs.end());
+    exit_x = q.x;
+    return true;
+}
+
+/*
+* stateKey
+* - Quantized pose used to avoid expanding the same state twice.
+*/
+static long long stateKey(const pose2d &p) {
+    long long qx = (long long)floor(p.x / PLAN_QUANT);
+    long long qy = (long long)floor(p.y / PLAN_QUANT);
+    long long qt = (long long)floor(p.th / (3.0 * PI / 180.0));
+    return (qx & 0xFFFFF) | ((qy & 0xFFFFF) << 20) | ((qt & 0xFFFFF) << 40);
+}
+
+/*
+* searchEscape
+* - Breadth first search from start for the escape with the fewest
+*   moves. The escape ends on the lane at exit_x.
+*/
+static bool searchEscape(const parkSlot &slot, const pose2d &start, std::vector<pathSeg> &escape, double &exit_x) {
+    std::vector<planNode> nodes;
+    std::set<long long> visited;
+    double R = TURNING_RADIUS;
+    double curvatures[3] = {1.0 / R, 0.0, -1.0 / R};
+
+    escape.clear();
+    exit_x = 0;
+
+    planNode root;
+    root.p = start;
+    root.parent = -1;
+    root.depth = 0;
+    if (!slotPoseFree(slot, root.p))
+        return false;
+    nodes.push_back(root);
+    visited.insert(stateKey(root.p));
+
+    for (size_t head = 0; head < nodes.size() && head < MAX_PLAN_NODES; head++) {
+        planNode n = nodes[head];
+
+        // Can we leave from here?
+        for (int dir = 1; dir >= -1; dir -= 2) {
+            std::vector<pathSeg> exit;
+            if (exitToLane(slot, n.p, dir, exit, exit_x)) {
+                for (int i = head; nodes[i].parent >= 0; i = nodes[i].parent)
+                    escape.insert(escape.begin(), nodes[i].seg);
+                escape.insert(escape.end(), exit.begin(), exit.end());
+                return true;
+            }
+        }
+        if (n.depth >= MAX_PLAN_SEGMENTS)
+            continue;
+
+        // Expand every move direction and curvature
+        for (int dir = 1; dir >= -1; dir -= 2) {
+            for (int k = 0; k < 3; k++) {
+                if (n.parent >= 0 && n.seg.dir == dir && n.seg.curvature == curvatures[k])
+                    continue;
+                pathSeg seg = {0, curvatures[k], dir};
+                double cap = curvatures[k] == 0 ? MAX_LINE_LEN : R * PI / 2.0;
+                double len = freeLength(slot, n.p, seg, cap);
+                for (int half = 0; half < 2; half++, len /= 2.0) {
+                    if (len < MIN_SEG_LEN)
+                        break;
+                    planNode child;
+                    child.seg = seg;
+                    child.seg.length = len;
+                    child.p = n.p;
+                    advancePose(child.p, child.seg, len);
+                    child.parent = head;
+                    child.depth = n.depth + 1;
+                    if (visited.insert(stateKey(child.p)).second)
+                        nodes.push_back(child);
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/*
+* planEscape
+* - The escape from the parked pose, the middle of the slot the margin
+*   off the wall. Slot is relative to car1_x = 0.
+*/
+bool planEscape(const parkSlot &slot, std::vector<pathSeg> &escape, double &exit_x) {
+    pose2d parked;
+    parked.x = (slot.car1_x + slot.car2_x) / 2.0;
+    parked.y = slot.wall_y + ROBOT_RADIUS + tuning.mar_err;
+    parked.th = 0;
+    return searchEscape(slot, parked, escape, exit_x);
+}
+
+/*
+* planExit
+* - The escape from wherever the robot really is in the slot, for
+*   leaving it. A robot parked closer to something than the planner's
+*   clearance is already there, so the slot is widened just enough for
+*   the start to count as free; every move after that keeps the full
+*   clearance. The path is driven as it is.
+*/
+bool planExit(const parkSlot &slot, const pose2d &start, std::vector<pathSeg> &path, double &exit_x) {
+    double r = ROBOT_RADIUS + PLAN_CLEARANCE;
+    parkSlot room = slot;
+
+    room.car1_x = fmin(room.car1_x, start.x - r);
+    room.car2_x = fmax(room.car2_x, start.x + r);
+    room.wall_y = fmin(room.wall_y, start.y - r);
+    return searchEscape(room, start, path, exit_x);
+}
+
+/*
+* escapeToPath
+* - Turn an escape into the parking path: drive along the lane to where
+*   the escape ended, then run it backwards.
+*/
+void escapeToPath(double lane_x, const std::vector<pathSeg> &escape, std::vector<pathSeg> &path) {
+    path.clear();
+    if (fabs(lane_x) > 0) {
+        pathSeg lane = {fabs(lane_x), 0.0, lane_x < 0 ? -1 : 1};
+        path.push_back(lane);
+    }
+    for (int i = (int)escape.size() - 1; i >= 0; i--) {
+        pathSeg back = escape[i];
+        back.dir = -back.dir;
+        path.push_back(back);
+    }
+    return;
+}
+
+/*
+* parkedFree
+* - Collision check a parking path (car1_x = 0) from the lane at exit_x,
+*   and check it ends square, within PLAN_QUANT of the depth the search
+*   parks at.
+*/
+bool parkedFree(const parkSlot &slot, double exit_x, const std::vector<pathSeg> &path) {
+    pose2d p = {exit_x, 0, 0};
+    if (!segmentsFree(slot, p, path))
+        return false;
+    return fabs(p.th) < 3.0 * PI / 180.0 &&
+           fabs(p.y - (slot.wall_y + ROBOT_RADIUS + tuning.mar_err)) < PLAN_QUANT;
+}
+
+/*
+* planMultiPoint
+* - Plan a forward/reverse maneuver from the scan pose (0,0,0) into the
+*   slot. Slots inside the precomputed table (if one is given) are looked
+*   up, the rest are searched. Returns false if no maneuver within the
+*   search bounds fits.
+*/
+bool planMultiPoint(const parkSlot &slot, std::vector<pathSeg> &path, const planTable *table) {
+    std::vector<pathSeg> escape;
+    double exit_x;
+
+    // Slot relative to car 1
+    parkSlot rel = slot;
+    rel.car1_x = 0;
+    rel.car2_x = slot.car2_x - slot.car1_x;
+
+    int hit = table ? lookupPlan(*table, rel, escape, exit_x) : PLAN_MISS;
+    if (hit == PLAN_NONE)
+        return false;
+    if (hit == PLAN_FOUND) {
+        escapeToPath(slot.car1_x + exit_x, escape, path);
+        return true;
+    }
+
+    // Round the slot towards less room so the plan fits every slot in the bucket
+    parkSlot q;
+    q.car1_x = 0;
+    q.car2_x = floor(rel.car2_x / PLAN_QUANT) * PLAN_QUANT;
+    q.curb_y = ceil(slot.curb_y / PLAN_QUANT) * PLAN_QUANT;
+    q.wall_y = q.curb_y - floor((slot.curb_y - slot.wall_y) / PLAN_QUANT) * PLAN_QUANT;
+
+    long long key = ((long long)(q.car2_x / PLAN_QUANT) & 0xFFFFF)
+                  | (((long long)(-q.curb_y / PLAN_QUANT) & 0xFFFFF) << 20)
+                  | (((long long)((q.curb_y - q.wall_y) / PLAN_QUANT) & 0xFFFFF) << 40);
+
+    if (plan_cache_margin != tuning.mar_err) {
+        plan_cache.clear();
+        plan_cache_margin = tuning.mar_err;
+    }
+    std::map<long long, cachedPlan>::iterator it = plan_cache.find(key);
+    if (it == plan_cache.end()) {
+        if (plan_cache.size() >= MAX_PLAN_CACHE)
+            plan_cache.clear();
+        cachedPlan plan;
+        plan.found = planEscape(q, plan.escape, plan.exit_x);
+        it = plan_cache.insert(std::make_pair(key, plan)).first;
+    }
+    if (!it->second.found)
+        return false;
+    escapeToPath(slot.car1_x + it->second.exit_x, it->second.escape, path);
+    return true;
+}
+
+/*
+* bayPointFree
+* - True if a point is in the lane or inside the bay.
+*/
+static bool bayPointFree(const baySlot &bay, double x, double y) {
+    if (y >= bay.curb_y)
+        return true;
+    double dx = x - bay.entry_x, dy = y - bay.curb_y;
+    double u = dx * cos(bay.angle) - dy * sin(bay.angle);  //along the bay
+    double v = dx * sin(bay.angle) + dy * cos(bay.angle);  //across it
+    return u <= bay.depth && fabs(v) <= bay.width / 2.0;
+}
+
+/*
+* bayPoseFree
+* - True if the robot (a disc) at p is clear of the cars either side of
+*   the bay and its back wall. Checks the center and 16 points on the rim.
+*/
+bool bayPoseFree(const baySlot &bay, const pose2d &p) {
+    double r = ROBOT_RADIUS + PLAN_CLEARANCE;
+
+    if (!bayPointFree(bay, p.x, p.y))
+        return false;
+    for (int i = 0; i < 16; i++) {
+        double a = i * PI / 8.0;
+        if (!bayPointFree(bay, p.x + r * cos(a), p.y + r * sin(a)))
+            return false;
+    }
+    return true;
+}
+
+/*
+* planBay
+* - Plan from the scan pose (0,0,0) into a bay: along the lane, one arc
+*   onto the bay's center line, then straight in. Bays leaning forward (or
+*   square) are entered forwards, bays leaning back are reversed into.
+*   Returns false if the bay is too small or the path collides.
+*/
+bool planBay(const baySlot &bay, std::vector<pathSeg> &path) {
+    double s = sin(bay.angle), c = cos(bay.angle);
+    double r = ROBOT_RADIUS + PLAN_CLEARANCE;
+
+    path.clear();
+    if (bay.width < 2.0 * r || s < 0.1)
+        return false;
+
+    // Stop with the robot's edge the margin off the back wall
+    double goal_t = bay.depth - ROBOT_RADIUS - tuning.mar_err;
+    if (goal_t < ROBOT_RADIUS)
+        return false;
+
+    int dir = bay.angle <= PI / 2.0 + BAY_RIGHT_TOL ? 1 : -1;
+    double turn = dir > 0 ? bay.angle : PI - bay.angle;
+    pathSeg arc = {TURNING_RADIUS * turn, -1.0 / TURNING_RADIUS, dir};
+
+    // The arc's shape doesn't depend on where it starts along the lane, so
+    // slide it until it ends on the center line
+    pose2d end = {0, 0, 0};
+    advancePose(end, arc, arc.length);
+    double t = (bay.curb_y - end.y) / s;
+    double start_x = bay.entry_x + t * c - end.x;
+    if (t > goal_t)
+        return false;
+
+    if (fabs(start_x) > 0) {
+        pathSeg lane = {fabs(start_x), 0.0, start_x < 0 ? -1 : 1};
+        path.push_back(lane);
+    }
+    path.push_back(arc);
+    if (goal_t - t > 0) {
+        pathSeg in = {goal_t - t, 0.0, dir};
+        path.push_back(in);
+    }
+
+    // Check the whole path against the cars and the back wall
+    pose2d p = {0, 0, 0};
+    for (size_t i = 0; i < path.size(); i++) {
+        for (double d = PLAN_STEP; d < path[i].length; d += PLAN_STEP) {
+            pose2d q = p;
+            advancePose(q, path[i], d);
+            if (!bayPoseFree(bay, q))
+                return false;
+        }
+        advancePose(p, path[i], path[i].length);
+    }
+    return bayPoseFree(bay, p);
+}
+
+// EOF
@@ -0,0 +1,68 @@
+/*
+* parkPlan.h
+* - Multi-point parallel parking planner for slots too short for the
+*   single two-circle maneuver in parkRobot(), and the planner for
+*   perpendicular and angled bays.
+*/
+#ifndef PARKPLAN_H
+#define PARKPLAN_H
+
+#include <vector>
+#include "autoPark.h"
+#include "tuning.h"
+
+// Planner limits
+#define MAX_PLAN_SEGMENTS 7   //Most segments (not counting the exit) in a maneuver
+#define MAX_PLAN_NODES 20000  //Search nodes expanded before giving up
+#define MAX_PLAN_CACHE 64     //Slot geometries remembered between calls
+#define PLAN_QUANT 20.0       //Slot geometry is rounded (conservatively) to this, mm
+#define PLAN_CLEARANCE (tuning.mar_err / 2.0) //Extra room kept around the robot, mm
+#define PLAN_STEP 10.0        //Collision check spacing along a segment, mm
+#define MIN_SEG_LEN 30.0      //Shorter moves aren't worth a stop, mm
+#define MAX_LINE_LEN 1000.0   //Longest straight primitive, mm
+
+#define BAY_RIGHT_TOL (10.0 * PI / 180.0) //Bays this close to 90 degrees count as perpendicular
+
+/*
+* parkSlot
+* - A parallel slot on the right of the robot: car 1 ends at car1_x, car 2
+*   starts at car2_x, both cars' outer sides are on curb_y and the wall is
+*   at wall_y.
+*/
+struct parkSlot {
+    double car1_x;
+    double car2_x;
+    double curb_y;
+    double wall_y;
+};
+
+/*
+* baySlot
+* - A perpendicular or angled bay on the right of the robot. The opening
+*   is centered on entry_x on the curb line and the bay runs into the lot
+*   at angle (radians clockwise from the lane, PI/2 when perpendicular).
+*   Width is across the bay, depth along it.
+*/
+struct baySlot {
+    double entry_x;
+    double curb_y;
+    double angle;
+    double width;
+    double depth;
+};
+
+struct planTable;
+
+void advancePose(pose2d &p, const pathSeg &seg, double s);
+bool slotPoseFree(const parkSlot &slot, const pose2d &p);
+bool planEscape(const parkSlot &slot, std::vector<pathSeg> &escape, double &exit_x);
+bool planExit(const parkSlot &slot, const pose2d &start, std::vector<pathSeg> &path, double &exit_x);
+void escapeToPath(double lane_x, const std::vector<pathSeg> &escape, std::vector<pathSeg> &path);
+bool parkedFree(const parkSlot &slot, double exit_x, const std::vector<pathSeg> &path);
+bool planMultiPoint(const parkSlot &slot, std::vector<pathSeg> &path, const planTable *table = NULL);
+bool bayPoseFree(const baySlot &bay, const pose2d &p);
+bool planBay(const baySlot &bay, std::vector<pathSeg> &path);
+
+#endif
+
+// EOF
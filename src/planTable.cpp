@@ -0,0 +1,253 @@
+/*
+* planTable.cpp
+* - Precomputed multi-point parking plans.
+*
+*   mkPlans runs planEscape() for every slot on a PLAN_QUANT grid of
+*   width, curb offset and depth and writes the results to plans.bin,
+*   which is mapped at start up. A lookup interpolates the segment
+*   lengths between the eight grid points around the slot when they all
+*   share one maneuver shape, and keeps the result if it checks free in
+*   the real slot. Otherwise the grid point with less room on every axis
+*   is used as is, which is the plan the live planner would have found.
+*   Slots outside the grid are left to the live planner.
+*/
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include "planTable.h"
+
+using namespace std;
+
+/*
+* gridSlot
+* - The slot at a grid point, car 1 at x = 0.
+*/
+static parkSlot gridSlot(const planTableHeader &header, int w, int o, int d) {
+    parkSlot slot;
+    slot.car1_x = 0;
+    slot.car2_x = header.min[0] + w * header.step;
+    slot.curb_y = -(header.min[1] + o * header.step);
+    slot.wall_y = slot.curb_y - (header.min[2] + d * header.step);
+    return slot;
+}
+
+/*
+* generatePlanTable
+* - Plan every grid slot, spread over threads.
+*/
+void generatePlanTable(planTableHeader &header, std::vector<planEntry> &entries, int threads) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PLAN_TABLE_MAGIC, 4);
+    header.version = PLAN_TABLE_VERSION;
+    header.segs = PLAN_TABLE_SEGS;
+    header.turning_radius = TURNING_RADIUS;
+    header.robot_radius = ROBOT_RADIUS;
+    header.clearance = PLAN_CLEARANCE;
+    header.step = PLAN_QUANT;
+    header.min[0] = PLAN_WIDTH_MIN;
+    header.min[1] = PLAN_OFFSET_MIN;
+    header.min[2] = PLAN_DEPTH_MIN;
+    header.count[0] = PLAN_WIDTH_COUNT;
+    header.count[1] = PLAN_OFFSET_COUNT;
+    header.count[2] = PLAN_DEPTH_COUNT;
+
+    int total = PLAN_WIDTH_COUNT * PLAN_OFFSET_COUNT * PLAN_DEPTH_COUNT;
+    entries.assign(total, planEntry());
+    memset(&entries[0], 0, total * sizeof(planEntry));
+
+    atomic<int> next(0);
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(thread([&]() {
+            std::vector<pathSeg> escape;
+            double exit_x;
+            for (int i = next++; i < total; i = next++) {
+                int d = i % PLAN_DEPTH_COUNT;
+                int o = i / PLAN_DEPTH_COUNT % PLAN_OFFSET_COUNT;
+                int w = i / PLAN_DEPTH_COUNT / PLAN_OFFSET_COUNT;
+                planEntry &e = entries[i];
+                if (!planEscape(gridSlot(header, w, o, d), escape, exit_x) ||
+                    escape.size() > PLAN_TABLE_SEGS)
+                    continue;
+                e.found = 1;
+                e.num_segs = escape.size();
+                e.exit_x = exit_x;
+                for (size_t s = 0; s < escape.size(); s++) {
+                    e.segs[s].length = escape[s].length;
+                    e.segs[s].turn = escape[s].curvature > 0 ? 1 : escape[s].curvature < 0 ? -1 : 0;
+                    e.segs[s].dir = escape[s].dir;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+    return;
+}
+
+/*
+* writePlanTable
+* - Save a plan table. Returns false on a write error.
+*/
+bool writePlanTable(const char *file, const planTableHeader &header, const std::vector<planEntry> &entries) {
+    FILE *fp = fopen(file, "wb");
+    if (fp == NULL)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(&entries[0], sizeof(planEntry), entries.size(), fp) == entries.size();
+    fclose(fp);
+    return ok;
+}
+
+/*
+* mapPlanTable
+* - Map a table written by mkPlans. Tables built for another robot size,
+*   turning radius or grid are rejected.
+*/
+bool mapPlanTable(const char *file, planTable &table) {
+    struct stat st;
+
+    table.header = NULL;
+    table.entries = NULL;
+    table.size = 0;
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(planTableHeader)) {
+        close(fd);
+        return false;
+    }
+    void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return false;
+
+    const planTableHeader *h = (const planTableHeader *)mem;
+    size_t total = (size_t)h->count[0] * h->count[1] * h->count[2];
+    bool ok = memcmp(h->magic, PLAN_TABLE_MAGIC, 4) == 0 &&
+              h->version == PLAN_TABLE_VERSION &&
+              h->segs == PLAN_TABLE_SEGS &&
+              h->turning_radius == (float)TURNING_RADIUS &&
+              h->robot_radius == (float)ROBOT_RADIUS &&
+              h->clearance == (float)PLAN_CLEARANCE &&
+              h->step == (float)PLAN_QUANT &&
+              h->count[0] >= 2 && h->count[1] >= 2 && h->count[2] >= 2 &&
+              (size_t)st.st_size == sizeof(planTableHeader) + total * sizeof(planEntry);
+    if (!ok) {
+        munmap(mem, st.st_size);
+        return false;
+    }
+    table.header = h;
+    table.entries = (const planEntry *)(h + 1);
+    table.size = st.st_size;
+    return true;
+}
+
+void unmapPlanTable(planTable &table) {
+    if (table.header != NULL)
+        munmap((void *)table.header, table.size);
+    table.header = NULL;
+    table.entries = NULL;
+    table.size = 0;
+    return;
+}
+
+/*
+* entryEscape
+* - Unpack an entry.
+*/
+static void entryEscape(const planEntry &e, std::vector<pathSeg> &escape, double &exit_x) {
+    escape.resize(e.num_segs);
+    for (int s = 0; s < e.num_segs; s++) {
+        escape[s].length = e.segs[s].length;
+        escape[s].curvature = e.segs[s].turn / TURNING_RADIUS;
+        escape[s].dir = e.segs[s].dir;
+    }
+    exit_x = e.exit_x;
+    return;
+}
+
+/*
+* sameShape
+* - True if two entries have the same moves, differing only in length.
+*/
+static bool sameShape(const planEntry &a, const planEntry &b) {
+    if (!a.found || !b.found || a.num_segs != b.num_segs)
+        return false;
+    for (int s = 0; s < a.num_segs; s++) {
+        if (a.segs[s].turn != b.segs[s].turn || a.segs[s].dir != b.segs[s].dir)
+            return false;
+    }
+    return true;
+}
+
+/*
+* lookupPlan
+* - Find the escape for a slot (car1_x = 0) in the table. Returns
+*   PLAN_MISS when the slot is off the grid.
+*/
+int lookupPlan(const planTable &table, const parkSlot &slot, std::vector<pathSeg> &escape, double &exit_x) {
+    if (table.header == NULL)
+        return PLAN_MISS;
+
+    const planTableHeader &h = *table.header;
+    double g[3] = {slot.car2_x, -slot.curb_y, slot.curb_y - slot.wall_y};
+    int cell[3], low[3];
+    double frac[3];
+    for (int a = 0; a < 3; a++) {
+        double u = (g[a] - h.min[a]) / h.step;
+        if (u < 0 || u > h.count[a] - 1)
+            return PLAN_MISS;
+        low[a] = (int)u;
+        cell[a] = low[a] < h.count[a] - 1 ? low[a] : h.count[a] - 2;
+        frac[a] = u - cell[a];
+    }
+    const planEntry &base = table.entries[((size_t)low[0] * h.count[1] + low[1]) * h.count[2] + low[2]];
+
+    // The eight grid points around the slot, base is the one with less room on every axis
+    const planEntry *corner[8];
+    for (int c = 0; c < 8; c++) {
+        int w = cell[0] + (c >> 2 & 1), o = cell[1] + (c >> 1 & 1), d = cell[2] + (c & 1);
+        corner[c] = &table.entries[((size_t)w * h.count[1] + o) * h.count[2] + d];
+    }
+
+    bool blend = true;
+    for (int c = 0; c < 8 && blend; c++)
+        blend = sameShape(base, *corner[c]);
+    if (blend) {
+        std::vector<pathSeg> path;
+        escape.resize(base.num_segs);
+        exit_x = 0;
+        for (int s = 0; s <= base.num_segs; s++) {
+            double v = 0;
+            for (int c = 0; c < 8; c++) {
+                double wgt = (c & 4 ? frac[0] : 1 - frac[0]) * (c & 2 ? frac[1] : 1 - frac[1]) *
+                             (c & 1 ? frac[2] : 1 - frac[2]);
+                v += wgt * (s < base.num_segs ? corner[c]->segs[s].length : corner[c]->exit_x);
+            }
+            if (s < base.num_segs) {
+                escape[s].length = v;
+                escape[s].curvature = base.segs[s].turn / TURNING_RADIUS;
+                escape[s].dir = base.segs[s].dir;
+            }
+            else
+                exit_x = v;
+        }
+        escapeToPath(0, escape, path);
+        if (parkedFree(slot, exit_x, path))
+            return PLAN_FOUND;
+    }
+
+    if (!base.found)
+        return PLAN_NONE;
+    entryEscape(base, escape, exit_x);
+    return PLAN_FOUND;
+}
+
+// EOF
@@ -0,0 +1,87 @@
+/*
+* planTable.h
+* - Precomputed multi-point parking plans, looked up by slot geometry
+*   instead of searched for while the robot waits.
+*/
+#ifndef PLANTABLE_H
+#define PLANTABLE_H
+
+#include <cstddef>
+#include <vector>
+#include "autoPark.h"
+#include "parkPlan.h"
+
+// Table layout
+#define PLAN_TABLE_MAGIC "APPL"
+#define PLAN_TABLE_VERSION 1
+#define PLAN_TABLE_FILE "plans.bin"
+#define PLAN_TABLE_SEGS (MAX_PLAN_SEGMENTS + 2) //search moves plus the two exit arcs
+
+// Grid, one entry every PLAN_QUANT mm on each axis
+#define PLAN_WIDTH_MIN 500.0   //car 1 to car 2 along the lane, mm
+#define PLAN_WIDTH_COUNT 51
+#define PLAN_OFFSET_MIN 200.0  //lane (the scan line) to the curb line, mm
+#define PLAN_OFFSET_COUNT 51
+#define PLAN_DEPTH_MIN 300.0   //curb line to the wall, mm
+#define PLAN_DEPTH_COUNT 36
+
+// lookupPlan() results
+#define PLAN_MISS 0  //outside the table, plan live
+#define PLAN_NONE 1  //inside, and no maneuver fits
+#define PLAN_FOUND 2
+
+/*
+* planTableHeader / planEntry
+* - On-disk table, written by mkPlans. Entries are in width, offset,
+*   depth order (depth fastest), each the escape planEscape() found for
+*   the slot at that grid point. The header is one cache line and an
+*   entry fits in two, so a lookup touches a handful of lines.
+*/
+struct planTableHeader {
+    char magic[4];
+    unsigned short version;
+    unsigned short segs;
+    float turning_radius;
+    float robot_radius;
+    float clearance;
+    float step;
+    float min[3];            //width, offset, depth
+    unsigned short count[3];
+    char pad[22];
+};
+
+struct planTableSeg {
+    float length;            //mm
+    signed char turn;        //+1 left, 0 straight, -1 right (driving forward)
+    signed char dir;         //+1 forward, -1 reverse
+    unsigned char pad[2];
+};
+
+struct planEntry {
+    unsigned char found;
+    unsigned char num_segs;
+    unsigned char pad[2];
+    float exit_x;            //lane x the escape ends at, relative to car 1
+    planTableSeg segs[PLAN_TABLE_SEGS];
+};
+
+/*
+* planTable
+* - A table mapped read-only from disk, shared between processes through
+*   the page cache.
+*/
+struct planTable {
+    const planTableHeader *header;
+    const planEntry *entries;
+    size_t size;
+};
+
+void generatePlanTable(planTableHeader &header, std::vector<planEntry> &entries, int threads);
+bool writePlanTable(const char *file, const planTableHeader &header, const std::vector<planEntry> &entries);
+bool mapPlanTable(const char *file, planTable &table);
+void unmapPlanTable(planTable &table);
+int lookupPlan(const planTable &table, const parkSlot &slot, std::vector<pathSeg> &escape, double &exit_x);
+
+#endif
+
+// EOF
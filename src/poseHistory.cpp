@@ -0,0 +1,156 @@
+/*
+* poseHistory.cpp
+* - Timestamped pose ring and sweep timing.
+*/
+#include "Aria.h"
+#include <cmath>
+#include "poseHistory.h"
+
+/*
+* poseCompose
+* - Pose b given relative to a, in a's frame.
+*/
+pose2d poseCompose(const pose2d &a, const pose2d &b) {
+    pose2d p;
+    p.x = a.x + b.x * cos(a.th) - b.y * sin(a.th);
+    p.y = a.y + b.x * sin(a.th) + b.y * cos(a.th);
+    p.th = a.th + b.th;
+    return p;
+}
+
+/*
+* poseInverse
+* - The pose that undoes a.
+*/
+pose2d poseInverse(const pose2d &a) {
+    pose2d p;
+    p.x = -a.x * cos(a.th) - a.y * sin(a.th);
+    p.y = a.x * sin(a.th) - a.y * cos(a.th);
+    p.th = -a.th;
+    return p;
+}
+
+/*
+* toPose2d / toSeconds
+* - Conversions from ARIA's degrees and split time stamps.
+*/
+pose2d toPose2d(const ArPose &p) {
+    pose2d q = {p.getX(), p.getY(), p.getTh() * PI / 180.0};
+    return q;
+}
+
+double toSeconds(const ArTime &t) {
+    return t.getSec() + t.getMSec() / 1000.0;
+}
+
+/*
+* beamTimeOffset
+* - When a beam at bearing (degrees, -90 right to 90 left, laser frame)
+*   was measured, relative to its sweep's time stamp (so <= 0). The
+*   mirror covers the 180 degrees in half a turn; in half degree mode the
+*   odd half degrees come from a second turn.
+*/
+double beamTimeOffset(double bearing) {
+    double frac = (bearing + 90.0) / 360.0;
+    double sweep = SICK_ROTATION;
+    double t = frac * SICK_ROTATION;
+
+    if (SICK_INTERLACED) {
+        sweep = 2.0 * SICK_ROTATION;
+        if ((long)floor((bearing + 90.0) * 2.0 + 0.5) % 2 == 1)
+            t += SICK_ROTATION;
+    }
+    return t - sweep - SICK_LATENCY;
+}
+
+/*
+* PoseHistory
+* - Constructor. Add getTask() as a robot sensor interpolation task.
+*/
+PoseHistory::PoseHistory(ArRobot *robot) :
+    myRobot(robot),
+    myTask(this, &PoseHistory::task),
+    myHead(0) {
+    for (int i = 0; i < POSE_HISTORY_SIZE; i++)
+        mySeq[i].store(0);
+}
+
+/*
+* task
+* - Record the encoder pose every robot cycle. Encoder poses aren't moved
+*   by moveTo(), so differences between them stay valid across resets.
+*/
+void PoseHistory::task() {
+    ArTime now;
+    now.setToNow();
+    push(toSeconds(now), toPose2d(myRobot->getEncoderPose()));
+}
+
+/*
+* push
+* - Add a pose. Only one thread may push.
+*/
+void PoseHistory::push(double t, const pose2d &pose) {
+    unsigned long h = myHead.load(std::memory_order_relaxed);
+    int i = h % POSE_HISTORY_SIZE;
+    unsigned int s = mySeq[i].load(std::memory_order_relaxed);
+
+    mySeq[i].store(s + 1, std::memory_order_relaxed); //odd while writing
+    std::atomic_thread_fence(std::memory_order_release);
+    mySlots[i].t = t;
+    mySlots[i].pose = pose;
+    mySeq[i].store(s + 2, std::memory_order_release);
+    myHead.store(h + 1, std::memory_order_release);
+}
+
+/*
+* read
+* - Copy entry i (a count since start, not a slot). False if it has been
+*   overwritten or is being written.
+*/
+bool PoseHistory::read(unsigned long i, stampedPose &out) const {
+    int slot = i % POSE_HISTORY_SIZE;
+    for (int tries = 0; tries < 4; tries++) {
+        unsigned int s1 = mySeq[slot].load(std::memory_order_acquire);
+        if (s1 & 1)
+            continue;
+        out = mySlots[slot];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (mySeq[slot].load(std::memory_order_relaxed) == s1)
+            return myHead.load(std::memory_order_acquire) - i <= POSE_HISTORY_SIZE;
+    }
+    return false;
+}
+
+/*
+* at
+* - Encoder pose at time t, interpolated between the two entries around
+*   it (or extrapolated a little past the newest). False if t is older
+*   than the history.
+*/
+bool PoseHistory::at(double t, pose2d &pose) const {
+    unsigned long head = myHead.load(std::memory_order_acquire);
+    stampedPose newer, older;
+
+    if (head < 2 || !read(head - 1, newer))
+        return false;
+    for (unsigned long i = head - 1; i > 0 && head - i < POSE_HISTORY_SIZE; i--) {
+        if (!read(i - 1, older))
+            return false;
+        if (older.t <= t || newer.t < t) {
+            if (t > newer.t + POSE_MAX_EXTRAP)
+                t = newer.t + POSE_MAX_EXTRAP;
+            double dt = newer.t - older.t;
+            double f = dt > 0 ? (t - older.t) / dt : 1.0;
+            double dth = atan2(sin(newer.pose.th - older.pose.th), cos(newer.pose.th - older.pose.th));
+            pose.x = older.pose.x + f * (newer.pose.x - older.pose.x);
+            pose.y = older.pose.y + f * (newer.pose.y - older.pose.y);
+            pose.th = older.pose.th + f * dth;
+            return true;
+        }
+        newer = older;
+    }
+    return false;
+}
+
+// EOF
@@ -0,0 +1,58 @@
+/*
+* poseHistory.h
+* - Lock-free history of timestamped robot poses, and the per-beam timing
+*   of a SICK sweep, for correcting sweeps taken while driving.
+*/
+#ifndef POSEHISTORY_H
+#define POSEHISTORY_H
+
+#include "Aria.h"
+#include <atomic>
+#include "autoPark.h"
+
+#define POSE_HISTORY_SIZE 64     //6.4 s of robot cycles
+#define POSE_MAX_EXTRAP 0.2      //Extrapolate past the newest pose this far at most, s
+
+// SICK LMS2xx timing
+#define SICK_ROTATION 0.01333    //One mirror turn at 75 Hz, s
+#define SICK_INTERLACED TRUE     //Half degree sweeps take two turns
+#define SICK_LATENCY 0.0         //Time from the end of a sweep to its time stamp, s
+
+struct stampedPose {
+    double t;    //s
+    pose2d pose;
+};
+
+pose2d poseCompose(const pose2d &a, const pose2d &b);
+pose2d poseInverse(const pose2d &a);
+pose2d toPose2d(const ArPose &p);
+double toSeconds(const ArTime &t);
+double beamTimeOffset(double bearing);
+
+/*
+* PoseHistory
+* - Ring of encoder poses. A robot sensor interpolation task is the only
+*   writer, readers on any thread use a per-slot sequence count and retry
+*   instead of taking a lock.
+*/
+class PoseHistory {
+public:
+    PoseHistory(ArRobot *robot);
+    void push(double t, const pose2d &pose);
+    bool at(double t, pose2d &pose) const;
+    ArFunctor *getTask() { return &myTask; }
+
+protected:
+    void task();
+    bool read(unsigned long i, stampedPose &out) const;
+
+    ArRobot *myRobot;
+    ArFunctorC<PoseHistory> myTask;
+    std::atomic<unsigned int> mySeq[POSE_HISTORY_SIZE];
+    stampedPose mySlots[POSE_HISTORY_SIZE];
+    std::atomic<unsigned long> myHead;
+};
+
+#endif
+
+// EOF
@@ -0,0 +1,147 @@
+/*
+* rangeFusion.cpp
+* - Pose-stamped point store for the laser and the sonar ring.
+*
+*   Points are kept in the encoder frame, which resetPose()'s moveTo()
+*   doesn't move, so what was seen before a reset stays where it was
+*   (in the odometry frame it would jump ahead of the robot). Readings
+*   are placed from their encoder pose when taken and only moved into
+*   the robot frame when asked. A sonar echo could come from anywhere
+*   across its cone, so it is stored as several points spread over the
+*   cone.
+*/
+#include "Aria.h"
+#include <cmath>
+#include "rangeFusion.h"
+
+/*
+* RangeFusion
+* - Constructor. Add getSonarTask() as a robot user task to feed sonar.
+*/
+RangeFusion::RangeFusion(ArRobot *robot) :
+    myRobot(robot),
+    myLaserCount(0), mySonarNext(0), mySonarCount(0),
+    mySonarTask(this, &RangeFusion::addSonar) {
+}
+
+/*
+* addPoint
+* - Add a point to a ring, overwriting the oldest. Call locked.
+*/
+void RangeFusion::addPoint(rangePoint *ring, int size, int &next, int &count,
+                           double x, double y, double sigma, rangeSource source, const ArTime &time) {
+    rangePoint &p = ring[next];
+    p.x = x;
+    p.y = y;
+    p.sigma = sigma;
+    p.time = time;
+    p.source = source;
+    next = (next + 1) % size;
+    if (count < size)
+        count++;
+}
+
+/*
+* addLaser
+* - Replace the laser points with a new sweep (raw readings), each put
+*   in the encoder frame from where the robot was when it was taken.
+*/
+void RangeFusion::addLaser(const std::list<ArSensorReading *> *readings) {
+    std::list<ArSensorReading *>::const_iterator it;
+    int next = 0;
+
+    if (readings == NULL)
+        return;
+    myMutex.lock();
+    myLaserCount = 0;
+    for (it = readings->begin(); it != readings->end() && myLaserCount < FUSE_LASER_POINTS; it++) {
+        if ((*it)->getIgnoreThisReading())
+            continue;
+        ArPose taken = (*it)->getEncoderPoseTaken();
+        double c = cos(taken.getThRad()), s = sin(taken.getThRad());
+        double lx = (*it)->getLocalX(), ly = (*it)->getLocalY();
+        addPoint(myLaser, FUSE_LASER_POINTS, next, myLaserCount,
+                 taken.getX() + lx * c - ly * s, taken.getY() + lx * s + ly * c,
+                 LASER_SIGMA, SOURCE_LASER, (*it)->getTimeTaken());
+    }
+    myMutex.unlock();
+}
+
+/*
+* addSonar
+* - Add the sonar echoes that arrived since the last robot cycle. Runs as
+*   a robot user task, so the robot is already locked.
+*/
+void RangeFusion::addSonar() {
+    ArRobot *robot = myRobot;
+
+    myMutex.lock();
+    for (int i = 0; i < robot->getNumSonar(); i++) {
+        ArSensorReading *r = robot->getSonarReading(i);
+        if (r == NULL || !r->isNew(robot->getCounter()) || r->getRange() > SONAR_MAX_RANGE)
+            continue;
+
+        double range = r->getRange();
+        double sigma = SONAR_SIGMA + SONAR_SIGMA_GAIN * range;
+        ArPose taken = r->getEncoderPoseTaken();
+        double th = taken.getTh() + r->getSensorTh();
+        double sx = taken.getX() + r->getSensorX() * cos(taken.getThRad()) - r->getSensorY() * sin(taken.getThRad());
+        double sy = taken.getY() + r->getSensorX() * sin(taken.getThRad()) + r->getSensorY() * cos(taken.getThRad());
+        for (int j = 0; j < SONAR_BEAM_POINTS; j++) {
+            double a = (th + SONAR_HALF_BEAM * (2.0 * j / (SONAR_BEAM_POINTS - 1) - 1.0)) * PI / 180.0;
+            addPoint(mySonar, FUSE_SONAR_POINTS, mySonarNext, mySonarCount,
+                     sx + range * cos(a), sy + range * sin(a), sigma, SOURCE_SONAR, r->getTimeTaken());
+        }
+    }
+    myMutex.unlock();
+}
+
+/*
+* points
+* - Copy the live points into the robot frame at encoder pose now, each
+*   pulled FUSE_SIGMAS of its noise towards the robot. Returns how many.
+*/
+int RangeFusion::points(const ArPose &now, double *xs, double *ys, int max) {
+    double c = cos(now.getThRad()), s = sin(now.getThRad());
+    int n = 0;
+
+    myMutex.lock();
+    for (int i = 0; i < myLaserCount + mySonarCount && n < max; i++) {
+        const rangePoint &p = i < myLaserCount ? myLaser[i] : mySonar[i - myLaserCount];
+        if (p.time.mSecSince() > FUSE_MAX_AGE)
+            continue;
+        double dx = p.x - now.getX(), dy = p.y - now.getY();
+        double x = dx * c + dy * s;
+        double y = -dx * s + dy * c;
+        double d = sqrt(x * x + y * y);
+        double pull = d > 0 ? fmax(d - FUSE_SIGMAS * p.sigma, 0.0) / d : 0;
+        xs[n] = x * pull;
+        ys[n] = y * pull;
+        n++;
+    }
+    myMutex.unlock();
+    return n;
+}
+
+/*
+* nearestRear
+* - Gap between the back half of the robot, at encoder pose now, and the
+*   closest point behind it, mm (can be negative). Large if nothing is
+*   there.
+*/
+double RangeFusion::nearestRear(const ArPose &now) {
+    double xs[FUSE_MAX_POINTS], ys[FUSE_MAX_POINTS];
+    int n = points(now, xs, ys, FUSE_MAX_POINTS);
+    double nearest = 1e9;
+
+    for (int i = 0; i < n; i++) {
+        if (xs[i] >= 0)
+            continue;
+        double gap = sqrt(xs[i] * xs[i] + ys[i] * ys[i]) - ROBOT_RADIUS;
+        if (gap < nearest)
+            nearest = gap;
+    }
+    return nearest;
+}
+
+// EOF
@@ -0,0 +1,73 @@
+/*
+* rangeFusion.h
+* - Laser and sonar returns in one pose-stamped point store.
+*/
+#ifndef RANGEFUSION_H
+#define RANGEFUSION_H
+
+#include "Aria.h"
+#include "autoPark.h"
+
+// Sensor noise models
+#define LASER_SIGMA 15.0          //SICK range noise, mm
+#define SONAR_SIGMA 30.0          //Sonar range noise at 0 mm, mm
+#define SONAR_SIGMA_GAIN 0.02     //Extra sonar noise per mm of range
+#define SONAR_HALF_BEAM 12.5      //Half width of the sonar cone, degrees
+#define SONAR_BEAM_POINTS 5       //Points spread across the cone per echo
+#define SONAR_MAX_RANGE 3000.0    //Ignore echoes further than this, mm
+#define FUSE_SIGMAS 2.0           //Points are pulled this many sigmas closer
+#define FUSE_LASER_POINTS 400     //Room for one laser sweep
+#define FUSE_SONAR_POINTS 512     //Sonar ring size
+#define FUSE_MAX_POINTS (FUSE_LASER_POINTS + FUSE_SONAR_POINTS)
+#define FUSE_MAX_AGE 1000         //Points older than this are dropped, ms
+
+enum rangeSource {
+    SOURCE_LASER,
+    SOURCE_SONAR
+};
+
+/*
+* rangePoint
+* - One return in the encoder frame, with when it was taken and how far
+*   it could be off.
+*/
+struct rangePoint {
+    double x, y;
+    double sigma;
+    ArTime time;
+    rangeSource source;
+};
+
+/*
+* RangeFusion
+* - Keeps the latest laser sweep and a ring of recent sonar echoes as
+*   points in the encoder frame, so pose resets don't move them. The
+*   laser side is fed from the laser thread, the sonar side from a robot
+*   task, and queries (given the robot's encoder pose) come back in the
+*   current robot frame with every point pulled closer by its noise.
+*/
+class RangeFusion {
+public:
+    RangeFusion(ArRobot *robot);
+    void addLaser(const std::list<ArSensorReading *> *readings);
+    void addSonar();
+    ArFunctor *getSonarTask() { return &mySonarTask; }
+    int points(const ArPose &now, double *xs, double *ys, int max);
+    double nearestRear(const ArPose &now);
+
+protected:
+    void addPoint(rangePoint *ring, int size, int &next, int &count,
+                  double x, double y, double sigma, rangeSource source, const ArTime &time);
+
+    ArMutex myMutex;
+    ArRobot *myRobot;
+    rangePoint myLaser[FUSE_LASER_POINTS];
+    int myLaserCount;
+    rangePoint mySonar[FUSE_SONAR_POINTS];
+    int mySonarNext, mySonarCount;
+    ArFunctorC<RangeFusion> mySonarTask;
+};
+
+#endif
+
+// EOF
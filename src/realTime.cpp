@@ -0,0 +1,193 @@
+/*
+* realTime.cpp
+* - Real-time mode set up and control loop timing.
+*
+*   Without -rt the control loop still keeps its timing here, just
+*   without the priority, so the report can be compared between modes.
+*/
+#include "Aria.h"
+#include <cerrno>
+#include <cstring>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "realTime.h"
+
+/*
+* RealTime
+* - Constructor.
+*/
+RealTime::RealTime() :
+    myEnabled(false), myRobotCpu(-1), myLaserCpu(-1),
+    myRobotDone(true), myLaserDone(true), mySetupFailed(0),
+    myRobotTask(this, &RealTime::robotTask),
+    myLaserCB(this, &RealTime::laserCB),
+    myTicks(0), myLateSum(0), myLateMax(0) {
+    memset(myHist, 0, sizeof(myHist));
+    memset(&myNext, 0, sizeof(myNext));
+}
+
+/*
+* prefaultStack
+* - Touch the stack we'll need so the first deep call doesn't page fault.
+*/
+static void prefaultStack() {
+    volatile unsigned char stack[RT_STACK_PREFAULT];
+    for (int i = 0; i < RT_STACK_PREFAULT; i += 4096)
+        stack[i] = 0;
+    (void)stack;
+    return;
+}
+
+/*
+* setupThread
+* - Pin the calling thread to cpu and give it a SCHED_FIFO priority.
+*   Returns false if either wasn't allowed, or there's no such cpu (the
+*   thread is then left unpinned rather than put on some other core).
+*/
+bool RealTime::setupThread(const char *name, int cpu, int priority) {
+    bool ok = true;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    sched_param param;
+    int err;
+
+    if (cpu < 0 || cpu >= CPU_SETSIZE || (cpus > 0 && cpu >= cpus)) {
+        printf("RT: no cpu %d (%ld online), %s thread is not pinned\n", cpu, cpus, name);
+        ok = false;
+    }
+    else {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            printf("RT: could not pin %s thread to cpu %d (%s)\n", name, cpu, strerror(err));
+            ok = false;
+        }
+    }
+
+    param.sched_priority = priority;
+    err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+        printf("RT: no SCHED_FIFO for %s thread (%s), needs CAP_SYS_NICE or an rtprio limit;"
+               " it stays at normal priority\n", name, strerror(err));
+        ok = false;
+    }
+    if (ok)
+        printf("RT: %s thread on cpu %d, SCHED_FIFO %d\n", name, cpu, priority);
+    else
+        mySetupFailed++;
+    prefaultStack();
+    return ok;
+}
+
+/*
+* start
+* - Lock and prefault memory, then set up the calling thread as the
+*   control thread. The robot and laser threads follow on their next run.
+*/
+void RealTime::start(int control_cpu, int robot_cpu, int laser_cpu) {
+    myEnabled = true;
+
+    // Keep freed heap mapped, so later allocations don't fault pages in
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        printf("RT: could not lock memory (%s), check RLIMIT_MEMLOCK; pages may fault\n",
+               strerror(errno));
+    else
+        printf("RT: memory locked\n");
+
+    setupThread("control", control_cpu, RT_CONTROL_PRIO);
+    myRobotCpu = robot_cpu;
+    myLaserCpu = laser_cpu;
+    myRobotDone = false;
+    myLaserDone = false;
+    return;
+}
+
+/*
+* robotTask / laserCB
+* - Set up whichever thread runs them, once.
+*/
+void RealTime::robotTask() {
+    if (myRobotDone.exchange(true))
+        return;
+    setupThread("robot", myRobotCpu, RT_ROBOT_PRIO);
+    return;
+}
+
+void RealTime::laserCB() {
+    if (myLaserDone.exchange(true))
+        return;
+    setupThread("laser", myLaserCpu, RT_LASER_PRIO);
+    return;
+}
+
+/*
+* beginTicks / waitTick
+* - Sleep until the next tick of a fixed period loop. Deadlines are
+*   absolute, so time spent in the loop body isn't added to the period,
+*   and how late each wake up is goes in the histogram.
+*/
+void RealTime::beginTicks() {
+    clock_gettime(CLOCK_MONOTONIC, &myNext);
+    return;
+}
+
+void RealTime::waitTick(unsigned int period_ms) {
+    timespec now;
+
+    myNext.tv_nsec += period_ms * 1000000L;
+    while (myNext.tv_nsec >= 1000000000L) {
+        myNext.tv_nsec -= 1000000000L;
+        myNext.tv_sec++;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &myNext, NULL) == EINTR)
+        ;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double late = (now.tv_sec - myNext.tv_sec) * 1e6 + (now.tv_nsec - myNext.tv_nsec) / 1e3;
+    if (late < 0)
+        late = 0;
+    int bin = (int)(late / RT_JITTER_BIN);
+    myHist[bin < RT_JITTER_BINS ? bin : RT_JITTER_BINS - 1]++;
+    myLateSum += late;
+    if (late > myLateMax)
+        myLateMax = late;
+    myTicks++;
+
+    // Overran a whole period, start again from now rather than catch up
+    if (late > period_ms * 1000.0)
+        myNext = now;
+    return;
+}
+
+/*
+* report
+* - Print the control loop lateness: mean, 99th percentile and worst.
+*/
+void RealTime::report(FILE *fp) {
+    long count = 0;
+    int p99 = RT_JITTER_BINS - 1;
+
+    if (mySetupFailed > 0)
+        fprintf(fp, "RT: %d thread(s) not set up as asked, see the RT: lines at start up\n", mySetupFailed.load());
+    if (myTicks == 0)
+        return;
+    for (int i = 0; i < RT_JITTER_BINS; i++) {
+        count += myHist[i];
+        if (count >= myTicks * 0.99) {
+            p99 = i;
+            break;
+        }
+    }
+    fprintf(fp, "RT %s: %ld control ticks, wake up late by mean %.0f us, p99 < %d us, max %.0f us\n",
+            myEnabled ? "on" : "off", myTicks, myLateSum / myTicks,
+            (p99 + 1) * RT_JITTER_BIN, myLateMax);
+    return;
+}
+
+// EOF
@@ -0,0 +1,66 @@
+/*
+* realTime.h
+* - Opt-in real-time mode: pinned threads, SCHED_FIFO, locked memory and
+*   a record of how late the control loop wakes up.
+*/
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include "Aria.h"
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+
+// Defaults for -rt, cores can be changed with -rtCpus control,robot,laser
+#define RT_CONTROL_CPU 1
+#define RT_ROBOT_CPU 2
+#define RT_LASER_CPU 3
+#define RT_ROBOT_PRIO 80   //robot sync loop, it sends the wheel commands
+#define RT_CONTROL_PRIO 70 //followProfile()
+#define RT_LASER_PRIO 60   //thread that delivers sweeps
+#define RT_STACK_PREFAULT (256 * 1024)
+#define RT_JITTER_BIN 50   //us per histogram bin
+#define RT_JITTER_BINS 400 //last bin collects everything past 20 ms
+
+/*
+* RealTime
+* - start() locks memory and sets up the calling (control) thread. The
+*   robot and laser threads set themselves up the first time they run the
+*   task and callback from getRobotTask() and getLaserCB(). Anything that
+*   isn't permitted is reported and skipped, the run goes on at normal
+*   priority.
+*/
+class RealTime {
+public:
+    RealTime();
+    bool enabled() const { return myEnabled; }
+    void start(int control_cpu, int robot_cpu, int laser_cpu);
+    ArFunctor *getRobotTask() { return &myRobotTask; }
+    ArFunctor *getLaserCB() { return &myLaserCB; }
+
+    void beginTicks();
+    void waitTick(unsigned int period_ms);
+    void report(FILE *fp);
+
+protected:
+    bool setupThread(const char *name, int cpu, int priority);
+    void robotTask();
+    void laserCB();
+
+    bool myEnabled;
+    int myRobotCpu, myLaserCpu;
+    std::atomic<bool> myRobotDone, myLaserDone;
+    std::atomic<int> mySetupFailed;  //threads left unpinned or at normal priority
+    ArFunctorC<RealTime> myRobotTask;
+    ArFunctorC<RealTime> myLaserCB;
+
+    // Control loop wake up lateness
+    timespec myNext;
+    long myTicks;
+    double myLateSum, myLateMax;
+    long myHist[RT_JITTER_BINS];
+};
+
+#endif
+
+// EOF
@@ -0,0 +1,156 @@
+/*
+* safety.cpp
+* - Stopping envelope check and the action that enforces it.
+*
+*   The check runs in the laser thread once per sweep. It only walks a
+*   fixed size array of points and does one atan2 per point, so its worst
+*   case is bounded by SAFETY_MAX_POINTS.
+*/
+#include "Aria.h"
+#include <cmath>
+#include "safety.h"
+#include "poseHistory.h"
+
+/*
+* safetyAllowedSpeed
+* - Fastest speed (mm/s) the robot can drive along the arc given by the
+*   wheel velocities and still stop short of every point (robot frame, mm).
+*   Points off the swept path don't count.
+*/
+double safetyAllowedSpeed(double left, double right, const double *xs, const double *ys, int n) {
+    double v = (left + right) / 2.0;
+    double w = (right - left) / WHEEL_BASE;
+    double reach = ROBOT_RADIUS + SAFETY_MARGIN;
+    double speed = fabs(v);
+
+    if (speed < 1.0)
+        return VMAX;
+    double k = w / v;
+    double stop = speed * speed / (2.0 * SAFETY_DECEL) + speed * SAFETY_LATENCY + reach;
+    double free = 1e9;
+
+    for (int i = 0; i < n; i++) {
+        double along, side;
+        if (fabs(k) < 1e-6) {
+            along = v > 0 ? xs[i] : -xs[i];
+            side = fabs(ys[i]);
+        }
+        else {
+            // Distance travelled on the circle before passing the point
+            double r = 1.0 / k;
+            double dx = xs[i], dy = ys[i] - r;
+            side = fabs(sqrt(dx * dx + dy * dy) - fabs(r));
+            double a = atan2(dx * (k > 0 ? 1 : -1), -dy * (k > 0 ? 1 : -1));
+            along = (v > 0 ? a : -a) * fabs(r);
+        }
+        if (side > reach || along <= 0)
+            continue;
+
+        // Distance travelled before the robot plus margin touches it
+        double contact = along - sqrt(reach * reach - side * side);
+        if (contact < free)
+            free = contact;
+    }
+    if (free + reach > stop)
+        return VMAX;
+
+    double room = free;
+    if (room <= 0)
+        return 0;
+    double b = SAFETY_DECEL * SAFETY_LATENCY;
+    return -b + sqrt(b * b + 2.0 * SAFETY_DECEL * room);
+}
+
+/*
+* SafetyAction
+* - Constructor. The sweep callback still has to be added to the laser
+*   with addDataCB(getSweepCB()).
+*/
+SafetyAction::SafetyAction(ArRangeDevice *laser, RangeFusion *fusion) :
+    ArAction("Safety", "Slows or stops the robot for obstacles on its path"),
+    myLaser(laser),
+    myFusion(fusion),
+    myTracker(NULL),
+    mySweepCB(this, &SafetyAction::sweepCB),
+    myScale(1.0),
+    myCmdLeft(0), myCmdRight(0), myHaveCmd(false),
+    myMeasLeft(0), myMeasRight(0) {
+}
+
+/*
+* setCommand / clearCommand
+* - Tell the monitor which wheel velocities are being streamed, so it
+*   checks the path being asked for rather than the one being driven.
+*/
+void SafetyAction::setCommand(double left, double right) {
+    myCmdLeft.store(left);
+    myCmdRight.store(right);
+    myHaveCmd.store(true);
+}
+
+void SafetyAction::clearCommand() {
+    myHaveCmd.store(false);
+}
+
+/*
+* sweepCB
+* - Laser data callback. Runs once per sweep with the laser locked. The
+*   sweep goes into the fusion store and the check runs over every live
+*   laser and sonar point, so reversing is covered too. Moving tracks
+*   add their predicted positions.
+*/
+void SafetyAction::sweepCB() {
+    const std::list<ArSensorReading *> *readings = myLaser->getRawReadings();
+
+    if (readings == NULL || readings->empty())
+        return;
+    myFusion->addLaser(readings);
+    ArPose now = readings->back()->getEncoderPoseTaken(); //fusion and tracks are in the encoder frame
+    int n = myFusion->points(now, myXs, myYs, FUSE_MAX_POINTS);
+    if (myTracker != NULL)
+        n += myTracker->predictMoving(toPose2d(now), myXs + n, myYs + n, SAFETY_MAX_POINTS - n);
+
+    double left = myHaveCmd.load() ? myCmdLeft.load() : myMeasLeft.load();
+    double right = myHaveCmd.load() ? myCmdRight.load() : myMeasRight.load();
+    double speed = fabs(left + right) / 2.0;
+    double allowed = safetyAllowedSpeed(left, right, myXs, myYs, n);
+
+    // Anything already up against the back stops a reverse outright
+    if (left + right < 0 && myFusion->nearestRear(now) < SAFETY_MARGIN)
+        allowed = 0;
+
+    if (allowed < SAFETY_MIN_VEL)
+        myScale.store(0);
+    else if (allowed >= speed)
+        myScale.store(1.0);
+    else
+        myScale.store(allowed / speed);
+}
+
+/*
+* fire
+* - Runs every robot cycle. Holds the robot when the last sweep asked for
+*   a stop (this also cancels direct motion) and caps speed otherwise.
+*/
+ArActionDesired *SafetyAction::fire(ArActionDesired currentDesired) {
+    double s = myScale.load();
+
+    myMeasLeft.store(myRobot->getLeftVel());
+    myMeasRight.store(myRobot->getRightVel());
+    myDesired.reset();
+    if (s <= 0) {
+        if (fabs(myRobot->getVel()) > 0 || fabs(myRobot->getRotVel()) > 0)
+            myRobot->clearDirectMotion();
+        myDesired.setVel(0);
+        myDesired.setRotVel(0);
+        return &myDesired;
+    }
+    if (s < 1.0) {
+        myDesired.setMaxVel(s * VMAX);
+        myDesired.setMaxNegVel(-s * VMAX);
+        return &myDesired;
+    }
+    return NULL;
+}
+
+// EOF
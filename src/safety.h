@@ -0,0 +1,62 @@
+/*
+* safety.h
+* - Reactive safety layer checked on every laser sweep.
+*/
+#ifndef SAFETY_H
+#define SAFETY_H
+
+#include "Aria.h"
+#include <atomic>
+#include "autoPark.h"
+#include "rangeFusion.h"
+#include "tracker.h"
+
+// Safety limits
+#define SAFETY_DECEL 400.0     //Deceleration we can count on when braking, mm/s^2
+#define SAFETY_LATENCY 0.15    //Laser sweep + robot cycle before a stop takes effect, s
+#define SAFETY_MARGIN 50.0     //Gap to keep after stopping, mm
+#define SAFETY_MIN_VEL 20.0    //Slower than this just stop, mm/s
+#define SAFETY_MAX_POINTS (FUSE_MAX_POINTS + TRACK_MAX * TRACK_PREDICT_STEPS) //Most points looked at per sweep
+#define SAFETY_TIMEOUT 10000   //Give up on a blocked maneuver after this, ms
+
+double safetyAllowedSpeed(double left, double right, const double *xs, const double *ys, int n);
+
+/*
+* SafetyAction
+* - Checks the stopping envelope of the commanded wheel velocities against
+*   every laser sweep (from the laser's data callback), together with the
+*   sonar echoes in the fusion store, and publishes a speed scale. As the
+*   highest priority action it holds the robot when the scale drops to
+*   zero and caps speed otherwise. Callers streaming setVel2 should report
+*   what they command and honour scale(). With a tracker, moving things
+*   are checked where they are about to be too.
+*/
+class SafetyAction : public ArAction {
+public:
+    SafetyAction(ArRangeDevice *laser, RangeFusion *fusion);
+    virtual ArActionDesired *fire(ArActionDesired currentDesired);
+    void setCommand(double left, double right);
+    void clearCommand();
+    void setTracker(const Tracker *tracker) { myTracker = tracker; }
+    double scale() const { return myScale.load(); }
+    ArFunctor *getSweepCB() { return &mySweepCB; }
+
+protected:
+    void sweepCB();
+
+    ArRangeDevice *myLaser;
+    RangeFusion *myFusion;
+    const Tracker *myTracker;
+    ArActionDesired myDesired;
+    ArFunctorC<SafetyAction> mySweepCB;
+    std::atomic<double> myScale;
+    std::atomic<double> myCmdLeft, myCmdRight; //streamed command, if any
+    std::atomic<bool> myHaveCmd;
+    std::atomic<double> myMeasLeft, myMeasRight; //last measured, from fire()
+    double myXs[SAFETY_MAX_POINTS];
+    double myYs[SAFETY_MAX_POINTS];
+};
+
+#endif
+
+// EOF
@@ -0,0 +1,578 @@
+/*
+* scanArchive.cpp
+* - Scan archive coding.
+*
+*   Each sweep is written as varints: the number, time and pose as deltas
+*   from the sweep before, then the ranges as residuals from whichever
+*   predictor is cheaper for that sweep, the beam before or the same beam
+*   one sweep ago (walls hold still, so the second usually wins while the
+*   robot is parked). Signed values are zigzagged so small either way is
+*   a byte. A block starts from nothing, so blocks decode on their own and
+*   a damaged one costs only its sweeps. The varint bytes are skewed
+*   towards a few values, which a static order-0 rANS coder per block
+*   takes further; blocks where it doesn't pay are written as they are.
+*/
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include "scanArchive.h"
+
+using namespace std;
+
+#define PROB_SCALE (1 << ARCHIVE_PROB_BITS)
+#define RANS_LOW (1u << 23)      //rANS state stays in [RANS_LOW, RANS_LOW << 8)
+
+// Sweep flags
+#define SWEEP_FROM_PREV 1        //ranges predicted from the sweep before
+#define SWEEP_GEOMETRY 2         //start angle, increment and count follow
+
+/*
+* parallelFor
+* - Run fn(i) for i in [0, n) over threads.
+*/
+template <class F>
+static void parallelFor(int n, int threads, F fn) {
+    atomic<int> next(0);
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(thread([&]() {
+            for (int i = next++; i < n; i = next++)
+                fn(i);
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+        pool[t].join();
+    return;
+}
+
+static double cpuMicros() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static unsigned int fnv1a(const unsigned char *p, size_t n) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+/*
+* putVarint / getVarint / zigzag / unzigzag
+* - Seven bits a byte, low first, high bit set while more follow.
+*/
+static void putVarint(vector<unsigned char> &out, unsigned long long v) {
+    while (v >= 0x80) {
+        out.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char)v);
+    return;
+}
+
+static bool getVarint(const unsigned char *&p, const unsigned char *end, unsigned long long &v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        unsigned char b = *p++;
+        v |= (unsigned long long)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static unsigned long long zigzag(long long v) {
+    return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+static long long unzigzag(unsigned long long v) {
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+/*
+* sweepKeys
+* - The sweep's number, time and pose as the integers that are stored.
+*/
+struct sweepKeys {
+    long long number, time, x, y, th;
+};
+
+static sweepKeys keysOf(const laserSweep &s) {
+    sweepKeys k;
+    k.number = s.number;
+    k.time = llround(s.time * 1e6);
+    k.x = llround(s.pose.x * 10.0);
+    k.y = llround(s.pose.y * 10.0);
+    k.th = llround(s.pose.th * 1e6);
+    return k;
+}
+
+static void setKeys(laserSweep &s, const sweepKeys &k) {
+    s.number = k.number;
+    s.time = k.time / 1e6;
+    s.pose.x = k.x / 10.0;
+    s.pose.y = k.y / 10.0;
+    s.pose.th = k.th / 1e6;
+    return;
+}
+
+static bool sameGeometry(const laserSweep &a, const laserSweep &b) {
+    return a.start_angle == b.start_angle && a.increment == b.increment && a.count == b.count;
+}
+
+/*
+* encodeSweep
+* - Append s to a block, prev being the sweep before it in the block as
+*   the decoder will see it, or NULL for the first.
+*/
+static void encodeSweep(const laserSweep &s, const laserSweep *prev, vector<unsigned char> &out) {
+    int count = s.count < SWEEP_MAX_BEAMS ? s.count : SWEEP_MAX_BEAMS;
+    bool geometry = prev == NULL || !sameGeometry(s, *prev);
+    unsigned char flags = geometry ? SWEEP_GEOMETRY : 0;
+
+    if (!geometry) {
+        long long beam = 0, sweep = 0;
+        for (int i = 0; i < count; i++) {
+            beam += labs((long)s.ranges[i] - (i > 0 ? s.ranges[i - 1] : 0));
+            sweep += labs((long)s.ranges[i] - prev->ranges[i]);
+        }
+        if (sweep < beam)
+            flags |= SWEEP_FROM_PREV;
+    }
+    out.push_back(flags);
+
+    sweepKeys k = keysOf(s), p;
+    memset(&p, 0, sizeof(p));
+    if (prev != NULL)
+        p = keysOf(*prev);
+    putVarint(out, zigzag(k.number - p.number));
+    putVarint(out, zigzag(k.time - p.time));
+    putVarint(out, zigzag(k.x - p.x));
+    putVarint(out, zigzag(k.y - p.y));
+    putVarint(out, zigzag(k.th - p.th));
+    if (geometry) {
+        unsigned char raw[8];
+        memcpy(raw, &s.start_angle, 4);
+        memcpy(raw + 4, &s.increment, 4);
+        out.insert(out.end(), raw, raw + 8);
+        putVarint(out, count);
+    }
+
+    for (int i = 0; i < count; i++) {
+        long pred = (flags & SWEEP_FROM_PREV) ? prev->ranges[i] : (i > 0 ? s.ranges[i - 1] : 0);
+        putVarint(out, zigzag((long)s.ranges[i] - pred));
+    }
+    return;
+}
+
+/*
+* decodeSweep
+* - The reverse of encodeSweep. Returns false on a malformed stream.
+*/
+static bool decodeSweep(const unsigned char *&p, const unsigned char *end, const laserSweep *prev, laserSweep &s) {
+    unsigned long long v;
+    sweepKeys k, d;
+
+    if (p >= end)
+        return false;
+    unsigned char flags = *p++;
+    if ((prev == NULL && !(flags & SWEEP_GEOMETRY)) || ((flags & SWEEP_FROM_PREV) && (flags & SWEEP_GEOMETRY)))
+        return false;
+
+    memset(&k, 0, sizeof(k));
+    if (prev != NULL)
+        k = keysOf(*prev);
+    long long *fields[5] = {&d.number, &d.time, &d.x, &d.y, &d.th};
+    for (int f = 0; f < 5; f++) {
+        if (!getVarint(p, end, v))
+            return false;
+        *fields[f] = unzigzag(v);
+    }
+    k.number += d.number;
+    k.time += d.time;
+    k.x += d.x;
+    k.y += d.y;
+    k.th += d.th;
+    setKeys(s, k);
+
+    if (flags & SWEEP_GEOMETRY) {
+        if (end - p < 8)
+            return false;
+        memcpy(&s.start_angle, p, 4);
+        memcpy(&s.increment, p + 4, 4);
+        p += 8;
+        if (!getVarint(p, end, v) || v > SWEEP_MAX_BEAMS)
+            return false;
+        s.count = v;
+    }
+    else {
+        s.start_angle = prev->start_angle;
+        s.increment = prev->increment;
+        s.count = prev->count;
+    }
+
+    for (int i = 0; i < s.count; i++) {
+        if (!getVarint(p, end, v))
+            return false;
+        long pred = (flags & SWEEP_FROM_PREV) ? prev->ranges[i] : (i > 0 ? s.ranges[i - 1] : 0);
+        long r = pred + unzigzag(v);
+        if (r < 0 || r > 0xffff)
+            return false;
+        s.ranges[i] = r;
+    }
+    for (int i = s.count; i < SWEEP_MAX_BEAMS; i++)
+        s.ranges[i] = 0;
+    return true;
+}
+
+/*
+* ransEncode
+* - Order-0 rANS over in: the symbol frequencies (scaled to PROB_SCALE)
+*   as a count and symbol/frequency pairs, the final state, then the
+*   stream. Returns false if the frequencies can't be scaled.
+*/
+static bool ransEncode(const vector<unsigned char> &in, vector<unsigned char> &out) {
+    unsigned int counts[256], freq[256], start[256];
+    size_t n = in.size();
+
+    out.clear();
+    if (n == 0)
+        return false;
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; i++)
+        counts[in[i]]++;
+
+    // Scale to PROB_SCALE, every symbol seen keeping at least one, the
+    // rounding going to the most common
+    int used = 0, biggest = 0;
+    long sum = 0;
+    for (int c = 0; c < 256; c++) {
+        freq[c] = 0;
+        if (counts[c] == 0)
+            continue;
+        freq[c] = (unsigned long long)counts[c] * PROB_SCALE / n;
+        if (freq[c] == 0)
+            freq[c] = 1;
+        sum += freq[c];
+        used++;
+        if (counts[c] > counts[biggest])
+            biggest = c;
+    }
+    if ((long)freq[biggest] + PROB_SCALE - sum < 1)
+        return false;
+    freq[biggest] += PROB_SCALE - sum;
+    for (int c = 0, at = 0; c < 256; c++) {
+        start[c] = at;
+        at += freq[c];
+    }
+
+    putVarint(out, used);
+    for (int c = 0; c < 256; c++) {
+        if (freq[c] == 0)
+            continue;
+        out.push_back(c);
+        putVarint(out, freq[c]);
+    }
+
+    // Encode backwards into the end of a buffer so it decodes forwards
+    vector<unsigned char> buf(n + n / 2 + 16);
+    unsigned char *ptr = buf.data() + buf.size();
+    unsigned int x = RANS_LOW;
+    for (size_t i = n; i-- > 0; ) {
+        unsigned int f = freq[in[i]];
+        unsigned int x_max = ((RANS_LOW >> ARCHIVE_PROB_BITS) << 8) * f;
+        while (x >= x_max) {
+            if (ptr == buf.data())
+                return false;
+            *--ptr = x & 0xff;
+            x >>= 8;
+        }
+        x = ((x / f) << ARCHIVE_PROB_BITS) + (x % f) + start[in[i]];
+    }
+    for (int b = 0; b < 4; b++)
+        out.push_back((x >> (8 * b)) & 0xff);
+    out.insert(out.end(), ptr, buf.data() + buf.size());
+    return true;
+}
+
+/*
+* ransDecode
+* - Decode n symbols of a ransEncode stream into out.
+*/
+static bool ransDecode(const unsigned char *p, const unsigned char *end, size_t n, vector<unsigned char> &out) {
+    unsigned int freq[256], start[256];
+    unsigned char symbol[PROB_SCALE];
+    unsigned long long used, f;
+
+    memset(freq, 0, sizeof(freq));
+    if (!getVarint(p, end, used) || used == 0 || used > 256)
+        return false;
+    for (unsigned long long k = 0; k < used; k++) {
+        if (p >= end)
+            return false;
+        int c = *p++;
+        if (!getVarint(p, end, f) || f == 0 || f > PROB_SCALE)
+            return false;
+        freq[c] = f;
+    }
+    unsigned int at = 0;
+    for (int c = 0; c < 256; c++) {
+        start[c] = at;
+        if (at + freq[c] > PROB_SCALE)
+            return false;
+        memset(symbol + at, c, freq[c]);
+        at += freq[c];
+    }
+    if (at != PROB_SCALE || end - p < 4)
+        return false;
+
+    unsigned int x = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+    p += 4;
+    out.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = symbol[x & (PROB_SCALE - 1)];
+        out[i] = c;
+        x = freq[c] * (x >> ARCHIVE_PROB_BITS) + (x & (PROB_SCALE - 1)) - start[c];
+        while (x < RANS_LOW) {
+            if (p >= end)
+                return false;
+            x = (x << 8) | *p++;
+        }
+    }
+    return true;
+}
+
+/*
+* ScanArchiveWriter
+* - Constructor.
+*/
+ScanArchiveWriter::ScanArchiveWriter() : myFile(NULL), myEntropy(true), myBudget(0), myBlockSweeps(0),
+                                         mySweeps(0), mySweepBytes(0), myFileBytes(0), myCpu(0) {
+    memset(&myPrev, 0, sizeof(myPrev));
+}
+
+ScanArchiveWriter::~ScanArchiveWriter() {
+    close();
+}
+
+/*
+* open
+* - Start a new archive in file. Returns false if it can't be written.
+*/
+bool ScanArchiveWriter::open(const char *file, bool entropy) {
+    archiveHeader header;
+
+    close();
+    myEntropy = entropy;
+    myBlockSweeps = 0;
+    mySweeps = 0;
+    mySweepBytes = 0;
+    myCpu = 0;
+    myStream.clear();
+
+    myFile = fopen(file, "wb");
+    if (myFile == NULL)
+        return false;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_MAGIC, 4);
+    header.version = ARCHIVE_VERSION;
+    header.block = ARCHIVE_BLOCK;
+    if (fwrite(&header, sizeof(header), 1, myFile) != 1) {
+        fclose(myFile);
+        myFile = NULL;
+        return false;
+    }
+    myFileBytes = sizeof(header);
+    return true;
+}
+
+/*
+* add
+* - Append one sweep, writing the block out once it's full.
+*/
+bool ScanArchiveWriter::add(const laserSweep &sweep) {
+    if (myFile == NULL)
+        return false;
+    double start = cpuMicros();
+
+    encodeSweep(sweep, myBlockSweeps > 0 ? &myPrev : NULL, myStream);
+    // Keep the sweep as the decoder will have it, so predictions match
+    memcpy(&myPrev, &sweep, sizeof(laserSweep));
+    setKeys(myPrev, keysOf(sweep));
+    if (myPrev.count > SWEEP_MAX_BEAMS)
+        myPrev.count = SWEEP_MAX_BEAMS;
+    myBlockSweeps++;
+    mySweeps++;
+    mySweepBytes += 50 + 2 * myPrev.count;
+
+    myCpu += cpuMicros() - start;
+    if (myBlockSweeps >= ARCHIVE_BLOCK)
+        return flush();
+    return true;
+}
+
+/*
+* flush
+* - Write the sweeps so far as a block.
+*/
+bool ScanArchiveWriter::flush() {
+    archiveBlockHeader header;
+    bool coded = false;
+
+    if (myFile == NULL || myBlockSweeps == 0)
+        return myFile != NULL;
+    double start = cpuMicros();
+
+    if (myEntropy)
+        coded = ransEncode(myStream, myCoded) && myCoded.size() < myStream.size();
+    const vector<unsigned char> &data = coded ? myCoded : myStream;
+
+    memcpy(header.magic, ARCHIVE_BLOCK_MAGIC, 4);
+    header.sweeps = myBlockSweeps;
+    header.raw_size = myStream.size();
+    header.data_size = data.size();
+    header.coding = coded ? ARCHIVE_RANS : ARCHIVE_RAW;
+    header.check = fnv1a(myStream.data(), myStream.size());
+    bool ok = fwrite(&header, sizeof(header), 1, myFile) == 1 &&
+              fwrite(data.data(), 1, data.size(), myFile) == data.size();
+    fflush(myFile);
+    myFileBytes += sizeof(header) + data.size();
+    myStream.clear();
+    myBlockSweeps = 0;
+
+    myCpu += cpuMicros() - start;
+    if (myEntropy && myBudget > 0 && cpuPerSweep() > myBudget)
+        myEntropy = false;
+    return ok;
+}
+
+/*
+* close
+* - Write out the last, partial, block and close the file.
+*/
+bool ScanArchiveWriter::close() {
+    if (myFile == NULL)
+        return true;
+    bool ok = flush();
+    ok = fclose(myFile) == 0 && ok;
+    myFile = NULL;
+    return ok;
+}
+
+/*
+* decodeBlock
+* - Decode one block's sweeps into out. Returns false if it's damaged,
+*   which includes a raw_size its sweeps couldn't take up (checked before
+*   anything is allocated for it).
+*/
+static bool decodeBlock(const archiveBlockHeader &header, const unsigned char *data, laserSweep *out) {
+    vector<unsigned char> stream;
+    const unsigned char *p = data, *end = data + header.data_size;
+
+    if (header.raw_size > (size_t)header.sweeps * ARCHIVE_SWEEP_MAX)
+        return false;
+    if (header.coding == ARCHIVE_RANS) {
+        if (!ransDecode(data, end, header.raw_size, stream))
+            return false;
+        p = stream.data();
+        end = p + stream.size();
+    }
+    else if (header.coding != ARCHIVE_RAW || header.raw_size != header.data_size)
+        return false;
+    if (fnv1a(p, end - p) != header.check)
+        return false;
+
+    for (unsigned int i = 0; i < header.sweeps; i++) {
+        if (!decodeSweep(p, end, i > 0 ? &out[i - 1] : NULL, out[i]))
+            return false;
+    }
+    return p == end;
+}
+
+/*
+* readScanArchive
+* - Read every sweep in file, decoding blocks over threads. Damaged
+*   blocks are skipped (bad_blocks counts them, if not NULL) and the
+*   next block found by its magic. Returns false if the file can't be
+*   read or isn't an archive.
+*/
+bool readScanArchive(const char *file, vector<laserSweep> &sweeps, int threads, int *bad_blocks) {
+    archiveHeader header;
+    vector<unsigned char> buf;
+    vector<archiveBlockHeader> blocks;
+    vector<size_t> offsets, firsts;
+    size_t total = 0;
+
+    sweeps.clear();
+    if (bad_blocks != NULL)
+        *bad_blocks = 0;
+    FILE *fp = fopen(file, "rb");
+    if (fp == NULL)
+        return false;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size < (long)sizeof(header)) {
+        fclose(fp);
+        return false;
+    }
+    buf.resize(size);
+    bool ok = fread(buf.data(), 1, size, fp) == (size_t)size;
+    fclose(fp);
+    memcpy(&header, buf.data(), sizeof(header));
+    if (!ok || memcmp(header.magic, ARCHIVE_MAGIC, 4) != 0 || header.version != ARCHIVE_VERSION)
+        return false;
+
+    // Find the blocks first, so each thread knows where its sweeps go
+    int skipped = 0;
+    size_t pos = sizeof(header);
+    while (pos + sizeof(archiveBlockHeader) <= buf.size()) {
+        archiveBlockHeader block;
+        memcpy(&block, buf.data() + pos, sizeof(block));
+        size_t next = pos + sizeof(block) + block.data_size;
+        if (memcmp(block.magic, ARCHIVE_BLOCK_MAGIC, 4) != 0 || block.sweeps > ARCHIVE_BLOCK ||
+            next > buf.size() || next < pos) {
+            // Lost our place, look for the next block
+            skipped = 1;
+            for (pos++; pos + 4 <= buf.size() && memcmp(buf.data() + pos, ARCHIVE_BLOCK_MAGIC, 4) != 0; pos++)
+                ;
+            continue;
+        }
+        if (skipped && bad_blocks != NULL)
+            (*bad_blocks)++;
+        skipped = 0;
+        blocks.push_back(block);
+        offsets.push_back(pos + sizeof(block));
+        firsts.push_back(total);
+        total += block.sweeps;
+        pos = next;
+    }
+    if ((skipped || pos != buf.size()) && bad_blocks != NULL)
+        (*bad_blocks)++;
+
+    sweeps.resize(total);
+    vector<char> good(blocks.size());
+    parallelFor(blocks.size(), threads < 1 ? 1 : threads, [&](int b) {
+        good[b] = decodeBlock(blocks[b], buf.data() + offsets[b], &sweeps[firsts[b]]);
+    });
+
+    // Close up the gaps left by damaged blocks
+    size_t kept = 0;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        if (!good[b]) {
+            if (bad_blocks != NULL)
+                (*bad_blocks)++;
+            continue;
+        }
+        if (kept != firsts[b])
+            memmove(&sweeps[kept], &sweeps[firsts[b]], blocks[b].sweeps * sizeof(laserSweep));
+        kept += blocks[b].sweeps;
+    }
+    sweeps.resize(kept);
+    return true;
+}
+
+// EOF
@@ -0,0 +1,90 @@
+/*
+* scanArchive.h
+* - Compact long-term storage of laser sweeps: blocks of delta coded,
+*   zigzag varint sweeps with an optional rANS entropy stage, written
+*   as they come and decoded in parallel.
+*/
+#ifndef SCANARCHIVE_H
+#define SCANARCHIVE_H
+
+#include <cstdio>
+#include <vector>
+#include "scanBus.h"
+
+#define ARCHIVE_MAGIC "APSA"
+#define ARCHIVE_BLOCK_MAGIC "APSB"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_BLOCK 128        //Sweeps per block, each block decodes on its own
+#define ARCHIVE_PROB_BITS 12     //rANS frequency resolution
+#define ARCHIVE_SWEEP_MAX (1 + 5 * 10 + 8 + 10 + SWEEP_MAX_BEAMS * 3) //Most varint bytes one sweep can take
+
+// Block codings
+#define ARCHIVE_RAW 0            //varints as they are
+#define ARCHIVE_RANS 1           //varints through order-0 rANS
+
+/*
+* archiveHeader / archiveBlockHeader
+* - File layout: the header, then blocks, each a header and data_size
+*   bytes. raw_size is the length of the varint stream and check its
+*   FNV-1a hash, so a damaged block is caught and the rest still read.
+*/
+struct archiveHeader {
+    char magic[4];
+    unsigned short version;
+    unsigned short block;
+    char pad[8];
+};
+
+struct archiveBlockHeader {
+    char magic[4];
+    unsigned int sweeps;
+    unsigned int raw_size;
+    unsigned int data_size;
+    unsigned int coding;
+    unsigned int check;
+};
+
+/*
+* ScanArchiveWriter
+* - Appends sweeps to an archive, a block at a time. Ranges are kept
+*   exactly; time is kept to the microsecond and the pose to 0.1 mm and
+*   a microradian. Each sweep costs a pass over its beams; the entropy
+*   stage runs once per block, and if a budget is set and the stage goes
+*   over it (CPU time per sweep), blocks are written raw from then on.
+*/
+class ScanArchiveWriter {
+public:
+    ScanArchiveWriter();
+    ~ScanArchiveWriter();
+    bool open(const char *file, bool entropy);
+    void setBudget(double us_per_sweep) { myBudget = us_per_sweep; }
+    bool add(const laserSweep &sweep);
+    bool close();
+
+    bool entropy() const { return myEntropy; }
+    long sweeps() const { return mySweeps; }
+    long long sweepBytes() const { return mySweepBytes; }
+    long long fileBytes() const { return myFileBytes; }
+    double cpuPerSweep() const { return mySweeps ? myCpu / mySweeps : 0; }
+
+protected:
+    bool flush();
+
+    FILE *myFile;
+    bool myEntropy;
+    double myBudget;           //us per sweep, 0 for none
+    std::vector<unsigned char> myStream;
+    std::vector<unsigned char> myCoded;
+    laserSweep myPrev;
+    int myBlockSweeps;
+    long mySweeps;
+    long long mySweepBytes;    //what the sweeps take as ranges plus pose
+    long long myFileBytes;
+    double myCpu;              //us spent encoding
+};
+
+bool readScanArchive(const char *file, std::vector<laserSweep> &sweeps, int threads, int *bad_blocks);
+
+#endif
+
+// EOF
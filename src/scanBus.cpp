@@ -0,0 +1,231 @@
+/*
+* scanBus.cpp
+* - Seqlock ring of sweeps in POSIX shared memory.
+*
+*   Every slot has a sequence count the writer makes odd before writing and
+*   even after. A reader notes the count, uses the sweep where it lies,
+*   then checks the count again; if it moved the sweep was overwritten and
+*   is thrown away. The writer never waits for anyone.
+*/
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "scanBus.h"
+
+/*
+* ScanBus
+* - Constructor and destructor.
+*/
+ScanBus::ScanBus() : myRegion(NULL), myName(NULL), myOwner(false), myShared(false) {
+}
+
+ScanBus::~ScanBus() {
+    close();
+}
+
+/*
+* stale
+* - Whether an existing region is left over from a writer that's gone.
+*   One still being set up, from another version, or whose writer is
+*   alive is not, and is left alone.
+*/
+static bool stale(const char *name) {
+    struct stat st;
+    bool gone = false;
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return errno == ENOENT;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(scanBusRegion)) {
+        void *mem = mmap(NULL, sizeof(scanBusRegion), PROT_READ, MAP_SHARED, fd, 0);
+        if (mem != MAP_FAILED) {
+            const scanBusRegion *r = (const scanBusRegion *)mem;
+            gone = r->magic == SCAN_BUS_MAGIC && r->version == SCAN_BUS_VERSION && r->owner > 0 &&
+                   kill(r->owner, 0) != 0 && errno == ESRCH;
+            munmap(mem, sizeof(scanBusRegion));
+        }
+    }
+    ::close(fd);
+    return gone;
+}
+
+/*
+* create
+* - Make a fresh region for the writer. A region already under that name
+*   is never reused or truncated, readers may still have it mapped: if
+*   its writer is gone the name is unlinked and a new one made, otherwise
+*   this fails. Returns false if shared memory can't be set up.
+*/
+bool ScanBus::create(const char *name) {
+    void *mem;
+
+    close();
+    if (name == NULL) {
+        mem = mmap(NULL, sizeof(scanBusRegion), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    else {
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0 && errno == EEXIST && stale(name)) {
+            shm_unlink(name);
+            fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+        }
+        if (fd < 0 && errno == EEXIST)
+            printf("Scan bus: %s is in use by another writer (or left by an older build,"
+                   " remove /dev/shm%s if nothing is running)\n", name, name);
+        if (fd < 0)
+            return false;
+        if (ftruncate(fd, sizeof(scanBusRegion)) != 0) {
+            ::close(fd);
+            shm_unlink(name);
+            return false;
+        }
+        mem = mmap(NULL, sizeof(scanBusRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mem == MAP_FAILED)
+            shm_unlink(name);
+    }
+    if (mem == MAP_FAILED)
+        return false;
+
+    myRegion = new (mem) scanBusRegion;
+    myRegion->slots = SCAN_BUS_SLOTS;
+    myRegion->sweep_size = sizeof(laserSweep);
+    myRegion->owner = getpid();
+    myRegion->published.store(0);
+    for (int i = 0; i < SCAN_BUS_SLOTS; i++)
+        myRegion->slot[i].seq.store(0);
+    myRegion->version = SCAN_BUS_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    myRegion->magic = SCAN_BUS_MAGIC;
+
+    myName = name;
+    myOwner = true;
+    myShared = name != NULL;
+    return true;
+}
+
+/*
+* attach
+* - Map a region another process created, read only. Returns false if it
+*   doesn't exist or was made by a different version.
+*/
+bool ScanBus::attach(const char *name) {
+    close();
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    void *mem = mmap(NULL, sizeof(scanBusRegion), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED)
+        return false;
+
+    myRegion = (scanBusRegion *)mem;
+    myName = name;
+    myOwner = false;
+    myShared = true;
+    if (myRegion->magic != SCAN_BUS_MAGIC || myRegion->version != SCAN_BUS_VERSION ||
+            myRegion->sweep_size != sizeof(laserSweep)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+/*
+* close
+* - Unmap, and remove the name if we created it.
+*/
+void ScanBus::close() {
+    if (myRegion == NULL)
+        return;
+    munmap(myRegion, sizeof(scanBusRegion));
+    if (myOwner && myShared)
+        shm_unlink(myName);
+    myRegion = NULL;
+    myOwner = false;
+}
+
+/*
+* publish
+* - Copy a sweep into the next slot. Only the creator may call this, from
+*   one thread. The sweep's number is filled in here.
+*/
+void ScanBus::publish(const laserSweep &sweep) {
+    if (myRegion == NULL || !myOwner)
+        return;
+    unsigned long long number = myRegion->published.load(std::memory_order_relaxed) + 1;
+    scanBusSlot &slot = myRegion->slot[number % SCAN_BUS_SLOTS];
+    unsigned int s = slot.seq.load(std::memory_order_relaxed);
+
+    slot.seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&slot.sweep, &sweep, sizeof(laserSweep));
+    slot.sweep.number = number;
+    slot.seq.store(s + 2, std::memory_order_release);
+    myRegion->published.store(number, std::memory_order_release);
+}
+
+/*
+* newest
+* - Number of the newest published sweep, 0 if none yet.
+*/
+unsigned long long ScanBus::newest() const {
+    if (myRegion == NULL)
+        return 0;
+    return myRegion->published.load(std::memory_order_acquire);
+}
+
+/*
+* beginRead / endRead
+* - Zero copy access to sweep number. beginRead returns the sweep in place
+*   (NULL if it is gone or being written); once done with it endRead says
+*   whether it stayed intact the whole time.
+*/
+const laserSweep *ScanBus::beginRead(unsigned long long number, unsigned int &ticket) const {
+    if (myRegion == NULL || number == 0)
+        return NULL;
+    const scanBusSlot &slot = myRegion->slot[number % SCAN_BUS_SLOTS];
+    ticket = slot.seq.load(std::memory_order_acquire);
+    if ((ticket & 1) || slot.sweep.number != number)
+        return NULL;
+    return &slot.sweep;
+}
+
+bool ScanBus::endRead(unsigned long long number, unsigned int ticket) const {
+    const scanBusSlot &slot = myRegion->slot[number % SCAN_BUS_SLOTS];
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == ticket;
+}
+
+/*
+* read / readLatest
+* - Copying reads, retried a few times if the writer gets in the way.
+*/
+bool ScanBus::read(unsigned long long number, laserSweep &out) const {
+    for (int tries = 0; tries < 4; tries++) {
+        unsigned int ticket;
+        const laserSweep *sweep = beginRead(number, ticket);
+        if (sweep == NULL)
+            continue;
+        memcpy(&out, sweep, sizeof(laserSweep));
+        if (endRead(number, ticket) && out.number == number)
+            return true;
+    }
+    return false;
+}
+
+bool ScanBus::readLatest(laserSweep &out) const {
+    for (int tries = 0; tries < 4; tries++) {
+        if (read(newest(), out))
+            return true;
+    }
+    return false;
+}
+
+// EOF
@@ -0,0 +1,82 @@
+/*
+* scanBus.h
+* - Single writer, many reader ring of laser sweeps in shared memory.
+*/
+#ifndef SCANBUS_H
+#define SCANBUS_H
+
+#include <atomic>
+#include "autoPark.h"
+
+#define SCAN_BUS_NAME "/autopark_scans" //POSIX shared memory name
+#define SCAN_BUS_MAGIC 0x41505342       //"APSB"
+#define SCAN_BUS_VERSION 2
+#define SCAN_BUS_SLOTS 16               //Sweeps kept, about half a second
+#define SWEEP_MAX_BEAMS 361             //180 degrees at half a degree
+
+/*
+* laserSweep
+* - One sweep by beam index. Ranges are mm, 0 where the laser flagged the
+*   reading to be ignored. Fixed size so it can live in shared memory.
+*/
+struct laserSweep {
+    unsigned long long number;  //counts up from 1 per published sweep
+    double time;                //s, ARIA time stamp of the sweep
+    pose2d pose;                //odometry pose the sweep was placed with
+    float start_angle;          //bearing of beam 0, degrees
+    float increment;            //degrees between beams
+    unsigned short count;
+    unsigned short ranges[SWEEP_MAX_BEAMS];
+};
+
+/*
+* scanBusSlot / scanBusRegion
+* - Shared memory layout. A slot's seq is odd while it is being written.
+*/
+struct scanBusSlot {
+    std::atomic<unsigned int> seq;
+    laserSweep sweep;
+};
+
+struct scanBusRegion {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int slots;
+    unsigned int sweep_size;
+    int owner;                                 //pid of the writer
+    std::atomic<unsigned long long> published; //number of the newest sweep
+    scanBusSlot slot[SCAN_BUS_SLOTS];
+};
+
+/*
+* ScanBus
+* - Either creates the region (the writer) or attaches to it (readers).
+*   With a NULL name the region is private to this process. Readers never
+*   block the writer: they read a slot in place and then check it wasn't
+*   rewritten underneath them.
+*/
+class ScanBus {
+public:
+    ScanBus();
+    ~ScanBus();
+    bool create(const char *name);
+    bool attach(const char *name);
+    void close();
+
+    void publish(const laserSweep &sweep);
+    unsigned long long newest() const;
+    const laserSweep *beginRead(unsigned long long number, unsigned int &ticket) const;
+    bool endRead(unsigned long long number, unsigned int ticket) const;
+    bool read(unsigned long long number, laserSweep &out) const;
+    bool readLatest(laserSweep &out) const;
+
+protected:
+    scanBusRegion *myRegion;
+    const char *myName;
+    bool myOwner;
+    bool myShared;
+};
+
+#endif
+
+// EOF
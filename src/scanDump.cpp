@@ -0,0 +1,70 @@
+/*
+* scanDump.cpp
+* - Reads a scan archive back, decoding its blocks over threads, and
+*   prints what's in it, or every sweep as text with -text (one line a
+*   sweep: number, time, pose x y th, start angle, increment, ranges).
+*
+*   usage: ./scanDump [-j threads] [-text] file
+*/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "scanArchive.h"
+
+int main(int argc, char **argv) {
+    const char *file = NULL;
+    int threads = std::thread::hardware_concurrency();
+    bool text = false;
+    std::vector<laserSweep> sweeps;
+    int bad = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-text") == 0)
+            text = true;
+        else
+            file = argv[i];
+    }
+    if (file == NULL) {
+        printf("usage: %s [-j threads] [-text] file\n", argv[0]);
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!readScanArchive(file, sweeps, threads, &bad)) {
+        printf("Could not read %s\n", file);
+        return 1;
+    }
+    double took = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (text) {
+        for (size_t i = 0; i < sweeps.size(); i++) {
+            const laserSweep &s = sweeps[i];
+            printf("%llu %.6f %.1f %.1f %.6f %g %g", s.number, s.time, s.pose.x, s.pose.y, s.pose.th,
+                   s.start_angle, s.increment);
+            for (int b = 0; b < s.count; b++)
+                printf(" %u", s.ranges[b]);
+            printf("\n");
+        }
+        return bad == 0 ? 0 : 2;
+    }
+
+    long long beams = 0;
+    long gaps = 0;
+    for (size_t i = 0; i < sweeps.size(); i++) {
+        beams += sweeps[i].count;
+        if (i > 0 && sweeps[i].number != sweeps[i - 1].number + 1)
+            gaps++;
+    }
+    printf("%d sweeps, %lld beams, %ld gaps in numbering, %d bad blocks\n", (int)sweeps.size(), beams, gaps, bad);
+    if (!sweeps.empty())
+        printf("sweeps %llu to %llu over %.1f s\n", sweeps.front().number, sweeps.back().number,
+               sweeps.back().time - sweeps.front().time);
+    printf("decoded in %.3f s (%.0f sweeps/s)\n", took, took > 0 ? sweeps.size() / took : 0.0);
+    return bad == 0 ? 0 : 2;
+}
+
+// EOF
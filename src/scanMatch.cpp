@@ -0,0 +1,83 @@
+/*
+* scanMatch.cpp
+* - Point to point ICP.
+*
+*   Each iteration pairs every point of scan b (moved by the current
+*   estimate) with its nearest point of scan a, drops pairs further apart
+*   than the gate and solves the best rigid motion for the rest in closed
+*   form. The gate starts at ICP_MAX_DIST and follows three times the rms
+*   error down, so bad pairings from a rough start are shed as it settles.
+*   Scans are a few hundred points, nearest neighbours are brute force.
+*/
+#include <cmath>
+#include "scanMatch.h"
+
+/*
+* matchScans
+* - Find delta, the pose of scan b's frame in scan a's frame, starting
+*   from the guess passed in. Returns false if too few points pair up.
+*/
+bool matchScans(const double *ax, const double *ay, int na,
+                const double *bx, const double *by, int nb,
+                pose2d &delta, double *rms) {
+    double gate = ICP_MAX_DIST;
+    double err = 0;
+
+    for (int iter = 0; iter < ICP_ITERATIONS; iter++) {
+        double c = cos(delta.th), s = sin(delta.th);
+        double sax = 0, say = 0, sbx = 0, sby = 0;
+        double sxx = 0, sxy = 0, syx = 0, syy = 0, sq = 0;
+        int pairs = 0;
+
+        // Pair up and accumulate in one pass, centred afterwards
+        for (int j = 0; j < nb; j++) {
+            double x = delta.x + c * bx[j] - s * by[j];
+            double y = delta.y + s * bx[j] + c * by[j];
+            double best = gate * gate;
+            int match = -1;
+            for (int i = 0; i < na; i++) {
+                double d = (ax[i] - x) * (ax[i] - x) + (ay[i] - y) * (ay[i] - y);
+                if (d < best) {
+                    best = d;
+                    match = i;
+                }
+            }
+            if (match < 0)
+                continue;
+            sax += ax[match];
+            say += ay[match];
+            sbx += bx[j];
+            sby += by[j];
+            sxx += bx[j] * ax[match];
+            sxy += bx[j] * ay[match];
+            syx += by[j] * ax[match];
+            syy += by[j] * ay[match];
+            sq += best;
+            pairs++;
+        }
+        if (pairs < ICP_MIN_PAIRS)
+            return false;
+
+        double n = pairs;
+        double mx = sxx - sbx * sax / n, my = syy - sby * say / n;
+        double cxy = sxy - sbx * say / n, cyx = syx - sby * sax / n;
+        double th = atan2(cxy - cyx, mx + my);
+        double x = sax / n - (cos(th) * sbx / n - sin(th) * sby / n);
+        double y = say / n - (sin(th) * sbx / n + cos(th) * sby / n);
+
+        bool done = fabs(x - delta.x) < ICP_DONE_XY && fabs(y - delta.y) < ICP_DONE_XY &&
+                    fabs(th - delta.th) < ICP_DONE_TH;
+        delta.x = x;
+        delta.y = y;
+        delta.th = th;
+        err = sqrt(sq / n);
+        gate = fmax(ICP_MIN_DIST, fmin(gate, 3.0 * err));
+        if (done)
+            break;
+    }
+    if (rms != NULL)
+        *rms = err;
+    return true;
+}
+
+// EOF
@@ -0,0 +1,23 @@
+/*
+* scanMatch.h
+* - 2D scan matching (ICP) between two sets of laser points.
+*/
+#ifndef SCANMATCH_H
+#define SCANMATCH_H
+
+#include "autoPark.h"
+
+#define ICP_ITERATIONS 50
+#define ICP_MAX_DIST 300.0  //mm, pairing gate on the first iteration
+#define ICP_MIN_DIST 30.0   //mm, smallest the gate shrinks to
+#define ICP_MIN_PAIRS 30
+#define ICP_DONE_XY 0.01    //mm, stop once an iteration moves less than this
+#define ICP_DONE_TH 1e-5    //rad
+
+bool matchScans(const double *ax, const double *ay, int na,
+                const double *bx, const double *by, int nb,
+                pose2d &delta, double *rms);
+
+#endif
+
+// EOF
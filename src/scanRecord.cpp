@@ -0,0 +1,90 @@
+/*
+* scanRecord.cpp
+* - Attaches to the live scan bus and records every sweep to a scan
+*   archive until Ctrl-C. Like scanTap it never slows down autoPark; a
+*   sweep that has left the ring before we get to it is counted as lost.
+*
+*   usage: ./scanRecord [-raw] [-budget us] [-bus name] file
+*          (-raw skips the entropy stage, -budget drops it once coding
+*           costs more than us of CPU per sweep)
+*/
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "scanArchive.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int) {
+    stop = 1;
+}
+
+int main(int argc, char **argv) {
+    const char *name = SCAN_BUS_NAME;
+    const char *file = NULL;
+    bool entropy = true;
+    double budget = 0;
+    ScanBus bus;
+    ScanArchiveWriter archive;
+    laserSweep sweep;
+    unsigned long long last = 0;
+    long lost = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-raw") == 0)
+            entropy = false;
+        else if (strcmp(argv[i], "-budget") == 0 && i + 1 < argc)
+            budget = atof(argv[++i]);
+        else if (strcmp(argv[i], "-bus") == 0 && i + 1 < argc)
+            name = argv[++i];
+        else
+            file = argv[i];
+    }
+    if (file == NULL) {
+        printf("usage: %s [-raw] [-budget us] [-bus name] file\n", argv[0]);
+        return 1;
+    }
+    if (!bus.attach(name)) {
+        printf("Could not attach to scan bus %s, is autoPark running?\n", name);
+        return 1;
+    }
+    if (!archive.open(file, entropy)) {
+        printf("Could not write %s\n", file);
+        return 1;
+    }
+    archive.setBudget(budget);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    last = bus.newest();
+
+    for (int tick = 1; !stop; tick++) {
+        unsigned long long n = bus.newest();
+        for (unsigned long long k = last + 1; k <= n && last != 0; k++) {
+            if (bus.read(k, sweep))
+                archive.add(sweep);
+            else
+                lost++;
+        }
+        last = n;
+
+        if (tick % 2500 == 0) {
+            printf("%ld sweeps, %ld lost, %.1f:1, %.1f us/sweep%s\n", archive.sweeps(), lost,
+                   (double)archive.sweepBytes() / archive.fileBytes(), archive.cpuPerSweep(),
+                   archive.entropy() ? "" : " (raw)");
+            fflush(stdout);
+        }
+        usleep(2000);
+    }
+
+    if (!archive.close()) {
+        printf("Could not finish %s\n", file);
+        return 1;
+    }
+    printf("Recorded %ld sweeps (%ld lost) to %s: %lld bytes, %.1f:1, %.1f us/sweep\n", archive.sweeps(), lost,
+           file, archive.fileBytes(), (double)archive.sweepBytes() / archive.fileBytes(), archive.cpuPerSweep());
+    return 0;
+}
+
+// EOF
@@ -0,0 +1,39 @@
+/*
+* scanRoi.cpp
+* - Region of interest index arithmetic.
+*/
+#include <cmath>
+#include "scanRoi.h"
+
+/*
+* roiSpan
+* - Which beams of a sweep (beam b at start_angle + b * increment) fall
+*   in the region. Works for either sweep direction. Returns false if
+*   none do.
+*/
+bool roiSpan(const scanRoi &roi, double start_angle, double increment, int beams, int &first, int &count) {
+    if (beams < 1)
+        return false;
+    if (increment == 0) {
+        first = 0;
+        count = start_angle >= roi.min_angle && start_angle <= roi.max_angle ? 1 : 0;
+        return count > 0;
+    }
+
+    // Beam indices at each end of the region, a little slack for rounding
+    double a = (roi.min_angle - start_angle) / increment;
+    double b = (roi.max_angle - start_angle) / increment;
+    int lo = (int)ceil(fmin(a, b) - 1e-6);
+    int hi = (int)floor(fmax(a, b) + 1e-6);
+    if (lo < 0)
+        lo = 0;
+    if (hi > beams - 1)
+        hi = beams - 1;
+    if (hi - lo + 1 > ROI_MAX_BEAMS)
+        hi = lo + ROI_MAX_BEAMS - 1;
+    first = lo;
+    count = hi - lo + 1;
+    return count > 0;
+}
+
+// EOF
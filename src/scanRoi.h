@@ -0,0 +1,47 @@
+/*
+* scanRoi.h
+* - Raw sweep ingest: the beams in an angular region of interest, picked
+*   by index before any trig, with the laser's ignore flags as a bitmask.
+*/
+#ifndef SCANROI_H
+#define SCANROI_H
+
+#define ROI_MAX_BEAMS 512
+#define ROI_MIN_ANGLE -95.0  //Default region, degrees in the robot frame: just past
+#define ROI_MAX_ANGLE 0.0    //the right side round to straight ahead, where slots are
+#define SCAN_STILL_VEL 5.0   //Slower than this counts as stopped for a scan, mm/s
+#define SCAN_STILL_ROT 1.0   //deg/s
+
+/*
+* scanRoi
+* - Beams from min_angle to max_angle (degrees, robot frame) are kept.
+*/
+struct scanRoi {
+    double min_angle;
+    double max_angle;
+};
+
+/*
+* roiSweep
+* - The kept beams of one sweep. Beam b of the sweep is ranges[b - first]
+*   at start_angle + (b - first) * increment degrees. Bit i of valid is
+*   clear when the laser flagged ranges[i] to be ignored.
+*/
+struct roiSweep {
+    int first;
+    int count;
+    double start_angle;
+    double increment;
+    unsigned short ranges[ROI_MAX_BEAMS];
+    unsigned long long valid[ROI_MAX_BEAMS / 64];
+};
+
+bool roiSpan(const scanRoi &roi, double start_angle, double increment, int beams, int &first, int &count);
+
+static inline bool roiValid(const roiSweep &sweep, int i) {
+    return (sweep.valid[i >> 6] >> (i & 63)) & 1;
+}
+
+#endif
+
+// EOF
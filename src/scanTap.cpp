@@ -0,0 +1,60 @@
+/*
+* scanTap.cpp
+* - Attaches to the live scan bus and prints the sweep rate, skipped sweeps
+*   and nearest return once a second. Never slows down autoPark.
+*
+*   usage: ./scanTap [bus name]
+*/
+#include <cstdio>
+#include <unistd.h>
+#include "scanBus.h"
+
+int main(int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : SCAN_BUS_NAME;
+    ScanBus bus;
+    unsigned long long last = 0;
+    int got = 0, skipped = 0, torn = 0;
+    unsigned int nearest = 0;
+
+    if (!bus.attach(name)) {
+        printf("Could not attach to scan bus %s, is autoPark running?\n", name);
+        return 1;
+    }
+    last = bus.newest();
+
+    for (int tick = 1; ; tick++) {
+        unsigned long long n = bus.newest();
+        if (n != last) {
+            if (last != 0 && n > last + 1)
+                skipped += n - last - 1;
+            last = n;
+
+            // Look at the sweep where it lies, then make sure it held still
+            unsigned int ticket;
+            const laserSweep *sweep = bus.beginRead(n, ticket);
+            unsigned int near = 0;
+            if (sweep != NULL) {
+                for (int i = 0; i < sweep->count && i < SWEEP_MAX_BEAMS; i++)
+                    if (sweep->ranges[i] != 0 && (near == 0 || sweep->ranges[i] < near))
+                        near = sweep->ranges[i];
+            }
+            if (sweep != NULL && bus.endRead(n, ticket)) {
+                got++;
+                nearest = near;
+            }
+            else
+                torn++;
+        }
+
+        if (tick % 500 == 0) {
+            printf("sweep %llu: %d/s, %d skipped, %d torn, nearest %u mm\n",
+                   last, got, skipped, torn, nearest);
+            fflush(stdout);
+            got = skipped = torn = 0;
+        }
+        usleep(2000);
+    }
+    return 0;
+}
+
+// EOF
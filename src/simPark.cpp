@@ -0,0 +1,114 @@
+/*
+* simPark.cpp
+* - Runs several robots through one lot (see lotSim.h) and reports how
+*   many parked, how long it took them and how often they got in each
+*   other's way. Runs are repeatable: the same seed gives the same result
+*   on any number of threads, and the checksum shows it.
+*
+*   usage: ./simPark [-n robots] [-j threads] [-arrival s] [-dwell s]
+*                    [-moves n] [-time s] [-seed n] [-tune profile] [-v] [map]
+*          (default 4 robots on Map1.map; -v prints every robot)
+*/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "lotSim.h"
+#include "tuning.h"
+
+static const char *state_names[] = {"waiting", "scanning", "searching", "parking", "parked", "left", "failed"};
+static const char *maneuver_names[] = {"-", "two-arc", "multi-point", "bay"};
+
+int main(int argc, char **argv) {
+    const char *file = "Map1.map";
+    bool verbose = false;
+    simConfig config;
+    lotMap map;
+
+    config.robots = 4;
+    config.arrival = SIM_ARRIVAL;
+    config.dwell = SIM_DWELL;
+    config.max_moves = SIM_MAX_MOVES;
+    config.time_limit = 0;
+    config.seed = 1;
+    config.threads = std::thread::hardware_concurrency();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            config.robots = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            config.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-arrival") == 0 && i + 1 < argc)
+            config.arrival = atof(argv[++i]);
+        else if (strcmp(argv[i], "-dwell") == 0 && i + 1 < argc)
+            config.dwell = atof(argv[++i]);
+        else if (strcmp(argv[i], "-moves") == 0 && i + 1 < argc)
+            config.max_moves = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc)
+            config.time_limit = atof(argv[++i]);
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            config.seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-tune") == 0 && i + 1 < argc) {
+            if (!loadTuning(argv[++i], tuning)) {
+                printf("Could not use profile %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-v") == 0)
+            verbose = true;
+        else
+            file = argv[i];
+    }
+    if (config.robots < 1 || !loadLotMap(file, map)) {
+        printf("Could not use %s with %d robots\n", file, config.robots);
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    LotSim sim(map, config);
+    long steps = 0;
+    while (!sim.done()) {
+        sim.step();
+        steps++;
+    }
+    double took = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const std::vector<simRobot> &robots = sim.robots();
+    int parked = 0, failed = 0, scans = 0, abandoned = 0;
+    double park_sum = 0, park_max = 0, waited = 0;
+    long contacts = 0;
+    for (size_t i = 0; i < robots.size(); i++) {
+        const simRobot &r = robots[i];
+        if (r.parked >= 0) {
+            double t = r.parked - r.enter;
+            parked++;
+            park_sum += t;
+            if (t > park_max)
+                park_max = t;
+        }
+        if (r.state == SIM_FAILED)
+            failed++;
+        scans += r.scans;
+        abandoned += r.abandoned;
+        waited += r.waited;
+        contacts += r.contacts;
+        if (verbose)
+            printf("robot %d: %s at %.0f %.0f, arrived %.1f entered %.1f parked %.1f (%s), %d scans %d moves "
+                   "%d plans, %d abandoned, waited %.1f s, %ld contact steps\n", r.id, state_names[r.state],
+                   r.pose.x, r.pose.y, r.arrive, r.enter, r.parked, maneuver_names[r.maneuver], r.scans, r.moves,
+                   r.plans, r.abandoned, r.waited, r.contacts);
+    }
+
+    printf("%d robots on %s, %.0f s simulated in %.2f s (%.0f steps/s, %d threads)\n", config.robots, file,
+           sim.time(), took, took > 0 ? steps / took : 0.0, config.threads);
+    printf("parked %d, gave up %d, still going %d\n", parked, failed, config.robots - parked - failed);
+    if (parked > 0)
+        printf("time to park mean %.1f s, max %.1f s; %.1f parks per hour\n", park_sum / parked, park_max,
+               parked * 3600.0 / sim.time());
+    printf("%d scans, %d maneuvers abandoned, %.1f s waiting on other robots, %ld steps touching a line\n",
+           scans, abandoned, waited, contacts);
+    printf("checksum %016llx\n", sim.checksum());
+    return 0;
+}
+
+// EOF
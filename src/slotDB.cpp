@@ -0,0 +1,434 @@
+/*
+* slotDB.cpp
+* - Slot memory across runs.
+*
+*   Each slot keeps the probability it's free. Between sightings it fades
+*   back towards one half with time constant SLOTDB_TAU, since cars come
+*   and go, and a sighting multiplies its odds by SLOTDB_ODDS either way.
+*   A scan that finds a slot updates the known slot it matches (or adds
+*   one). Known slots the scan should have seen and didn't count as
+*   taken: all of them in view when it found nothing, only the ones
+*   before the slot it found otherwise, since the corner search stops at
+*   the first slot. Nearest queries walk the grid index out ring by ring
+*   and stop once no closer cell is left.
+*/
+#include <cmath>
+#include <cstring>
+#include "slotDB.h"
+
+using namespace std;
+
+// File header, one per file
+struct slotDBHeader {
+    char magic[4];
+    unsigned short version;
+    unsigned short record_size;
+    char pad[8];
+};
+
+// Version 1 records, before samples
+struct slotRecordV1 {
+    unsigned int id;
+    unsigned int sightings;
+    pose2d center;
+    pose2d view;
+    double width;
+    double depth;
+    double last_seen;
+    double free;
+};
+
+/*
+* slotFreeNow
+* - The chance a slot is free now, given what was seen last.
+*/
+double slotFreeNow(const slotRecord &slot, double now) {
+    double age = now - slot.last_seen;
+    if (age < 0)
+        age = 0;
+    return 0.5 + (slot.free - 0.5) * exp(-age / SLOTDB_TAU);
+}
+
+/*
+* SlotDB
+* - Constructor.
+*/
+SlotDB::SlotDB() : myNextId(1), myFile(NULL), myRecords(0) {
+    myPath[0] = '\0';
+}
+
+SlotDB::~SlotDB() {
+    close();
+}
+
+/*
+* readRecord
+* - The next record of a file of the given version.
+*/
+static bool readRecord(FILE *fp, int version, slotRecord &rec) {
+    if (version == SLOTDB_VERSION)
+        return fread(&rec, sizeof(rec), 1, fp) == 1;
+    slotRecordV1 old;
+    if (fread(&old, sizeof(old), 1, fp) != 1)
+        return false;
+    rec.id = old.id;
+    rec.sightings = old.sightings;
+    rec.samples = old.sightings;
+    rec.pad = 0;
+    rec.center = old.center;
+    rec.view = old.view;
+    rec.width = old.width;
+    rec.depth = old.depth;
+    rec.last_seen = old.last_seen;
+    rec.free = old.free;
+    return true;
+}
+
+/*
+* open
+* - Load the slots in file, creating it if there isn't one, and keep it
+*   open for appending. A file left with half a record by a crash, or
+*   from an older version, is rewritten first so appends stay aligned.
+*   Returns false if it can't be read or written.
+*/
+bool SlotDB::open(const char *file) {
+    slotDBHeader header;
+    slotRecord rec;
+    bool rewrite = false;
+
+    close();
+    mySlots.clear();
+    myById.clear();
+    myGrid.clear();
+    myNextId = 1;
+    myRecords = 0;
+    strncpy(myPath, file, sizeof(myPath) - 1);
+    myPath[sizeof(myPath) - 1] = '\0';
+
+    FILE *fp = fopen(file, "rb");
+    if (fp != NULL) {
+        bool ok = fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, SLOTDB_MAGIC, 4) == 0;
+        bool current = header.version == SLOTDB_VERSION && header.record_size == sizeof(slotRecord);
+        bool old = header.version == 1 && header.record_size == sizeof(slotRecordV1);
+        if (!ok || !(current || old)) {
+            fclose(fp);
+            return false;
+        }
+        while (readRecord(fp, header.version, rec)) {
+            myRecords++;
+            map<unsigned int, int>::iterator it = myById.find(rec.id);
+            if (it == myById.end()) {
+                myById[rec.id] = mySlots.size();
+                mySlots.push_back(rec);
+            }
+            else
+                mySlots[it->second] = rec;
+            if (rec.id >= myNextId)
+                myNextId = rec.id + 1;
+        }
+
+        // Anything after the last whole record is a torn write
+        fseek(fp, 0, SEEK_END);
+        long whole = sizeof(header) + myRecords * (long)header.record_size;
+        rewrite = ftell(fp) != whole || header.version != SLOTDB_VERSION;
+        fclose(fp);
+    }
+    for (size_t i = 0; i < mySlots.size(); i++)
+        index(i);
+
+    // A new or torn file, or one that's mostly old records, is written out fresh
+    if (fp == NULL || rewrite || myRecords - (long)mySlots.size() >= SLOTDB_COMPACT)
+        return compact();
+    myFile = fopen(file, "ab");
+    return myFile != NULL;
+}
+
+void SlotDB::close() {
+    if (myFile != NULL)
+        fclose(myFile);
+    myFile = NULL;
+    return;
+}
+
+/*
+* compact
+* - Write the live slots to a new file and swap it in.
+*/
+bool SlotDB::compact() {
+    slotDBHeader header;
+    char tmp[sizeof(myPath) + 4];
+
+    close();
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SLOTDB_MAGIC, 4);
+    header.version = SLOTDB_VERSION;
+    header.record_size = sizeof(slotRecord);
+    snprintf(tmp, sizeof(tmp), "%s.new", myPath);
+
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (size_t i = 0; i < mySlots.size() && ok; i++)
+        ok = fwrite(&mySlots[i], sizeof(slotRecord), 1, fp) == 1;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp, myPath) != 0) {
+        remove(tmp);
+        return false;
+    }
+    myRecords = mySlots.size();
+    myFile = fopen(myPath, "ab");
+    return myFile != NULL;
+}
+
+/*
+* append
+* - Save a slot's new state.
+*/
+void SlotDB::append(const slotRecord &slot) {
+    if (myFile == NULL)
+        return;
+    if (fwrite(&slot, sizeof(slot), 1, myFile) == 1)
+        myRecords++;
+    fflush(myFile);
+    return;
+}
+
+/*
+* gridKey / cellKey / index / unindex / bound
+* - Grid index over slot centres, and the box of cells it spans. The box
+*   grows as cells are added and is only worked out again from the grid
+*   when a cell on its edge empties.
+*/
+static long long gridKey(long long cx, long long cy) {
+    return (cx << 32) ^ (cy & 0xffffffffLL);
+}
+
+static long long cellKey(double x, double y) {
+    return gridKey((long long)floor(x / SLOTDB_CELL), (long long)floor(y / SLOTDB_CELL));
+}
+
+void SlotDB::index(int i) {
+    long long cx = (long long)floor(mySlots[i].center.x / SLOTDB_CELL);
+    long long cy = (long long)floor(mySlots[i].center.y / SLOTDB_CELL);
+    if (myGrid.empty()) {
+        myMinCx = myMaxCx = cx;
+        myMinCy = myMaxCy = cy;
+    }
+    else {
+        myMinCx = cx < myMinCx ? cx : myMinCx;
+        myMaxCx = cx > myMaxCx ? cx : myMaxCx;
+        myMinCy = cy < myMinCy ? cy : myMinCy;
+        myMaxCy = cy > myMaxCy ? cy : myMaxCy;
+    }
+    myGrid[gridKey(cx, cy)].push_back(i);
+    return;
+}
+
+void SlotDB::unindex(int i) {
+    long long cx = (long long)floor(mySlots[i].center.x / SLOTDB_CELL);
+    long long cy = (long long)floor(mySlots[i].center.y / SLOTDB_CELL);
+    map<long long, vector<int> >::iterator it = myGrid.find(gridKey(cx, cy));
+    if (it == myGrid.end())
+        return;
+    for (size_t k = 0; k < it->second.size(); k++) {
+        if (it->second[k] == i) {
+            it->second.erase(it->second.begin() + k);
+            break;
+        }
+    }
+    if (it->second.empty()) {
+        myGrid.erase(it);
+        if (cx == myMinCx || cx == myMaxCx || cy == myMinCy || cy == myMaxCy)
+            bound();
+    }
+    return;
+}
+
+void SlotDB::bound() {
+    bool first = true;
+    for (map<long long, vector<int> >::const_iterator it = myGrid.begin(); it != myGrid.end(); it++) {
+        long long kx = it->first >> 32, ky = (int)(it->first & 0xffffffffLL);
+        if (first || kx < myMinCx)
+            myMinCx = kx;
+        if (first || kx > myMaxCx)
+            myMaxCx = kx;
+        if (first || ky < myMinCy)
+            myMinCy = ky;
+        if (first || ky > myMaxCy)
+            myMaxCy = ky;
+        first = false;
+    }
+    return;
+}
+
+/*
+* match
+* - The known slot a sighting is of, or -1.
+*/
+int SlotDB::match(const slotObs &obs) const {
+    double best = SLOTDB_MATCH_DIST;
+    int found = -1;
+    long long cx = (long long)floor(obs.center.x / SLOTDB_CELL);
+    long long cy = (long long)floor(obs.center.y / SLOTDB_CELL);
+
+    for (long long dx = -1; dx <= 1; dx++) {
+        for (long long dy = -1; dy <= 1; dy++) {
+            map<long long, vector<int> >::const_iterator it = myGrid.find(gridKey(cx + dx, cy + dy));
+            if (it == myGrid.end())
+                continue;
+            for (size_t k = 0; k < it->second.size(); k++) {
+                const slotRecord &s = mySlots[it->second[k]];
+                double d = hypot(s.center.x - obs.center.x, s.center.y - obs.center.y);
+                double dth = fabs(atan2(sin(s.center.th - obs.center.th), cos(s.center.th - obs.center.th)));
+                if (d < best && dth < SLOTDB_MATCH_ANGLE) {
+                    best = d;
+                    found = it->second[k];
+                }
+            }
+        }
+    }
+    return found;
+}
+
+/*
+* update
+* - Fade a slot to now and fold in one sighting.
+*/
+void SlotDB::update(slotRecord &slot, bool free, double now) {
+    double p = slotFreeNow(slot, now);
+    double odds = p / (1.0 - p) * (free ? SLOTDB_ODDS : 1.0 / SLOTDB_ODDS);
+    p = odds / (1.0 + odds);
+    slot.free = fmin(0.98, fmax(0.02, p));
+    slot.last_seen = now;
+    slot.sightings++;
+    return;
+}
+
+/*
+* observeScan
+* - Record one scan from the robot's map pose: found is the slot it
+*   found, or NULL. Known slots in view that it should have found first
+*   (all of them, if it found none) are taken.
+*/
+void SlotDB::observeScan(const pose2d &robot, const slotObs *found, double now) {
+    int hit = found != NULL ? match(*found) : -1;
+    double c = cos(robot.th), s = sin(robot.th);
+
+    // The corner search stops at the first slot, anything past it wasn't looked at
+    double seen_to = SLOTDB_VIEW_AHEAD;
+    if (found != NULL)
+        seen_to = c * (found->center.x - robot.x) + s * (found->center.y - robot.y) - SLOTDB_MATCH_DIST;
+
+    for (size_t i = 0; i < mySlots.size(); i++) {
+        if ((int)i == hit)
+            continue;
+        double dx = mySlots[i].center.x - robot.x, dy = mySlots[i].center.y - robot.y;
+        double ahead = c * dx + s * dy, left = -s * dx + c * dy;
+        if (ahead < 0 || ahead > seen_to || left > 0 || left < -SLOTDB_VIEW_SIDE)
+            continue;
+        update(mySlots[i], false, now);
+        append(mySlots[i]);
+    }
+    if (found == NULL)
+        return;
+
+    if (hit < 0) {
+        slotRecord rec;
+        rec.id = myNextId++;
+        rec.sightings = 0;
+        rec.samples = 0;
+        rec.pad = 0;
+        rec.center = found->center;
+        rec.view = found->view;
+        rec.width = found->width;
+        rec.depth = found->depth;
+        rec.last_seen = now;
+        rec.free = 0.5;
+        myById[rec.id] = mySlots.size();
+        mySlots.push_back(rec);
+        index(mySlots.size() - 1);
+        hit = mySlots.size() - 1;
+    }
+    else {
+        // Running average of where it is and how big, from the latest view
+        slotRecord &rec = mySlots[hit];
+        double w = 1.0 / (rec.samples + 1);
+        unindex(hit);
+        rec.center.x += w * (found->center.x - rec.center.x);
+        rec.center.y += w * (found->center.y - rec.center.y);
+        rec.width += w * (found->width - rec.width);
+        rec.depth += w * (found->depth - rec.depth);
+        rec.view = found->view;
+        index(hit);
+    }
+    mySlots[hit].samples++;
+    update(mySlots[hit], true, now);
+    append(mySlots[hit]);
+    return;
+}
+
+/*
+* nearestFree
+* - The closest slot to from (map frame) at least min_width wide and at
+*   least min_free likely to be free now. Returns false if there's none.
+*/
+bool SlotDB::nearestFree(const pose2d &from, double min_width, double min_free, double now, slotRecord &out) const {
+    long long cx = (long long)floor(from.x / SLOTDB_CELL);
+    long long cy = (long long)floor(from.y / SLOTDB_CELL);
+    double best = 1e18;
+    vector<long long> cells;
+
+    if (myGrid.empty())
+        return false;
+
+    // Rings from the first that reaches the indexed box to the last that
+    // touches it, each walked only where it crosses the box
+    long long first = 0, reach = 0;
+    first = myMinCx - cx > first ? myMinCx - cx : first;
+    first = cx - myMaxCx > first ? cx - myMaxCx : first;
+    first = myMinCy - cy > first ? myMinCy - cy : first;
+    first = cy - myMaxCy > first ? cy - myMaxCy : first;
+    reach = llabs(myMinCx - cx) > reach ? llabs(myMinCx - cx) : reach;
+    reach = llabs(myMaxCx - cx) > reach ? llabs(myMaxCx - cx) : reach;
+    reach = llabs(myMinCy - cy) > reach ? llabs(myMinCy - cy) : reach;
+    reach = llabs(myMaxCy - cy) > reach ? llabs(myMaxCy - cy) : reach;
+
+    for (long long r = first; r <= reach; r++) {
+        // Everything in ring r is at least (r - 1) cells away
+        if ((r - 1) * SLOTDB_CELL > best)
+            break;
+        long long x0 = cx - r > myMinCx ? cx - r : myMinCx, x1 = cx + r < myMaxCx ? cx + r : myMaxCx;
+        long long y0 = cy - r > myMinCy ? cy - r : myMinCy, y1 = cy + r < myMaxCy ? cy + r : myMaxCy;
+        cells.clear();
+        for (long long x = x0; x <= x1; x++) {
+            // Whole columns at the ring's ends, only its top and bottom rows between
+            if (x == cx - r || x == cx + r) {
+                for (long long y = y0; y <= y1; y++)
+                    cells.push_back(gridKey(x, y));
+            }
+            else {
+                if (cy - r >= y0)
+                    cells.push_back(gridKey(x, cy - r));
+                if (cy + r <= y1)
+                    cells.push_back(gridKey(x, cy + r));
+            }
+        }
+        for (size_t c = 0; c < cells.size(); c++) {
+            map<long long, vector<int> >::const_iterator it = myGrid.find(cells[c]);
+            if (it == myGrid.end())
+                continue;
+            for (size_t k = 0; k < it->second.size(); k++) {
+                const slotRecord &s = mySlots[it->second[k]];
+                double d = hypot(s.center.x - from.x, s.center.y - from.y);
+                if (d < best && s.width >= min_width && slotFreeNow(s, now) >= min_free) {
+                    best = d;
+                    out = s;
+                }
+            }
+        }
+    }
+    return best < 1e18;
+}
+
+// EOF
@@ -0,0 +1,105 @@
+/*
+* slotDB.h
+* - What earlier runs saw of the lot: every slot found, where, how big,
+*   when it was last seen and how likely it is to be free, kept on disk
+*   between runs.
+*/
+#ifndef SLOTDB_H
+#define SLOTDB_H
+
+#include <cstdio>
+#include <map>
+#include <vector>
+#include "autoPark.h"
+
+#define SLOTDB_FILE "slots.db"
+#define SLOTDB_MAGIC "APSD"
+#define SLOTDB_VERSION 2         //1 had no samples, and is read and rewritten
+#define SLOTDB_CELL 2000.0       //Spatial index cell, mm
+#define SLOTDB_MATCH_DIST 500.0  //A sighting this close to a known slot is that slot, mm
+#define SLOTDB_MATCH_ANGLE 0.35  //and facing within this, rad
+#define SLOTDB_TAU 1800.0        //What we know fades back to a coin toss over this, s
+#define SLOTDB_ODDS 4.0          //Odds one sighting (free or taken) is worth
+#define SLOTDB_MIN_CONF 0.6      //Free at least this likely to be worth driving to
+#define SLOTDB_VIEW_AHEAD 3000.0 //Scans see slots centred this far ahead of the robot, mm
+#define SLOTDB_VIEW_SIDE 2500.0  //and this far to the right, mm
+#define SLOTDB_LANE_TOL 150.0    //A view pose this close to our line is straight ahead, mm
+#define SLOTDB_LANE_ANGLE 0.17   //rad
+#define SLOTDB_COMPACT 256       //Rewrite the file once it holds this many stale records
+
+/*
+* slotRecord
+* - One slot, map frame (mm, radians). center is the middle of the slot
+*   with th along the lane, view the robot pose it was seen from, which
+*   is where to scan from to find it again. free is the probability it
+*   was free at last_seen (s since the epoch). sightings counts every
+*   scan that saw it, free or taken; samples only the ones that found it,
+*   which are what center, width and depth are averaged over.
+*/
+struct slotRecord {
+    unsigned int id;
+    unsigned int sightings;
+    unsigned int samples;
+    unsigned int pad;
+    pose2d center;
+    pose2d view;
+    double width;
+    double depth;
+    double last_seen;
+    double free;
+};
+
+/*
+* slotObs
+* - A slot found by one scan, map frame.
+*/
+struct slotObs {
+    pose2d center;
+    pose2d view;
+    double width;
+    double depth;
+};
+
+double slotFreeNow(const slotRecord &slot, double now);
+
+/*
+* SlotDB
+* - The slots in memory with a grid index over their centres, backed by
+*   an append-only file of records: each change appends the slot's new
+*   record and loading keeps the last one per id, so a crash loses at most
+*   the record being written. The file is compacted on open once it's
+*   mostly stale. Not thread safe, use it from one thread at a time.
+*/
+class SlotDB {
+public:
+    SlotDB();
+    ~SlotDB();
+    bool open(const char *file);
+    void close();
+    int size() const { return mySlots.size(); }
+
+    void observeScan(const pose2d &robot, const slotObs *found, double now);
+    bool nearestFree(const pose2d &from, double min_width, double min_free, double now, slotRecord &out) const;
+
+protected:
+    void index(int i);
+    void unindex(int i);
+    void bound();
+    int match(const slotObs &obs) const;
+    void update(slotRecord &slot, bool free, double now);
+    void append(const slotRecord &slot);
+    bool compact();
+
+    std::vector<slotRecord> mySlots;
+    std::map<unsigned int, int> myById;
+    std::map<long long, std::vector<int> > myGrid;
+    long long myMinCx, myMaxCx, myMinCy, myMaxCy; //cells myGrid spans, if it isn't empty
+    unsigned int myNextId;
+    FILE *myFile;
+    char myPath[256];
+    long myRecords;   //records in the file, live or stale
+};
+
+#endif
+
+// EOF
@@ -0,0 +1,363 @@
+/*
+* telemetry.cpp
+* - Telemetry server thread.
+*
+*   Every TELEM_POLL_MS the thread accepts viewers, picks up the newest
+*   sweep from the scan bus, drains the event queue and the controller
+*   mailbox, and writes what it can to each viewer without blocking.
+*   Frames that don't fit in a viewer's buffer are dropped, and a viewer
+*   that asked for delta sweeps gets a whole sweep after any drop.
+*/
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "telemetry.h"
+
+/*
+* TelemetryServer
+* - Constructor and destructor.
+*/
+TelemetryServer::TelemetryServer() :
+    myListen(-1), myBus(NULL), myRunning(false), myDropped(0),
+    myEventHead(0), myEventTail(0), myControlSeq(0) {
+    for (int i = 0; i < TELEM_MAX_CLIENTS; i++)
+        myClients[i] = NULL;
+    memset(&myControl, 0, sizeof(myControl));
+}
+
+TelemetryServer::~TelemetryServer() {
+    stop();
+}
+
+/*
+* start
+* - Listen on host:port or a Unix socket path and start the thread.
+*   Returns false if the socket can't be opened.
+*/
+bool TelemetryServer::start(const char *where, const ScanBus *bus) {
+    stop();
+    myBus = bus;
+
+    if (where[0] == '/') {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, where, sizeof(addr.sun_path) - 1);
+        unlink(where);
+        myListen = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (myListen < 0 || bind(myListen, (sockaddr *)&addr, sizeof(addr)) != 0) {
+            stop();
+            return false;
+        }
+    }
+    else {
+        char host[64];
+        int port;
+        sockaddr_in addr;
+        int on = 1;
+        if (sscanf(where, "%63[^:]:%d", host, &port) != 2)
+            return false;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+            return false;
+        myListen = socket(AF_INET, SOCK_STREAM, 0);
+        if (myListen < 0)
+            return false;
+        setsockopt(myListen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(myListen, (sockaddr *)&addr, sizeof(addr)) != 0) {
+            stop();
+            return false;
+        }
+    }
+    if (listen(myListen, TELEM_MAX_CLIENTS) != 0) {
+        stop();
+        return false;
+    }
+    fcntl(myListen, F_SETFL, O_NONBLOCK);
+
+    myRunning.store(true);
+    myThread = std::thread(&TelemetryServer::run, this);
+    return true;
+}
+
+/*
+* stop
+* - Stop the thread and close every socket.
+*/
+void TelemetryServer::stop() {
+    myRunning.store(false);
+    if (myThread.joinable())
+        myThread.join();
+    for (int i = 0; i < TELEM_MAX_CLIENTS; i++)
+        closeClient(i);
+    if (myListen >= 0)
+        close(myListen);
+    myListen = -1;
+}
+
+/*
+* postEvent / postCorners / postPlan
+* - Queue an event for the viewers. Called from the control thread only;
+*   if the queue is full, or the server isn't running, the event is
+*   dropped.
+*/
+void TelemetryServer::postEvent(const telemEvent &event) {
+    if (!myRunning.load(std::memory_order_relaxed))
+        return;
+    unsigned int head = myEventHead.load(std::memory_order_relaxed);
+    if (head - myEventTail.load(std::memory_order_acquire) >= TELEM_EVENTS) {
+        myDropped++;
+        return;
+    }
+    myEvents[head % TELEM_EVENTS] = event;
+    myEventHead.store(head + 1, std::memory_order_release);
+}
+
+void TelemetryServer::postCorners(const reading &first, const reading &second, const reading &third, int type) {
+    telemEvent e;
+    e.type = TELEM_CORNERS;
+    e.corners.first = first;
+    e.corners.second = second;
+    e.corners.third = third;
+    e.corners.type = type;
+    postEvent(e);
+}
+
+void TelemetryServer::postPlan(const telemPlan &plan) {
+    telemEvent e;
+    e.type = TELEM_PLAN;
+    e.plan = plan;
+    postEvent(e);
+}
+
+/*
+* postControl
+* - Update the controller state. Only the latest value is sent, so this is
+*   cheap enough to call every control tick.
+*/
+void TelemetryServer::postControl(double tau, double scale, double left, double right) {
+    unsigned int s = myControlSeq.load(std::memory_order_relaxed);
+    myControlSeq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    myControl.tau = tau;
+    myControl.scale = scale;
+    myControl.left = left;
+    myControl.right = right;
+    myControlSeq.store(s + 2, std::memory_order_release);
+}
+
+/*
+* acceptClients
+* - Take any waiting viewers, up to TELEM_MAX_CLIENTS.
+*/
+void TelemetryServer::acceptClients() {
+    int fd;
+    while ((fd = accept(myListen, NULL, NULL)) >= 0) {
+        int i = 0;
+        while (i < TELEM_MAX_CLIENTS && myClients[i] != NULL)
+            i++;
+        if (i == TELEM_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        int size = TELEM_SOCKET_BUFFER;
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        telemClient *c = (telemClient *)calloc(1, sizeof(telemClient));
+        c->fd = fd;
+        c->keyframe = true;
+        myClients[i] = c;
+    }
+}
+
+void TelemetryServer::closeClient(int i) {
+    if (myClients[i] == NULL)
+        return;
+    close(myClients[i]->fd);
+    free(myClients[i]);
+    myClients[i] = NULL;
+}
+
+/*
+* queueFrame
+* - Append a frame to a viewer's buffer, or drop it if there's no room.
+*/
+bool TelemetryServer::queueFrame(telemClient &c, int type, unsigned char flags, const void *payload, int length) {
+    telemHeader h;
+    if (c.out_len + (int)sizeof(h) + length > TELEM_CLIENT_BUFFER) {
+        c.dropped++;
+        myDropped++;
+        return false;
+    }
+    h.magic = TELEM_MAGIC;
+    h.type = type;
+    h.flags = flags;
+    h.length = length;
+    memcpy(c.out + c.out_len, &h, sizeof(h));
+    memcpy(c.out + c.out_len + sizeof(h), payload, length);
+    c.out_len += sizeof(h) + length;
+    return true;
+}
+
+/*
+* encodeSweep
+* - Pack a sweep: number, time, pose, angles and count, then the ranges,
+*   either raw or as zigzag varint deltas from the last sweep this viewer
+*   got. Every TELEM_KEYFRAME sweeps one goes whole, so a viewer that lost
+*   track of the deltas can pick up again. Returns the payload length.
+*/
+int TelemetryServer::encodeSweep(telemClient &c, const laserSweep &sweep, unsigned char *buf, unsigned char &flags) {
+    int n = 0;
+    memcpy(buf + n, &sweep.number, sizeof(sweep.number)); n += sizeof(sweep.number);
+    memcpy(buf + n, &sweep.time, sizeof(sweep.time)); n += sizeof(sweep.time);
+    memcpy(buf + n, &sweep.pose, sizeof(sweep.pose)); n += sizeof(sweep.pose);
+    memcpy(buf + n, &sweep.start_angle, sizeof(float)); n += sizeof(float);
+    memcpy(buf + n, &sweep.increment, sizeof(float)); n += sizeof(float);
+    memcpy(buf + n, &sweep.count, sizeof(sweep.count)); n += sizeof(sweep.count);
+
+    flags = 0;
+    if ((c.flags & TELEM_DELTA) && !c.keyframe && c.since_key < TELEM_KEYFRAME && c.last_count == sweep.count) {
+        flags = TELEM_DELTA;
+        for (int i = 0; i < sweep.count; i++) {
+            int d = (int)sweep.ranges[i] - (int)c.last[i];
+            unsigned int z = ((unsigned int)d << 1) ^ (unsigned int)(d >> 31);
+            while (z >= 0x80) {
+                buf[n++] = (z & 0x7F) | 0x80;
+                z >>= 7;
+            }
+            buf[n++] = z;
+        }
+    }
+    else {
+        memcpy(buf + n, sweep.ranges, sweep.count * sizeof(unsigned short));
+        n += sweep.count * sizeof(unsigned short);
+    }
+    return n;
+}
+
+/*
+* flush
+* - Write as much of a viewer's buffer as the socket takes right now.
+*/
+void TelemetryServer::flush(telemClient &c, int i) {
+    while (c.out_len > 0) {
+        ssize_t sent = send(c.fd, c.out, c.out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent > 0) {
+            memmove(c.out, c.out + sent, c.out_len - sent);
+            c.out_len -= sent;
+        }
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        else {
+            closeClient(i);
+            return;
+        }
+    }
+}
+
+/*
+* run
+* - The server thread.
+*/
+void TelemetryServer::run() {
+    unsigned long long last_sweep = 0;
+    unsigned int last_control = 0;
+    static unsigned char buf[sizeof(laserSweep) + SWEEP_MAX_BEAMS * 3];
+
+    while (myRunning.load()) {
+        pollfd fds[TELEM_MAX_CLIENTS + 1];
+        int n = 0;
+        fds[n].fd = myListen;
+        fds[n++].events = POLLIN;
+        for (int i = 0; i < TELEM_MAX_CLIENTS; i++) {
+            if (myClients[i] == NULL)
+                continue;
+            fds[n].fd = myClients[i]->fd;
+            fds[n++].events = POLLIN | (myClients[i]->out_len > 0 ? POLLOUT : 0);
+        }
+        poll(fds, n, TELEM_POLL_MS);
+        acceptClients();
+
+        // Viewers may send one flags byte; anything else or a hangup closes them
+        for (int i = 0; i < TELEM_MAX_CLIENTS; i++) {
+            unsigned char in;
+            if (myClients[i] == NULL)
+                continue;
+            ssize_t got = recv(myClients[i]->fd, &in, 1, MSG_DONTWAIT);
+            if (got == 1)
+                myClients[i]->flags = in;
+            else if (got == 0)
+                closeClient(i);
+        }
+
+        // Newest sweep
+        unsigned long long number = myBus != NULL ? myBus->newest() : 0;
+        if (number != last_sweep) {
+            laserSweep sweep;
+            if (myBus->read(number, sweep)) {
+                for (int i = 0; i < TELEM_MAX_CLIENTS; i++) {
+                    telemClient *c = myClients[i];
+                    unsigned char flags;
+                    if (c == NULL)
+                        continue;
+                    int len = encodeSweep(*c, sweep, buf, flags);
+                    if (queueFrame(*c, TELEM_SWEEP, flags, buf, len)) {
+                        memcpy(c->last, sweep.ranges, sweep.count * sizeof(unsigned short));
+                        c->last_count = sweep.count;
+                        c->keyframe = false;
+                        c->since_key = (flags & TELEM_DELTA) ? c->since_key + 1 : 0;
+                    }
+                    else
+                        c->keyframe = true;
+                }
+            }
+            last_sweep = number;
+        }
+
+        // Events from the control thread
+        unsigned int tail = myEventTail.load(std::memory_order_relaxed);
+        while (tail != myEventHead.load(std::memory_order_acquire)) {
+            const telemEvent &e = myEvents[tail % TELEM_EVENTS];
+            for (int i = 0; i < TELEM_MAX_CLIENTS; i++) {
+                if (myClients[i] == NULL)
+                    continue;
+                if (e.type == TELEM_CORNERS)
+                    queueFrame(*myClients[i], e.type, 0, &e.corners, sizeof(e.corners));
+                else
+                    queueFrame(*myClients[i], e.type, 0, &e.plan, sizeof(e.plan));
+            }
+            tail++;
+            myEventTail.store(tail, std::memory_order_release);
+        }
+
+        // Latest controller state, if it changed
+        unsigned int s1 = myControlSeq.load(std::memory_order_acquire);
+        if (s1 != last_control && !(s1 & 1)) {
+            telemControl control = myControl;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (myControlSeq.load(std::memory_order_relaxed) == s1) {
+                last_control = s1;
+                for (int i = 0; i < TELEM_MAX_CLIENTS; i++)
+                    if (myClients[i] != NULL)
+                        queueFrame(*myClients[i], TELEM_CONTROL, 0, &control, sizeof(control));
+            }
+        }
+
+        for (int i = 0; i < TELEM_MAX_CLIENTS; i++)
+            if (myClients[i] != NULL)
+                flush(*myClients[i], i);
+    }
+}
+
+// EOF
@@ -0,0 +1,132 @@
+/*
+* telemetry.h
+* - Non-blocking telemetry stream of sweeps, corners, plans and controller
+*   state for a local viewer.
+*/
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <thread>
+#include "autoPark.h"
+#include "scanBus.h"
+
+#define TELEM_DEFAULT "127.0.0.1:7272" //-telemetry, -telemetryAt takes host:port or a Unix socket path
+#define TELEM_MAGIC 0x5441             //"AT"
+#define TELEM_MAX_CLIENTS 4
+#define TELEM_CLIENT_BUFFER 65536      //Queued bytes per client before frames are dropped
+#define TELEM_SOCKET_BUFFER 32768      //Kernel send buffer, kept small so old frames don't pile up
+#define TELEM_EVENTS 64                //Events queued from the control thread
+#define TELEM_MAX_SEGS 16              //Path segments sent with a plan
+#define TELEM_POLL_MS 5
+#define TELEM_KEYFRAME 50              //Delta viewers get a whole sweep at least this often, to resync
+
+// Frame types
+#define TELEM_SWEEP 1
+#define TELEM_CORNERS 2
+#define TELEM_PLAN 3
+#define TELEM_CONTROL 4
+
+// Flags, sent by a client as one byte after connecting and set on frames
+#define TELEM_DELTA 0x01 //sweep ranges are zigzag varint deltas from the last sweep sent
+
+/*
+* telemHeader
+* - Starts every frame, followed by length bytes of payload.
+*/
+struct telemHeader {
+    unsigned short magic;
+    unsigned char type;
+    unsigned char flags;
+    unsigned int length;
+};
+
+/*
+* Payloads. Sweeps are packed by hand (see TelemetryServer::encodeSweep),
+* the others are sent as they are.
+*/
+struct telemCorners {
+    reading first, second, third;
+    int type; //slotType
+};
+
+struct telemPlan {
+    double circle1_x, circle1_y;
+    double circle2_x, circle2_y;
+    double xtangent;
+    int num_segs;
+    pathSeg segs[TELEM_MAX_SEGS];
+};
+
+struct telemControl {
+    double tau;    //profile time, s
+    double scale;  //safety speed scale
+    double left, right;
+};
+
+struct telemEvent {
+    int type;
+    union {
+        telemCorners corners;
+        telemPlan plan;
+    };
+};
+
+struct telemClient {
+    int fd;
+    unsigned char flags;
+    bool keyframe;                      //next sweep must be sent whole
+    int since_key;                      //deltas sent since the last whole sweep
+    unsigned short last[SWEEP_MAX_BEAMS];
+    unsigned short last_count;
+    unsigned char out[TELEM_CLIENT_BUFFER];
+    int out_len;
+    long dropped;
+};
+
+/*
+* TelemetryServer
+* - Runs its own thread. The control thread only ever writes into a
+*   lock-free queue (events) or mailbox (controller state), so a slow or
+*   stuck viewer can't hold it up; a viewer that falls behind loses frames.
+*/
+class TelemetryServer {
+public:
+    TelemetryServer();
+    ~TelemetryServer();
+    bool start(const char *where, const ScanBus *bus);
+    void stop();
+
+    void postCorners(const reading &first, const reading &second, const reading &third, int type);
+    void postPlan(const telemPlan &plan);
+    void postControl(double tau, double scale, double left, double right);
+    long dropped() const { return myDropped.load(); }
+
+protected:
+    void run();
+    void postEvent(const telemEvent &event);
+    void acceptClients();
+    void closeClient(int i);
+    bool queueFrame(telemClient &c, int type, unsigned char flags, const void *payload, int length);
+    int encodeSweep(telemClient &c, const laserSweep &sweep, unsigned char *buf, unsigned char &flags);
+    void flush(telemClient &c, int i);
+
+    int myListen;
+    const ScanBus *myBus;
+    std::thread myThread;
+    std::atomic<bool> myRunning;
+    std::atomic<long> myDropped;
+    telemClient *myClients[TELEM_MAX_CLIENTS];
+
+    // Single producer, single consumer event queue
+    telemEvent myEvents[TELEM_EVENTS];
+    std::atomic<unsigned int> myEventHead, myEventTail;
+
+    // Latest controller state, seqlocked
+    std::atomic<unsigned int> myControlSeq;
+    telemControl myControl;
+};
+
+#endif
+
+// EOF
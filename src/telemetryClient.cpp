@@ -0,0 +1,239 @@
+/*
+* telemetryClient.cpp
+* - Connects to autoPark's telemetry stream, decodes every frame and
+*   prints corners and plans as they come and a summary once a second.
+*
+*   usage: ./telemetryClient [host:port | socket path] [-delta]
+*/
+#include <cstdio>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "telemetry.h"
+
+/*
+* connectTo
+* - Open a socket to host:port or a Unix socket path. Returns -1 on failure.
+*/
+int connectTo(const char *where) {
+    int fd;
+
+    if (where[0] == '/') {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, where, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0)
+            return fd;
+    }
+    else {
+        char host[64];
+        int port;
+        sockaddr_in addr;
+        if (sscanf(where, "%63[^:]:%d", host, &port) != 2)
+            return -1;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+            return -1;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0)
+            return fd;
+    }
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+/*
+* readAll
+* - Read exactly n bytes. Returns false when the server goes away.
+*/
+bool readAll(int fd, void *buf, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = read(fd, (char *)buf + got, n - got);
+        if (r <= 0)
+            return false;
+        got += r;
+    }
+    return true;
+}
+
+double now() {
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv) {
+    const char *where = TELEM_DEFAULT;
+    unsigned char flags = 0;
+    static unsigned char payload[sizeof(laserSweep) + SWEEP_MAX_BEAMS * 3];
+    unsigned short ranges[SWEEP_MAX_BEAMS], next[SWEEP_MAX_BEAMS];
+    bool synced = false;            //ranges hold the last sweep the server sent
+    unsigned short synced_count = 0;
+    unsigned long long last_number = 0;
+    int sweeps = 0, deltas = 0, controls = 0, gaps = 0, bad = 0, skipped = 0;
+    long bytes = 0;
+    unsigned int nearest = 0;
+    telemControl control;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-delta") == 0)
+            flags |= TELEM_DELTA;
+        else
+            where = argv[i];
+    }
+
+    int fd = connectTo(where);
+    if (fd < 0) {
+        printf("Could not connect to %s, is autoPark running with -telemetry?\n", where);
+        return 1;
+    }
+    if (write(fd, &flags, 1) != 1) {
+        printf("Could not talk to %s\n", where);
+        return 1;
+    }
+    memset(&control, 0, sizeof(control));
+
+    double report = now() + 1.0;
+    telemHeader h;
+    while (readAll(fd, &h, sizeof(h))) {
+        if (h.magic != TELEM_MAGIC || h.length > sizeof(payload)) {
+            printf("Bad frame, giving up\n");
+            break;
+        }
+        if (!readAll(fd, payload, h.length))
+            break;
+        bytes += sizeof(h) + h.length;
+
+        if (h.type == TELEM_SWEEP) {
+            unsigned long long number;
+            unsigned short count;
+            int n = sizeof(number) + sizeof(double) + sizeof(pose2d) + 2 * sizeof(float);
+            if (h.length < n + sizeof(count)) {
+                bad++;
+                synced = false;
+                continue;
+            }
+            memcpy(&number, payload, sizeof(number));
+            memcpy(&count, payload + n, sizeof(count));
+            n += sizeof(count);
+            if (count > SWEEP_MAX_BEAMS) {
+                bad++;
+                synced = false;
+                continue;
+            }
+
+            // Deltas apply to the last sweep we got, which the server tracks too.
+            // Every byte is checked against the frame, a short one is bad, and
+            // after that deltas mean nothing until the next whole sweep.
+            bool whole = true;
+            if ((h.flags & TELEM_DELTA) && !synced) {
+                skipped++;
+                continue;
+            }
+            if ((h.flags & TELEM_DELTA) && count != synced_count)
+                whole = false;
+            else if (h.flags & TELEM_DELTA) {
+                memcpy(next, ranges, count * sizeof(unsigned short));
+                for (int i = 0; i < count && whole; i++) {
+                    unsigned int z = 0;
+                    int shift = 0;
+                    whole = false;
+                    while (n < (int)h.length && shift < 32) {
+                        unsigned char b = payload[n++];
+                        z |= (unsigned int)(b & 0x7F) << shift;
+                        shift += 7;
+                        if (!(b & 0x80)) {
+                            whole = true;
+                            break;
+                        }
+                    }
+                    if (whole)
+                        next[i] += (int)(z >> 1) ^ -(int)(z & 1);
+                }
+                if (whole)
+                    deltas++;
+            }
+            else if (n + count * sizeof(unsigned short) <= h.length)
+                memcpy(next, payload + n, count * sizeof(unsigned short));
+            else
+                whole = false;
+            synced = whole;
+            if (!whole) {
+                bad++;
+                continue;
+            }
+            memcpy(ranges, next, count * sizeof(unsigned short));
+            synced_count = count;
+
+            if (last_number != 0 && number > last_number + 1)
+                gaps += number - last_number - 1;
+            last_number = number;
+            nearest = 0;
+            for (int i = 0; i < count; i++)
+                if (ranges[i] != 0 && (nearest == 0 || ranges[i] < nearest))
+                    nearest = ranges[i];
+            sweeps++;
+        }
+        else if (h.type == TELEM_CORNERS) {
+            telemCorners c;
+            if (h.length < sizeof(c)) {
+                bad++;
+                continue;
+            }
+            memcpy(&c, payload, sizeof(c));
+            printf("corners: (%.1f deg, %.0f mm) (%.1f deg, %.0f mm) (%.1f deg, %.0f mm) type %d\n",
+                   c.first.angle, c.first.distance, c.second.angle, c.second.distance,
+                   c.third.angle, c.third.distance, c.type);
+        }
+        else if (h.type == TELEM_PLAN) {
+            telemPlan p;
+            if (h.length < sizeof(p)) {
+                bad++;
+                continue;
+            }
+            memcpy(&p, payload, sizeof(p));
+            if (p.num_segs < 0 || p.num_segs > TELEM_MAX_SEGS) {
+                bad++;
+                continue;
+            }
+            printf("plan: circle1 (%.0f, %.0f) circle2 (%.0f, %.0f) xtangent %.0f, %d segments\n",
+                   p.circle1_x, p.circle1_y, p.circle2_x, p.circle2_y, p.xtangent, p.num_segs);
+            for (int i = 0; i < p.num_segs; i++)
+                printf("  %d: length %.0f curvature %f dir %d\n",
+                       i, p.segs[i].length, p.segs[i].curvature, p.segs[i].dir);
+        }
+        else if (h.type == TELEM_CONTROL) {
+            if (h.length < sizeof(control)) {
+                bad++;
+                continue;
+            }
+            memcpy(&control, payload, sizeof(control));
+            controls++;
+        }
+
+        if (now() >= report) {
+            printf("sweep %llu: %d/s (%d delta), %d missed, %d bad, %d skipped, %ld B/s, nearest %u mm | "
+                   "control %d/s t %.2f scale %.2f wheels %.0f %.0f\n",
+                   last_number, sweeps, deltas, gaps, bad, skipped, bytes, nearest,
+                   controls, control.tau, control.scale, control.left, control.right);
+            fflush(stdout);
+            sweeps = deltas = controls = gaps = bad = skipped = 0;
+            bytes = 0;
+            report += 1.0;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+// EOF
@@ -0,0 +1,274 @@
+/*
+* tracker.cpp
+* - Adaptive breakpoint segmentation and an alpha-beta multi-target
+*   tracker.
+*
+*   Two neighbouring beams are in the same cluster unless the gap between
+*   their points is bigger than a surface at SEG_LAMBDA to the beam could
+*   make it (Borges and Aldon), plus three sigma of range noise, so the
+*   threshold grows with range instead of splitting far cars apart. Long
+*   clusters are the static scene and aren't tracked at all, and neither
+*   are pieces of background cut off by something in front, whose ends
+*   slide along with the shadow. Tracks live in the encoder frame, where
+*   anything standing still stays put while the robot drives and which
+*   resetPose()'s moveTo() doesn't jump, and a track is only called
+*   moving once it has been seen enough and its filtered speed is clear
+*   of the noise.
+*/
+#include <algorithm>
+#include <cmath>
+#include "tracker.h"
+
+using namespace std;
+
+/*
+* segmentSweep
+* - Split a sweep into clusters of at least SEG_MIN_POINTS beams. An
+*   ignored beam ends a cluster. Returns the number found.
+*/
+int segmentSweep(const laserSweep &sweep, double sensor_x, double sensor_y, segment *segs, int max) {
+    double c = cos(sweep.pose.th), s = sin(sweep.pose.th);
+    double dphi = fabs(sweep.increment) * PI / 180.0;
+    double lambda = SEG_LAMBDA * PI / 180.0;
+    double ratio = sin(dphi) / sin(lambda - dphi);
+    double px = 0, py = 0, pr = 0;
+    double fx = 0, fy = 0, fr = 0, sx = 0, sy = 0, before = 0;
+    int n = 0, points = 0, first = -1;
+
+    for (int i = 0; i <= sweep.count; i++) {
+        double r = i < sweep.count ? sweep.ranges[i] : 0;
+        double x = 0, y = 0;
+        bool split = r <= 0;
+        if (!split) {
+            double a = (sweep.start_angle + i * sweep.increment) * PI / 180.0;
+            x = sensor_x + r * cos(a);
+            y = sensor_y + r * sin(a);
+            split = points > 0 && hypot(x - px, y - py) > pr * ratio + 3.0 * SEG_SIGMA;
+        }
+
+        // Close the current cluster
+        if (split && points > 0) {
+            if (points >= SEG_MIN_POINTS && n < max) {
+                segment &seg = segs[n++];
+                double cx = sx / points, cy = sy / points;
+                seg.first = first;
+                seg.last = first + points - 1;
+                seg.x = sweep.pose.x + c * cx - s * cy;
+                seg.y = sweep.pose.y + s * cx + c * cy;
+                seg.size = hypot(px - fx, py - fy);
+                seg.foreground = (before <= 0 || before > fr) && (r <= 0 || r > pr);
+            }
+            points = 0;
+        }
+        if (r <= 0)
+            continue;
+        if (points == 0) {
+            first = i;
+            fx = x;
+            fy = y;
+            fr = r;
+            sx = sy = 0;
+            before = i > 0 ? sweep.ranges[i - 1] : 0;
+        }
+        sx += x;
+        sy += y;
+        points++;
+        px = x;
+        py = y;
+        pr = r;
+    }
+    return n;
+}
+
+/*
+* Tracker
+* - Constructor.
+*/
+Tracker::Tracker() : myNextId(1), myNumMoving(0) {
+    for (int i = 0; i < TRACK_MAX; i++)
+        myTracks[i].used = false;
+}
+
+/*
+* update
+* - Feed in one sweep. Called from the laser thread only.
+*/
+void Tracker::update(const laserSweep &sweep, double sensor_x, double sensor_y) {
+    int n = segmentSweep(sweep, sensor_x, sensor_y, mySegs, SEG_MAX);
+
+    // Only small clusters in plain view can be people, carts or other robots
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        if (mySegs[i].size <= TRACK_MAX_SIZE && mySegs[i].foreground)
+            mySegs[kept++] = mySegs[i];
+    }
+    associate(mySegs, kept, sweep.time);
+    publish();
+    return;
+}
+
+/*
+* associate
+* - Match clusters to predicted tracks, closest pairs first, and update
+*   or start tracks.
+*/
+void Tracker::associate(const segment *segs, int n, double time) {
+    pairing *pairs = myPairs;
+    double px[TRACK_MAX], py[TRACK_MAX], dt[TRACK_MAX];
+    bool track_done[TRACK_MAX] = {false};
+    bool seg_done[SEG_MAX] = {false};
+    int num_pairs = 0;
+
+    for (int t = 0; t < TRACK_MAX; t++) {
+        track &tr = myTracks[t];
+        if (!tr.used)
+            continue;
+        dt[t] = time - tr.time;
+        if (dt[t] < 0)
+            dt[t] = 0;
+        px[t] = tr.x + tr.vx * dt[t];
+        py[t] = tr.y + tr.vy * dt[t];
+        for (int s = 0; s < n; s++) {
+            double d = hypot(segs[s].x - px[t], segs[s].y - py[t]);
+            if (d < TRACK_GATE) {
+                pairs[num_pairs].d = d;
+                pairs[num_pairs].t = t;
+                pairs[num_pairs].s = s;
+                num_pairs++;
+            }
+        }
+    }
+    sort(pairs, pairs + num_pairs);
+
+    for (int p = 0; p < num_pairs; p++) {
+        int t = pairs[p].t, s = pairs[p].s;
+        if (track_done[t] || seg_done[s])
+            continue;
+        track_done[t] = seg_done[s] = true;
+
+        // Velocity from the first two hits, alpha-beta steps after that
+        track &tr = myTracks[t];
+        double rx = segs[s].x - px[t], ry = segs[s].y - py[t];
+        if (tr.hits == 1 && dt[t] > 1e-3) {
+            tr.vx = rx / dt[t];
+            tr.vy = ry / dt[t];
+            tr.x = segs[s].x;
+            tr.y = segs[s].y;
+        }
+        else {
+            tr.x = px[t] + TRACK_ALPHA * rx;
+            tr.y = py[t] + TRACK_ALPHA * ry;
+            if (dt[t] > 1e-3) {
+                tr.vx += TRACK_BETA / dt[t] * rx;
+                tr.vy += TRACK_BETA / dt[t] * ry;
+            }
+        }
+        tr.time = time;
+        tr.hits++;
+        tr.misses = 0;
+
+        double speed = hypot(tr.vx, tr.vy);
+        if (tr.hits >= TRACK_CONFIRM && speed > TRACK_MOVING_SPEED)
+            tr.moving = true;
+        else if (speed < TRACK_MOVING_SPEED / 2.0)
+            tr.moving = false;
+    }
+
+    // Coast unseen tracks and drop the lost ones
+    for (int t = 0; t < TRACK_MAX; t++) {
+        track &tr = myTracks[t];
+        if (!tr.used || track_done[t])
+            continue;
+        if (++tr.misses > TRACK_MAX_MISSES) {
+            tr.used = false;
+            continue;
+        }
+        tr.x = px[t];
+        tr.y = py[t];
+        tr.time = time;
+    }
+
+    // New tracks for what's left, while the pool lasts
+    int t = 0;
+    for (int s = 0; s < n; s++) {
+        if (seg_done[s])
+            continue;
+        while (t < TRACK_MAX && myTracks[t].used)
+            t++;
+        if (t == TRACK_MAX)
+            break;
+        track &tr = myTracks[t];
+        tr.id = myNextId++;
+        tr.used = true;
+        tr.x = segs[s].x;
+        tr.y = segs[s].y;
+        tr.vx = tr.vy = 0;
+        tr.time = time;
+        tr.hits = 1;
+        tr.misses = 0;
+        tr.moving = false;
+    }
+    return;
+}
+
+/*
+* publish
+* - Copy out the moving tracks.
+*/
+void Tracker::publish() {
+    std::lock_guard<std::mutex> lock(myMutex);
+    myNumMoving = 0;
+    for (int t = 0; t < TRACK_MAX; t++) {
+        if (myTracks[t].used && myTracks[t].moving)
+            myMoving[myNumMoving++] = myTracks[t];
+    }
+    return;
+}
+
+/*
+* nearMoving
+* - True if a point (encoder frame) is within TRACK_RADIUS of a moving
+*   track as of the last sweep.
+*/
+bool Tracker::nearMoving(double x, double y) const {
+    std::lock_guard<std::mutex> lock(myMutex);
+    for (int i = 0; i < myNumMoving; i++) {
+        if (hypot(x - myMoving[i].x, y - myMoving[i].y) < TRACK_RADIUS)
+            return true;
+    }
+    return false;
+}
+
+int Tracker::movingTracks(track *out, int max) const {
+    std::lock_guard<std::mutex> lock(myMutex);
+    int n = myNumMoving < max ? myNumMoving : max;
+    for (int i = 0; i < n; i++)
+        out[i] = myMoving[i];
+    return n;
+}
+
+/*
+* predictMoving
+* - Where each moving track will be over the next TRACK_PREDICT_TIME, as
+*   points in the frame of the given encoder pose. Returns the number of
+*   points written.
+*/
+int Tracker::predictMoving(const pose2d &frame, double *xs, double *ys, int max) const {
+    double c = cos(frame.th), s = sin(frame.th);
+    int n = 0;
+
+    std::lock_guard<std::mutex> lock(myMutex);
+    for (int i = 0; i < myNumMoving; i++) {
+        for (int k = 0; k < TRACK_PREDICT_STEPS && n < max; k++) {
+            double ahead = TRACK_PREDICT_TIME * k / (TRACK_PREDICT_STEPS - 1);
+            double dx = myMoving[i].x + myMoving[i].vx * ahead - frame.x;
+            double dy = myMoving[i].y + myMoving[i].vy * ahead - frame.y;
+            xs[n] = c * dx + s * dy;
+            ys[n] = -s * dx + c * dy;
+            n++;
+        }
+    }
+    return n;
+}
+
+// EOF
@@ -0,0 +1,106 @@
+/*
+* tracker.h
+* - Splits each laser sweep into clusters and tracks the small ones from
+*   sweep to sweep, so people and other moving things can be told apart
+*   from parked cars and walls.
+*/
+#ifndef TRACKER_H
+#define TRACKER_H
+
+#include <mutex>
+#include "autoPark.h"
+#include "scanBus.h"
+
+// Segmentation
+#define SEG_MAX 128            //Clusters kept per sweep
+#define SEG_MIN_POINTS 3       //Smaller clusters are noise
+#define SEG_LAMBDA 10.0        //Adaptive breakpoint angle, degrees
+#define SEG_SIGMA 10.0         //Range noise, mm
+
+// Tracking
+#define TRACK_MAX 32           //Track pool, tracks are never allocated
+#define TRACK_MAX_SIZE 800.0   //Longer clusters are cars and walls, never tracked, mm
+#define TRACK_GATE 400.0       //Furthest a cluster can be from a track's prediction, mm
+#define TRACK_ALPHA 0.4        //Position gain
+#define TRACK_BETA 0.05        //Velocity gain
+#define TRACK_CONFIRM 5        //Hits before a track can be called moving
+#define TRACK_MAX_MISSES 5     //Sweeps a track can go unseen before it's dropped
+#define TRACK_MOVING_SPEED 200.0 //Faster than this is moving, mm/s; below half it's static again
+#define TRACK_RADIUS 300.0     //Readings this close to a moving track belong to it, mm
+#define TRACK_PREDICT_STEPS 5  //Predicted positions given to the safety layer
+#define TRACK_PREDICT_TIME 1.0 //over this far ahead, s
+
+/*
+* segment
+* - A cluster of consecutive beams. x, y is its centroid in the frame
+*   of sweep.pose, size the distance between its end points. It's in the
+*   foreground when neither neighbouring beam hits something closer.
+*/
+struct segment {
+    int first;
+    int last;
+    double x;
+    double y;
+    double size;
+    bool foreground;
+};
+
+/*
+* track
+* - One tracked cluster, encoder frame, mm and mm/s.
+*/
+struct track {
+    int id;
+    bool used;
+    double x, y;
+    double vx, vy;
+    double time;     //s, of the last update
+    int hits;
+    int misses;
+    bool moving;
+};
+
+int segmentSweep(const laserSweep &sweep, double sensor_x, double sensor_y, segment *segs, int max);
+
+/*
+* Tracker
+* - update() runs from the laser data callback on every sweep: segment,
+*   associate clusters with tracks (nearest first, inside the gate), then
+*   an alpha-beta filter per track. The work is bounded by SWEEP_MAX_BEAMS
+*   and SEG_MAX x TRACK_MAX, so it keeps up with the laser. The moving
+*   tracks are copied out after each update for readers on other threads.
+*   Sweeps come in placed with the encoder pose, which moveTo() leaves
+*   alone, and queries are in that frame too.
+*/
+class Tracker {
+public:
+    Tracker();
+    void update(const laserSweep &sweep, double sensor_x, double sensor_y);
+    bool nearMoving(double x, double y) const;
+    int movingTracks(track *out, int max) const;
+    int predictMoving(const pose2d &frame, double *xs, double *ys, int max) const;
+
+protected:
+    struct pairing {
+        double d;
+        short t, s;
+        bool operator<(const pairing &o) const { return d < o.d; }
+    };
+
+    void associate(const segment *segs, int n, double time);
+    void publish();
+
+    track myTracks[TRACK_MAX];
+    segment mySegs[SEG_MAX];
+    pairing myPairs[TRACK_MAX * SEG_MAX];
+    int myNextId;
+
+    // Moving tracks for other threads
+    mutable std::mutex myMutex;
+    track myMoving[TRACK_MAX];
+    int myNumMoving;
+};
+
+#endif
+
+// EOF
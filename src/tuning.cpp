@@ -0,0 +1,56 @@
+/*
+* tuning.cpp
+* - Parking parameter profiles.
+*/
+#include "tuning.h"
+#include "params.h"
+
+tuneParams tuning = {DEPTH_BOUND, MAR_ERR, TUNING_WIGGLE, TUNING_APPROACH, TUNING_FIRST_MAX};
+
+/*
+* defaultTuning
+* - The compiled in values.
+*/
+void defaultTuning(tuneParams &t) {
+    t.depth_bound = DEPTH_BOUND;
+    t.mar_err = MAR_ERR;
+    t.wiggle = TUNING_WIGGLE;
+    t.approach = TUNING_APPROACH;
+    t.first_max = TUNING_FIRST_MAX;
+    return;
+}
+
+/*
+* loadTuning / saveTuning
+* - Read and write a profile as a parameter file. Keys left out keep
+*   their defaults.
+*/
+bool loadTuning(const char *file, tuneParams &t) {
+    paramFile params;
+    defaultTuning(t);
+    if (!loadParams(file, params))
+        return false;
+    t.depth_bound = getParam(params, "depth_bound", t.depth_bound);
+    t.mar_err = getParam(params, "mar_err", t.mar_err);
+    t.wiggle = getParam(params, "wiggle", t.wiggle);
+    t.approach = getParam(params, "approach", t.approach);
+    t.first_max = getParam(params, "first_max", t.first_max);
+    if (t.depth_bound <= 0 || t.mar_err < 0 || t.wiggle < 0 || t.first_max <= 90 || t.first_max > 180) {
+        defaultTuning(t);
+        return false;
+    }
+    return true;
+}
+
+bool saveTuning(const char *file, const tuneParams &t, const char *comment) {
+    paramFile params;
+    clearParams(params);
+    setParam(params, "depth_bound", t.depth_bound);
+    setParam(params, "mar_err", t.mar_err);
+    setParam(params, "wiggle", t.wiggle);
+    setParam(params, "approach", t.approach);
+    setParam(params, "first_max", t.first_max);
+    return saveParams(file, params, comment);
+}
+
+// EOF
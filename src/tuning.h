@@ -0,0 +1,39 @@
+/*
+* tuning.h
+* - The hand-tuned parking parameters, loaded at startup from a profile
+*   written by mkTune. Compiled values are the defaults, so without a
+*   profile nothing changes.
+*/
+#ifndef TUNING_H
+#define TUNING_H
+
+#include "autoPark.h"
+
+#define TUNING_FILE "tuning.txt"
+#define TUNING_WIGGLE 50.0       //Room between the wall and circle 1's edge, mm
+#define TUNING_APPROACH 150.0    //The approach stops this far short of circle 2, mm
+#define TUNING_FIRST_MAX 150.0   //A first corner further round than this (degrees) is behind us
+
+/*
+* tuneParams
+* - Read by corner detection, the planners and ParkAgent. Set once
+*   before anything runs (mkTune sets it between candidates, with no
+*   episodes running), so it's read without locks.
+*/
+struct tuneParams {
+    double depth_bound;      //range jump that makes the first corner, mm
+    double mar_err;          //margin kept off walls and cars, mm
+    double wiggle;
+    double approach;
+    double first_max;
+};
+
+extern tuneParams tuning;
+
+void defaultTuning(tuneParams &t);
+bool loadTuning(const char *file, tuneParams &t);
+bool saveTuning(const char *file, const tuneParams &t, const char *comment);
+
+#endif
+
+// EOF
@@ -0,0 +1,141 @@
+/*
+* unpark.cpp
+* - Leaving a parallel slot.
+*
+*   The robot sits between car 1 (behind, seen by the sonar) and car 2
+*   (ahead, seen by the laser) with the wall on its right, which is the
+*   parking frame flipped end to end: planExit() searches out of it the
+*   same way planEscape() does for parking, two opposite arcs onto the
+*   lane when there's room and forward/reverse moves first when there
+*   isn't. The wall sets the frame, so a robot parked a little crooked
+*   starts a little crooked.
+*/
+#include <cmath>
+#include "unpark.h"
+
+#define UNPARK_WALL_BAND 60.0    //Points this close to the wall line are the wall, mm
+#define UNPARK_MAX_SKEW 0.35     //A wall fit further off than this (rad) isn't the wall
+
+/*
+* toScene
+* - A robot frame point in the planner's frame.
+*/
+static void toScene(const exitScene &scene, double x, double y, double &sx, double &sy) {
+    double c = cos(scene.wall_angle), s = sin(scene.wall_angle);
+    sx = c * x + s * y;
+    sy = -s * x + c * y + scene.start.y;
+    return;
+}
+
+/*
+* findExitScene
+* - Fit the wall on the right, find the ends of the cars in the strip
+*   the robot is parked in and their outer sides, and put the lane just
+*   clear of those. Cars not seen are UNPARK_FAR away. Returns false with
+*   nothing to go on.
+*/
+bool findExitScene(const double *xs, const double *ys, int n, exitScene &scene) {
+    if (n <= 0)
+        return false;
+
+    // The wall is the nearest thing on the right, beside the robot
+    double near_y = -UNPARK_FAR;
+    for (int i = 0; i < n; i++) {
+        if (fabs(xs[i]) <= UNPARK_SIDE_X && ys[i] < -ROBOT_RADIUS / 2 && ys[i] > near_y)
+            near_y = ys[i];
+    }
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        if (fabs(xs[i]) <= UNPARK_SIDE_X && ys[i] <= near_y && ys[i] > near_y - UNPARK_WALL_BAND) {
+            sx += xs[i];
+            sy += ys[i];
+            sxx += xs[i] * xs[i];
+            sxy += xs[i] * ys[i];
+            m++;
+        }
+    }
+    double slope = 0, offset = near_y;
+    if (m >= 3 && m * sxx - sx * sx > 1e-6) {
+        slope = (m * sxy - sx * sy) / (m * sxx - sx * sx);
+        offset = (sy - slope * sx) / m;
+    }
+    scene.wall_angle = atan(slope);
+    scene.wall_points = m;
+    if (fabs(scene.wall_angle) > UNPARK_MAX_SKEW) {
+        scene.wall_angle = 0;
+        offset = near_y;
+    }
+    double wall_y = m > 0 ? offset * cos(scene.wall_angle) : -UNPARK_FAR;
+
+    // Car ends in the strip between the wall and the robot's far side
+    double car1_x = -UNPARK_FAR, car2_x = UNPARK_FAR;
+    double c = cos(scene.wall_angle), s = sin(scene.wall_angle);
+    for (int i = 0; i < n; i++) {
+        double x = c * xs[i] + s * ys[i], y = -s * xs[i] + c * ys[i];
+        if (y <= wall_y + UNPARK_WALL_BAND || y > ROBOT_RADIUS + PLAN_CLEARANCE)
+            continue;
+        if (x > ROBOT_RADIUS / 2 && x < car2_x)
+            car2_x = x;
+        if (x < -ROBOT_RADIUS / 2 && x > car1_x)
+            car1_x = x;
+    }
+
+    // Their outer sides, or just the robot's own side with no cars
+    double curb_y = -UNPARK_FAR;
+    for (int i = 0; i < n; i++) {
+        double x = c * xs[i] + s * ys[i], y = -s * xs[i] + c * ys[i];
+        bool by_car2 = car2_x < UNPARK_FAR && x >= car2_x && x <= car2_x + UNPARK_CAR_LOOK;
+        bool by_car1 = car1_x > -UNPARK_FAR && x <= car1_x && x >= car1_x - UNPARK_CAR_LOOK;
+        if ((by_car1 || by_car2) && y > wall_y && y < ROBOT_RADIUS + UNPARK_CURB_MAX && y > curb_y)
+            curb_y = y;
+    }
+    if (curb_y < ROBOT_RADIUS)
+        curb_y = ROBOT_RADIUS;
+
+    double lane_y = curb_y + ROBOT_RADIUS + PLAN_CLEARANCE + UNPARK_LANE_GAP;
+    scene.slot.car1_x = car1_x;
+    scene.slot.car2_x = car2_x;
+    scene.slot.curb_y = curb_y - lane_y;
+    scene.slot.wall_y = wall_y - lane_y;
+    scene.start.x = 0;
+    scene.start.y = -lane_y;
+    scene.start.th = -scene.wall_angle;
+    return true;
+}
+
+/*
+* exitPathClear
+* - Walk a planned exit against the points themselves, not the boxes it
+*   was planned around: something in the lane the slot doesn't describe
+*   shows up here. Nothing may come closer than the planner's clearance,
+*   or than it already is at the start.
+*/
+bool exitPathClear(const exitScene &scene, const std::vector<pathSeg> &path,
+                   const double *xs, const double *ys, int n) {
+    std::vector<double> px(n), py(n);
+    double need = ROBOT_RADIUS + PLAN_CLEARANCE;
+
+    for (int i = 0; i < n; i++) {
+        toScene(scene, xs[i], ys[i], px[i], py[i]);
+        double d = hypot(px[i] - scene.start.x, py[i] - scene.start.y);
+        if (d < need)
+            need = d;
+    }
+
+    pose2d p = scene.start;
+    for (size_t k = 0; k < path.size(); k++) {
+        for (double s = PLAN_STEP; s < path[k].length + PLAN_STEP; s += PLAN_STEP) {
+            pose2d q = p;
+            advancePose(q, path[k], fmin(s, path[k].length));
+            for (int i = 0; i < n; i++) {
+                if (hypot(px[i] - q.x, py[i] - q.y) < need - 1.0)
+                    return false;
+            }
+        }
+        advancePose(p, path[k], path[k].length);
+    }
+    return true;
+}
+
+// EOF
@@ -0,0 +1,39 @@
+/*
+* unpark.h
+* - Leaving a parallel slot: what the robot can see around it (laser
+*   ahead, sonar behind) as a slot for planExit(), and a check of a
+*   planned exit against the points themselves. No robot or laser calls.
+*/
+#ifndef UNPARK_H
+#define UNPARK_H
+
+#include <vector>
+#include "autoPark.h"
+#include "parkPlan.h"
+
+#define UNPARK_SIDE_X 300.0      //Points this far either side of the centre, on the right, are the wall, mm
+#define UNPARK_CAR_LOOK 600.0    //Points this far past a car's end are its side, mm
+#define UNPARK_CURB_MAX 1500.0   //Car sides further left of the robot than this are across the lane, mm
+#define UNPARK_LANE_GAP 100.0    //The exit lane clears the cars by this, beyond the clearance, mm
+#define UNPARK_FAR 1e6           //Stands in for nothing there, mm
+#define UNPARK_MAX_MOVES (MAX_PLAN_SEGMENTS + 2) //Replans before giving up
+
+/*
+* exitScene
+* - The slot around the robot, in the planner's frame: lane along x at
+*   y = 0, the robot at start. Points are in the robot frame.
+*/
+struct exitScene {
+    parkSlot slot;
+    pose2d start;
+    double wall_angle;           //wall heading in the robot frame, rad
+    int wall_points;             //how many points the wall was fitted to
+};
+
+bool findExitScene(const double *xs, const double *ys, int n, exitScene &scene);
+bool exitPathClear(const exitScene &scene, const std::vector<pathSeg> &path,
+                   const double *xs, const double *ys, int n);
+
+#endif
+
+// EOF
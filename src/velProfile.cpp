@@ -0,0 +1,162 @@
+/*
+* velProfile.cpp
+* - Turns an arc/line path into a time-stamped wheel velocity table.
+*
+*   The speed along the path is first bounded by VMAX on the outer wheel,
+*   OMEGA_MAX and the wheel speed jump at every curvature change (zero
+*   where the direction flips). A forward and a backward pass under
+*   ACC_MAX give the time-optimal trapezoid, which is then smoothed with a
+*   box filter in time to bound jerk (a trapezoid convolved with a box is
+*   an S-curve and covers the same distance).
+*/
+#include <cmath>
+#include <vector>
+#include "velProfile.h"
+
+using namespace std;
+
+/*
+* wheelSpeedLimit
+* - Fastest path speed for a curvature without breaking VMAX or OMEGA_MAX.
+*/
+static double wheelSpeedLimit(double curvature) {
+    double k = fabs(curvature);
+    double v = VMAX / (1.0 + k * WHEEL_BASE / 2.0);
+    if (k > 0 && OMEGA_MAX / k < v)
+        v = OMEGA_MAX / k;
+    return v;
+}
+
+/*
+* curvatureAt
+* - Curvature of a run of segments at distance s from its start.
+*/
+static double curvatureAt(const vector<pathSeg> &run, double s) {
+    for (size_t i = 0; i < run.size(); i++) {
+        if (s < run[i].length)
+            return run[i].curvature;
+        s -= run[i].length;
+    }
+    return run.back().curvature;
+}
+
+/*
+* profileRun
+* - Profile segments that all drive in the same direction. Speed is zero
+*   at both ends, setpoints are appended to table starting at time t0.
+*   Returns the time the run ends.
+*/
+static double profileRun(const vector<pathSeg> &run, double t0, vector<setpoint> &table) {
+    vector<double> vlim;
+    vector<double> ds;
+    double total = 0;
+
+    // Sample the run and find the speed limit at every node
+    vlim.push_back(0);
+    for (size_t i = 0; i < run.size(); i++) {
+        int n = (int)ceil(run[i].length / PROFILE_DS);
+        if (n < 1)
+            n = 1;
+        double lim = wheelSpeedLimit(run[i].curvature);
+        for (int j = 0; j < n; j++) {
+            ds.push_back(run[i].length / n);
+            vlim.push_back(lim);
+        }
+        total += run[i].length;
+
+        // Wheel speeds jump where the curvature does, keep the jump small
+        if (i + 1 < run.size()) {
+            double dk = fabs(run[i+1].curvature - run[i].curvature);
+            double junction = wheelSpeedLimit(run[i+1].curvature);
+            if (dk > 0 && WHEEL_STEP_MAX / (dk * WHEEL_BASE / 2.0) < junction)
+                junction = WHEEL_STEP_MAX / (dk * WHEEL_BASE / 2.0);
+            if (junction < vlim.back())
+                vlim.back() = junction;
+        }
+    }
+    vlim.back() = 0;
+
+    // Forward and backward passes under ACC_MAX
+    vector<double> v(vlim);
+    for (size_t k = 0; k + 1 < v.size(); k++) {
+        double reach = sqrt(v[k] * v[k] + 2.0 * ACC_MAX * ds[k]);
+        if (reach < v[k+1])
+            v[k+1] = reach;
+    }
+    for (size_t k = v.size() - 1; k > 0; k--) {
+        double reach = sqrt(v[k] * v[k] + 2.0 * ACC_MAX * ds[k-1]);
+        if (reach < v[k-1])
+            v[k-1] = reach;
+    }
+
+    // Resample the trapezoid in time
+    vector<double> u;
+    double t = 0, next = 0;
+    for (size_t k = 0; k + 1 < v.size(); k++) {
+        double dt = 2.0 * ds[k] / (v[k] + v[k+1]);
+        while (next < t + dt) {
+            u.push_back(v[k] + (v[k+1] - v[k]) * (next - t) / dt);
+            next += PROFILE_DT;
+        }
+        t += dt;
+    }
+
+    // Box filter bounds jerk to about ACC_MAX / (width * PROFILE_DT)
+    int width = (int)ceil(ACC_MAX / (JERK_MAX * PROFILE_DT));
+    if (width < 1)
+        width = 1;
+    vector<double> smooth(u.size() + width - 1, 0.0);
+    for (size_t j = 0; j < u.size(); j++)
+        for (int w = 0; w < width; w++)
+            smooth[j + w] += u[j] / width;
+
+    // Stretch slightly so the streamed speeds cover exactly the run length
+    double covered = 0;
+    for (size_t j = 0; j < smooth.size(); j++)
+        covered += smooth[j] * PROFILE_DT;
+    double scale = covered > 0 ? total / covered : 0;
+
+    int dir = run[0].dir;
+    double s = 0;
+    for (size_t j = 0; j < smooth.size(); j++) {
+        setpoint sp;
+        double speed = smooth[j] * scale;
+        sp.t = t0 + j * PROFILE_DT;
+        sp.vel = dir * speed;
+        sp.omega = sp.vel * curvatureAt(run, s + speed * PROFILE_DT / 2.0);
+        sp.left = sp.vel - sp.omega * WHEEL_BASE / 2.0;
+        sp.right = sp.vel + sp.omega * WHEEL_BASE / 2.0;
+        table.push_back(sp);
+        s += speed * PROFILE_DT;
+    }
+    return t0 + smooth.size() * PROFILE_DT;
+}
+
+/*
+* buildProfile
+* - Build the setpoint table for a path. The robot stops at every change
+*   of direction and the table ends with a zero setpoint.
+*/
+void buildProfile(const vector<pathSeg> &path, vector<setpoint> &table) {
+    double t = 0;
+    size_t i = 0;
+
+    table.clear();
+    while (i < path.size()) {
+        vector<pathSeg> run;
+        int dir = path[i].dir;
+        while (i < path.size() && path[i].dir == dir) {
+            if (path[i].length > 0)
+                run.push_back(path[i]);
+            i++;
+        }
+        if (!run.empty())
+            t = profileRun(run, t, table);
+    }
+
+    setpoint stop = {t, 0, 0, 0, 0};
+    table.push_back(stop);
+    return;
+}
+
+// EOF
@@ -0,0 +1,34 @@
+/*
+* velProfile.h
+* - Velocity-profile generator for the parking path.
+*/
+#ifndef VELPROFILE_H
+#define VELPROFILE_H
+
+#include <vector>
+#include "autoPark.h"
+
+// Profile limits
+#define ACC_MAX 300.0        //Max linear acceleration, mm/s^2
+#define JERK_MAX 1500.0      //Max linear jerk, mm/s^3
+#define WHEEL_STEP_MAX 50.0  //Max wheel speed jump allowed where the curvature changes, mm/s
+#define PROFILE_DT 0.05      //Time between setpoints, s
+#define PROFILE_DS 5.0       //Path sampling step, mm
+
+/*
+* setpoint
+* - One entry of the precomputed table the controller streams out.
+*/
+struct setpoint {
+    double t;     //s since start of the profile
+    double vel;   //signed linear velocity, mm/s
+    double omega; //rad/s
+    double left;  //left wheel velocity, mm/s
+    double right; //right wheel velocity, mm/s
+};
+
+void buildProfile(const std::vector<pathSeg> &path, std::vector<setpoint> &table);
+
+#endif
+
+// EOF